@@ -0,0 +1,1628 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Device simulator for the tinyusb vendor example - the host side, and
+// main().  See sim.h for how the simulator fits together.
+//
+// Behaves like host/usb-bench.cpp, so results can be compared: each command
+// is sent as its own bulk OUT transfer (the command, plus its data for a
+// WRITE), and its response - READ data, or a WRITE's status - is received
+// as its own bulk IN transfer, with up to DEPTH commands in flight.  For
+// each run it reports throughput, commands per second, per-command latency
+// percentiles (from the host starting the command to receiving all of its
+// response) and errors, all in simulated time.
+//
+// The loop and echo workloads exercise the loopback modes (see
+// src/loopback.h), and check the data which comes back is the data sent:
+// loop alternates PROTO_LOOPBACK WRITEs with READs of the same size, and echo
+// sends PROTO_LOOPBACK_STREAM WRITEs, each of which gets two responses - its
+// data, echoed back as it's received, and then its status.  An echo's
+// latency is the full round trip, until its status is received.
+//
+// READs normally return 'x's, but with -g the device is asked (with
+// CTRL_PATTERN) for one of its test patterns instead, and the data checked
+// against the same pattern generated here (see src/pattern.h).  With -C
+// READs and WRITEs use PROTO_CRC, and each WRITE status's CRC is checked
+// against the CRC of the data sent.
+//
+// With -k the host paces itself by the device's flow control credits (see
+// src/credit.h), sending commands and WRITE data only as far as the limits
+// allow.  READs and WRITEs use PROTO_CREDIT, so each WRITE status brings new
+// limits, and if the host runs out it asks for them with CTRL_CREDITS - at
+// most once a frame, as a real host's control transfers would take.
+//
+// With -a READs and WRITEs use PROTO_NOACK (see src/ack.h), and WRITEs only
+// get a status at the end of each ack interval - COUNT WRITEs, or KB of
+// their data - and after the run's last.  The rest are complete, as far as
+// the host is concerned, once they've been sent.  Each status's ack counts
+// are checked, as are those CTRL_ACKS returns at the end of the run.
+//
+// With -R READs and WRITEs use PROTO_RESUME (see src/resume.h), one at a
+// time, and every BYTES bytes of data the host resets the bus, as if the
+// device had been unplugged and plugged back in, losing whatever was in
+// flight.  Once the device has been mounted again the host asks where the
+// interrupted command got to, with CTRL_RESUME, and resumes it from there -
+// or starts it again, if the device never started it.  A command's latency
+// includes its interruptions.
+//
+// The store workload WRITEs the run's size of data to an object in the
+// device's object store (see src/store.h), and then READs it back, over and
+// over, checking the data - and, at the end of the run, that CTRL_STORE says
+// the object is using the right number of blocks.  The flash workload does
+// the same with a flash object (see src/flash-store.h) - the flash is a
+// file, which is temporary unless one is given with -F, in which case
+// what's written to it is still there the next time it's used.  Each run's
+// WRITE replaces the object, sector by sector, at the rate a Pico's flash
+// could program it, and the report says how long core 0 spent locked out
+// by core 1 while it did.
+//
+// The batch workload sends PROTO_BATCH WRITEs (see src/batch.h), each
+// packing -b WRITEs of the run's size into one command, and checks every
+// entry of each status vector.  Throughput counts just the WRITEs' data.
+//
+// A run's commands can instead come from a script file, with one command
+// per line:
+//
+//   read 4096        # A READ of 4096 bytes
+//   write 512 100    # 100 WRITEs of 512 bytes each
+//   loop 512         # A loopback WRITE of 512 bytes, and a READ of them
+//   echo 1024 10     # 10 streaming echo WRITEs of 1024 bytes each
+//
+// With -T, once the runs are complete, the device's flight recorder (see
+// src/trace.h) is read with CTRL_TRACE, and the dump saved to a file, for
+// scripts/trace/trace2chrome.py to turn into a timeline.  It covers the end
+// of the last run.
+//
+// Runs use the device's first channel (vendor interface).  With -P, and a
+// device built with more than one channel (VENDOR_CHANNELS), the second
+// channel is used at the same time for a latency probe: a stream of small
+// READs, one at a time, whose latency is reported alongside the run's - to
+// show how little the run holds them up.
+//
+// Exits non-zero if there were any errors, or the device stopped
+// responding, so it can be used in CI.  Commands answered BUSY aren't
+// errors - a VENDOR_RX_UNBUFFERED build answers any it has no room for with
+// BUSY - so are counted separately.
+//
+// Usage: device-sim [options] - see usage() below.
+//
+
+#include <errno.h>
+#include <unistd.h>
+
+#include "pico/stdlib.h"
+#include "tusb.h"
+#include "include.h"
+#include "stats.h"
+#include "loopback.h"
+#include "batch.h"
+#include "pattern.h"
+#include "crc32.h"
+#include "resume.h"
+#include "store.h"
+#include "flash-store.h"
+#include "trace.h"
+#include "hardware/flash.h"
+#include "sim.h"
+
+// The device's main(), renamed (see CMakeLists.txt)
+void device_main(void);
+
+typedef struct {
+    uint8_t type;
+    uint8_t proto;
+    uint8_t batch;            // WRITEs in a PROTO_BATCH WRITE
+    uint8_t ack_commands;     // A PROTO_NOACK WRITE's ack interval
+    uint8_t ack_kb;
+    bool acked;               // A PROTO_NOACK WRITE gets a status
+    uint16_t id;              // A PROTO_RESUME command's transfer ID
+    bool resumed;             // Being resumed, from resume_off
+    uint32_t resume_off;
+    uint32_t len;
+    uint64_t submit_ns;
+} command_t;
+
+typedef struct {
+    const char *name;
+    uint32_t size;            // 0 for a script
+    command_t *cmds;
+    uint32_t count;
+} run_t;
+
+// The channels runs, and the latency probe, use
+#define RUN_ITF     0
+#define PROBE_ITF   1
+
+// Options
+static uint32_t depth = 4;
+static uint32_t probe_size = 0;
+static bool large = false;
+static bool crc = false;
+static bool paced = false;
+static bool noack = false;
+static uint8_t ack_commands = 0;
+static uint8_t ack_kb = 0;
+static uint32_t batch_len = 16;
+static uint32_t resume_bytes = 0;
+static bool store = false;
+static bool flash = false;
+static const char *flash_file = NULL;
+static const char *trace_file = NULL;
+static uint16_t pattern_selection = PATTERN_X;
+static uint32_t timeout_ms = 1000;
+static bool verbose = false;
+
+static run_t *runs;
+static uint32_t run_count;
+
+// Progress through the current run.  Commands are submitted, sent and
+// completed in order, so indexes into the run's commands are enough.
+static run_t *run;
+static bool run_started;
+static uint64_t start_ns;
+static uint64_t last_progress_ns;
+static uint32_t submitted;
+static uint32_t out_cmd;
+static uint32_t out_off;
+static bool out_zlp;
+static uint32_t in_cmd;
+static uint32_t in_off;
+static bool in_echoed;        // Have had an echo's data, and now want its status
+static bool in_echo_empty;    // and it was empty
+static uint8_t in_first;      // First byte of a READ's or echo's response
+static bool in_loop_busy;     // The last loopback WRITE was answered BUSY
+static bool in_data_ok;
+static uint8_t in_status[STATUS_LEN_LARGE + BATCH_MAX_COMMANDS];
+static pattern_gen_t in_pattern;   // Generates the data READs should return
+static uint32_t in_pattern_word;
+static uint64_t bytes;
+static double *latencies_us;
+static int exit_code = 0;
+
+static struct {
+    uint32_t short_xfer;      // Response shorter than expected
+    uint32_t overflow;        // Response longer than expected
+    uint32_t status;          // WRITE status not READY, or wrong length or CRC
+    uint32_t data;            // READ or echoed data not as expected
+} errors;
+
+// Commands answered BUSY - not errors, as a VENDOR_RX_UNBUFFERED build
+// answers any command it has no room for with BUSY
+static uint32_t busy;
+
+// Flow control credits, with -k - the commands and bytes of WRITE data sent
+// on the run's channel, the limits the device has given us, and when it last
+// did
+static struct {
+    uint32_t commands;
+    uint32_t bytes;
+    uint32_t command_limit;
+    uint32_t byte_limit;
+    uint64_t update_ns;
+    uint32_t polls;
+} credit;
+
+// With -a, the PROTO_NOACK WRITEs, and their bytes, completed on the run's
+// channel, and the number which got statuses
+static struct {
+    uint32_t commands;
+    uint32_t bytes;
+    uint32_t statuses;
+} acks;
+
+// With -R, the data moved since the last interruption, whether we're
+// waiting to resume, and how it went
+static struct {
+    uint64_t bytes;
+    bool waiting;
+    uint32_t interruptions;
+    uint32_t resumed;
+    uint32_t restarted;
+} resume;
+
+// The latency probe - at most one READ in flight, and its progress
+static struct {
+    bool busy;
+    bool out_sent;
+    uint32_t in_off;
+    uint64_t submit_ns;
+    uint32_t count;
+    uint32_t alloc;
+    double *latencies_us;
+} probe;
+
+static uint32_t error_total(void) {
+    return errors.short_xfer + errors.overflow + errors.status + errors.data;
+}
+
+//
+// Commands
+//
+
+static uint32_t get_u16(const uint8_t *buf) {
+    return buf[0] | ((uint32_t)buf[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t *buf) {
+    return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+static bool is_echo(const command_t *cmd) {
+    return (cmd->type == CMD_WRITE) && (cmd->proto == PROTO_LOOPBACK_STREAM);
+}
+
+static bool is_noack_write(const command_t *cmd) {
+    return (cmd->type == CMD_WRITE) && (cmd->proto == PROTO_NOACK);
+}
+
+// PROTO_NOACK WRITEs only get a status at the end of an ack interval
+static bool has_response(const command_t *cmd) {
+    return !is_noack_write(cmd) || cmd->acked;
+}
+
+static uint32_t header_len(const command_t *cmd) {
+    return PROTO_HAS_LARGE_LEN(cmd->proto) ? COMMAND_LEN_LARGE : COMMAND_LEN;
+}
+
+// Data length of a command's transfer - what's left of it, if it's being
+// resumed
+static uint32_t xfer_len(const command_t *cmd) {
+    return cmd->len - cmd->resume_off;
+}
+
+static uint32_t out_xfer_len(const command_t *cmd) {
+    return header_len(cmd) + ((cmd->type == CMD_WRITE) ? xfer_len(cmd) : 0);
+}
+
+// Length of a command's status
+static uint32_t status_len(const command_t *cmd) {
+    if (cmd->proto == PROTO_CRC) {
+        return STATUS_LEN_CRC;
+    }
+    if (cmd->proto == PROTO_CREDIT) {
+        return STATUS_LEN_CREDIT;
+    }
+    if (cmd->proto == PROTO_NOACK) {
+        return STATUS_LEN_NOACK;
+    }
+    if (cmd->proto == PROTO_BATCH) {
+        return STATUS_LEN_LARGE + cmd->batch;
+    }
+    return ((cmd->proto == PROTO_LARGE) || (cmd->proto == PROTO_RESUME) || (cmd->proto == PROTO_STORE)) ?
+        STATUS_LEN_LARGE : STATUS_LEN;
+}
+
+// Length of the response the host is currently waiting for
+static uint32_t response_len(const command_t *cmd) {
+    if ((cmd->type == CMD_READ) || (is_echo(cmd) && !in_echoed)) {
+        return xfer_len(cmd);
+    }
+    return status_len(cmd);
+}
+
+// Returns true if the response just received, of len bytes, is a BUSY
+// status.  A READ answered BUSY gets the status in place of its data, and an
+// echo an empty echo before it.  A batch's BUSY status has no vector.
+static bool answered_busy(const command_t *cmd, uint32_t len) {
+    if (cmd->type == CMD_READ) {
+        return (len != xfer_len(cmd)) && (len == status_len(cmd)) && (in_first == STATUS_BUSY);
+    }
+    if (is_echo(cmd) && !in_echo_empty) {
+        return false;
+    }
+    return (len == ((cmd->proto == PROTO_BATCH) ? STATUS_LEN_LARGE : status_len(cmd))) &&
+        (in_status[0] == STATUS_BUSY);
+}
+
+// Data length of each WRITE in a batch
+static uint32_t batch_write_len(const command_t *cmd) {
+    return (cmd->len / cmd->batch) - COMMAND_LEN;
+}
+
+// Data byte off of a READ's response.  Loopback READs return the data of the
+// WRITE before them, which is the same length, and store READs the data of
+// the run's first command, which is too.  Others return the selected
+// pattern, which carries on from READ to READ, a word at a time - so this
+// must be called for each byte of a READ in turn.
+static uint8_t expected_byte(const command_t *cmd, uint32_t off) {
+    if ((cmd->proto == PROTO_LOOPBACK) || (cmd->proto == PROTO_LOOPBACK_STREAM) || (cmd->proto == PROTO_STORE)) {
+        return (uint8_t)off;
+    }
+    if (in_pattern.pattern == PATTERN_X) {
+        // See read_source_x in bulk-in.c
+        return 'x';
+    }
+
+    if ((off % 4) == 0) {
+        in_pattern_word = pattern_gen_next(&in_pattern);
+    }
+    return (uint8_t)(in_pattern_word >> ((off % 4) * 8));
+}
+
+// CRC of a WRITE's data - see out_byte()
+static uint32_t expected_crc(const command_t *cmd) {
+    uint8_t data[256];
+    uint32_t value = 0;
+
+    for (uint32_t ii = 0; ii < sizeof(data); ii++) {
+        data[ii] = (uint8_t)ii;
+    }
+    for (uint32_t off = 0; off < cmd->len; off += sizeof(data)) {
+        uint32_t len = cmd->len - off;
+        value = crc32_update(value, data, (len < sizeof(data)) ? len : sizeof(data));
+    }
+    return value;
+}
+
+// Byte off of a command's OUT transfer.  A resumed WRITE's data carries on
+// from where it got to.
+static uint8_t out_byte(const command_t *cmd, uint32_t off) {
+    uint32_t len = xfer_len(cmd);
+    uint8_t header[COMMAND_LEN_LARGE] = {
+        cmd->type,
+        cmd->proto,
+        (uint8_t)len,
+        (uint8_t)(len >> 8),
+        (uint8_t)len,
+        (uint8_t)(len >> 8),
+        (uint8_t)(len >> 16),
+        (uint8_t)(len >> 24),
+    };
+    uint16_t id = cmd->id | (cmd->resumed ? RESUME_CONTINUE : 0);
+    uint32_t write_len;
+
+    if (cmd->proto == PROTO_BATCH) {
+        header[2] = cmd->batch;
+        header[3] = 0;
+    } else if (cmd->proto == PROTO_NOACK) {
+        header[2] = cmd->ack_commands;
+        header[3] = cmd->ack_kb;
+    } else if (cmd->proto == PROTO_RESUME) {
+        header[2] = (uint8_t)id;
+        header[3] = (uint8_t)(id >> 8);
+    } else if (cmd->proto == PROTO_STORE) {
+        // Object 0, replacing its data
+        header[2] = 0;
+        header[3] = flash ? STORE_FLASH : 0;
+    }
+    if (off < header_len(cmd)) {
+        return header[off];
+    }
+    off -= header_len(cmd);
+
+    if (cmd->proto == PROTO_BATCH) {
+        // Each WRITE in the batch - a PROTO_DEFAULT header, and its data
+        write_len = batch_write_len(cmd);
+        off %= COMMAND_LEN + write_len;
+        switch (off) {
+            case 0:
+                return CMD_WRITE;
+            case 1:
+                return PROTO_DEFAULT;
+            case 2:
+                return (uint8_t)write_len;
+            case 3:
+                return (uint8_t)(write_len >> 8);
+            default:
+                return (uint8_t)(off - COMMAND_LEN);
+        }
+    }
+    return (uint8_t)(cmd->resume_off + off);
+}
+
+//
+// Credits
+//
+
+// Take new limits, unless we already have later ones - a status's limits
+// may be older than those from a CTRL_CREDITS sent after it left the device
+static void credit_update(uint32_t command_limit, uint32_t byte_limit) {
+    if ((int32_t)(command_limit - credit.command_limit) > 0) {
+        credit.command_limit = command_limit;
+    }
+    if ((int32_t)(byte_limit - credit.byte_limit) > 0) {
+        credit.byte_limit = byte_limit;
+    }
+    credit.update_ns = sim_now_ns();
+}
+
+static bool credit_poll(void) {
+    uint8_t buf[8];
+    uint16_t len;
+
+    if (!sim_control_in(RUN_ITF, CTRL_CREDITS, 0, buf, sizeof(buf), &len) || (len != sizeof(buf))) {
+        return false;
+    }
+    credit_update(get_u32(&buf[0]), get_u32(&buf[4]));
+    credit.polls++;
+    return true;
+}
+
+// How many bytes of the current command's OUT transfer, from out_off, the
+// credits let us send now - its header needs a command's credit, and its
+// data a byte's credit for each byte
+static uint32_t out_allowed(const command_t *cmd) {
+    uint32_t header = header_len(cmd);
+    uint32_t allowed = 0;
+    uint32_t data;
+
+    if (!paced) {
+        return out_xfer_len(cmd) - out_off;
+    }
+
+    if (out_off < header) {
+        if ((int32_t)(credit.command_limit - (credit.commands + 1)) < 0) {
+            return 0;
+        }
+        allowed = header - out_off;
+    }
+
+    data = out_xfer_len(cmd) - header - ((out_off > header) ? (out_off - header) : 0);
+    if ((int32_t)(credit.byte_limit - credit.bytes) > 0) {
+        uint32_t bytes = credit.byte_limit - credit.bytes;
+        allowed += (data < bytes) ? data : bytes;
+    }
+    return allowed;
+}
+
+//
+// Bus - called by sim-usb.c
+//
+
+bool host_out_pending(uint8_t itf) {
+    if (itf == PROBE_ITF) {
+        return probe.busy && !probe.out_sent;
+    }
+    if ((itf != RUN_ITF) || (out_cmd == submitted) || resume.waiting) {
+        return false;
+    }
+    return out_zlp || (out_allowed(&run->cmds[out_cmd]) > 0);
+}
+
+// A transfer which is a multiple of the packet size is ended with a zero
+// length packet, as libusb does with LIBUSB_TRANSFER_ADD_ZERO_PACKET
+uint32_t host_out_packet(uint8_t itf, uint8_t *buf) {
+    const command_t *cmd;
+    uint32_t len;
+
+    if (itf == PROBE_ITF) {
+        // A READ, in a single short packet
+        buf[0] = CMD_READ;
+        buf[1] = PROTO_DEFAULT;
+        buf[2] = (uint8_t)probe_size;
+        buf[3] = (uint8_t)(probe_size >> 8);
+        probe.out_sent = true;
+        return COMMAND_LEN;
+    }
+
+    cmd = &run->cmds[out_cmd];
+    len = out_zlp ? 0 : out_allowed(cmd);
+
+    if (len > SIM_PACKET_SIZE) {
+        len = SIM_PACKET_SIZE;
+    }
+    for (uint32_t ii = 0; ii < len; ii++) {
+        buf[ii] = out_byte(cmd, out_off + ii);
+    }
+
+    // Count what the credits were spent on
+    if ((out_off == 0) && (len > 0)) {
+        credit.commands++;
+    }
+    if ((out_off + len) > header_len(cmd)) {
+        credit.bytes += (out_off + len) - ((out_off > header_len(cmd)) ? out_off : header_len(cmd));
+    }
+    out_off += len;
+    resume.bytes += len;
+
+    if (out_off == out_xfer_len(cmd)) {
+        if ((len == SIM_PACKET_SIZE) && !out_zlp) {
+            out_zlp = true;
+        } else {
+            out_cmd++;
+            out_off = 0;
+            out_zlp = false;
+        }
+    }
+    return len;
+}
+
+bool host_in_pending(uint8_t itf) {
+    if (itf == PROBE_ITF) {
+        return probe.busy;
+    }
+    return (itf == RUN_ITF) && (in_cmd < submitted) && !resume.waiting;
+}
+
+static void complete_command(void) {
+    command_t *cmd = &run->cmds[in_cmd];
+    uint32_t expected = response_len(cmd);
+    bool rejected = has_response(cmd) && answered_busy(cmd, in_off);
+
+    // A loopback READ of a WRITE answered BUSY has no data to return
+    if ((cmd->type == CMD_READ) && (cmd->proto == PROTO_LOOPBACK) && in_loop_busy && (in_off == 0)) {
+        rejected = true;
+    }
+    if (cmd->proto == PROTO_LOOPBACK) {
+        in_loop_busy = rejected && (cmd->type == CMD_WRITE);
+    }
+
+    if (!has_response(cmd)) {
+        // Nothing to check until a later status acknowledges it
+    } else if (rejected) {
+        busy++;
+    } else if (in_echo_empty) {
+        errors.short_xfer++;
+    } else if (in_off < expected) {
+        errors.short_xfer++;
+    } else if (cmd->type == CMD_READ) {
+        if (!in_data_ok) {
+            errors.data++;
+        }
+    } else {
+        uint32_t status_data_len = in_status[1] | (in_status[2] << 8);
+        if (PROTO_HAS_LARGE_LEN(cmd->proto)) {
+            status_data_len |= (in_status[3] << 16) | ((uint32_t)in_status[4] << 24);
+        }
+        if ((in_status[0] != STATUS_READY) || (status_data_len != xfer_len(cmd))) {
+            errors.status++;
+        } else if ((cmd->proto == PROTO_CRC) && (get_u32(&in_status[5]) != expected_crc(cmd))) {
+            errors.status++;
+        } else if ((cmd->proto == PROTO_NOACK) &&
+                   ((get_u32(&in_status[5]) != (acks.commands + 1)) ||
+                    (get_u32(&in_status[9]) != (acks.bytes + cmd->len)))) {
+            errors.status++;
+        } else if (cmd->proto == PROTO_BATCH) {
+            for (uint32_t ii = 0; ii < cmd->batch; ii++) {
+                if (in_status[STATUS_LEN_LARGE + ii] != STATUS_READY) {
+                    errors.status++;
+                    break;
+                }
+            }
+        }
+        if (cmd->proto == PROTO_CREDIT) {
+            credit_update(get_u32(&in_status[5]), get_u32(&in_status[9]));
+        }
+        if (is_noack_write(cmd)) {
+            acks.statuses++;
+        }
+    }
+    if (is_noack_write(cmd)) {
+        acks.commands++;
+        acks.bytes += cmd->len;
+    }
+
+    latencies_us[in_cmd] = (double)(sim_now_ns() - cmd->submit_ns) / 1000.0;
+    if (!rejected) {
+        bytes += (cmd->proto == PROTO_BATCH) ? (cmd->batch * batch_write_len(cmd)) : cmd->len;
+    }
+    last_progress_ns = sim_now_ns();
+    in_cmd++;
+    in_off = 0;
+    in_data_ok = true;
+    in_echoed = false;
+    in_echo_empty = false;
+}
+
+// Complete any PROTO_NOACK WRITEs which have been sent, and get no status -
+// there's nothing more to wait for
+static void complete_unacked(void) {
+    while ((in_cmd < out_cmd) && (in_off == 0) && !has_response(&run->cmds[in_cmd])) {
+        complete_command();
+    }
+}
+
+// An echo's data has all been received - now wait for its status.  If it's
+// empty, the status should be BUSY.
+static void complete_echo(void) {
+    const command_t *cmd = &run->cmds[in_cmd];
+
+    if (in_off == 0) {
+        in_echo_empty = true;
+    } else if (in_off < cmd->len) {
+        errors.short_xfer++;
+    }
+    if (!in_data_ok) {
+        errors.data++;
+    }
+    in_off = 0;
+    in_data_ok = true;
+    in_echoed = true;
+}
+
+// Responses are read into a buffer larger than expected, as usb-bench does,
+// so they end with a short packet - which is a zero length packet if the
+// response is a multiple of the packet size
+static void probe_packet(const uint8_t *buf, uint32_t len) {
+    for (uint32_t ii = 0; ii < len; ii++) {
+        if (buf[ii] != 'x') {
+            errors.data++;
+            break;
+        }
+    }
+    probe.in_off += len;
+    if (len == SIM_PACKET_SIZE) {
+        return;
+    }
+
+    if (probe.in_off != probe_size) {
+        errors.short_xfer++;
+    }
+    if (probe.count == probe.alloc) {
+        probe.alloc = probe.alloc ? (probe.alloc * 2) : 256;
+        probe.latencies_us = realloc(probe.latencies_us, probe.alloc * sizeof(double));
+        if (probe.latencies_us == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+    probe.latencies_us[probe.count++] = (double)(sim_now_ns() - probe.submit_ns) / 1000.0;
+    probe.busy = false;
+}
+
+void host_in_packet(uint8_t itf, const uint8_t *buf, uint32_t len) {
+    const command_t *cmd;
+    uint32_t expected;
+    uint32_t copy = 0;
+
+    if (itf == PROBE_ITF) {
+        probe_packet(buf, len);
+        return;
+    }
+    resume.bytes += len;
+    complete_unacked();
+    if (in_cmd == submitted) {
+        // A status we didn't expect, for a WRITE we took to have succeeded
+        errors.overflow++;
+        return;
+    }
+    cmd = &run->cmds[in_cmd];
+    expected = response_len(cmd);
+
+    if (in_off < expected) {
+        copy = expected - in_off;
+        if (copy > len) {
+            copy = len;
+        }
+    }
+    if ((in_off <= expected) && ((in_off + len) > expected)) {
+        // The rest is lost, as libusb would report an overflow
+        errors.overflow++;
+    }
+
+    if ((cmd->type == CMD_READ) || (is_echo(cmd) && !in_echoed)) {
+        if ((in_off == 0) && (len > 0)) {
+            in_first = buf[0];
+        }
+        if ((cmd->type == CMD_READ) && (len < SIM_PACKET_SIZE) && answered_busy(cmd, in_off + len)) {
+            // A BUSY status in place of the data, which mustn't move the
+            // pattern on
+            copy = 0;
+        }
+        for (uint32_t ii = 0; ii < copy; ii++) {
+            if (buf[ii] != expected_byte(cmd, in_off + ii)) {
+                in_data_ok = false;
+            }
+        }
+    } else {
+        memcpy(&in_status[in_off], buf, copy);
+    }
+    in_off += len;
+
+    // Only a short packet ends the transfer
+    if (len < SIM_PACKET_SIZE) {
+        if (is_echo(cmd) && !in_echoed) {
+            complete_echo();
+        } else {
+            complete_command();
+        }
+    }
+}
+
+//
+// Runs
+//
+
+static int compare_double(const void *a, const void *b) {
+    double da = *(const double *)a;
+    double db = *(const double *)b;
+    return (da > db) - (da < db);
+}
+
+static double percentile(const double *sorted, uint32_t count, double pct) {
+    uint32_t index;
+
+    if (count == 0) {
+        return 0;
+    }
+    index = (uint32_t)((pct / 100.0) * (double)(count - 1) + 0.5);
+    return sorted[(index < count) ? index : (count - 1)];
+}
+
+// Print the device's own counters for the run - see stats.h
+static void report_device(void) {
+    uint8_t buf[STATS_BLOCK_LEN];
+    uint16_t len;
+    const uint8_t *counters = &buf[12];
+
+    if (!sim_control_in(RUN_ITF, CTRL_STATS, 0, buf, sizeof(buf), &len) || (len != sizeof(buf))) {
+        printf("  device: CTRL_STATS failed\n");
+        return;
+    }
+
+    printf("  device: packets out %lu in %lu, TX FIFO full %lu, RX flushes %lu, "
+        "statuses ready %lu busy %lu error %lu\n",
+        (unsigned long)get_u32(&counters[STAT_PACKETS_OUT * 4]),
+        (unsigned long)get_u32(&counters[STAT_PACKETS_IN * 4]),
+        (unsigned long)get_u32(&counters[STAT_TX_FIFO_FULL * 4]),
+        (unsigned long)get_u32(&counters[STAT_RX_FLUSH * 4]),
+        (unsigned long)get_u32(&counters[STAT_STATUS_READY * 4]),
+        (unsigned long)get_u32(&counters[STAT_STATUS_BUSY * 4]),
+        (unsigned long)get_u32(&counters[STAT_STATUS_ERROR * 4]));
+}
+
+// Percentage of its turns a core spent asleep, waiting for an event
+static double percent_asleep(int core) {
+    if (sim_core_stats.ticks[core] == 0) {
+        return 0.0;
+    }
+    return (double)sim_core_stats.asleep[core] * 100.0 / (double)sim_core_stats.ticks[core];
+}
+
+static void report(bool stalled) {
+    double elapsed_s = (double)(last_progress_ns - start_ns) / 1e9;
+    char size[16];
+
+    qsort(latencies_us, in_cmd, sizeof(double), compare_double);
+
+    if (run->size > 0) {
+        snprintf(size, sizeof(size), "%lu", (unsigned long)run->size);
+    } else {
+        snprintf(size, sizeof(size), "-");
+    }
+
+    printf("%-6s size %-7s depth %-2lu cmds %-6lu %9.1f KB/s %9.1f cmd/s  "
+        "latency us p50 %8.1f p99 %8.1f p999 %8.1f max %8.1f  errors %lu (short %lu overflow %lu status %lu data %lu) busy %lu%s\n",
+        run->name, size, (unsigned long)depth, (unsigned long)in_cmd,
+        (elapsed_s > 0) ? (double)bytes / 1024.0 / elapsed_s : 0.0,
+        (elapsed_s > 0) ? (double)in_cmd / elapsed_s : 0.0,
+        percentile(latencies_us, in_cmd, 50), percentile(latencies_us, in_cmd, 99),
+        percentile(latencies_us, in_cmd, 99.9),
+        (in_cmd > 0) ? latencies_us[in_cmd - 1] : 0.0,
+        (unsigned long)error_total(), (unsigned long)errors.short_xfer, (unsigned long)errors.overflow,
+        (unsigned long)errors.status, (unsigned long)errors.data, (unsigned long)busy,
+        stalled ? "  STALLED" : "");
+
+    if (flash) {
+        printf("  flash: sectors erased %llu, pages programmed %llu, core 0 locked out %.1f ms\n",
+            (unsigned long long)sim_flash_stats.erases, (unsigned long long)sim_flash_stats.pages,
+            (double)sim_flash_stats.locked_out_ns / 1e6);
+    }
+
+    if (noack) {
+        printf("  acks: WRITEs %lu bytes %lu, statuses %lu\n",
+            (unsigned long)acks.commands, (unsigned long)acks.bytes, (unsigned long)acks.statuses);
+    }
+
+    if (resume_bytes > 0) {
+        printf("  resumes: interruptions %lu, resumed %lu, restarted %lu\n",
+            (unsigned long)resume.interruptions, (unsigned long)resume.resumed, (unsigned long)resume.restarted);
+    }
+
+    if (paced) {
+        printf("  credits: sent cmds %lu bytes %lu, limits cmds %lu bytes %lu, CTRL_CREDITS polls %lu\n",
+            (unsigned long)credit.commands, (unsigned long)credit.bytes,
+            (unsigned long)credit.command_limit, (unsigned long)credit.byte_limit,
+            (unsigned long)credit.polls);
+    }
+
+    if (probe_size > 0) {
+        qsort(probe.latencies_us, probe.count, sizeof(double), compare_double);
+        printf("  probe: READ size %lu on channel %d, cmds %lu, latency us p50 %8.1f p99 %8.1f max %8.1f\n",
+            (unsigned long)probe_size, PROBE_ITF, (unsigned long)probe.count,
+            percentile(probe.latencies_us, probe.count, 50), percentile(probe.latencies_us, probe.count, 99),
+            (probe.count > 0) ? probe.latencies_us[probe.count - 1] : 0.0);
+    }
+
+    if (verbose) {
+        printf("  bus: %llu frames, slots out %llu in %llu idle %llu, NAKs out %llu in %llu\n",
+            (unsigned long long)((last_progress_ns - start_ns) / SIM_FRAME_NS),
+            (unsigned long long)sim_bus_stats.slots_out, (unsigned long long)sim_bus_stats.slots_in,
+            (unsigned long long)sim_bus_stats.slots_idle, (unsigned long long)sim_bus_stats.nak_out,
+            (unsigned long long)sim_bus_stats.nak_in);
+        printf("  cores: asleep core 0 %.1f%% core 1 %.1f%%\n",
+            percent_asleep(0), percent_asleep(1));
+        report_device();
+    }
+}
+
+// Read the device's flight recorder (see src/trace.h) with CTRL_TRACE, a
+// block at a time, and save the dump to trace_file
+static void save_trace(void) {
+#ifdef TRACE
+    static uint8_t dump[TRACE_HEADER_LEN + (TRACE_CORES * TRACE_LEN * sizeof(trace_entry_t)) + TRACE_BLOCK_LEN];
+    uint32_t total = 0;
+    uint32_t entries[TRACE_CORES];
+    uint16_t len;
+    FILE *f;
+
+    for (uint16_t block = 0; ; block++) {
+        if ((total + TRACE_BLOCK_LEN > sizeof(dump)) ||
+            !sim_control_in(RUN_ITF, CTRL_TRACE, block, &dump[total], TRACE_BLOCK_LEN, &len)) {
+            fprintf(stderr, "Device rejected CTRL_TRACE\n");
+            exit(1);
+        }
+        total += len;
+        if (len < TRACE_BLOCK_LEN) {
+            break;
+        }
+    }
+
+    entries[0] = (total >= TRACE_HEADER_LEN) ? (dump[2] | (dump[3] << 8)) : 0;
+    entries[1] = (total >= TRACE_HEADER_LEN) ? (dump[4] | (dump[5] << 8)) : 0;
+    if ((total < TRACE_HEADER_LEN) || (dump[0] != TRACE_VERSION) || (dump[1] != sizeof(trace_entry_t)) ||
+        (total != TRACE_HEADER_LEN + ((entries[0] + entries[1]) * sizeof(trace_entry_t)))) {
+        fprintf(stderr, "Bad CTRL_TRACE dump\n");
+        exit(1);
+    }
+
+    f = fopen(trace_file, "wb");
+    if ((f == NULL) || (fwrite(dump, 1, total, f) != total) || (fclose(f) != 0)) {
+        fprintf(stderr, "%s: %s\n", trace_file, strerror(errno));
+        exit(1);
+    }
+    printf("trace: %lu core 0 and %lu core 1 events saved to %s\n",
+        (unsigned long)entries[0], (unsigned long)entries[1], trace_file);
+#endif // TRACE
+}
+
+// Start the next run, or finish if there are none left.  Like usb-bench,
+// each run starts with CTRL_INIT, so the device starts from a clean state,
+// and then selects the READ pattern, which restarts it.  With -k it then
+// gets the run's first credits.
+static void start_run(void) {
+    uint8_t buf[STATS_BLOCK_LEN];
+    uint16_t len;
+
+    run = (run == NULL) ? runs : (run + 1);
+    if (run == (runs + run_count)) {
+        if (trace_file != NULL) {
+            save_trace();
+        }
+        exit(exit_code);
+    }
+
+    if (!sim_control_in(RUN_ITF, CTRL_INIT, 0, buf, 8, &len) ||
+        ((probe_size > 0) && !sim_control_in(PROBE_ITF, CTRL_INIT, 0, buf, 8, &len)) ||
+        !sim_control_in(RUN_ITF, CTRL_PATTERN, pattern_selection, buf, 1, &len) ||
+        !sim_control_in(RUN_ITF, CTRL_STATS, 1, buf, sizeof(buf), &len)) {
+        fprintf(stderr, "Device rejected control request\n");
+        exit(1);
+    }
+    memset(&credit, 0, sizeof(credit));
+    memset(&acks, 0, sizeof(acks));
+    memset(&resume, 0, sizeof(resume));
+    if (paced && !credit_poll()) {
+        fprintf(stderr, "Device rejected CTRL_CREDITS\n");
+        exit(1);
+    }
+
+    free(latencies_us);
+    latencies_us = calloc(run->count, sizeof(double));
+    if (latencies_us == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    submitted = 0;
+    out_cmd = 0;
+    out_off = 0;
+    out_zlp = false;
+    in_cmd = 0;
+    in_off = 0;
+    in_data_ok = true;
+    in_echoed = false;
+    pattern_gen_init(&in_pattern, (uint8_t)pattern_selection, (uint8_t)(pattern_selection >> 8));
+    probe.count = 0;
+    bytes = 0;
+    memset(&errors, 0, sizeof(errors));
+    busy = 0;
+    in_loop_busy = false;
+    memset(&sim_bus_stats, 0, sizeof(sim_bus_stats));
+    memset(&sim_core_stats, 0, sizeof(sim_core_stats));
+    memset(&sim_flash_stats, 0, sizeof(sim_flash_stats));
+    start_ns = sim_now_ns();
+    last_progress_ns = start_ns;
+    run_started = true;
+}
+
+// Check CTRL_ACKS agrees that every PROTO_NOACK WRITE was completed
+static void check_acks(void) {
+    uint8_t buf[8];
+    uint16_t len;
+
+    if (!sim_control_in(RUN_ITF, CTRL_ACKS, 0, buf, sizeof(buf), &len) || (len != sizeof(buf))) {
+        fprintf(stderr, "Device rejected CTRL_ACKS\n");
+        exit(1);
+    }
+    if ((get_u32(&buf[0]) != acks.commands) || (get_u32(&buf[4]) != acks.bytes)) {
+        errors.status++;
+    }
+}
+
+// Check CTRL_STORE agrees that the run's object is all the store holds, in
+// as few blocks as it will fit in - or, for a flash object, sectors, after
+// its header page
+static void check_store(void) {
+    uint8_t info[STORE_INFO_LEN];
+    uint16_t len;
+    uint32_t blocks = (run->size + STORE_BLOCK_SIZE - 1) / STORE_BLOCK_SIZE;
+    uint32_t pool = STORE_BLOCKS;
+    uint32_t block_size = STORE_BLOCK_SIZE;
+    uint32_t objects = STORE_OBJECTS;
+
+    if (flash) {
+        blocks = (FLASH_PAGE_SIZE + run->size + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE;
+        pool = FLASH_STORE_SIZE / FLASH_SECTOR_SIZE;
+        block_size = FLASH_SECTOR_SIZE;
+        objects = FLASH_STORE_OBJECTS;
+    }
+    if (!sim_control_in(RUN_ITF, CTRL_STORE, flash ? STORE_FLASH : 0, info, sizeof(info), &len) ||
+        (len != sizeof(info))) {
+        fprintf(stderr, "Device rejected CTRL_STORE\n");
+        exit(1);
+    }
+    if ((get_u16(&info[0]) != blocks) || (get_u16(&info[2]) != pool) ||
+        (get_u16(&info[4]) != block_size) || (info[6] != 1) || (info[7] != objects)) {
+        errors.status++;
+    }
+}
+
+//
+// Resuming
+//
+
+// Reset the bus, losing whatever was in flight
+static void interrupt_run(void) {
+    sim_usb_reset();
+    resume.bytes = 0;
+    resume.waiting = true;
+    resume.interruptions++;
+}
+
+// How far the interrupted command got, as far as the host knows - the data
+// it sent, or received
+static uint32_t host_done(const command_t *cmd) {
+    uint32_t done;
+
+    if (cmd->type == CMD_READ) {
+        done = in_off;
+    } else if (out_cmd > in_cmd) {
+        done = xfer_len(cmd);
+    } else {
+        done = (out_off > header_len(cmd)) ? (out_off - header_len(cmd)) : 0;
+    }
+    return cmd->resume_off + ((done < xfer_len(cmd)) ? done : xfer_len(cmd));
+}
+
+// Once the device is mounted again, and has reset the channel, ask it how
+// far the interrupted command got, and carry on from there.  A READ the
+// device has sent all of is complete - only its zero length packet, at most,
+// was lost.
+static void resume_run(void) {
+    command_t *cmd = &run->cmds[in_cmd];
+    uint8_t info[RESUME_INFO_LEN];
+    uint16_t len;
+    uint32_t done;
+
+    if (!tud_mounted()) {
+        return;
+    }
+    if (!sim_control_in(RUN_ITF, CTRL_RESUME, 0, info, sizeof(info), &len) || (len != sizeof(info))) {
+        fprintf(stderr, "Device rejected CTRL_RESUME\n");
+        exit(1);
+    }
+    if (info[3] == STATUS_BUSY) {
+        return;
+    }
+    resume.waiting = false;
+
+    done = get_u32(&info[8]);
+    if ((info[2] != cmd->type) || ((info[0] | (info[1] << 8)) != cmd->id) || (get_u32(&info[4]) != cmd->len)) {
+        // The device never started it
+        cmd->resumed = false;
+        cmd->resume_off = 0;
+        resume.restarted++;
+    } else if (done > host_done(cmd)) {
+        // The device thinks we have data we don't
+        errors.data++;
+        cmd->resumed = false;
+        cmd->resume_off = 0;
+        resume.restarted++;
+    } else {
+        cmd->resumed = true;
+        cmd->resume_off = done;
+        resume.resumed++;
+    }
+
+    out_cmd = in_cmd;
+    out_off = 0;
+    out_zlp = false;
+    in_off = 0;
+    if ((cmd->type == CMD_READ) && (xfer_len(cmd) == 0)) {
+        complete_command();
+    }
+}
+
+void host_poll(void) {
+    uint64_t now = sim_now_ns();
+
+    if (!run_started) {
+        start_run();
+    }
+
+    if ((resume_bytes > 0) && !resume.waiting && (resume.bytes >= resume_bytes) && (in_cmd < submitted)) {
+        interrupt_run();
+    }
+    if (resume.waiting) {
+        resume_run();
+    }
+
+    while ((submitted < run->count) && ((submitted - in_cmd) < depth)) {
+        run->cmds[submitted].submit_ns = now;
+        submitted++;
+    }
+
+    // If we're out of credits, and haven't had any for a frame, ask for more
+    if (paced && (out_cmd < submitted) && !out_zlp && (out_allowed(&run->cmds[out_cmd]) == 0) &&
+        ((now - credit.update_ns) >= SIM_FRAME_NS) && !credit_poll()) {
+        fprintf(stderr, "Device rejected CTRL_CREDITS\n");
+        exit(1);
+    }
+
+    // Keep a probe READ in flight until the run's commands are done
+    if ((probe_size > 0) && !probe.busy && (in_cmd < run->count)) {
+        probe.busy = true;
+        probe.out_sent = false;
+        probe.in_off = 0;
+        probe.submit_ns = now;
+    }
+
+    complete_unacked();
+    if ((in_cmd == run->count) && !probe.busy) {
+        if (noack) {
+            check_acks();
+        }
+        if (store) {
+            check_store();
+        }
+        report(false);
+        if (error_total() > 0) {
+            exit_code = 1;
+        }
+        start_run();
+    } else if ((now - last_progress_ns) > ((uint64_t)timeout_ms * 1000000)) {
+        // Nothing more is going to happen
+        report(true);
+        exit(1);
+    }
+}
+
+//
+// Setup
+//
+
+// Set which PROTO_NOACK WRITEs get a status, as the device will decide (see
+// src/ack.h) - the run's last always does, so everything is acknowledged by
+// the end
+static void set_acks(command_t *cmds, uint32_t count) {
+    command_t *last = NULL;
+    uint32_t interval_commands = 0;
+    uint64_t interval_bytes = 0;
+
+    for (uint32_t ii = 0; ii < count; ii++) {
+        command_t *cmd = &cmds[ii];
+
+        if (!is_noack_write(cmd)) {
+            continue;
+        }
+        cmd->ack_commands = ack_commands;
+        cmd->ack_kb = ack_kb;
+        interval_commands++;
+        interval_bytes += cmd->len;
+        cmd->acked = ((ack_commands > 0) && (interval_commands >= ack_commands)) ||
+                     ((ack_kb > 0) && (interval_bytes >= ((uint64_t)ack_kb * 1024)));
+        if (cmd->acked) {
+            interval_commands = 0;
+            interval_bytes = 0;
+        }
+        last = cmd;
+    }
+    if (last != NULL) {
+        last->ack_commands = 1;
+        last->acked = true;
+    }
+}
+
+static void add_run(const char *name, uint32_t size, command_t *cmds, uint32_t count) {
+    set_acks(cmds, count);
+    for (uint32_t ii = 0; ii < count; ii++) {
+        cmds[ii].id = (uint16_t)(ii & ~RESUME_CONTINUE);
+    }
+    runs = realloc(runs, (run_count + 1) * sizeof(run_t));
+    if (runs == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    runs[run_count].name = name;
+    runs[run_count].size = size;
+    runs[run_count].cmds = cmds;
+    runs[run_count].count = count;
+    run_count++;
+}
+
+static command_t *alloc_cmds(uint32_t count) {
+    command_t *cmds = calloc(count ? count : 1, sizeof(command_t));
+    if (cmds == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    return cmds;
+}
+
+// The protocol for ordinary READs and WRITEs
+static uint8_t default_proto(void) {
+    if (crc) {
+        return PROTO_CRC;
+    }
+    if (paced) {
+        return PROTO_CREDIT;
+    }
+    if (noack) {
+        return PROTO_NOACK;
+    }
+    if (resume_bytes > 0) {
+        return PROTO_RESUME;
+    }
+    return large ? PROTO_LARGE : PROTO_DEFAULT;
+}
+
+// A workload of count commands, all of size bytes.  The mixed workload uses
+// a fixed seed, so every run sends the same commands.
+static void add_workload(const char *name, uint32_t size, uint32_t count, uint32_t read_percent) {
+    command_t *cmds = alloc_cmds(count);
+    uint32_t seed = 1;
+
+    for (uint32_t ii = 0; ii < count; ii++) {
+        seed = seed * 1103515245 + 12345;
+        cmds[ii].type = (((seed >> 16) % 100) < read_percent) ? CMD_READ : CMD_WRITE;
+        cmds[ii].proto = default_proto();
+        cmds[ii].len = size;
+    }
+    add_run(name, size, cmds, count);
+}
+
+// The batch workload - count batches, each of batch_len WRITEs of size bytes
+static void add_batch_workload(uint32_t size, uint32_t count) {
+    command_t *cmds = alloc_cmds(count);
+
+    for (uint32_t ii = 0; ii < count; ii++) {
+        cmds[ii].type = CMD_WRITE;
+        cmds[ii].proto = PROTO_BATCH;
+        cmds[ii].batch = (uint8_t)batch_len;
+        cmds[ii].len = batch_len * (COMMAND_LEN + size);
+    }
+    add_run("BATCH", size, cmds, count);
+}
+
+// The store workload - a WRITE of size bytes to an object, then count - 1
+// READs of it
+static void add_store_workload(uint32_t size, uint32_t count) {
+    command_t *cmds = alloc_cmds(count);
+
+    for (uint32_t ii = 0; ii < count; ii++) {
+        cmds[ii].type = (ii == 0) ? CMD_WRITE : CMD_READ;
+        cmds[ii].proto = PROTO_STORE;
+        cmds[ii].len = size;
+    }
+    add_run(flash ? "FLASH" : "STORE", size, cmds, count);
+}
+
+// Add a script line's commands - a loop is two commands, a WRITE and a READ
+static void add_commands(command_t *cmds, uint32_t *count, const char *type, uint32_t size) {
+    command_t *cmd = &cmds[*count];
+
+    cmd->type = (type[0] == 'r') ? CMD_READ : CMD_WRITE;
+    cmd->len = size;
+    cmd->submit_ns = 0;
+    if (strcmp(type, "loop") == 0) {
+        cmd->proto = PROTO_LOOPBACK;
+        cmd[1] = cmd[0];
+        cmd[1].type = CMD_READ;
+        (*count)++;
+    } else if (strcmp(type, "echo") == 0) {
+        cmd->proto = PROTO_LOOPBACK_STREAM;
+    } else {
+        cmd->proto = default_proto();
+    }
+    (*count)++;
+}
+
+// The loopback workloads - loop is count WRITE and READ pairs, and echo
+// count echoes
+static void add_loopback_workload(const char *name, const char *type, uint32_t size, uint32_t count) {
+    command_t *cmds = alloc_cmds(count * 2);
+    uint32_t added = 0;
+
+    for (uint32_t ii = 0; ii < count; ii++) {
+        add_commands(cmds, &added, type, size);
+    }
+    add_run(name, size, cmds, added);
+}
+
+static bool check_size(unsigned long size) {
+    if (size == 0) {
+        // A zero length READ gets no response at all
+        fprintf(stderr, "Sizes must be non-zero\n");
+        return false;
+    }
+    if (!store && !PROTO_HAS_LARGE_LEN(default_proto()) && (size > 0xffff)) {
+        fprintf(stderr, "Sizes over 65535 need -l, -C, -k, -a or -R\n");
+        return false;
+    }
+    return true;
+}
+
+// Loopback commands, and the WRITEs in a batch, always have a 16-bit length,
+// and a loop's data has to fit in the loopback buffer - and a store object's
+// in the store, or a flash object's in its slot
+static bool check_loopback_size(const char *type, unsigned long size) {
+    if ((strcmp(type, "store") == 0) && (size > (STORE_BLOCKS * STORE_BLOCK_SIZE))) {
+        fprintf(stderr, "Store sizes must be at most the object store's size (%d)\n", STORE_BLOCKS * STORE_BLOCK_SIZE);
+        return false;
+    }
+    if ((strcmp(type, "flash") == 0) && (size > (FLASH_STORE_SLOT_SIZE - FLASH_PAGE_SIZE))) {
+        fprintf(stderr, "Flash sizes must be at most a flash object's size (%d)\n", FLASH_STORE_SLOT_SIZE - FLASH_PAGE_SIZE);
+        return false;
+    }
+    if ((strcmp(type, "loop") != 0) && (strcmp(type, "echo") != 0) && (strcmp(type, "batch") != 0)) {
+        return true;
+    }
+    if (size > 0xffff) {
+        fprintf(stderr, "Loopback and batch sizes must be at most 65535\n");
+        return false;
+    }
+    if ((type[0] == 'l') && (size > LOOPBACK_SIZE)) {
+        fprintf(stderr, "Loop sizes must be at most the loopback buffer size (%d)\n", LOOPBACK_SIZE);
+        return false;
+    }
+    return true;
+}
+
+static bool load_script(const char *filename) {
+    FILE *f = fopen(filename, "r");
+    char line[256];
+    char type[16];
+    unsigned long size;
+    unsigned long repeat;
+    uint32_t count = 0;
+    uint32_t line_num = 0;
+    command_t *cmds = NULL;
+
+    if (f == NULL) {
+        fprintf(stderr, "Can't open %s: %s\n", filename, strerror(errno));
+        return false;
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char *comment = strchr(line, '#');
+        int fields;
+
+        line_num++;
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+        repeat = 1;
+        fields = sscanf(line, "%15s %lu %lu", type, &size, &repeat);
+        if (fields <= 0) {
+            continue;
+        }
+        if ((fields < 2) || (repeat == 0) ||
+            ((strcmp(type, "read") != 0) && (strcmp(type, "write") != 0) &&
+             (strcmp(type, "loop") != 0) && (strcmp(type, "echo") != 0)) ||
+            !check_size(size) || !check_loopback_size(type, size)) {
+            fprintf(stderr, "%s:%lu: expected: read|write|loop|echo SIZE [COUNT]\n", filename, (unsigned long)line_num);
+            fclose(f);
+            return false;
+        }
+
+        cmds = realloc(cmds, (count + (repeat * 2)) * sizeof(command_t));
+        if (cmds == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        for (unsigned long ii = 0; ii < repeat; ii++) {
+            add_commands(cmds, &count, type, (uint32_t)size);
+        }
+    }
+    fclose(f);
+
+    if (count == 0) {
+        fprintf(stderr, "%s: no commands\n", filename);
+        return false;
+    }
+    add_run("SCRIPT", 0, cmds, count);
+    return true;
+}
+
+// Parse -a's COUNT[:KB] ack interval
+static bool parse_acks(const char *arg) {
+    const char *colon = strchr(arg, ':');
+    unsigned long count = strtoul(arg, NULL, 0);
+    unsigned long kb = (colon != NULL) ? strtoul(colon + 1, NULL, 0) : 0;
+
+    if ((count > 0xff) || (kb > 0xff)) {
+        return false;
+    }
+    ack_commands = (uint8_t)count;
+    ack_kb = (uint8_t)kb;
+    noack = true;
+    return true;
+}
+
+// Parse -g's PATTERN[:SEED] into a CTRL_PATTERN wValue
+static bool parse_pattern(const char *arg) {
+    static const char *names[PATTERN_COUNT] = {"x", "counter", "prbs31", "lfsr"};
+    const char *colon = strchr(arg, ':');
+    size_t name_len = (colon != NULL) ? (size_t)(colon - arg) : strlen(arg);
+    unsigned long seed = 0;
+
+    if (colon != NULL) {
+        seed = strtoul(colon + 1, NULL, 0);
+        if (seed > 0xff) {
+            return false;
+        }
+    }
+    for (uint16_t ii = 0; ii < PATTERN_COUNT; ii++) {
+        if ((strlen(names[ii]) == name_len) && (strncmp(arg, names[ii], name_len) == 0)) {
+            pattern_selection = (uint16_t)(ii | (seed << 8));
+            return true;
+        }
+    }
+    return false;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  -w WORKLOAD          read, write, mixed, loop, echo, batch, store or flash (default: the first three)\n"
+        "  -s SIZES             Comma separated command data sizes in bytes (default: 64,512,4096)\n"
+        "  -f FILE              Run the commands in a script file instead\n"
+        "  -d DEPTH             Commands in flight (default: 4)\n"
+        "  -n COUNT             Commands per run (default: 200)\n"
+        "  -r PERCENT           Percentage of READs in the mixed workload (default: 50)\n"
+        "  -b COUNT             WRITEs per batch in the batch workload (default: 16, at most 255)\n"
+        "  -l                   Use PROTO_LARGE (32-bit length) commands\n"
+        "  -C                   Use PROTO_CRC commands, and check WRITE data CRCs\n"
+        "  -k                   Pace commands by the device's credits, using PROTO_CREDIT commands\n"
+        "  -a COUNT[:KB]        Use PROTO_NOACK commands, with a WRITE status every COUNT WRITEs or KB\n"
+        "  -R BYTES             Use PROTO_RESUME commands, one at a time, and reset the bus every BYTES bytes\n"
+        "  -g PATTERN[:SEED]    READ pattern - x, counter, prbs31 or lfsr (default: x)\n"
+        "  -p PACKETS           Bulk packets per 1ms frame (default: 19)\n"
+        "  -c NS                Simulated time per main loop pass (default: 2000)\n"
+        "  -t MS                Give up if nothing completes for this long, in simulated time (default: 1000,\n"
+        "                       or 5000 for the flash workload)\n"
+        "  -F FILE              Back the device's flash with FILE (default: a temporary file)\n"
+        "  -T FILE              Save the device's trace dump to FILE after the last run\n"
+        "  -P SIZE              Also time SIZE byte READs, one at a time, on the second channel\n"
+        "  -v                   Also report bus and device counters\n",
+        prog);
+}
+
+int main(int argc, char **argv) {
+    const char *workload = NULL;
+    const char *script = NULL;
+    char default_sizes[] = "64,512,4096";
+    char *sizes = default_sizes;
+    uint32_t count = 200;
+    uint32_t read_percent = 50;
+    bool timeout_set = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "w:s:f:d:n:r:b:lCka:R:g:p:c:t:F:T:P:v")) != -1) {
+        switch (opt) {
+            case 'w':
+                workload = optarg;
+                break;
+            case 's':
+                sizes = optarg;
+                break;
+            case 'f':
+                script = optarg;
+                break;
+            case 'd':
+                depth = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                count = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 'r':
+                read_percent = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 'b':
+                batch_len = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 'l':
+                large = true;
+                break;
+            case 'C':
+                crc = true;
+                break;
+            case 'k':
+                paced = true;
+                break;
+            case 'a':
+                if (!parse_acks(optarg)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'R':
+                resume_bytes = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 'g':
+                if (!parse_pattern(optarg)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'p':
+                sim_packets_per_frame = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 'c':
+                sim_loop_ns = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 't':
+                timeout_ms = (uint32_t)strtoul(optarg, NULL, 0);
+                timeout_set = true;
+                break;
+            case 'F':
+                flash_file = optarg;
+                break;
+            case 'T':
+                trace_file = optarg;
+                break;
+            case 'P':
+                probe_size = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if ((optind != argc) || (depth == 0) || (count == 0) || (read_percent > 100) ||
+        (sim_packets_per_frame == 0) || (sim_loop_ns == 0) || (probe_size > 0xffff) ||
+        (batch_len == 0) || (batch_len > BATCH_MAX_COMMANDS) ||
+        ((workload != NULL) && (strcmp(workload, "read") != 0) &&
+         (strcmp(workload, "write") != 0) && (strcmp(workload, "mixed") != 0) &&
+         (strcmp(workload, "loop") != 0) && (strcmp(workload, "echo") != 0) &&
+         (strcmp(workload, "batch") != 0) && (strcmp(workload, "store") != 0) &&
+         (strcmp(workload, "flash") != 0))) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (crc && paced) {
+        fprintf(stderr, "-C and -k can't be combined - PROTO_CRC statuses don't carry credits\n");
+        return 1;
+    }
+    if (noack && (crc || paced)) {
+        fprintf(stderr, "-a can't be combined with -C or -k - PROTO_NOACK statuses carry neither\n");
+        return 1;
+    }
+#if CFG_TUD_VENDOR_RX_BUFSIZE == 0
+    if (noack) {
+        // Any WRITE may be answered BUSY, which gets a status straight away
+        // and restarts the ack interval, so we can't tell which WRITEs will
+        // get a status, and would count the BUSYs as errors
+        fprintf(stderr, "-a isn't supported with VENDOR_RX_UNBUFFERED - the device may answer any WRITE BUSY, "
+            "so which get a status can't be predicted\n");
+        return 1;
+    }
+#endif
+
+    flash = (workload != NULL) && (strcmp(workload, "flash") == 0);
+    store = flash || ((workload != NULL) && (strcmp(workload, "store") == 0));
+    if (store && (crc || paced || noack || (resume_bytes > 0))) {
+        fprintf(stderr, "-w %s can't be combined with -C, -k, -a or -R - it uses PROTO_STORE\n", workload);
+        return 1;
+    }
+    if (flash && !timeout_set) {
+        // A flash WRITE takes tens of ms a sector
+        timeout_ms = 5000;
+    }
+
+    if ((resume_bytes > 0) &&
+        (crc || paced || noack || (script != NULL) || (probe_size > 0) || (pattern_selection != PATTERN_X) ||
+         ((workload != NULL) && (strcmp(workload, "read") != 0) &&
+          (strcmp(workload, "write") != 0) && (strcmp(workload, "mixed") != 0)))) {
+        fprintf(stderr, "-R only works with the read, write and mixed workloads and the x pattern, "
+            "without -f, -C, -k, -a or -P\n");
+        return 1;
+    }
+    if (resume_bytes > 0) {
+        // Only the most recently started PROTO_RESUME command can be resumed
+        depth = 1;
+    }
+
+#ifndef TRACE
+    if (trace_file != NULL) {
+        fprintf(stderr, "-T needs a device with the flight recorder (-DTRACE=ON)\n");
+        return 1;
+    }
+#endif
+
+    if ((probe_size > 0) && (CFG_TUD_VENDOR < 2)) {
+        fprintf(stderr, "-P needs a device with more than one channel (-DVENDOR_CHANNELS=2)\n");
+        return 1;
+    }
+
+    if (script != NULL) {
+        if (!load_script(script)) {
+            return 1;
+        }
+    } else {
+        static const char *names[] = {"read", "write", "mixed"};
+        static const char *upper[] = {"READ", "WRITE", "MIXED"};
+        static const uint32_t percents[] = {100, 0, 0};
+
+        uint32_t size_list[16];
+        uint32_t size_count = 0;
+
+        for (char *tok = strtok(sizes, ","); tok != NULL; tok = strtok(NULL, ",")) {
+            unsigned long size = strtoul(tok, NULL, 0);
+            if (!check_size(size) || ((workload != NULL) && !check_loopback_size(workload, size))) {
+                return 1;
+            }
+            if (size_count == (sizeof(size_list) / sizeof(size_list[0]))) {
+                fprintf(stderr, "Too many sizes\n");
+                return 1;
+            }
+            size_list[size_count++] = (uint32_t)size;
+        }
+
+        for (int ww = 0; ww < 3; ww++) {
+            if ((workload != NULL) && (strcmp(workload, names[ww]) != 0)) {
+                continue;
+            }
+            for (uint32_t ii = 0; ii < size_count; ii++) {
+                add_workload(upper[ww], size_list[ii], count, (ww == 2) ? read_percent : percents[ww]);
+            }
+        }
+        for (uint32_t ii = 0; (workload != NULL) && (ii < size_count); ii++) {
+            if (strcmp(workload, "loop") == 0) {
+                add_loopback_workload("LOOP", workload, size_list[ii], count);
+            } else if (strcmp(workload, "echo") == 0) {
+                add_loopback_workload("ECHO", workload, size_list[ii], count);
+            } else if (strcmp(workload, "batch") == 0) {
+                add_batch_workload(size_list[ii], count);
+            } else if (store) {
+                add_store_workload(size_list[ii], count);
+            }
+        }
+    }
+
+    sim_flash_open(flash_file);
+
+    // Never returns - host_poll() exits once all runs are complete
+    device_main();
+    return 0;
+}
@@ -0,0 +1,16 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Stand-in for tinyusb's bsp/board_api.h, for the device simulator.
+//
+
+#ifndef SIM_BSP_BOARD_API_H
+#define SIM_BSP_BOARD_API_H
+
+void board_init(void);
+
+#endif // SIM_BSP_BOARD_API_H
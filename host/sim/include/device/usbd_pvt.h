@@ -0,0 +1,24 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Stand-in for tinyusb's device/usbd_pvt.h, for the device simulator.
+//
+// Only the endpoint functions the firmware uses to send a zero length packet
+// on the vendor IN endpoint are provided - see sim-usb.c.
+//
+
+#ifndef SIM_USBD_PVT_H
+#define SIM_USBD_PVT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+bool usbd_edpt_claim(uint8_t rhport, uint8_t ep_addr);
+bool usbd_edpt_release(uint8_t rhport, uint8_t ep_addr);
+bool usbd_edpt_xfer(uint8_t rhport, uint8_t ep_addr, uint8_t *buffer, uint16_t total_bytes);
+
+#endif // SIM_USBD_PVT_H
@@ -0,0 +1,35 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Stand-in for the Pico SDK's hardware/flash.h, for the device simulator.
+// The flash is a file, memory mapped at sim_xip_base - which stands in for
+// the XIP window - so what's written to it survives from one run to the
+// next.  Erasing and programming behave as on NOR flash, and take as long,
+// in simulated time - see sim-pico.c.
+//
+
+#ifndef SIM_HARDWARE_FLASH_H
+#define SIM_HARDWARE_FLASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FLASH_PAGE_SIZE        256
+#define FLASH_SECTOR_SIZE      4096
+#define PICO_FLASH_SIZE_BYTES  (2 * 1024 * 1024)
+
+extern uint8_t *sim_xip_base;
+#define XIP_BASE               ((uintptr_t)sim_xip_base)
+
+// offset and count must be multiples of FLASH_SECTOR_SIZE
+void flash_range_erase(uint32_t flash_offs, size_t count);
+
+// offset and count must be multiples of FLASH_PAGE_SIZE.  Bits can only be
+// cleared, as on NOR flash, so what's being programmed must have been erased.
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count);
+
+#endif // SIM_HARDWARE_FLASH_H
@@ -0,0 +1,27 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Stand-in for the Pico SDK's hardware/structs/scb.h, for the device
+// simulator.  The registers are just memory - the simulator always behaves
+// as if SEVONPEND were set.
+//
+
+#ifndef SIM_HARDWARE_STRUCTS_SCB_H
+#define SIM_HARDWARE_STRUCTS_SCB_H
+
+#include <stdint.h>
+
+#define M0PLUS_SCR_SEVONPEND_BITS  0x00000010
+
+typedef struct {
+    uint32_t scr;
+} armv6m_scb_t;
+
+extern armv6m_scb_t sim_scb;
+#define scb_hw (&sim_scb)
+
+#endif // SIM_HARDWARE_STRUCTS_SCB_H
@@ -0,0 +1,31 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Stand-in for the Pico SDK's hardware/sync.h, for the device simulator.
+// Each simulated core has an event flag, as the Cortex-M0+ does - see
+// sim-pico.c.
+//
+
+#ifndef SIM_HARDWARE_SYNC_H
+#define SIM_HARDWARE_SYNC_H
+
+#include <stdint.h>
+
+// Set both cores' event flags
+void __sev(void);
+
+// If the calling core's event flag is set, clear it and return.  Otherwise
+// let simulated time pass until it is set (by __sev(), or on core 0 an
+// interrupt).
+void __wfe(void);
+
+// These just record whether the calling core's interrupts are off, for the
+// flash stand-ins to check (see hardware/flash.h)
+uint32_t save_and_disable_interrupts(void);
+void restore_interrupts(uint32_t status);
+
+#endif // SIM_HARDWARE_SYNC_H
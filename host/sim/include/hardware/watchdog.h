@@ -0,0 +1,23 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Stand-in for the Pico SDK's hardware/watchdog.h, for the device simulator.
+// The watchdog is checked in simulated time - if it isn't fed within its
+// timeout the simulator exits with an error (see sim-pico.c).
+//
+
+#ifndef SIM_HARDWARE_WATCHDOG_H
+#define SIM_HARDWARE_WATCHDOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+void watchdog_enable(uint32_t delay_ms, bool pause_on_debug);
+bool watchdog_caused_reboot(void);
+void watchdog_update(void);
+
+#endif // SIM_HARDWARE_WATCHDOG_H
@@ -0,0 +1,25 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Stand-in for the Pico SDK's pico/multicore.h, for the device simulator.
+// Core 1 runs on its own thread, in lockstep with core 0 - see sim-pico.c.
+// Only core 1 can lock core 0 out.
+//
+
+#ifndef SIM_PICO_MULTICORE_H
+#define SIM_PICO_MULTICORE_H
+
+void multicore_launch_core1(void (*entry)(void));
+void multicore_reset_core1(void);
+
+// While core 0 is locked out, none of its code runs, but its hardware (and
+// the host) carries on, and simulated time still passes
+void multicore_lockout_victim_init(void);
+void multicore_lockout_start_blocking(void);
+void multicore_lockout_end_blocking(void);
+
+#endif // SIM_PICO_MULTICORE_H
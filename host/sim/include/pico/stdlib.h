@@ -0,0 +1,57 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Stand-in for the Pico SDK's pico/stdlib.h, for the device simulator - see
+// host/sim/sim.h.  Only provides what the firmware uses.
+//
+
+#ifndef SIM_PICO_STDLIB_H
+#define SIM_PICO_STDLIB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "pico/time.h"
+
+#define PICO_SDK_VERSION_STRING "sim"
+
+typedef unsigned int uint;
+
+// As the Pico SDK's, checked even when assert() isn't (NDEBUG)
+#define hard_assert(condition) do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: hard_assert failed: %s\n", __FILE__, __LINE__, #condition); \
+            abort(); \
+        } \
+    } while (0)
+
+// Everything runs from "RAM" on the host
+#define __not_in_flash_func(func_name) func_name
+
+// Each simulated core is a thread, which knows which core it is
+extern _Thread_local uint sim_core_num;
+
+static inline uint get_core_num(void) {
+    return sim_core_num;
+}
+
+// Hands over to the other core, so it can do whatever this core is waiting
+// for, or take its turn after a pass of this core's loop
+void tight_loop_contents(void);
+
+typedef struct stdio_driver stdio_driver_t;
+extern stdio_driver_t stdio_uart;
+
+bool stdio_init_all(void);
+void stdio_set_driver_enabled(stdio_driver_t *driver, bool enabled);
+
+#endif // SIM_PICO_STDLIB_H
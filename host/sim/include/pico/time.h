@@ -0,0 +1,34 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Stand-in for the Pico SDK's pico/time.h, for the device simulator.  Only
+// one repeating timer is supported.  Its callback is called on core 0, in
+// simulated time, as if from the timer interrupt - see sim-pico.c.
+//
+
+#ifndef SIM_PICO_TIME_H
+#define SIM_PICO_TIME_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct repeating_timer repeating_timer_t;
+typedef bool (*repeating_timer_callback_t)(repeating_timer_t *rt);
+
+struct repeating_timer {
+    int64_t delay_us;
+    repeating_timer_callback_t callback;
+    void *user_data;
+};
+
+// Simulated time, rather than wall clock time
+uint64_t time_us_64(void);
+uint32_t time_us_32(void);
+
+bool add_repeating_timer_ms(int32_t delay_ms, repeating_timer_callback_t callback, void *user_data, repeating_timer_t *out);
+
+#endif // SIM_PICO_TIME_H
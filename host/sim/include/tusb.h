@@ -0,0 +1,120 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Stand-in for tinyusb's tusb.h, for the device simulator.
+//
+// Declares the parts of tinyusb's device stack, and its vendor class, that
+// the firmware uses, with the same signatures as the real thing.  They are
+// implemented by sim-usb.c, which models the vendor class's FIFOs and
+// endpoints, and the bus.  The firmware's tusb_config.h is used as is, so
+// the FIFO and endpoint buffer sizes are the firmware's.
+//
+
+#ifndef SIM_TUSB_H
+#define SIM_TUSB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define OPT_MCU_NONE          0
+#define OPT_OS_NONE           1
+#define OPT_MODE_DEVICE       0x0001
+#define OPT_MODE_FULL_SPEED   0x0000
+
+#ifndef CFG_TUSB_MCU
+#define CFG_TUSB_MCU          OPT_MCU_NONE
+#endif
+
+#include "tusb_config.h"
+
+typedef struct {
+    union {
+        struct {
+            uint8_t recipient : 5;
+            uint8_t type : 2;
+            uint8_t direction : 1;
+        } bmRequestType_bit;
+        uint8_t bmRequestType;
+    };
+    uint8_t bRequest;
+    uint16_t wValue;
+    uint16_t wIndex;
+    uint16_t wLength;
+} tusb_control_request_t;
+
+enum {
+    TUSB_DIR_OUT = 0,
+    TUSB_DIR_IN = 1,
+};
+
+enum {
+    TUSB_REQ_TYPE_STANDARD = 0,
+    TUSB_REQ_TYPE_CLASS,
+    TUSB_REQ_TYPE_VENDOR,
+};
+
+enum {
+    TUSB_REQ_RCPT_DEVICE = 0,
+    TUSB_REQ_RCPT_INTERFACE,
+};
+
+enum {
+    CONTROL_STAGE_IDLE,
+    CONTROL_STAGE_SETUP,
+    CONTROL_STAGE_DATA,
+    CONTROL_STAGE_ACK,
+};
+
+// Device stack
+bool tusb_init(void);
+void tud_task(void);
+bool tud_task_event_ready(void);
+bool tud_mounted(void);
+bool tud_control_xfer(uint8_t rhport, tusb_control_request_t const *request, void *buffer, uint16_t len);
+
+// Vendor class
+uint32_t tud_vendor_n_available(uint8_t itf);
+uint32_t tud_vendor_n_read(uint8_t itf, void *buffer, uint32_t bufsize);
+void tud_vendor_n_read_flush(uint8_t itf);
+uint32_t tud_vendor_n_write(uint8_t itf, void const *buffer, uint32_t bufsize);
+uint32_t tud_vendor_n_write_flush(uint8_t itf);
+uint32_t tud_vendor_n_write_available(uint8_t itf);
+
+static inline uint32_t tud_vendor_available(void) {
+    return tud_vendor_n_available(0);
+}
+
+static inline uint32_t tud_vendor_read(void *buffer, uint32_t bufsize) {
+    return tud_vendor_n_read(0, buffer, bufsize);
+}
+
+static inline void tud_vendor_read_flush(void) {
+    tud_vendor_n_read_flush(0);
+}
+
+static inline uint32_t tud_vendor_write(void const *buffer, uint32_t bufsize) {
+    return tud_vendor_n_write(0, buffer, bufsize);
+}
+
+static inline uint32_t tud_vendor_write_flush(void) {
+    return tud_vendor_n_write_flush(0);
+}
+
+static inline uint32_t tud_vendor_write_available(void) {
+    return tud_vendor_n_write_available(0);
+}
+
+// Callbacks, implemented by the firmware
+void tud_mount_cb(void);
+void tud_umount_cb(void);
+void tud_suspend_cb(bool remote_wakeup_en);
+void tud_resume_cb(void);
+void tud_vendor_rx_cb(uint8_t itf, uint8_t const *buffer, uint16_t bufsize);
+void tud_vendor_tx_cb(uint8_t itf, uint32_t sent_bytes);
+bool tud_vendor_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_request_t const *request);
+
+#endif // SIM_TUSB_H
@@ -0,0 +1,362 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Pico SDK stand-ins for the device simulator - see sim.h.
+//
+// Core 1 runs on its own thread, so the lock-free queues between the cores
+// are exercised for real.  But the threads take turns: each core hands over
+// to the other at the end of each pass of its loop - from
+// tight_loop_contents() or __wfe(), one of which event_wait() calls - and
+// whenever it spins in tight_loop_contents() waiting for the other.  This
+// keeps each run deterministic, even on a single CPU host.
+//
+// Simulated time only advances when core 0 hands over, by sim_loop_ns - so
+// a pass of both cores' loops is assumed to take sim_loop_ns, whatever work
+// it does.  A core asleep in __wfe() keeps handing over, without doing
+// anything, until its event flag is set.
+//
+// The hardware is driven from core 0's hand overs, once time has advanced:
+// the repeating timer's callback is called when it's due, as if from its
+// interrupt, the USB bus moves any packets due (sim_usb_tick()), and the
+// watchdog is checked.  An interrupt sets core 0's event flag.
+//
+// While core 1 has core 0 locked out (multicore_lockout_start_blocking()),
+// core 0's hand overs don't return to its code, as if it were spinning in
+// the SDK's lockout handler, with interrupts off - but time still advances,
+// and the hardware, bar the timer, and the host carry on.  Core 1 locks
+// core 0 out to erase or program the flash, which is a memory mapped file,
+// and core 1 spends as long in each operation as it would take on a Pico's
+// flash, in simulated time.
+//
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pico/stdlib.h"
+#include "pico/bootrom.h"
+#include "pico/multicore.h"
+#include "hardware/watchdog.h"
+#include "hardware/sync.h"
+#include "hardware/flash.h"
+#include "hardware/structs/scb.h"
+#include "bsp/board_api.h"
+#include "sim.h"
+
+_Thread_local uint sim_core_num = 0;
+
+uint32_t sim_loop_ns = 2000;
+sim_core_stats_t sim_core_stats;
+armv6m_scb_t sim_scb;
+
+// Each core's event flag, set by __sev() and cleared by __wfe()
+static _Atomic bool event_flag[2];
+
+// The repeating timer, if started
+static repeating_timer_t *timer;
+static uint64_t timer_due_ns;
+
+// The watchdog, checked by core 0
+static uint64_t watchdog_timeout_ns;
+static uint64_t watchdog_fed_ns;
+
+// Only core 0 advances the time, but core 1 reads it (log timestamps)
+static _Atomic uint64_t now_ns;
+
+// Whose turn it is to run, and whether core 1 is running at all
+static _Atomic uint turn;
+static _Atomic bool core1_running;
+
+// Whether core 0 can be, and is, locked out, and whether the calling core
+// has its interrupts off
+static bool lockout_victim;
+static _Atomic bool locked_out;
+static _Thread_local bool interrupts_off;
+
+// The flash, and how long it takes to erase a sector, and program a page
+// (typical figures for the Pico's W25Q16JV)
+uint8_t *sim_xip_base;
+sim_flash_stats_t sim_flash_stats;
+#define FLASH_ERASE_NS   45000000
+#define FLASH_PAGE_NS    400000
+
+static pthread_t core1_thread;
+static void (*core1_entry)(void);
+
+struct stdio_driver {
+    int unused;
+};
+stdio_driver_t stdio_uart;
+
+uint64_t sim_now_ns(void) {
+    return atomic_load_explicit(&now_ns, memory_order_relaxed);
+}
+
+uint64_t time_us_64(void) {
+    return sim_now_ns() / 1000;
+}
+
+uint32_t time_us_32(void) {
+    return (uint32_t)time_us_64();
+}
+
+// Give the turn to the other core, and wait for it to give it back
+static void hand_over(uint self) {
+    atomic_store_explicit(&turn, 1 - self, memory_order_release);
+    while (atomic_load_explicit(&turn, memory_order_acquire) != self) {
+        sched_yield();
+    }
+}
+
+void sim_irq(void) {
+    atomic_store(&event_flag[0], true);
+}
+
+// Run the hardware up to the current time, on core 0.  The timer's
+// interrupt waits while core 0 is locked out.
+static void run_hardware(void) {
+    uint64_t now = sim_now_ns();
+
+    if ((timer != NULL) && (now >= timer_due_ns) && !atomic_load(&locked_out)) {
+        timer_due_ns += (uint64_t)timer->delay_us * 1000;
+        if (!timer->callback(timer)) {
+            timer = NULL;
+        }
+        sim_irq();
+    }
+
+    if ((watchdog_timeout_ns > 0) && ((now - watchdog_fed_ns) > watchdog_timeout_ns)) {
+        fprintf(stderr, "sim: watchdog not fed for %llu ms - device would have rebooted\n",
+            (unsigned long long)((now - watchdog_fed_ns) / 1000000));
+        exit(1);
+    }
+
+    sim_usb_tick();
+}
+
+// Advance time by a pass of the loop, on core 0
+static void advance(void) {
+    atomic_store_explicit(&now_ns, sim_now_ns() + sim_loop_ns, memory_order_relaxed);
+    run_hardware();
+}
+
+void sim_tick(void) {
+    sim_core_stats.ticks[sim_core_num]++;
+    if (sim_core_num == 0) {
+        advance();
+        if (!atomic_load(&core1_running)) {
+            return;
+        }
+    }
+    hand_over(sim_core_num);
+
+    // Core 1 may have locked core 0 out during its turn
+    while ((sim_core_num == 0) && atomic_load(&locked_out)) {
+        sim_flash_stats.locked_out_ns += sim_loop_ns;
+        advance();
+        sim_usb_idle();
+        hand_over(0);
+    }
+}
+
+void tight_loop_contents(void) {
+    sim_tick();
+}
+
+void __sev(void) {
+    atomic_store(&event_flag[0], true);
+    atomic_store(&event_flag[1], true);
+}
+
+void __wfe(void) {
+    uint self = sim_core_num;
+
+    // The pass of the loop which got here takes its turn like any other
+    sim_tick();
+
+    while (!atomic_exchange(&event_flag[self], false)) {
+        sim_core_stats.asleep[self]++;
+        if (self == 0) {
+            // The host carries on while the device sleeps
+            sim_usb_idle();
+        }
+        sim_tick();
+    }
+}
+
+bool add_repeating_timer_ms(int32_t delay_ms, repeating_timer_callback_t callback, void *user_data, repeating_timer_t *out) {
+    if ((timer != NULL) || (delay_ms <= 0)) {
+        return false;
+    }
+    out->delay_us = (int64_t)delay_ms * 1000;
+    out->callback = callback;
+    out->user_data = user_data;
+    timer = out;
+    timer_due_ns = sim_now_ns() + ((uint64_t)delay_ms * 1000000);
+    return true;
+}
+
+static void *core1_main(void *arg) {
+    (void)arg;
+    sim_core_num = 1;
+
+    // Wait for core 0's first hand over
+    while (atomic_load_explicit(&turn, memory_order_acquire) != 1) {
+        sched_yield();
+    }
+    core1_entry();
+    return NULL;
+}
+
+void multicore_launch_core1(void (*entry)(void)) {
+    core1_entry = entry;
+    atomic_store(&turn, 0);
+    atomic_store(&core1_running, true);
+    if (pthread_create(&core1_thread, NULL, core1_main, NULL) != 0) {
+        fprintf(stderr, "sim: failed to start core 1\n");
+        exit(1);
+    }
+}
+
+// Core 1 is left waiting for a turn it will never get
+void multicore_reset_core1(void) {
+    atomic_store(&core1_running, false);
+}
+
+void multicore_lockout_victim_init(void) {
+    lockout_victim = true;
+}
+
+void multicore_lockout_start_blocking(void) {
+    if ((sim_core_num != 1) || !lockout_victim) {
+        fprintf(stderr, "sim: core 0 locked out by core %u, victim initialised %d\n", sim_core_num, lockout_victim);
+        exit(1);
+    }
+    atomic_store(&locked_out, true);
+}
+
+void multicore_lockout_end_blocking(void) {
+    atomic_store(&locked_out, false);
+}
+
+uint32_t save_and_disable_interrupts(void) {
+    uint32_t status = interrupts_off;
+
+    interrupts_off = true;
+    return status;
+}
+
+void restore_interrupts(uint32_t status) {
+    interrupts_off = (status != 0);
+}
+
+void sim_flash_open(const char *path) {
+    char tmp_path[] = "/tmp/device-sim-flash-XXXXXX";
+    struct stat st;
+    int fd;
+
+    if (path != NULL) {
+        fd = open(path, O_RDWR | O_CREAT, 0644);
+    } else {
+        fd = mkstemp(tmp_path);
+        if (fd >= 0) {
+            unlink(tmp_path);
+        }
+    }
+    if ((fd < 0) || (fstat(fd, &st) != 0) ||
+        ((st.st_size < PICO_FLASH_SIZE_BYTES) && (ftruncate(fd, PICO_FLASH_SIZE_BYTES) != 0))) {
+        fprintf(stderr, "sim: can't open flash file %s: %s\n", (path != NULL) ? path : tmp_path, strerror(errno));
+        exit(1);
+    }
+    sim_xip_base = mmap(NULL, PICO_FLASH_SIZE_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (sim_xip_base == MAP_FAILED) {
+        fprintf(stderr, "sim: can't map flash file: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    // Whatever the file didn't cover starts off erased
+    if (st.st_size < PICO_FLASH_SIZE_BYTES) {
+        memset(sim_xip_base + st.st_size, 0xff, PICO_FLASH_SIZE_BYTES - st.st_size);
+    }
+}
+
+// Flash can only be erased or programmed by core 1, with core 0 locked out
+// and interrupts off, within the flash, and aligned as the SDK requires
+static void check_flash_op(const char *op, uint32_t offset, size_t count, uint32_t align) {
+    if (!atomic_load(&locked_out) || !interrupts_off || (sim_core_num != 1) ||
+        ((offset % align) != 0) || ((count % align) != 0) ||
+        (offset > PICO_FLASH_SIZE_BYTES) || (count > (PICO_FLASH_SIZE_BYTES - offset))) {
+        fprintf(stderr, "sim: bad flash %s of %zu bytes at 0x%08x, core %u, locked out %d, interrupts off %d\n",
+            op, count, offset, sim_core_num, atomic_load(&locked_out), interrupts_off);
+        exit(1);
+    }
+}
+
+// Let ns of simulated time pass, on core 1, while core 0 is locked out
+static void flash_busy(uint64_t ns) {
+    uint64_t end = sim_now_ns() + ns;
+
+    while (sim_now_ns() < end) {
+        sim_tick();
+    }
+}
+
+void flash_range_erase(uint32_t flash_offs, size_t count) {
+    check_flash_op("erase", flash_offs, count, FLASH_SECTOR_SIZE);
+    memset(sim_xip_base + flash_offs, 0xff, count);
+    sim_flash_stats.erases += count / FLASH_SECTOR_SIZE;
+    flash_busy((uint64_t)(count / FLASH_SECTOR_SIZE) * FLASH_ERASE_NS);
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count) {
+    check_flash_op("program", flash_offs, count, FLASH_PAGE_SIZE);
+    for (size_t ii = 0; ii < count; ii++) {
+        sim_xip_base[flash_offs + ii] &= data[ii];
+    }
+    sim_flash_stats.pages += count / FLASH_PAGE_SIZE;
+    flash_busy((uint64_t)(count / FLASH_PAGE_SIZE) * FLASH_PAGE_NS);
+}
+
+void watchdog_enable(uint32_t delay_ms, bool pause_on_debug) {
+    (void)pause_on_debug;
+    watchdog_timeout_ns = (uint64_t)delay_ms * 1000000;
+    watchdog_fed_ns = sim_now_ns();
+}
+
+bool watchdog_caused_reboot(void) {
+    return false;
+}
+
+void watchdog_update(void) {
+    watchdog_fed_ns = sim_now_ns();
+}
+
+void reset_usb_boot(uint32_t usb_activity_gpio_pin_mask, uint32_t disable_interface_mask) {
+    (void)usb_activity_gpio_pin_mask;
+    (void)disable_interface_mask;
+    printf("sim: device rebooted into BOOTSEL mode\n");
+    exit(0);
+}
+
+bool stdio_init_all(void) {
+    return true;
+}
+
+void stdio_set_driver_enabled(stdio_driver_t *driver, bool enabled) {
+    (void)driver;
+    (void)enabled;
+}
+
+void board_init(void) {
+}
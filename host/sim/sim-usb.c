@@ -0,0 +1,452 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// tinyusb stand-in for the device simulator - see sim.h.
+//
+// Models the vendor class as tinyusb implements it:
+// - OUT: a transfer of up to CFG_TUD_VENDOR_EP_BUFSIZE bytes is armed on the
+//   OUT endpoint, which completes on a short packet or when the buffer is
+//   full.  Once tud_task() handles the completion the data is copied into
+//   the RX FIFO and tud_vendor_rx_cb() called.  The endpoint is only re-armed when there's room in the FIFO
+//   for a whole transfer - until then the host is NAKed.  Without an RX FIFO
+//   (CFG_TUD_VENDOR_RX_BUFSIZE 0), it's re-armed as soon as the callback
+//   returns.
+// - IN: tud_vendor_write() adds data to the TX FIFO, and once it holds a
+//   full packet starts a transfer of up to CFG_TUD_VENDOR_EP_BUFSIZE bytes
+//   from it, as does tud_vendor_write_flush().  Once tud_task() handles a
+//   transfer's completion tud_vendor_tx_cb() is called, and the next
+//   transfer started.  The
+//   firmware can also claim the IN endpoint and start a transfer on it
+//   itself (usbd_edpt_claim() and usbd_edpt_xfer()), which it does to send
+//   a zero length packet.
+//
+// Each vendor interface (CFG_TUD_VENDOR of them) has its own endpoints and
+// FIFOs.
+//
+// The host can reset the bus (sim_usb_reset()), which empties them all, and
+// unmounts and remounts the device.
+//
+// The bus is divided into evenly spaced slots, sim_packets_per_frame per
+// 1ms frame, each of which can carry one packet on any endpoint.  Endpoints
+// with a packet ready take turns, as with a host controller's round robin
+// scheduling of bulk endpoints.  Packets are moved as their slots pass
+// (sim_usb_tick()), as the USB controller does, whatever core 0 is doing.
+// A transfer completing raises an interrupt, and, as with tinyusb, leaves
+// its endpoint busy until tud_task() handles it and calls the firmware's
+// callback - so the firmware's callbacks are only ever called from its main
+// loop, as on the device.
+//
+
+#include "pico/stdlib.h"
+#include "tusb.h"
+#include "device/usbd_pvt.h"
+#include "include.h"
+#include "sim.h"
+
+uint32_t sim_packets_per_frame = 19;
+sim_bus_stats_t sim_bus_stats;
+
+static bool mount_pending;
+static bool mounted;
+static bool unmount_pending;
+
+// A vendor interface's endpoints and FIFOs
+typedef struct {
+    // OUT endpoint, and RX FIFO
+    uint8_t out_buf[CFG_TUD_VENDOR_EP_BUFSIZE];
+    uint32_t out_len;
+    bool out_armed;
+    bool out_done;
+#if CFG_TUD_VENDOR_RX_BUFSIZE > 0
+    uint8_t rx_fifo[CFG_TUD_VENDOR_RX_BUFSIZE];
+    uint32_t rx_head;
+    uint32_t rx_count;
+#endif
+
+    // IN endpoint, and TX FIFO
+    uint8_t in_buf[CFG_TUD_VENDOR_EP_BUFSIZE];
+    uint32_t in_len;
+    uint32_t in_sent;
+    bool in_busy;
+    bool in_claimed;
+    bool in_done;
+    uint8_t tx_fifo[CFG_TUD_VENDOR_TX_BUFSIZE];
+    uint32_t tx_head;
+    uint32_t tx_count;
+} vendor_t;
+
+static vendor_t vendors[CFG_TUD_VENDOR];
+
+// The next bus slot, and which endpoint gets first go at it - endpoint
+// (itf * 2) is an interface's OUT endpoint, and (itf * 2) + 1 its IN
+#define PIPE_COUNT  (CFG_TUD_VENDOR * 2)
+static uint64_t next_slot_ns;
+static uint32_t first_pipe;
+
+// Control transfer response, from tud_control_xfer()
+static uint8_t const *ctrl_data;
+static uint16_t ctrl_len;
+
+bool tusb_init(void) {
+    mount_pending = true;
+    return true;
+}
+
+bool tud_mounted(void) {
+    return mounted;
+}
+
+//
+// OUT
+//
+
+// Arm the OUT endpoint if there's room for a whole transfer
+static void prep_out(vendor_t *v) {
+#if CFG_TUD_VENDOR_RX_BUFSIZE > 0
+    if (!v->out_armed && ((CFG_TUD_VENDOR_RX_BUFSIZE - v->rx_count) >= CFG_TUD_VENDOR_EP_BUFSIZE)) {
+        v->out_armed = true;
+    }
+#else
+    v->out_armed = true;
+#endif
+}
+
+static void complete_out(uint8_t itf) {
+    vendor_t *v = &vendors[itf];
+    uint32_t len = v->out_len;
+
+    v->out_done = false;
+    v->out_len = 0;
+#if CFG_TUD_VENDOR_RX_BUFSIZE > 0
+    for (uint32_t ii = 0; ii < len; ii++) {
+        v->rx_fifo[(v->rx_head + v->rx_count + ii) % CFG_TUD_VENDOR_RX_BUFSIZE] = v->out_buf[ii];
+    }
+    v->rx_count += len;
+#endif
+    tud_vendor_rx_cb(itf, v->out_buf, (uint16_t)len);
+    prep_out(v);
+}
+
+uint32_t tud_vendor_n_available(uint8_t itf) {
+#if CFG_TUD_VENDOR_RX_BUFSIZE > 0
+    return vendors[itf].rx_count;
+#else
+    (void)itf;
+    return 0;
+#endif
+}
+
+uint32_t tud_vendor_n_read(uint8_t itf, void *buffer, uint32_t bufsize) {
+#if CFG_TUD_VENDOR_RX_BUFSIZE > 0
+    vendor_t *v = &vendors[itf];
+    uint8_t *dst = buffer;
+
+    if (bufsize > v->rx_count) {
+        bufsize = v->rx_count;
+    }
+    for (uint32_t ii = 0; ii < bufsize; ii++) {
+        dst[ii] = v->rx_fifo[v->rx_head];
+        v->rx_head = (v->rx_head + 1) % CFG_TUD_VENDOR_RX_BUFSIZE;
+    }
+    v->rx_count -= bufsize;
+    prep_out(v);
+    return bufsize;
+#else
+    (void)itf;
+    (void)buffer;
+    (void)bufsize;
+    return 0;
+#endif
+}
+
+void tud_vendor_n_read_flush(uint8_t itf) {
+#if CFG_TUD_VENDOR_RX_BUFSIZE > 0
+    vendor_t *v = &vendors[itf];
+
+    v->rx_head = 0;
+    v->rx_count = 0;
+    prep_out(v);
+#else
+    (void)itf;
+#endif
+}
+
+//
+// IN
+//
+
+uint32_t tud_vendor_n_write_flush(uint8_t itf) {
+    vendor_t *v = &vendors[itf];
+
+    if (!mounted || v->in_busy || v->in_claimed || (v->tx_count == 0)) {
+        return 0;
+    }
+
+    v->in_len = (v->tx_count < sizeof(v->in_buf)) ? v->tx_count : sizeof(v->in_buf);
+    for (uint32_t ii = 0; ii < v->in_len; ii++) {
+        v->in_buf[ii] = v->tx_fifo[v->tx_head];
+        v->tx_head = (v->tx_head + 1) % CFG_TUD_VENDOR_TX_BUFSIZE;
+    }
+    v->tx_count -= v->in_len;
+    v->in_sent = 0;
+    v->in_busy = true;
+    return v->in_len;
+}
+
+uint32_t tud_vendor_n_write(uint8_t itf, void const *buffer, uint32_t bufsize) {
+    vendor_t *v = &vendors[itf];
+    const uint8_t *src = buffer;
+    uint32_t space = CFG_TUD_VENDOR_TX_BUFSIZE - v->tx_count;
+
+    if (bufsize > space) {
+        bufsize = space;
+    }
+    for (uint32_t ii = 0; ii < bufsize; ii++) {
+        v->tx_fifo[(v->tx_head + v->tx_count + ii) % CFG_TUD_VENDOR_TX_BUFSIZE] = src[ii];
+    }
+    v->tx_count += bufsize;
+
+    // tinyusb starts sending by itself once it has a full packet
+    if (v->tx_count >= SIM_PACKET_SIZE) {
+        tud_vendor_n_write_flush(itf);
+    }
+    return bufsize;
+}
+
+uint32_t tud_vendor_n_write_available(uint8_t itf) {
+    return CFG_TUD_VENDOR_TX_BUFSIZE - vendors[itf].tx_count;
+}
+
+// Only the vendor IN endpoints are supported, and only for zero length
+// transfers
+static vendor_t *in_endpoint(uint8_t ep_addr) {
+    for (uint8_t itf = 0; itf < CFG_TUD_VENDOR; itf++) {
+        if (ep_addr == BULK_IN_ENDPOINT_N(itf)) {
+            return &vendors[itf];
+        }
+    }
+    return NULL;
+}
+
+bool usbd_edpt_claim(uint8_t rhport, uint8_t ep_addr) {
+    vendor_t *v = in_endpoint(ep_addr);
+
+    (void)rhport;
+    if ((v == NULL) || v->in_busy || v->in_claimed) {
+        return false;
+    }
+    v->in_claimed = true;
+    return true;
+}
+
+bool usbd_edpt_release(uint8_t rhport, uint8_t ep_addr) {
+    vendor_t *v = in_endpoint(ep_addr);
+
+    (void)rhport;
+    if ((v == NULL) || v->in_busy) {
+        return false;
+    }
+    v->in_claimed = false;
+    return true;
+}
+
+bool usbd_edpt_xfer(uint8_t rhport, uint8_t ep_addr, uint8_t *buffer, uint16_t total_bytes) {
+    vendor_t *v = in_endpoint(ep_addr);
+
+    (void)rhport;
+    (void)buffer;
+    if (!mounted || (v == NULL) || v->in_busy || (total_bytes != 0)) {
+        return false;
+    }
+    v->in_len = 0;
+    v->in_sent = 0;
+    v->in_busy = true;
+    return true;
+}
+
+//
+// Bus
+//
+
+static bool slot_out(uint8_t itf) {
+    vendor_t *v = &vendors[itf];
+    uint32_t len;
+
+    if (!host_out_pending(itf)) {
+        return false;
+    }
+    if (!v->out_armed) {
+        sim_bus_stats.nak_out++;
+        return false;
+    }
+
+    len = host_out_packet(itf, &v->out_buf[v->out_len]);
+    v->out_len += len;
+    sim_bus_stats.slots_out++;
+
+    // A short packet ends the host's transfer.  The endpoint isn't armed
+    // again until tud_task() has handled it.
+    if ((len < SIM_PACKET_SIZE) || (v->out_len == sizeof(v->out_buf))) {
+        v->out_armed = false;
+        v->out_done = true;
+        sim_irq();
+    }
+    return true;
+}
+
+static bool slot_in(uint8_t itf) {
+    vendor_t *v = &vendors[itf];
+    uint32_t len;
+
+    if (!host_in_pending(itf)) {
+        return false;
+    }
+    if (!v->in_busy || v->in_done) {
+        sim_bus_stats.nak_in++;
+        return false;
+    }
+
+    len = v->in_len - v->in_sent;
+    if (len > SIM_PACKET_SIZE) {
+        len = SIM_PACKET_SIZE;
+    }
+    host_in_packet(itf, &v->in_buf[v->in_sent], len);
+    v->in_sent += len;
+    sim_bus_stats.slots_in++;
+
+    if (v->in_sent == v->in_len) {
+        v->in_done = true;
+        sim_irq();
+    }
+    return true;
+}
+
+static void bus_slot(void) {
+    bool used = false;
+
+    for (uint32_t ii = 0; (ii < PIPE_COUNT) && !used; ii++) {
+        uint32_t pipe = (first_pipe + ii) % PIPE_COUNT;
+        uint8_t itf = (uint8_t)(pipe / 2);
+
+        used = (pipe & 1) ? slot_in(itf) : slot_out(itf);
+    }
+    first_pipe = (first_pipe + 1) % PIPE_COUNT;
+
+    if (!used) {
+        sim_bus_stats.slots_idle++;
+    }
+}
+
+void sim_usb_tick(void) {
+    uint64_t slot_ns = SIM_FRAME_NS / sim_packets_per_frame;
+
+    while (mounted && (next_slot_ns <= sim_now_ns())) {
+        bus_slot();
+        next_slot_ns += slot_ns;
+    }
+}
+
+void sim_usb_idle(void) {
+    host_poll();
+}
+
+// The bus stops at once, but, as with tinyusb, the endpoints and FIFOs are
+// only emptied once tud_task() handles the reset - so anything the firmware
+// writes before then is lost too
+void sim_usb_reset(void) {
+    unmount_pending = mounted;
+    mounted = false;
+    mount_pending = true;
+    sim_irq();
+}
+
+bool tud_task_event_ready(void) {
+    if (unmount_pending || mount_pending) {
+        return true;
+    }
+    for (int ii = 0; ii < CFG_TUD_VENDOR; ii++) {
+        if (vendors[ii].out_done || vendors[ii].in_done) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void tud_task(void) {
+    if (unmount_pending) {
+        // The host enumerates the device again before the next tud_task()
+        unmount_pending = false;
+        memset(vendors, 0, sizeof(vendors));
+        tud_umount_cb();
+        host_poll();
+        return;
+    }
+    if (mount_pending) {
+        mount_pending = false;
+        mounted = true;
+        for (int ii = 0; ii < CFG_TUD_VENDOR; ii++) {
+            prep_out(&vendors[ii]);
+        }
+        next_slot_ns = sim_now_ns();
+        tud_mount_cb();
+    }
+
+    // Handle the transfers the bus has completed
+    for (uint8_t itf = 0; itf < CFG_TUD_VENDOR; itf++) {
+        vendor_t *v = &vendors[itf];
+
+        if (v->out_done) {
+            complete_out(itf);
+        }
+        if (v->in_done) {
+            v->in_done = false;
+            v->in_busy = false;
+            v->in_claimed = false;
+            tud_vendor_tx_cb(itf, v->in_len);
+            tud_vendor_n_write_flush(itf);
+        }
+    }
+
+    host_poll();
+}
+
+//
+// Control transfers
+//
+
+bool tud_control_xfer(uint8_t rhport, tusb_control_request_t const *request, void *buffer, uint16_t len) {
+    (void)rhport;
+    ctrl_data = buffer;
+    ctrl_len = (len < request->wLength) ? len : request->wLength;
+    return true;
+}
+
+bool sim_control_in(uint8_t itf, uint8_t request, uint16_t value, uint8_t *buf, uint16_t len, uint16_t *actual) {
+    tusb_control_request_t req = {
+        .bmRequestType_bit = {
+            .recipient = TUSB_REQ_RCPT_INTERFACE,
+            .type = TUSB_REQ_TYPE_CLASS,
+            .direction = TUSB_DIR_IN,
+        },
+        .bRequest = request,
+        .wValue = value,
+        .wIndex = ITF_NUM_VENDOR + itf,
+        .wLength = len,
+    };
+
+    ctrl_data = NULL;
+    ctrl_len = 0;
+    if (!tud_vendor_control_xfer_cb(0, CONTROL_STAGE_SETUP, &req)) {
+        return false;
+    }
+    if (ctrl_data != NULL) {
+        memcpy(buf, ctrl_data, ctrl_len);
+    }
+    *actual = ctrl_len;
+    tud_vendor_control_xfer_cb(0, CONTROL_STAGE_ACK, &req);
+    return true;
+}
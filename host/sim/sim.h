@@ -0,0 +1,140 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Device simulator for the tinyusb vendor example.
+//
+// The firmware's own sources (src/main.c and friends) are compiled for the
+// host, against stand-ins for the Pico SDK and tinyusb headers in
+// host/sim/include, so that the protocol's performance can be measured, and
+// regressions caught, without a Pico:
+//
+// - sim-pico.c provides the Pico SDK functions.  Core 1 is a thread, run in
+//   lockstep with core 0 - each pass of core 0's main loop is followed by one
+//   pass of core 1's - and time is simulated, advancing by sim_loop_ns each
+//   pass, so results don't depend on how fast, or busy, the host is.  A core
+//   sleeping in __wfe() skips its passes until it is woken.
+//
+// - sim-usb.c provides tinyusb.  It models the vendor class's RX and TX
+//   FIFOs and endpoint buffers (sized from src/tusb_config.h), for each
+//   vendor interface, and a full speed bus, which carries at most
+//   sim_packets_per_frame 64 byte bulk packets per 1ms frame, evenly spaced,
+//   shared between the interfaces' endpoints in turn.  Packets are exchanged
+//   by the "hardware", whatever the firmware is doing, and a completed
+//   transfer raises an interrupt.  tinyusb's callbacks are called from
+//   tud_task(), as on the device.
+//
+// - device-sim.c is the host.  It sends a scripted workload of READ and
+//   WRITE commands, with up to a given number in flight, checks the
+//   responses, and reports throughput and per-command latency in simulated
+//   time.
+//
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Full speed USB
+#define SIM_FRAME_NS              1000000
+#define SIM_PACKET_SIZE           64
+
+// Simulation parameters, set before the firmware is started
+extern uint32_t sim_loop_ns;
+extern uint32_t sim_packets_per_frame;
+
+//
+// sim-pico.c
+//
+
+typedef struct {
+    uint64_t ticks[2];        // Turns each core has taken
+    uint64_t asleep[2];       // Turns each core spent asleep in __wfe()
+} sim_core_stats_t;
+
+extern sim_core_stats_t sim_core_stats;
+
+// Current simulated time
+uint64_t sim_now_ns(void);
+
+// Called by each core once per pass of its loop.  On core 0 this advances
+// simulated time, and runs the hardware, and then both cores wait for the
+// other to complete a pass.
+void sim_tick(void);
+
+// Raise an interrupt on core 0, waking it from __wfe()
+void sim_irq(void);
+
+typedef struct {
+    uint64_t erases;          // Sectors erased
+    uint64_t pages;           // Pages programmed
+    uint64_t locked_out_ns;   // Time core 0 spent locked out by core 1
+} sim_flash_stats_t;
+
+extern sim_flash_stats_t sim_flash_stats;
+
+// Back the flash (see hardware/flash.h) with the file at path, creating it,
+// erased, if need be - or, if path is NULL, with a temporary file.  Called
+// before the firmware is started.
+void sim_flash_open(const char *path);
+
+//
+// sim-usb.c
+//
+
+typedef struct {
+    uint64_t slots_out;       // Slots used for OUT packets
+    uint64_t slots_in;        // Slots used for IN packets
+    uint64_t slots_idle;      // Slots nothing was sent in
+    uint64_t nak_out;         // Times the host had an OUT packet but the device NAKed it
+    uint64_t nak_in;          // Times the host wanted an IN packet but the device had none
+} sim_bus_stats_t;
+
+extern sim_bus_stats_t sim_bus_stats;
+
+// Called from core 0's sim_tick(), once time has advanced, to move any
+// packets due on the bus
+void sim_usb_tick(void);
+
+// Called on core 0 for each turn it spends asleep, in place of tud_task(),
+// so the host carries on
+void sim_usb_idle(void);
+
+// Reset the bus, as the host.  As tinyusb does on a bus reset, the next
+// tud_task() empties every endpoint and FIFO - anything in them is lost, and
+// no callbacks are made for transfers in progress - and calls
+// tud_umount_cb().  The device is then mounted again, as the host
+// enumerates it, by the tud_task() after that.
+void sim_usb_reset(void);
+
+// Issue a class IN control request to vendor interface itf (from 0), as the
+// host.  Returns false if the device stalled it.
+bool sim_control_in(uint8_t itf, uint8_t request, uint16_t value, uint8_t *buf, uint16_t len, uint16_t *actual);
+
+//
+// device-sim.c - the host side of the bus.  itf is the vendor interface
+// (channel) the endpoint belongs to.
+//
+
+// Returns true if the host has a bulk OUT packet to send
+bool host_out_pending(uint8_t itf);
+
+// Fills buf with the next bulk OUT packet (at most SIM_PACKET_SIZE bytes),
+// and returns its length.  Only called if host_out_pending().
+uint32_t host_out_packet(uint8_t itf, uint8_t *buf);
+
+// Returns true if the host has a bulk IN transfer waiting for data
+bool host_in_pending(uint8_t itf);
+
+// Called with each bulk IN packet the device sends
+void host_in_packet(uint8_t itf, const uint8_t *buf, uint32_t len);
+
+// Called from each tud_task(), and while the device sleeps, to let the host
+// start commands and check for completion
+void host_poll(void);
+
+#endif // SIM_H
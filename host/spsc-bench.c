@@ -0,0 +1,282 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Host benchmark for src/spsc-queue.h - the lock-free queue used to pass
+// work, WRITE data and READ data between core 0 and core 1.
+//
+// Runs a producer and consumer thread, pinned to different CPUs if there are
+// at least two, and reports:
+// - throughput of single element push/pop, using the same element size as
+//   the firmware's work queue,
+// - throughput of a byte queue using the in place span functions, as the
+//   WRITE sink does, and
+// - round trip latency, by bouncing an element between two queues.
+//
+// Usage: spsc-bench [iterations]
+//
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "spsc-queue.h"
+
+// Match the firmware's work item and queue sizes
+typedef struct {
+    uint8_t type;
+    uint8_t proto;
+    uint8_t status;
+    uint8_t reserved;
+    uint32_t len;
+} item_t;
+
+#define ITEM_QUEUE_LEN  8
+#define BYTE_QUEUE_LEN  1024
+#define BYTE_CHUNK      64
+
+static uint64_t iterations = 10000000;
+
+// Set if there's only one CPU, so the threads can't spin waiting for each
+// other
+static int single_cpu;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void pin_to_cpu(int cpu) {
+    cpu_set_t set;
+    if (single_cpu) {
+        return;
+    }
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// Called while waiting for the other thread
+static inline void spin_wait(void) {
+    if (single_cpu) {
+        sched_yield();
+    }
+}
+
+//
+// Item throughput
+//
+
+static item_t item_storage[ITEM_QUEUE_LEN];
+static spsc_queue_t item_queue;
+
+static void *item_producer(void *arg) {
+    item_t item = { .type = 9 };
+    (void)arg;
+
+    pin_to_cpu(0);
+    for (uint64_t ii = 0; ii < iterations; ii++) {
+        item.len = (uint32_t)ii;
+        while (!spsc_push(&item_queue, &item)) {
+            spin_wait();
+        }
+    }
+    return NULL;
+}
+
+static void bench_items(void) {
+    pthread_t producer;
+    item_t item;
+    uint64_t start, elapsed;
+
+    spsc_init(&item_queue, item_storage, sizeof(item_t), ITEM_QUEUE_LEN);
+
+    start = now_ns();
+    pthread_create(&producer, NULL, item_producer, NULL);
+    pin_to_cpu(1);
+    for (uint64_t ii = 0; ii < iterations; ii++) {
+        while (!spsc_pop(&item_queue, &item)) {
+            spin_wait();
+        }
+        if (item.len != (uint32_t)ii) {
+            fprintf(stderr, "Item %llu out of order\n", (unsigned long long)ii);
+            exit(1);
+        }
+    }
+    elapsed = now_ns() - start;
+    pthread_join(producer, NULL);
+
+    printf("items:   %llu x %zu bytes, queue %d - %.1f Mitems/s, %.1f ns/item\n",
+        (unsigned long long)iterations, sizeof(item_t), ITEM_QUEUE_LEN,
+        (double)iterations * 1000.0 / elapsed,
+        (double)elapsed / iterations);
+}
+
+//
+// Byte throughput, using spans
+//
+
+static uint8_t byte_storage[BYTE_QUEUE_LEN];
+static spsc_queue_t byte_queue;
+static uint64_t byte_total;
+
+static void *byte_producer(void *arg) {
+    uint64_t produced = 0;
+    uint32_t len;
+    uint8_t *ptr;
+    (void)arg;
+
+    pin_to_cpu(0);
+    while (produced < byte_total) {
+        ptr = spsc_produce_span(&byte_queue, &len);
+        if (len == 0) {
+            spin_wait();
+            continue;
+        }
+        if (len > BYTE_CHUNK) {
+            len = BYTE_CHUNK;
+        }
+        for (uint32_t ii = 0; ii < len; ii++) {
+            ptr[ii] = (uint8_t)(produced + ii);
+        }
+        spsc_produce_commit(&byte_queue, len);
+        produced += len;
+    }
+    return NULL;
+}
+
+static void bench_bytes(void) {
+    pthread_t producer;
+    uint64_t consumed = 0;
+    uint64_t start, elapsed;
+    const uint8_t *ptr;
+    uint32_t len;
+
+    byte_total = iterations * 16;
+    spsc_init(&byte_queue, byte_storage, 1, BYTE_QUEUE_LEN);
+
+    start = now_ns();
+    pthread_create(&producer, NULL, byte_producer, NULL);
+    pin_to_cpu(1);
+    while (consumed < byte_total) {
+        ptr = spsc_consume_span(&byte_queue, &len);
+        if (len == 0) {
+            spin_wait();
+            continue;
+        }
+        for (uint32_t ii = 0; ii < len; ii++) {
+            if (ptr[ii] != (uint8_t)(consumed + ii)) {
+                fprintf(stderr, "Byte %llu corrupt\n", (unsigned long long)(consumed + ii));
+                exit(1);
+            }
+        }
+        spsc_consume_release(&byte_queue, len);
+        consumed += len;
+    }
+    elapsed = now_ns() - start;
+    pthread_join(producer, NULL);
+
+    printf("bytes:   %llu bytes, queue %d - %.1f MB/s\n",
+        (unsigned long long)byte_total, BYTE_QUEUE_LEN,
+        (double)byte_total * 1000.0 / elapsed);
+}
+
+//
+// Round trip latency
+//
+
+static item_t ping_storage[ITEM_QUEUE_LEN];
+static item_t pong_storage[ITEM_QUEUE_LEN];
+static spsc_queue_t ping_queue;
+static spsc_queue_t pong_queue;
+static uint64_t latency_iterations;
+
+static void *ponger(void *arg) {
+    item_t item;
+    (void)arg;
+
+    pin_to_cpu(0);
+    for (uint64_t ii = 0; ii < latency_iterations; ii++) {
+        while (!spsc_pop(&ping_queue, &item)) {
+            spin_wait();
+        }
+        while (!spsc_push(&pong_queue, &item)) {
+            spin_wait();
+        }
+    }
+    return NULL;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void bench_latency(void) {
+    pthread_t thread;
+    item_t item = { 0 };
+    uint64_t *samples;
+    uint64_t start;
+
+    latency_iterations = iterations / 10;
+    if (latency_iterations == 0) {
+        latency_iterations = 1;
+    }
+    samples = malloc(latency_iterations * sizeof(uint64_t));
+
+    spsc_init(&ping_queue, ping_storage, sizeof(item_t), ITEM_QUEUE_LEN);
+    spsc_init(&pong_queue, pong_storage, sizeof(item_t), ITEM_QUEUE_LEN);
+
+    pthread_create(&thread, NULL, ponger, NULL);
+    pin_to_cpu(1);
+    for (uint64_t ii = 0; ii < latency_iterations; ii++) {
+        start = now_ns();
+        spsc_push(&ping_queue, &item);
+        while (!spsc_pop(&pong_queue, &item)) {
+            spin_wait();
+        }
+        samples[ii] = now_ns() - start;
+    }
+    pthread_join(thread, NULL);
+
+    qsort(samples, latency_iterations, sizeof(uint64_t), compare_u64);
+    printf("latency: %llu round trips - p50 %llu ns, p99 %llu ns, p99.9 %llu ns, max %llu ns\n",
+        (unsigned long long)latency_iterations,
+        (unsigned long long)samples[latency_iterations / 2],
+        (unsigned long long)samples[(latency_iterations * 99) / 100],
+        (unsigned long long)samples[(latency_iterations * 999) / 1000],
+        (unsigned long long)samples[latency_iterations - 1]);
+    free(samples);
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        iterations = strtoull(argv[1], NULL, 0);
+        if (iterations == 0) {
+            fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    single_cpu = (sysconf(_SC_NPROCESSORS_ONLN) < 2);
+    if (single_cpu) {
+        printf("Only one CPU - results will be dominated by context switches\n");
+    }
+
+    bench_items();
+    bench_bytes();
+    bench_latency();
+
+    return 0;
+}
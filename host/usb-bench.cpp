@@ -0,0 +1,909 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Host benchmark for the tinyusb vendor example's bulk protocol.
+//
+// Unlike scripts/usbcmd/usbcmd.py, which does one synchronous transfer per
+// process, this opens the device once and uses libusb's asynchronous API to
+// keep a configurable number of commands in flight - the device accepts the
+// next command while earlier ones are still executing (see PROTOCOL.md).
+//
+// Each command is sent as a single bulk OUT transfer (the command, plus its
+// data for a WRITE), and its response - READ data, or a WRITE's status - is
+// received as a single bulk IN transfer.  Responses come back in command
+// order, so IN transfers are submitted in the same order as the commands.
+// OUT transfers which are a multiple of the packet size are ended with a
+// zero length packet, and IN transfers are given room for a packet more than
+// the response, so each ends on the response's short (or zero length)
+// packet rather than running on into the next response.
+//
+// A device built with several channels (VENDOR_CHANNELS) has a vendor
+// interface, and pair of bulk endpoints, per channel - -i selects which to
+// use, so that several instances can run at once, one per channel.
+//
+// The loop and echo workloads exercise the loopback modes (see
+// src/loopback.h): loop alternates PROTO_LOOPBACK WRITEs with READs of the
+// same size, and echo sends PROTO_LOOPBACK_STREAM WRITEs, each of which
+// gets two IN transfers - the data echoed back, and then the status.  Each
+// WRITE carries a different pattern of data, and the data which comes back
+// (or, for other READs, the device's 'x's) is checked.
+//
+// -g selects one of the device's READ test patterns (see src/pattern.h) in
+// place of the 'x's, generating the same pattern here to check READs
+// against, and -C uses PROTO_CRC, checking the CRC in each WRITE's status
+// against the CRC of the data sent.
+//
+// -k paces the READ, WRITE and mixed workloads by the device's flow control
+// credits (see src/credit.h), using PROTO_CREDIT commands.  A command's OUT
+// transfer is then sent in as many pieces as the credits allow - each WRITE
+// status brings new limits, and if they run out we ask for more with
+// CTRL_CREDITS.
+//
+// For each workload (READ, WRITE, mixed, loop or echo) and command size it
+// reports throughput, commands per second, per-command latency percentiles
+// (from submitting the command to receiving its last response - for an
+// echo, the full round trip) and error counts.
+//
+// Usage: usb-bench [options] - see usage() below.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <libusb.h>
+
+#include "pattern.h"
+
+namespace {
+
+// Must match src/include.h.  Channel n uses interface kInterface + n, and
+// endpoints kBulkIn + 2n and kBulkOut + 2n.
+constexpr uint16_t kVid = 0x1209;
+constexpr uint16_t kPid = 0x0f0f;
+constexpr int kInterface = 0;
+constexpr uint8_t kBulkIn = 0x83;
+constexpr uint8_t kBulkOut = 0x04;
+constexpr unsigned kMaxChannels = 6;
+constexpr uint32_t kPacketSize = 64;
+constexpr uint8_t kCtrlInit = 0x01;
+constexpr uint8_t kCtrlPattern = 0x0a;
+constexpr uint8_t kCtrlCredits = 0x0b;
+constexpr uint8_t kCtrlType = 0xa1;
+constexpr uint8_t kCmdRead = 8;
+constexpr uint8_t kCmdWrite = 9;
+constexpr uint8_t kProtoDefault = 16;
+constexpr uint8_t kProtoLarge = 17;
+constexpr uint8_t kProtoLoopback = 18;
+constexpr uint8_t kProtoLoopbackStream = 19;
+constexpr uint8_t kProtoCrc = 20;
+constexpr uint8_t kProtoCredit = 21;
+constexpr uint8_t kStatusReady = 2;
+
+enum class Workload { Read, Write, Mixed, Loop, Echo };
+
+struct Options {
+    Workload workload = Workload::Mixed;
+    bool all_workloads = true;
+    std::vector<uint32_t> sizes = {64, 512, 4096};
+    unsigned depth = 4;
+    unsigned count = 2000;
+    unsigned read_percent = 50;
+    unsigned timeout_ms = 2000;
+    bool large = false;
+    bool crc = false;
+    bool credit = false;
+    uint16_t pattern = PATTERN_X;   // CTRL_PATTERN wValue - pattern and seed
+    unsigned channel = 0;
+
+    int interface() const { return kInterface + (int)channel; }
+    uint8_t bulk_in() const { return (uint8_t)(kBulkIn + (2 * channel)); }
+    uint8_t bulk_out() const { return (uint8_t)(kBulkOut + (2 * channel)); }
+};
+
+using Clock = std::chrono::steady_clock;
+
+// Counts of everything that went wrong
+struct Errors {
+    unsigned transfer = 0;   // Transfer failed (stall, timeout, etc)
+    unsigned short_xfer = 0; // Received, or sent, fewer bytes than expected
+    unsigned overflow = 0;   // Received more bytes than expected
+    unsigned status = 0;     // WRITE status wasn't READY, or had the wrong length or CRC
+    unsigned data = 0;       // READ or echoed data wasn't as expected
+
+    unsigned total() const { return transfer + short_xfer + overflow + status + data; }
+};
+
+uint32_t get_u32(const uint8_t *buf) {
+    return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+class Bench;
+
+// One command in flight - its OUT and IN transfers and their buffers.  An
+// echo has a second IN transfer, for the echoed data, ahead of its status.
+struct Command {
+    Bench *bench = nullptr;
+    uint8_t type = 0;
+    uint8_t proto = 0;
+    uint8_t pattern = 0;     // First byte of the data sent, or expected back
+    uint32_t len = 0;
+    uint32_t in_len = 0;     // Expected response length
+    size_t header_len = 0;
+    size_t out_sent = 0;     // Bytes of out_buf submitted so far
+    Clock::time_point start;
+    bool out_busy = false;   // A piece of out_buf is being sent
+    bool out_done = false;
+    bool in_done = false;
+    bool echo_done = false;
+    libusb_transfer *out_xfer = nullptr;
+    libusb_transfer *in_xfer = nullptr;
+    libusb_transfer *echo_xfer = nullptr;
+    std::vector<uint8_t> out_buf;
+    std::vector<uint8_t> in_buf;
+    std::vector<uint8_t> echo_buf;
+
+    Command() {
+        out_xfer = libusb_alloc_transfer(0);
+        in_xfer = libusb_alloc_transfer(0);
+        echo_xfer = libusb_alloc_transfer(0);
+    }
+    ~Command() {
+        libusb_free_transfer(out_xfer);
+        libusb_free_transfer(in_xfer);
+        libusb_free_transfer(echo_xfer);
+    }
+
+    bool echo() const { return (type == kCmdWrite) && (proto == kProtoLoopbackStream); }
+    bool done() const { return out_done && in_done && echo_done; }
+
+    bool loopback() const { return (proto == kProtoLoopback) || (proto == kProtoLoopbackStream); }
+
+    // Returns true if data received is what this command expects - the
+    // pattern it (or, for a loopback READ, the WRITE before it) sent, or
+    // the next len bytes of the device's READ pattern, from gen.  The
+    // pattern is generated a word at a time, and each READ starts on a new
+    // word.
+    bool data_ok(const std::vector<uint8_t> &buf, pattern_gen_t &gen) const {
+        uint32_t word = 0;
+        bool ok = true;
+
+        for (uint32_t ii = 0; ii < len; ii++) {
+            uint8_t expected;
+            if (loopback()) {
+                expected = (uint8_t)(pattern + ii);
+            } else {
+                if ((ii % 4) == 0) {
+                    word = pattern_gen_next(&gen);
+                }
+                expected = (uint8_t)(word >> ((ii % 4) * 8));
+            }
+            if (buf[ii] != expected) {
+                ok = false;
+            }
+        }
+        return ok;
+    }
+    Command(const Command &) = delete;
+    Command &operator=(const Command &) = delete;
+};
+
+class Bench {
+public:
+    Bench(libusb_context *ctx, libusb_device_handle *handle, const Options &opts)
+        : ctx_(ctx), handle_(handle), opts_(opts), rng_(1) {
+        ctrl_xfer_ = libusb_alloc_transfer(0);
+    }
+    ~Bench() { libusb_free_transfer(ctrl_xfer_); }
+
+    // Run count commands of the given workload and size, and print results
+    bool run(Workload workload, uint32_t size);
+
+    Bench(const Bench &) = delete;
+    Bench &operator=(const Bench &) = delete;
+
+private:
+    static void LIBUSB_CALL out_cb(libusb_transfer *xfer);
+    static void LIBUSB_CALL in_cb(libusb_transfer *xfer);
+    static void LIBUSB_CALL echo_cb(libusb_transfer *xfer);
+    static void LIBUSB_CALL credit_cb(libusb_transfer *xfer);
+
+    bool submit(Command &cmd, uint8_t type, uint8_t proto, uint32_t len);
+    size_t out_allowed(const Command &cmd) const;
+    bool send_out(std::vector<std::unique_ptr<Command>> &cmds);
+    void credit_update(uint32_t command_limit, uint32_t byte_limit);
+    bool credit_poll();
+    static uint32_t crc32(const uint8_t *data, size_t len);
+    void complete(Command &cmd);
+    void report(const char *name, uint32_t size, double elapsed_s);
+
+    libusb_context *ctx_;
+    libusb_device_handle *handle_;
+    const Options &opts_;
+    std::mt19937 rng_;
+
+    // Per run state
+    unsigned submitted_ = 0;
+    unsigned completed_ = 0;
+    unsigned in_flight_ = 0;
+    uint8_t last_pattern_ = 0;
+    pattern_gen_t read_pattern_;   // Generates the data READs should return
+    uint64_t bytes_ = 0;
+    bool fatal_ = false;
+    Errors errors_;
+    std::vector<double> latencies_us_;
+    unsigned out_next_ = 0;   // Next command with OUT data still to send
+
+    // Flow control credits, with -k - the commands and bytes of WRITE data
+    // sent, and the limits the device has given us
+    struct {
+        uint32_t commands;
+        uint32_t bytes;
+        uint32_t command_limit;
+        uint32_t byte_limit;
+        unsigned polls;
+        bool polling;         // CTRL_CREDITS in flight
+    } credit_ = {};
+    libusb_transfer *ctrl_xfer_ = nullptr;
+    uint8_t ctrl_buf_[LIBUSB_CONTROL_SETUP_SIZE + 8];
+};
+
+void LIBUSB_CALL Bench::out_cb(libusb_transfer *xfer) {
+    Command &cmd = *static_cast<Command *>(xfer->user_data);
+    Bench &bench = *cmd.bench;
+
+    cmd.out_busy = false;
+    if (xfer->status != LIBUSB_TRANSFER_COMPLETED) {
+        bench.errors_.transfer++;
+    } else if (xfer->actual_length != xfer->length) {
+        bench.errors_.short_xfer++;
+    } else if (cmd.out_sent < cmd.out_buf.size()) {
+        // Waiting for credits to send the rest
+        return;
+    }
+    cmd.out_done = true;
+    if (cmd.done()) {
+        bench.complete(cmd);
+    }
+}
+
+void LIBUSB_CALL Bench::in_cb(libusb_transfer *xfer) {
+    Command &cmd = *static_cast<Command *>(xfer->user_data);
+    Bench &bench = *cmd.bench;
+    uint32_t status_data_len;
+    bool data_ok = true;
+
+    // Check READ data whatever else went wrong, so the pattern stays in step
+    // with the device's
+    if (cmd.type == kCmdRead) {
+        data_ok = cmd.data_ok(cmd.in_buf, bench.read_pattern_);
+    }
+
+    if (xfer->status != LIBUSB_TRANSFER_COMPLETED) {
+        bench.errors_.transfer++;
+    } else if ((uint32_t)xfer->actual_length < cmd.in_len) {
+        bench.errors_.short_xfer++;
+    } else if ((uint32_t)xfer->actual_length > cmd.in_len) {
+        bench.errors_.overflow++;
+    } else if (cmd.type == kCmdWrite) {
+        status_data_len = cmd.in_buf[1] | (cmd.in_buf[2] << 8);
+        if ((cmd.proto == kProtoLarge) || (cmd.proto == kProtoCrc) || (cmd.proto == kProtoCredit)) {
+            status_data_len |= (cmd.in_buf[3] << 16) | ((uint32_t)cmd.in_buf[4] << 24);
+        }
+        if (cmd.proto == kProtoCredit) {
+            bench.credit_update(get_u32(&cmd.in_buf[5]), get_u32(&cmd.in_buf[9]));
+        }
+        if ((cmd.in_buf[0] != kStatusReady) || (status_data_len != cmd.len)) {
+            bench.errors_.status++;
+        } else if (cmd.proto == kProtoCrc) {
+            if (get_u32(&cmd.in_buf[5]) != crc32(cmd.out_buf.data() + cmd.header_len, cmd.len)) {
+                bench.errors_.status++;
+            }
+        }
+    } else if (!data_ok) {
+        bench.errors_.data++;
+    }
+    cmd.in_done = true;
+    if (cmd.done()) {
+        bench.complete(cmd);
+    }
+}
+
+void LIBUSB_CALL Bench::echo_cb(libusb_transfer *xfer) {
+    Command &cmd = *static_cast<Command *>(xfer->user_data);
+    Bench &bench = *cmd.bench;
+
+    if (xfer->status != LIBUSB_TRANSFER_COMPLETED) {
+        bench.errors_.transfer++;
+    } else if ((uint32_t)xfer->actual_length < cmd.len) {
+        bench.errors_.short_xfer++;
+    } else if ((uint32_t)xfer->actual_length > cmd.len) {
+        bench.errors_.overflow++;
+    } else if (!cmd.data_ok(cmd.echo_buf, bench.read_pattern_)) {
+        bench.errors_.data++;
+    }
+    cmd.echo_done = true;
+    if (cmd.done()) {
+        bench.complete(cmd);
+    }
+}
+
+void LIBUSB_CALL Bench::credit_cb(libusb_transfer *xfer) {
+    Bench &bench = *static_cast<Bench *>(xfer->user_data);
+    const uint8_t *data = libusb_control_transfer_get_data(xfer);
+
+    bench.credit_.polling = false;
+    if (xfer->status == LIBUSB_TRANSFER_CANCELLED) {
+        // The run's over
+        return;
+    }
+    if ((xfer->status != LIBUSB_TRANSFER_COMPLETED) || (xfer->actual_length != 8)) {
+        bench.errors_.transfer++;
+        bench.fatal_ = true;
+        return;
+    }
+    bench.credit_update(get_u32(&data[0]), get_u32(&data[4]));
+    bench.credit_.polls++;
+}
+
+// Take new limits, unless we already have later ones - a status's limits
+// may be older than those from a CTRL_CREDITS sent after it left the device
+void Bench::credit_update(uint32_t command_limit, uint32_t byte_limit) {
+    if ((int32_t)(command_limit - credit_.command_limit) > 0) {
+        credit_.command_limit = command_limit;
+    }
+    if ((int32_t)(byte_limit - credit_.byte_limit) > 0) {
+        credit_.byte_limit = byte_limit;
+    }
+}
+
+// Ask for new credits, unless we already have
+bool Bench::credit_poll() {
+    if (credit_.polling) {
+        return true;
+    }
+    libusb_fill_control_setup(ctrl_buf_, kCtrlType, kCtrlCredits, 0, (uint16_t)opts_.interface(), 8);
+    libusb_fill_control_transfer(ctrl_xfer_, handle_, ctrl_buf_, credit_cb, this, opts_.timeout_ms);
+    if (libusb_submit_transfer(ctrl_xfer_) != 0) {
+        return false;
+    }
+    credit_.polling = true;
+    return true;
+}
+
+// How many bytes of the command's OUT transfer, from out_sent, the credits
+// let us send now - its header needs a command's credit, and its data a
+// byte's credit for each byte
+size_t Bench::out_allowed(const Command &cmd) const {
+    size_t allowed = 0;
+    size_t data;
+
+    if (!opts_.credit) {
+        return cmd.out_buf.size() - cmd.out_sent;
+    }
+
+    if (cmd.out_sent < cmd.header_len) {
+        if ((int32_t)(credit_.command_limit - (credit_.commands + 1)) < 0) {
+            return 0;
+        }
+        allowed = cmd.header_len - cmd.out_sent;
+    }
+
+    data = cmd.out_buf.size() - std::max(cmd.out_sent, cmd.header_len);
+    if ((int32_t)(credit_.byte_limit - credit_.bytes) > 0) {
+        allowed += std::min(data, (size_t)(credit_.byte_limit - credit_.bytes));
+    }
+    return allowed;
+}
+
+// Send as much of the submitted commands' OUT data, in order, as we can.
+// Each command has one OUT transfer, so one piece of it can be in flight at
+// once.  Without -k that's all of it, as soon as the command is submitted.
+bool Bench::send_out(std::vector<std::unique_ptr<Command>> &cmds) {
+    while (out_next_ < submitted_) {
+        Command &cmd = *cmds[out_next_ % opts_.depth];
+        size_t len;
+
+        if (cmd.out_busy) {
+            return true;
+        }
+        len = out_allowed(cmd);
+        if (len == 0) {
+            // Out of credits
+            return credit_poll();
+        }
+
+        libusb_fill_bulk_transfer(cmd.out_xfer, handle_, opts_.bulk_out(), cmd.out_buf.data() + cmd.out_sent,
+            (int)len, out_cb, &cmd, opts_.timeout_ms);
+        // Only the last piece needs ending - the device is still expecting
+        // the rest after any other
+        cmd.out_xfer->flags = ((cmd.out_sent + len) == cmd.out_buf.size()) ? LIBUSB_TRANSFER_ADD_ZERO_PACKET : 0;
+        if (libusb_submit_transfer(cmd.out_xfer) != 0) {
+            return false;
+        }
+        cmd.out_busy = true;
+
+        // Count what the credits were spent on
+        if (cmd.out_sent == 0) {
+            credit_.commands++;
+        }
+        credit_.bytes += (uint32_t)(cmd.out_sent + len - std::max(cmd.out_sent, cmd.header_len));
+        cmd.out_sent += len;
+
+        if (cmd.out_sent < cmd.out_buf.size()) {
+            return true;
+        }
+        out_next_++;
+    }
+    return true;
+}
+
+// The CRC-32 the device calculates (see src/crc32.h) - as zlib's crc32()
+uint32_t Bench::crc32(const uint8_t *data, size_t len) {
+    static uint32_t table[256];
+
+    if (table[1] == 0) {
+        for (uint32_t ii = 0; ii < 256; ii++) {
+            uint32_t value = ii;
+            for (int bit = 0; bit < 8; bit++) {
+                value = (value & 1) ? ((value >> 1) ^ 0xedb88320) : (value >> 1);
+            }
+            table[ii] = value;
+        }
+    }
+
+    uint32_t crc = 0xffffffff;
+    for (size_t ii = 0; ii < len; ii++) {
+        crc = table[(crc ^ data[ii]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+bool Bench::submit(Command &cmd, uint8_t type, uint8_t proto, uint32_t len) {
+    bool large = (proto == kProtoLarge) || (proto == kProtoCrc) || (proto == kProtoCredit);
+    size_t header_len = large ? 8 : 4;
+    size_t status_len = (proto == kProtoCredit) ? 13 : ((proto == kProtoCrc) ? 9 : (large ? 5 : 3));
+
+    cmd.bench = this;
+    cmd.type = type;
+    cmd.proto = proto;
+    cmd.len = len;
+    cmd.header_len = header_len;
+    cmd.out_sent = 0;
+    cmd.out_busy = false;
+    cmd.out_done = false;
+    cmd.in_done = false;
+    cmd.echo_done = !cmd.echo();
+
+    // Each WRITE sends a different pattern, and a loopback READ expects the
+    // last one back
+    if (type == kCmdWrite) {
+        last_pattern_ = (uint8_t)submitted_;
+    }
+    cmd.pattern = last_pattern_;
+
+    // The command, followed by the data for a WRITE.  Commands are framed by
+    // length, so they don't need their own transfer.
+    cmd.out_buf.resize(header_len + ((type == kCmdWrite) ? len : 0));
+    cmd.out_buf[0] = type;
+    cmd.out_buf[1] = proto;
+    if (large) {
+        cmd.out_buf[2] = 0;
+        cmd.out_buf[3] = 0;
+        for (int ii = 0; ii < 4; ii++) {
+            cmd.out_buf[4 + ii] = (uint8_t)(len >> (8 * ii));
+        }
+    } else {
+        cmd.out_buf[2] = (uint8_t)len;
+        cmd.out_buf[3] = (uint8_t)(len >> 8);
+    }
+    for (size_t ii = header_len; ii < cmd.out_buf.size(); ii++) {
+        cmd.out_buf[ii] = (uint8_t)(cmd.pattern + (ii - header_len));
+    }
+
+    // The response - READ data, or a WRITE's status - with room for a packet
+    // more.  An echo's data comes back first, in its own transfer.
+    cmd.in_len = (type == kCmdRead) ? len : (uint32_t)status_len;
+    cmd.in_buf.assign(((cmd.in_len / kPacketSize) + 1) * kPacketSize, 0);
+    if (cmd.echo()) {
+        cmd.echo_buf.assign(((len / kPacketSize) + 1) * kPacketSize, 0);
+    }
+
+    // The OUT transfer is sent by send_out()
+    libusb_fill_bulk_transfer(cmd.in_xfer, handle_, opts_.bulk_in(), cmd.in_buf.data(),
+        (int)cmd.in_buf.size(), in_cb, &cmd, opts_.timeout_ms);
+    libusb_fill_bulk_transfer(cmd.echo_xfer, handle_, opts_.bulk_in(), cmd.echo_buf.data(),
+        (int)cmd.echo_buf.size(), echo_cb, &cmd, opts_.timeout_ms);
+
+    cmd.start = Clock::now();
+    if (cmd.echo() && (libusb_submit_transfer(cmd.echo_xfer) != 0)) {
+        return false;
+    }
+    if (libusb_submit_transfer(cmd.in_xfer) != 0) {
+        if (cmd.echo()) {
+            libusb_cancel_transfer(cmd.echo_xfer);
+        }
+        return false;
+    }
+
+    submitted_++;
+    in_flight_++;
+    return true;
+}
+
+void Bench::complete(Command &cmd) {
+    auto elapsed = std::chrono::duration<double, std::micro>(Clock::now() - cmd.start);
+
+    latencies_us_.push_back(elapsed.count());
+    bytes_ += cmd.len;
+    completed_++;
+    in_flight_--;
+
+    if ((cmd.out_xfer->status != LIBUSB_TRANSFER_COMPLETED) ||
+        (cmd.in_xfer->status != LIBUSB_TRANSFER_COMPLETED) ||
+        (cmd.echo() && (cmd.echo_xfer->status != LIBUSB_TRANSFER_COMPLETED))) {
+        // After a failed transfer the device and host may disagree about
+        // where the next command starts - stop this run
+        fatal_ = true;
+    }
+}
+
+static double percentile(const std::vector<double> &sorted, double pct) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t index = (size_t)((pct / 100.0) * (double)(sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+void Bench::report(const char *name, uint32_t size, double elapsed_s) {
+    std::vector<double> sorted = latencies_us_;
+    std::sort(sorted.begin(), sorted.end());
+
+    printf("%-6s size %-7u depth %-2u cmds %-6u %9.1f KB/s %9.1f cmd/s  "
+        "latency us p50 %8.1f p99 %8.1f p999 %8.1f max %8.1f  errors %u (xfer %u short %u overflow %u status %u data %u)\n",
+        name, size, opts_.depth, completed_,
+        (elapsed_s > 0) ? (double)bytes_ / 1024.0 / elapsed_s : 0.0,
+        (elapsed_s > 0) ? (double)completed_ / elapsed_s : 0.0,
+        percentile(sorted, 50), percentile(sorted, 99), percentile(sorted, 99.9),
+        sorted.empty() ? 0.0 : sorted.back(),
+        errors_.total(), errors_.transfer, errors_.short_xfer, errors_.overflow, errors_.status,
+        errors_.data);
+
+    if (opts_.credit) {
+        printf("  credits: sent cmds %u bytes %u, limits cmds %u bytes %u, CTRL_CREDITS polls %u\n",
+            credit_.commands, credit_.bytes, credit_.command_limit, credit_.byte_limit, credit_.polls);
+    }
+}
+
+bool Bench::run(Workload workload, uint32_t size) {
+    static const char *names[] = {"READ", "WRITE", "MIXED", "LOOP", "ECHO"};
+    std::vector<std::unique_ptr<Command>> cmds;
+    std::uniform_int_distribution<unsigned> percent(0, 99);
+    uint8_t type;
+    uint8_t proto;
+    timeval tv = {0, 100000};
+
+    submitted_ = 0;
+    completed_ = 0;
+    in_flight_ = 0;
+    out_next_ = 0;
+    bytes_ = 0;
+    fatal_ = false;
+    errors_ = Errors();
+    latencies_us_.clear();
+    latencies_us_.reserve(opts_.count);
+    pattern_gen_init(&read_pattern_, (uint8_t)opts_.pattern, (uint8_t)(opts_.pattern >> 8));
+
+    // The run's first credits.  The device now knows we're pacing
+    // ourselves, so won't turn away WRITEs too big for its WRITE sink.
+    credit_ = {};
+    if (opts_.credit) {
+        uint8_t rsp[8];
+        int rc = libusb_control_transfer(handle_, kCtrlType, kCtrlCredits, 0, (uint16_t)opts_.interface(),
+            rsp, sizeof(rsp), 1000);
+        if (rc != (int)sizeof(rsp)) {
+            fprintf(stderr, "CTRL_CREDITS failed: %s\n", (rc < 0) ? libusb_error_name(rc) : "short response");
+            return false;
+        }
+        credit_update(get_u32(&rsp[0]), get_u32(&rsp[4]));
+    }
+
+    for (unsigned ii = 0; ii < opts_.depth; ii++) {
+        cmds.push_back(std::make_unique<Command>());
+    }
+
+    auto start = Clock::now();
+    while (!fatal_ && (completed_ < opts_.count)) {
+        // Keep depth commands in flight.  Commands complete in order, so
+        // the oldest is always the next to be free.
+        while ((submitted_ < opts_.count) && (in_flight_ < opts_.depth)) {
+            Command &cmd = *cmds[submitted_ % opts_.depth];
+            if (opts_.credit) {
+                proto = kProtoCredit;
+            } else {
+                proto = opts_.crc ? kProtoCrc : (opts_.large ? kProtoLarge : kProtoDefault);
+            }
+            switch (workload) {
+                case Workload::Read:
+                    type = kCmdRead;
+                    break;
+                case Workload::Write:
+                    type = kCmdWrite;
+                    break;
+                case Workload::Loop:
+                    type = ((submitted_ % 2) == 0) ? kCmdWrite : kCmdRead;
+                    proto = kProtoLoopback;
+                    break;
+                case Workload::Echo:
+                    type = kCmdWrite;
+                    proto = kProtoLoopbackStream;
+                    break;
+                default:
+                    type = (percent(rng_) < opts_.read_percent) ? kCmdRead : kCmdWrite;
+                    break;
+            }
+            if (!submit(cmd, type, proto, size)) {
+                fprintf(stderr, "Failed to submit transfer\n");
+                fatal_ = true;
+                break;
+            }
+        }
+        if (!fatal_ && !send_out(cmds)) {
+            fprintf(stderr, "Failed to submit transfer\n");
+            fatal_ = true;
+        }
+
+        libusb_handle_events_timeout_completed(ctx_, &tv, nullptr);
+    }
+
+    // Let anything still outstanding (after an error) finish or be cancelled.
+    // A command still waiting for credits to send its OUT data never will.
+    while ((in_flight_ > 0) || credit_.polling) {
+        if (credit_.polling) {
+            libusb_cancel_transfer(ctrl_xfer_);
+        }
+        for (auto &cmd : cmds) {
+            if (cmd->out_busy) {
+                libusb_cancel_transfer(cmd->out_xfer);
+            } else if (!cmd->out_done && cmd->in_done && cmd->echo_done) {
+                cmd->out_done = true;
+                complete(*cmd);
+            }
+            if (!cmd->in_done) {
+                libusb_cancel_transfer(cmd->in_xfer);
+            }
+            if (!cmd->echo_done) {
+                libusb_cancel_transfer(cmd->echo_xfer);
+            }
+        }
+        libusb_handle_events_timeout_completed(ctx_, &tv, nullptr);
+    }
+    double elapsed_s = std::chrono::duration<double>(Clock::now() - start).count();
+
+    report(names[(int)workload], size, elapsed_s);
+    return !fatal_;
+}
+
+// Ask the device to reset the channel's protocol handling, so a previous run
+// (or failure) can't leave it part way through a command, and select the
+// READ pattern, which restarts it
+bool init_device(libusb_device_handle *handle, const Options &opts) {
+    uint8_t rsp[8];
+    int rc = libusb_control_transfer(handle, kCtrlType, kCtrlInit, 0, (uint16_t)opts.interface(),
+        rsp, sizeof(rsp), 1000);
+    if (rc < 0) {
+        fprintf(stderr, "CTRL_INIT failed: %s\n", libusb_error_name(rc));
+        return false;
+    }
+    rc = libusb_control_transfer(handle, kCtrlType, kCtrlPattern, opts.pattern, (uint16_t)opts.interface(),
+        rsp, 1, 1000);
+    if (rc < 0) {
+        fprintf(stderr, "CTRL_PATTERN failed: %s\n", libusb_error_name(rc));
+        return false;
+    }
+
+    // Throw away anything left over in the host's or device's buffers
+    libusb_clear_halt(handle, opts.bulk_in());
+    libusb_clear_halt(handle, opts.bulk_out());
+    return true;
+}
+
+void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  -w WORKLOAD          read, write, mixed, loop or echo (default: the first three)\n"
+        "  -s SIZES             Comma separated command data sizes in bytes (default: 64,512,4096)\n"
+        "  -d DEPTH             Commands in flight (default: 4)\n"
+        "  -n COUNT             Commands per run (default: 2000)\n"
+        "  -r PERCENT           Percentage of READs in the mixed workload (default: 50)\n"
+        "  -t MS                Transfer timeout (default: 2000)\n"
+        "  -i CHANNEL           Channel (vendor interface) to use (default: 0)\n"
+        "  -l                   Use PROTO_LARGE (32-bit length) commands\n"
+        "  -C                   Use PROTO_CRC commands, and check WRITE data CRCs\n"
+        "  -k                   Pace commands by the device's credits, using PROTO_CREDIT commands\n"
+        "  -g PATTERN[:SEED]    READ pattern - x, counter, prbs31 or lfsr (default: x)\n",
+        prog);
+}
+
+// Parse -g's PATTERN[:SEED] into a CTRL_PATTERN wValue
+bool parse_pattern(const std::string &arg, Options &opts) {
+    static const char *names[PATTERN_COUNT] = {"x", "counter", "prbs31", "lfsr"};
+    size_t colon = arg.find(':');
+    std::string name = arg.substr(0, colon);
+    unsigned long seed = 0;
+
+    if (colon != std::string::npos) {
+        seed = strtoul(arg.c_str() + colon + 1, nullptr, 0);
+        if (seed > 0xff) {
+            return false;
+        }
+    }
+    for (uint16_t ii = 0; ii < PATTERN_COUNT; ii++) {
+        if (name == names[ii]) {
+            opts.pattern = (uint16_t)(ii | (seed << 8));
+            return true;
+        }
+    }
+    return false;
+}
+
+bool parse_args(int argc, char **argv, Options &opts) {
+    for (int ii = 1; ii < argc; ii++) {
+        std::string arg = argv[ii];
+        const char *val = ((ii + 1) < argc) ? argv[ii + 1] : nullptr;
+
+        if (arg == "-l") {
+            opts.large = true;
+            continue;
+        }
+        if (arg == "-C") {
+            opts.crc = true;
+            continue;
+        }
+        if (arg == "-k") {
+            opts.credit = true;
+            continue;
+        }
+        if (val == nullptr) {
+            return false;
+        }
+        ii++;
+
+        if (arg == "-w") {
+            std::string w = val;
+            opts.all_workloads = false;
+            if (w == "read") {
+                opts.workload = Workload::Read;
+            } else if (w == "write") {
+                opts.workload = Workload::Write;
+            } else if (w == "mixed") {
+                opts.workload = Workload::Mixed;
+            } else if (w == "loop") {
+                opts.workload = Workload::Loop;
+            } else if (w == "echo") {
+                opts.workload = Workload::Echo;
+            } else {
+                return false;
+            }
+        } else if (arg == "-s") {
+            opts.sizes.clear();
+            for (char *tok = strtok(argv[ii], ","); tok != nullptr; tok = strtok(nullptr, ",")) {
+                opts.sizes.push_back((uint32_t)strtoul(tok, nullptr, 0));
+            }
+        } else if (arg == "-d") {
+            opts.depth = (unsigned)strtoul(val, nullptr, 0);
+        } else if (arg == "-n") {
+            opts.count = (unsigned)strtoul(val, nullptr, 0);
+        } else if (arg == "-r") {
+            opts.read_percent = (unsigned)strtoul(val, nullptr, 0);
+        } else if (arg == "-t") {
+            opts.timeout_ms = (unsigned)strtoul(val, nullptr, 0);
+        } else if (arg == "-i") {
+            opts.channel = (unsigned)strtoul(val, nullptr, 0);
+        } else if (arg == "-g") {
+            if (!parse_pattern(val, opts)) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+
+    if ((opts.depth == 0) || opts.sizes.empty() || (opts.read_percent > 100) ||
+        (opts.channel >= kMaxChannels)) {
+        return false;
+    }
+    if (opts.credit && (opts.crc || (opts.workload == Workload::Loop) || (opts.workload == Workload::Echo))) {
+        // Only PROTO_CREDIT statuses carry credits, and the loop and echo
+        // workloads need their own protocols
+        fprintf(stderr, "-k can't be used with -C, or the loop and echo workloads\n");
+        return false;
+    }
+    for (uint32_t size : opts.sizes) {
+        if (size == 0) {
+            // A zero length READ gets no response at all
+            fprintf(stderr, "Sizes must be non-zero\n");
+            return false;
+        }
+        if (!opts.large && !opts.crc && !opts.credit && (size > 0xffff)) {
+            fprintf(stderr, "Sizes over 65535 need -l, -C or -k\n");
+            return false;
+        }
+        if (((opts.workload == Workload::Loop) || (opts.workload == Workload::Echo)) && (size > 0xffff)) {
+            // Loopback commands always have a 16-bit length
+            fprintf(stderr, "Loopback sizes must be at most 65535\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Options opts;
+    libusb_context *ctx = nullptr;
+    libusb_device_handle *handle = nullptr;
+    int rc;
+    int result = 0;
+
+    if (!parse_args(argc, argv, opts)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    rc = libusb_init(&ctx);
+    if (rc != 0) {
+        fprintf(stderr, "libusb_init failed: %s\n", libusb_error_name(rc));
+        return 1;
+    }
+
+    handle = libusb_open_device_with_vid_pid(ctx, kVid, kPid);
+    if (handle == nullptr) {
+        fprintf(stderr, "Device %04x:%04x not found\n", kVid, kPid);
+        libusb_exit(ctx);
+        return 1;
+    }
+    libusb_set_auto_detach_kernel_driver(handle, 1);
+
+    rc = libusb_claim_interface(handle, opts.interface());
+    if (rc != 0) {
+        fprintf(stderr, "Failed to claim interface: %s\n", libusb_error_name(rc));
+        result = 1;
+    } else {
+        Bench bench(ctx, handle, opts);
+        std::vector<Workload> workloads;
+
+        if (opts.all_workloads) {
+            workloads = {Workload::Read, Workload::Write, Workload::Mixed};
+        } else {
+            workloads = {opts.workload};
+        }
+
+        for (Workload workload : workloads) {
+            for (uint32_t size : opts.sizes) {
+                if (!init_device(handle, opts) || !bench.run(workload, size)) {
+                    result = 1;
+                }
+            }
+        }
+
+        libusb_release_interface(handle, opts.interface());
+    }
+
+    libusb_close(handle);
+    libusb_exit(ctx);
+    return result;
+}
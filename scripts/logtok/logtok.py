@@ -0,0 +1,271 @@
+#!/usr/bin/env python3
+
+#
+# Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+#
+# Licensed under MIT license - see https://opensource.org/licenses/MIT
+#
+
+#
+# Tokenized log support for tinyusb-vendor-example.
+#
+# When built with -DLOG_TOKENIZED=ON, the firmware doesn't output log
+# format strings.  Instead each log call is identified by a token - a hash
+# of its format string, calculated at compile time (see src/log.h) - and the
+# firmware outputs the token and the raw argument values, as a base64 line
+# starting with '$'.
+#
+# This script:
+# - dict   - builds the token dictionary from the source files (run by the
+#            build - see CMakeLists.txt),
+# - decode - turns a UART capture back into readable text, using the
+#            dictionary, and
+# - header - generates src/log-token-hash.h, which implements the hash in C.
+#
+
+import argparse
+import ast
+import base64
+import re
+import sys
+
+# Must match LOG_TOKEN_HASH_LEN in src/log-token-hash.h - characters after
+# this many don't affect the token
+HASH_LEN = 128
+HASH_COEFFICIENT = 65599
+
+# Format of the binary record inside each '$' line (all little-endian):
+# byte 0      - core number (high nibble), number of arguments (low nibble)
+# bytes 1-4   - token
+# varint      - microseconds since the previous record
+# per argument, a varint, or for a string argument a varint length followed
+# by that many bytes
+
+def token_hash(fmt: bytes) -> int:
+    """Calculate the token for a format string, as LOG_TOKEN() does."""
+    hash = len(fmt)
+    coefficient = HASH_COEFFICIENT
+    for c in fmt[:HASH_LEN]:
+        hash = (hash + coefficient * c) & 0xffffffff
+        coefficient = (coefficient * HASH_COEFFICIENT) & 0xffffffff
+    return hash
+
+#
+# dict
+#
+
+# A log call, up to the start of its format string
+LOG_CALL_RE = re.compile(r'\b(?:INFO|DEBUG|LOG)\(\s*(?=")')
+
+# A C string literal, and the whitespace/comments between adjacent ones
+STRING_RE = re.compile(r'"((?:[^"\\\n]|\\.)*)"')
+BETWEEN_RE = re.compile(r'(?:\s|//[^\n]*\n|/\*.*?\*/)*', re.DOTALL)
+
+def find_formats(source: str):
+    """Yield the format string of each log call in C source."""
+    for call in LOG_CALL_RE.finditer(source):
+        pos = call.end()
+        pieces = []
+        while True:
+            match = STRING_RE.match(source, pos)
+            if not match:
+                break
+            pieces.append(match.group(1))
+            pos = BETWEEN_RE.match(source, match.end()).end()
+        # C and Python escapes are the same for anything we're likely to log
+        yield ast.literal_eval('"' + ''.join(pieces) + '"').encode('latin-1')
+
+def do_dict(args):
+    tokens = {}
+    for filename in args.sources:
+        with open(filename, 'r', encoding='utf-8') as f:
+            source = f.read()
+        for fmt in find_formats(source):
+            token = token_hash(fmt)
+            if (token in tokens) and (tokens[token] != fmt):
+                print(f"Token collision 0x{token:08x}: {tokens[token]!r} and {fmt!r}", file=sys.stderr)
+                return 1
+            tokens[token] = fmt
+
+    with open(args.output, 'w', encoding='utf-8') as f:
+        for token, fmt in sorted(tokens.items()):
+            # Escape the format string the same way C would have it
+            escaped = fmt.decode('latin-1').encode('unicode_escape').decode('ascii')
+            f.write(f"{token:08x},{escaped}\n")
+    return 0
+
+#
+# decode
+#
+
+# A printf conversion specification
+CONVERSION_RE = re.compile(r'%([-+ #0]*)(\d+)?(?:\.(\d+))?(?:hh|h|ll|l|z|j|t)?([diouxXcsp%])')
+
+def load_dict(filename: str) -> dict:
+    tokens = {}
+    with open(filename, 'r', encoding='utf-8') as f:
+        for line in f:
+            line = line.rstrip('\n')
+            if not line:
+                continue
+            token, escaped = line.split(',', 1)
+            tokens[int(token, 16)] = escaped.encode('ascii').decode('unicode_escape')
+    return tokens
+
+def read_varint(data: bytes, pos: int):
+    value = 0
+    shift = 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7f) << shift
+        shift += 7
+        if not (byte & 0x80):
+            return value, pos
+
+def format_record(fmt: str, args: list) -> str:
+    """printf() fmt with args, which are ints, or bytes for %s arguments."""
+    out = []
+    pos = 0
+    arg_iter = iter(args)
+    for conv in CONVERSION_RE.finditer(fmt):
+        out.append(fmt[pos:conv.start()])
+        pos = conv.end()
+        flags, width, precision, kind = conv.groups()
+        if kind == '%':
+            out.append('%')
+            continue
+        value = next(arg_iter, None)
+        if value is None:
+            out.append('<missing>')
+            continue
+        if kind == 's':
+            value = value.decode('latin-1') if isinstance(value, bytes) else f"<0x{value:08x}>"
+        elif kind in 'di':
+            if value >= 0x80000000:
+                value -= 0x100000000
+        elif kind == 'p':
+            kind = 'x'
+            flags = '#'
+        elif kind == 'u':
+            kind = 'd'
+        spec = '%' + flags + (width or '') + ('.' + precision if precision else '') + kind
+        out.append(spec % value)
+    out.append(fmt[pos:])
+    return ''.join(out)
+
+def decode_line(tokens: dict, state: dict, line: str) -> str:
+    """Decode one '$' line from the firmware."""
+    data = base64.b64decode(line[1:])
+    core = data[0] >> 4
+    nargs = data[0] & 0xf
+    token = int.from_bytes(data[1:5], 'little')
+    delta, pos = read_varint(data, 5)
+    state['time_us'] = (state['time_us'] + delta) & 0xffffffff
+
+    fmt = tokens.get(token)
+    if fmt is None:
+        return f"{state['time_us']:10d} core{core}: <unknown token 0x{token:08x}>"
+
+    # We need the format string to know which arguments are strings
+    kinds = [conv.group(4) for conv in CONVERSION_RE.finditer(fmt) if conv.group(4) != '%']
+    args = []
+    for ii in range(nargs):
+        if (ii < len(kinds)) and (kinds[ii] == 's'):
+            length, pos = read_varint(data, pos)
+            args.append(data[pos:pos + length])
+            pos += length
+        else:
+            value, pos = read_varint(data, pos)
+            args.append(value)
+
+    return f"{state['time_us']:10d} core{core}: {format_record(fmt, args)}"
+
+def do_decode(args):
+    tokens = load_dict(args.dict)
+    state = {'time_us': 0}
+
+    infile = sys.stdin if args.input == '-' else open(args.input, 'r', encoding='latin-1', errors='replace')
+    try:
+        for line in infile:
+            line = line.rstrip('\r\n')
+            if line.startswith('$'):
+                try:
+                    line = decode_line(tokens, state, line)
+                except (ValueError, IndexError) as e:
+                    line = f"<corrupt record {line!r}: {e}>"
+            # Anything else the firmware printed passes straight through
+            print(line, flush=args.follow)
+    finally:
+        if infile is not sys.stdin:
+            infile.close()
+    return 0
+
+#
+# header
+#
+
+def do_header(args):
+    lines = [
+        '//',
+        '// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>',
+        '//',
+        '// Licensed under MIT license - see https://opensource.org/licenses/MIT',
+        '//',
+        '',
+        '//',
+        '// Generated by scripts/logtok/logtok.py header - do not edit.',
+        '//',
+        '// LOG_TOKEN(s) calculates the token for string literal s at compile time.',
+        '// It must match token_hash() in logtok.py.',
+        '//',
+        '',
+        '#ifndef LOG_TOKEN_HASH_H',
+        '#define LOG_TOKEN_HASH_H',
+        '',
+        '#include <stdint.h>',
+        '',
+        f'#define LOG_TOKEN_HASH_LEN  {HASH_LEN}',
+        '',
+        '#define LOG_HASH_TERM(s, i, k) \\',
+        '    (((i) < sizeof(s) - 1) ? (uint32_t)(k) * (uint8_t)(s)[((i) < sizeof(s) - 1) ? (i) : 0] : 0)',
+        '',
+        '#define LOG_TOKEN(s) ((uint32_t)(sizeof(s) - 1) \\',
+    ]
+    coefficient = HASH_COEFFICIENT
+    for ii in range(HASH_LEN):
+        end = ')' if ii == HASH_LEN - 1 else ' \\'
+        lines.append(f'    + LOG_HASH_TERM(s, {ii}, 0x{coefficient:08x}u){end}')
+        coefficient = (coefficient * HASH_COEFFICIENT) & 0xffffffff
+    lines += ['', '#endif // LOG_TOKEN_HASH_H', '']
+
+    with open(args.output, 'w', encoding='utf-8') as f:
+        f.write('\n'.join(lines))
+    return 0
+
+def main():
+    parser = argparse.ArgumentParser(description='Tokenized log tool for tinyusb-vendor-example')
+    subparsers = parser.add_subparsers(dest='command', required=True, help='Command to execute')
+
+    dict_parser = subparsers.add_parser('dict', help='Build the token dictionary from source files')
+    dict_parser.add_argument('-o', '--output', required=True, help='Dictionary file to write')
+    dict_parser.add_argument('sources', nargs='+', help='Source files to scan')
+
+    decode_parser = subparsers.add_parser('decode', help='Decode a UART capture')
+    decode_parser.add_argument('-d', '--dict', required=True, help='Dictionary file, from the build directory')
+    decode_parser.add_argument('-f', '--follow', action='store_true', help='Flush after each line, for live captures')
+    decode_parser.add_argument('input', nargs='?', default='-', help='Capture file, or - for stdin (default)')
+
+    header_parser = subparsers.add_parser('header', help='Generate the C token hash header')
+    header_parser.add_argument('-o', '--output', required=True, help='Header file to write')
+
+    args = parser.parse_args()
+    if args.command == 'dict':
+        return do_dict(args)
+    elif args.command == 'decode':
+        return do_decode(args)
+    else:
+        return do_header(args)
+
+if __name__ == '__main__':
+    sys.exit(main())
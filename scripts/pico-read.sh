@@ -1,7 +1,11 @@
 #!/bin/bash
 
+# Both steps run over one claimed handle (see usbcmd.py batch)
+usbcmd/usbcmd.py -v 0x1209 -p 0x0f0f batch <<EOF
 # 0x08 is READ, 0x10 is protocol, 0x40 | (0x00 << 8) is amount of data to read
-usbcmd/usbcmd.py -v 0x1209 -p 0x0f0f bulk out 0x04 -d 0x08104000
+bulk out 0x04 -d 0x08104000
 
-# Read in the 0x40 (64) bytes expected
-usbcmd/usbcmd.py -v 0x1209 -p 0x0f0f bulk in 0x83 -l 0x40
+# Read in the 0x40 (64) bytes expected, plus room for the zero length packet
+# which follows
+bulk in 0x83 -l 0x80
+EOF
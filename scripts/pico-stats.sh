@@ -0,0 +1,7 @@
+#!/bin/bash
+
+# Prints the device's performance counters, and resets them, so running this
+# again shows the counts since the last run.
+#
+# Add -i 1 to poll the counters every second and print rates instead.
+usbcmd/usbcmd.py -v 0x1209 -p 0x0f0f stats -r "$@"
@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+
+#
+# Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+#
+# Licensed under MIT license - see https://opensource.org/licenses/MIT
+#
+
+#
+# Flight recorder dump converter for tinyusb-vendor-example.
+#
+# The firmware records its last few hundred events on each core - see
+# src/trace.h - and returns them with the CTRL_TRACE control request, which
+# `usbcmd.py trace` (or host/sim/device-sim -T) saves to a file.  This script
+# turns that dump into Chrome trace event JSON, for viewing as a timeline in
+# https://ui.perfetto.dev or chrome://tracing: a track per core, with
+# tud_vendor_rx_cb() calls as spans, and everything else as instants, each
+# with its channel and arguments.
+#
+# Times are microseconds since the device booted, as in its log output.
+#
+
+import argparse
+import json
+import struct
+import sys
+
+# Must match src/trace.h
+TRACE_VERSION = 1
+HEADER = struct.Struct('<BBHHHQ')
+ENTRY = struct.Struct('<IBBHI')
+NO_CHAN = 0xff
+
+# trace_event_t, in order
+EVENTS = [
+    'none',
+    'rx_cb_enter',
+    'rx_cb_exit',
+    'command',
+    'vendor_write',
+    'tx_cb',
+    'status',
+    'suspend',
+    'resume',
+    'mount',
+    'unmount',
+]
+
+# Command types, protocols and statuses - see src/include.h
+COMMANDS = {8: 'READ', 9: 'WRITE'}
+PROTOCOLS = {
+    16: 'DEFAULT', 17: 'LARGE', 18: 'LOOPBACK', 19: 'LOOPBACK_STREAM', 20: 'CRC',
+    21: 'CREDIT', 22: 'BATCH', 23: 'NOACK', 24: 'RESUME', 25: 'STORE',
+}
+STATUSES = {1: 'BUSY', 2: 'READY', 3: 'ERROR'}
+
+def parse_dump(data: bytes):
+    """Parse a CTRL_TRACE dump into its time, and a list of (core, time,
+    event, chan, aux, arg) entries, with 64-bit times, oldest first for each
+    core."""
+    if len(data) < HEADER.size:
+        raise ValueError(f"Dump too short: {len(data)} bytes")
+    version, entry_len, count0, count1, _, dump_us = HEADER.unpack_from(data)
+    if version != TRACE_VERSION:
+        raise ValueError(f"Unsupported trace version {version}")
+    if entry_len < ENTRY.size:
+        raise ValueError(f"Bad entry length {entry_len}")
+    if len(data) < HEADER.size + (count0 + count1) * entry_len:
+        raise ValueError(f"Dump truncated: {len(data)} bytes")
+
+    entries = []
+    offset = HEADER.size
+    for core, count in enumerate((count0, count1)):
+        for _ in range(count):
+            time_us, event, chan, aux, arg = ENTRY.unpack_from(data, offset)
+            offset += entry_len
+            # Entries hold the low 32 bits of the time - they're all from
+            # before the dump, so unwrap them against its full time
+            time_us = dump_us - ((dump_us - time_us) & 0xffffffff)
+            entries.append((core, time_us, event, chan, aux, arg))
+    return dump_us, entries
+
+def event_name(event: int) -> str:
+    return EVENTS[event] if event < len(EVENTS) else f'event_{event}'
+
+def to_chrome(entries) -> list:
+    """Convert parsed entries to a list of Chrome trace events."""
+    events = [{'name': 'process_name', 'ph': 'M', 'pid': 0, 'args': {'name': 'tinyusb-vendor-example'}}]
+    for core in (0, 1):
+        events.append({'name': 'thread_name', 'ph': 'M', 'pid': 0, 'tid': core, 'args': {'name': f'core {core}'}})
+
+    rx_cb = {}
+    for core, time_us, event, chan, aux, arg in entries:
+        name = event_name(event)
+        args = {} if chan == NO_CHAN else {'chan': chan}
+
+        if name == 'rx_cb_enter':
+            rx_cb[core] = (time_us, chan, arg)
+            continue
+        if name == 'rx_cb_exit':
+            # The dump may start part way through a callback
+            if core in rx_cb:
+                start_us, chan, received = rx_cb.pop(core)
+                events.append({'name': 'rx_cb', 'ph': 'X', 'pid': 0, 'tid': core, 'ts': start_us,
+                               'dur': time_us - start_us, 'args': {'chan': chan, 'bytes': received}})
+            continue
+
+        if name == 'command':
+            command, proto = aux >> 8, aux & 0xff
+            name = COMMANDS.get(command, f'command 0x{command:02x}')
+            args['proto'] = PROTOCOLS.get(proto, proto)
+            args['len'] = arg
+        elif name == 'status':
+            name = STATUSES.get(aux, f'status 0x{aux:02x}')
+            args['len'] = arg
+        elif name in ('vendor_write', 'tx_cb'):
+            args['bytes'] = arg
+        elif name == 'suspend':
+            args['remote_wakeup'] = bool(aux)
+        else:
+            args['aux'] = aux
+            args['arg'] = arg
+        events.append({'name': name, 'ph': 'i', 's': 't', 'pid': 0, 'tid': core, 'ts': time_us, 'args': args})
+
+    return events
+
+def main():
+    parser = argparse.ArgumentParser(description='Convert a CTRL_TRACE dump to Chrome trace event JSON')
+    parser.add_argument('dump', help='Dump file, as saved by usbcmd.py trace (- for stdin)')
+    parser.add_argument('-o', '--output', default='-', help='JSON file to write (default: stdout)')
+    args = parser.parse_args()
+
+    try:
+        if args.dump == '-':
+            data = sys.stdin.buffer.read()
+        else:
+            with open(args.dump, 'rb') as f:
+                data = f.read()
+        dump_us, entries = parse_dump(data)
+        trace = {'traceEvents': to_chrome(entries), 'displayTimeUnit': 'ns',
+                 'otherData': {'dump_us': dump_us}}
+        if args.output == '-':
+            json.dump(trace, sys.stdout)
+        else:
+            with open(args.output, 'w') as f:
+                json.dump(trace, f)
+    except (OSError, ValueError) as e:
+        print(f"Error: {e}", file=sys.stderr)
+        sys.exit(1)
+
+    counts = [sum(1 for entry in entries if entry[0] == core) for core in (0, 1)]
+    span_us = dump_us - min((entry[1] for entry in entries), default=dump_us)
+    print(f"{counts[0]} core 0 and {counts[1]} core 1 events, "
+          f"covering {span_us / 1000:.1f} ms before the dump", file=sys.stderr)
+
+if __name__ == '__main__':
+    main()
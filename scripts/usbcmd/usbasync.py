@@ -0,0 +1,723 @@
+#!/usr/bin/env python3
+
+#
+# Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+#
+# Licensed under MIT license - see https://opensource.org/licenses/MIT
+#
+
+"""
+Pipelined asyncio host API for tinyusb-vendor-example devices.
+
+usbcmd.py's transfers are blocking, so a script using them has one transfer
+on the bus at a time, and the device's IN FIFO drains while the script turns
+each response round into the next command.  This module instead keeps
+several commands in flight on a channel, each with its bulk OUT (command and
+WRITE data) and bulk IN (READ data or WRITE status) transfers queued with
+libusb up front, as host/usb-bench does:
+
+    async with await Device.open() as dev:
+        await dev.init()
+        data = await dev.read(4096)
+        status = await dev.write(b'hello')
+
+        # Up to depth commands in flight, completed in order
+        async for cmd in dev.pipeline(read_request(4096) for _ in range(100)):
+            check(cmd.result())
+
+read() and write() each wait for their own command, so to keep the bus busy
+submit several at once, from separate tasks or with submit_read() and
+submit_write(), which return as soon as the command is queued.  A Command
+completes when its response arrives, which for a WRITE is its status,
+returned as a Status.  The device answers commands in the order it receives
+them, and the IN transfers are queued in the same order, so each response
+lands in its own command's transfer: pipeline() relies on this to hand back
+commands, in submission order, as they complete.
+
+pyusb has no asynchronous transfers, so this uses python-libusb1 (imported as
+usb1), with a thread running libusb's event loop and handing completions to
+asyncio.  Control requests are rare, and are run synchronously in a worker
+thread.
+
+Like usb-bench, this assumes the firmware buffers WRITE data
+(VENDOR_RX_UNBUFFERED isn't defined).  Otherwise a pipelined command can be
+answered with STATUS_BUSY instead of its response - unless the caller paces
+itself by the device's flow control credits (see src/credit.h), which
+credits() and PROTO_CREDIT statuses return.
+
+PROTO_NOACK WRITEs (see noack_request()) mostly get no status.  The Device
+works out which do, as the device will, so each Command still gets the
+right response - as long as none is turned away with STATUS_BUSY or
+STATUS_ERROR, which, as an unexpected status, would be taken for the next
+command's response.
+
+PROTO_RESUME commands (see resume_request()) can be resumed after the
+channel is reset - by CTRL_INIT, or the device being suspended, resumed or
+reset - interrupting them.  resume() says how far the device got with the
+last one, and resume_request() makes a command which carries on from there.
+
+PROTO_STORE commands (see store_request()) READ and WRITE objects in the
+device's object store - in RAM, or, with flash, in flash, so they survive the
+device being reset - and store() returns how full it is.
+"""
+
+import argparse
+import asyncio
+import collections
+import struct
+import sys
+import threading
+import time
+import zlib
+import usb1
+
+from usbcmd import BULK_PACKET_SIZE, CTRL_STATS, parse_int, parse_stats, stats_length
+
+# Must match src/include.h.  Channel n uses interface INTERFACE + n, and
+# endpoints BULK_IN + 2n and BULK_OUT + 2n.
+VENDOR_ID = 0x1209
+PRODUCT_ID = 0x0f0f
+INTERFACE = 0
+BULK_IN = 0x83
+BULK_OUT = 0x04
+
+CTRL_TYPE = 0xa1
+CTRL_INIT = 0x01
+CTRL_RESET = 0x02
+CTRL_PATTERN = 0x0a
+CTRL_CREDITS = 0x0b
+CTRL_ACKS = 0x0c
+CTRL_RESUME = 0x0d
+CTRL_STORE = 0x0e
+CTRL_TRACE = 0x0f
+
+CMD_READ = 8
+CMD_WRITE = 9
+
+PROTO_DEFAULT = 16
+PROTO_LARGE = 17
+PROTO_LOOPBACK = 18
+PROTO_LOOPBACK_STREAM = 19
+PROTO_CRC = 20
+PROTO_CREDIT = 21
+PROTO_BATCH = 22
+PROTO_NOACK = 23
+PROTO_RESUME = 24
+PROTO_STORE = 25
+
+# The most commands a PROTO_BATCH WRITE can hold
+BATCH_MAX_COMMANDS = 255
+
+# Added to a PROTO_RESUME command's transfer ID to resume the transfer
+RESUME_CONTINUE = 0x8000
+
+# The object store's objects, in RAM and in flash, a PROTO_STORE WRITE's
+# flag to append its data to the object's, and a PROTO_STORE command's (or
+# CTRL_STORE's) flag for a flash object
+STORE_OBJECTS = 16
+FLASH_STORE_OBJECTS = 4
+STORE_APPEND = 0x01
+STORE_FLASH = 0x02
+
+STATUS_BUSY = 1
+STATUS_READY = 2
+STATUS_ERROR = 3
+
+# CTRL_TRACE returns the flight recorder's dump in blocks of this many bytes
+TRACE_BLOCK_LEN = 1024
+
+# How long a control request may take, in ms
+CTRL_TIMEOUT = 1000
+
+def large_len(proto: int) -> bool:
+    """Whether proto's commands and statuses have 32-bit lengths."""
+    return proto in (PROTO_LARGE, PROTO_CRC, PROTO_CREDIT, PROTO_BATCH, PROTO_NOACK, PROTO_RESUME, PROTO_STORE)
+
+def status_len(proto: int, count: int = 0) -> int:
+    """Length of a status response, for a command using proto - for
+    PROTO_BATCH, a batch of count commands."""
+    if proto == PROTO_CRC:
+        return 9
+    if proto in (PROTO_CREDIT, PROTO_NOACK):
+        return 13
+    if proto == PROTO_BATCH:
+        return 5 + count
+    return 5 if large_len(proto) else 3
+
+def encode_command(type: int, proto: int, length: int, count: int = 0, ack: tuple = None,
+                   transfer_id: int = 0, store: tuple = None) -> bytes:
+    """A command's header - for PROTO_BATCH, of a batch of count commands,
+    for PROTO_NOACK, with the ack interval ack, as (WRITEs, KB), for
+    PROTO_RESUME, with transfer ID transfer_id (plus RESUME_CONTINUE, to
+    resume it), and for PROTO_STORE, addressing store, as (object,
+    flags)."""
+    if large_len(proto):
+        if proto == PROTO_RESUME:
+            byte2, byte3 = transfer_id & 0xff, transfer_id >> 8
+        elif proto == PROTO_STORE:
+            byte2, byte3 = store or (0, 0)
+        else:
+            byte2, byte3 = ack if (proto == PROTO_NOACK) and ack else (count, 0)
+        return struct.pack('<BBBBI', type, proto, byte2, byte3, length)
+    if length > 0xffff:
+        raise ValueError(f"Length {length} needs a protocol with 32-bit lengths, such as PROTO_LARGE")
+    return struct.pack('<BBH', type, proto, length)
+
+class Status(collections.namedtuple('Status', ['code', 'length', 'crc', 'credits', 'statuses', 'acks'],
+                                    defaults=(None, None, None, None))):
+    """A WRITE's status response.  crc is None unless PROTO_CRC was used,
+    credits - the channel's (command limit, byte limit) - unless PROTO_CREDIT
+    was, statuses - the status code of each command in a batch - unless
+    PROTO_BATCH was, and acks - the channel's (WRITEs, bytes) acknowledged -
+    unless PROTO_NOACK was."""
+    __slots__ = ()
+
+    @property
+    def ok(self) -> bool:
+        return self.code == STATUS_READY
+
+def decode_status(proto: int, data: bytes, count: int = 0) -> Status:
+    """Decode a status response - for PROTO_BATCH, to a batch of count
+    commands."""
+    if proto == PROTO_BATCH and len(data) == status_len(PROTO_LARGE) and data[0] != STATUS_READY:
+        # Turned away before its data was received - no status vector
+        return Status(*struct.unpack('<BI', data))
+    if len(data) != status_len(proto, count):
+        raise ProtocolError(f"Expected a {status_len(proto, count)} byte status, got {len(data)} bytes")
+    if proto == PROTO_CRC:
+        return Status(*struct.unpack('<BII', data))
+    if proto == PROTO_CREDIT:
+        code, length, commands, byte_limit = struct.unpack('<BIII', data)
+        return Status(code, length, credits=(commands, byte_limit))
+    if proto == PROTO_NOACK:
+        code, length, commands, acked = struct.unpack('<BIII', data)
+        return Status(code, length, acks=(commands, acked))
+    if proto == PROTO_BATCH:
+        return Status(*struct.unpack('<BI', data[:5]), statuses=tuple(data[5:]))
+    if large_len(proto):
+        return Status(*struct.unpack('<BI', data))
+    return Status(*struct.unpack('<BH', data))
+
+class ProtocolError(Exception):
+    """The device's response didn't match its command."""
+
+class TransferError(Exception):
+    """A bulk transfer failed, timed out or was cancelled."""
+
+class Request(collections.namedtuple('Request', ['type', 'proto', 'length', 'data', 'count', 'ack', 'transfer_id',
+                                                 'store'],
+                                     defaults=(0, None, 0, None))):
+    """A command to submit - see read_request(), write_request(),
+    batch_request(), noack_request(), resume_request() and
+    store_request()."""
+    __slots__ = ()
+
+def read_request(length: int, proto: int = PROTO_DEFAULT) -> Request:
+    return Request(CMD_READ, proto, length, None)
+
+def write_request(data: bytes, proto: int = PROTO_DEFAULT) -> Request:
+    return Request(CMD_WRITE, proto, len(data), bytes(data))
+
+def batch_request(requests) -> Request:
+    """A PROTO_BATCH WRITE carrying requests - usually small WRITEs - packed
+    into a single command (see src/batch.h).  Its Status has a status code
+    for each request in statuses."""
+    requests = list(requests)
+    if len(requests) > BATCH_MAX_COMMANDS:
+        raise ValueError(f"A batch holds at most {BATCH_MAX_COMMANDS} commands")
+    data = b''.join(encode_command(r.type, r.proto, r.length) + (r.data if r.type == CMD_WRITE else b'')
+                    for r in requests)
+    return Request(CMD_WRITE, PROTO_BATCH, len(data), data, len(requests))
+
+def noack_request(data: bytes, commands: int = 0, kb: int = 0) -> Request:
+    """A PROTO_NOACK WRITE (see src/ack.h), which only gets a status once
+    commands PROTO_NOACK WRITEs, or kb KB of their data, have completed since
+    the last - 0 turns either limit off.  Without one, its Command's result
+    is None."""
+    if not (0 <= commands <= 0xff and 0 <= kb <= 0xff):
+        raise ValueError("Ack intervals must be 0-255")
+    return Request(CMD_WRITE, PROTO_NOACK, len(data), bytes(data), ack=(commands, kb))
+
+def resume_request(request: Request, transfer_id: int, done: int = None) -> Request:
+    """The PROTO_RESUME version of a READ or WRITE request (see
+    src/resume.h), as transfer transfer_id (0-0x7fff).  Given done - the
+    bytes of the transfer done, as resume() returns - it instead resumes
+    the transfer: a READ gets just the rest of its data, and a WRITE sends
+    just the rest of request's."""
+    if not 0 <= transfer_id < RESUME_CONTINUE:
+        raise ValueError(f"Transfer IDs must be 0-0x{RESUME_CONTINUE - 1:x}")
+    if done is None:
+        return request._replace(proto=PROTO_RESUME, transfer_id=transfer_id)
+    if not 0 <= done <= request.length:
+        raise ValueError(f"Can't resume a {request.length} byte transfer at {done}")
+    data = request.data[done:] if request.type == CMD_WRITE else None
+    return request._replace(proto=PROTO_RESUME, length=request.length - done, data=data,
+                            transfer_id=transfer_id | RESUME_CONTINUE)
+
+def store_request(request: Request, obj: int, append: bool = False, flash: bool = False) -> Request:
+    """The PROTO_STORE version of a READ or WRITE request (see
+    src/store.h), addressing object obj (0-15, or with flash, a flash object,
+    0-3 - see src/flash-store.h).  A WRITE replaces the object's data, or,
+    with append (RAM objects only), adds to it.  A READ returns the object's
+    data, so is short if the object holds less than it asks for."""
+    objects = FLASH_STORE_OBJECTS if flash else STORE_OBJECTS
+    if not 0 <= obj < objects:
+        raise ValueError(f"Objects are 0-{objects - 1}")
+    if append and flash:
+        raise ValueError("Flash objects can't be appended to")
+    flags = STORE_APPEND if append and request.type == CMD_WRITE else 0
+    if flash:
+        flags |= STORE_FLASH
+    return request._replace(proto=PROTO_STORE, store=(obj, flags))
+
+class StoreInfo(collections.namedtuple('StoreInfo', ['blocks_used', 'blocks', 'block_size', 'objects_used',
+                                                     'objects'])):
+    """The object store's occupancy - its blocks in use, out of how many, and
+    their size, then the objects holding data, out of how many.  For the
+    flash objects, the blocks are flash sectors."""
+    __slots__ = ()
+
+class Resume(collections.namedtuple('Resume', ['transfer_id', 'type', 'length', 'done'])):
+    """How far the last PROTO_RESUME command on a channel got - its
+    transfer's ID, type (CMD_READ or CMD_WRITE), total length and bytes
+    done.  A READ's done is what the device knows was sent: the caller may
+    have received more, which it should discard."""
+    __slots__ = ()
+
+class Command:
+    """
+    A submitted command.  Await it for its result - a READ's data, or a
+    WRITE's Status - or, once done(), call result().
+
+    A PROTO_LOOPBACK_STREAM WRITE's echoed data is in echo.  acked is False
+    for a PROTO_NOACK WRITE which gets no status, and so completes once it
+    has been sent, with a result of None.  Like usb-bench,
+    the library doesn't check READ data or WRITE statuses, only that the
+    responses have the right length, leaving the rest to the caller.
+    """
+
+    def __init__(self, request: Request, future: asyncio.Future):
+        self.request = request
+        self.echo = None
+        self.acked = True
+        self.submitted = time.perf_counter()
+        self.completed = None
+        self._future = future
+        self._pending = 0
+        self._error = None
+        self._response = b''
+
+    @property
+    def type(self) -> int:
+        return self.request.type
+
+    @property
+    def proto(self) -> int:
+        return self.request.proto
+
+    @property
+    def length(self) -> int:
+        return self.request.length
+
+    @property
+    def latency(self) -> float:
+        """Seconds from submission to completion."""
+        return self.completed - self.submitted
+
+    @property
+    def echoes(self) -> bool:
+        return (self.type == CMD_WRITE) and (self.proto == PROTO_LOOPBACK_STREAM)
+
+    def done(self) -> bool:
+        return self._future.done()
+
+    def result(self):
+        return self._future.result()
+
+    def __await__(self):
+        return self._future.__await__()
+
+    def __repr__(self):
+        name = 'READ' if self.type == CMD_READ else 'WRITE'
+        return f"<Command {name} proto={self.proto} length={self.length}>"
+
+class Device:
+    """
+    One channel of a tinyusb-vendor-example device.  Create with open(), and
+    use from a single event loop.
+    """
+
+    def __init__(self, context, handle, channel: int, depth: int, timeout: int):
+        self._context = context
+        self._handle = handle
+        self.channel = channel
+        self.interface = INTERFACE + channel
+        self.bulk_in = BULK_IN + (2 * channel)
+        self.bulk_out = BULK_OUT + (2 * channel)
+        self.timeout = timeout
+        self._loop = asyncio.get_running_loop()
+        self._slots = asyncio.Semaphore(depth)
+        self._transfers = set()
+        self._idle = asyncio.Event()
+        self._idle.set()
+        self._ack_interval = (0, 0)
+        self._stopping = False
+        self._events = threading.Thread(target=self._handle_events, name='usbasync-events', daemon=True)
+        self._events.start()
+
+    @classmethod
+    async def open(cls, vendor_id: int = VENDOR_ID, product_id: int = PRODUCT_ID, channel: int = 0,
+                   depth: int = 4, timeout: int = 2000) -> 'Device':
+        """
+        Open and claim a channel.  depth is the most commands kept in flight -
+        there's no point in more than the device's WORK_QUEUE_LEN (8).
+        timeout is the bulk transfer timeout, in ms.
+        """
+        context = usb1.USBContext()
+        context.open()
+        handle = context.openByVendorIDAndProductID(vendor_id, product_id, skip_on_error=True)
+        if handle is None:
+            context.close()
+            raise OSError(f"Device {vendor_id:04x}:{product_id:04x} not found")
+        try:
+            handle.setAutoDetachKernelDriver(True)
+        except usb1.USBErrorNotSupported:
+            pass
+        try:
+            handle.claimInterface(INTERFACE + channel)
+        except usb1.USBError:
+            handle.close()
+            context.close()
+            raise
+        return cls(context, handle, channel, depth, timeout)
+
+    async def close(self):
+        """Cancel anything in flight, and release the device."""
+        for transfer in list(self._transfers):
+            try:
+                transfer.cancel()
+            except usb1.USBError:
+                pass
+        await self._idle.wait()
+        self._stopping = True
+        await asyncio.to_thread(self._events.join)
+        self._handle.releaseInterface(self.interface)
+        self._handle.close()
+        self._context.close()
+
+    async def __aenter__(self):
+        return self
+
+    async def __aexit__(self, *exc):
+        await self.close()
+
+    def _handle_events(self):
+        while not self._stopping:
+            self._context.handleEventsTimeout(0.1)
+
+    #
+    # Control requests
+    #
+
+    async def control(self, request: int, value: int = 0, length: int = 0, data: bytes = None,
+                      request_type: int = CTRL_TYPE) -> bytes:
+        """
+        Send a control request to this channel's interface.  IN requests
+        (bit 7 of request_type set) return up to length bytes.  OUT requests
+        send data, and return b''.
+        """
+        if request_type & 0x80:
+            func = self._handle.controlRead
+            arg = length
+        else:
+            func = self._handle.controlWrite
+            arg = data or b''
+        response = await asyncio.to_thread(func, request_type, request, value, self.interface, arg, CTRL_TIMEOUT)
+        return bytes(response) if request_type & 0x80 else b''
+
+    async def init(self):
+        """Reset the channel's protocol state, as CTRL_INIT."""
+        await self.control(CTRL_INIT, length=1)
+        self._ack_interval = (0, 0)
+
+    async def pattern(self, pattern: int, seed: int = 0):
+        """Select the pattern READs return (see src/pattern.h)."""
+        await self.control(CTRL_PATTERN, value=(seed << 8) | pattern, length=1)
+
+    async def stats(self, reset: bool = False) -> dict:
+        """Read (and optionally reset) the performance counters."""
+        data = await self.control(CTRL_STATS, value=1 if reset else 0, length=stats_length())
+        return parse_stats(data)
+
+    async def credits(self) -> tuple:
+        """Read the channel's flow control credits, as (command limit, byte
+        limit) - see src/credit.h.  This also tells the device we're pacing
+        ourselves by them, so it won't turn away WRITEs too big for its WRITE
+        sink.  Pacing is up to the caller."""
+        return struct.unpack('<II', await self.control(CTRL_CREDITS, length=8))
+
+    async def acks(self) -> tuple:
+        """Read the channel's ack counts, as (WRITEs, bytes) - the
+        PROTO_NOACK WRITEs the device has completed since the channel was
+        initialised - see src/ack.h."""
+        return struct.unpack('<II', await self.control(CTRL_ACKS, length=8))
+
+    async def resume(self) -> Resume:
+        """How far the channel's last PROTO_RESUME command got, as a Resume,
+        or None if it hasn't had one - see src/resume.h.  Waits for the
+        device to finish resetting the channel, if it's still doing so."""
+        while True:
+            data = await self.control(CTRL_RESUME, length=12)
+            transfer_id, type, status, length, done = struct.unpack('<HBBII', data)
+            if status != STATUS_BUSY:
+                break
+            await asyncio.sleep(0.001)
+        return Resume(transfer_id, type, length, done) if type else None
+
+    async def store(self, flash: bool = False) -> StoreInfo:
+        """The object store's occupancy - or, with flash, the flash
+        objects' - as a StoreInfo - see src/store.h.  The store is shared by
+        all the channels."""
+        value = STORE_FLASH if flash else 0
+        return StoreInfo(*struct.unpack('<HHHBB', await self.control(CTRL_STORE, value=value, length=8)))
+
+    async def trace(self) -> bytes:
+        """The device's flight recorder dump - its last few hundred events on
+        each core - see src/trace.h.  scripts/trace/trace2chrome.py turns it
+        into a timeline.  The recorder is shared by all the channels."""
+        data = b''
+        block = 0
+        while True:
+            chunk = await self.control(CTRL_TRACE, value=block, length=TRACE_BLOCK_LEN)
+            data += chunk
+            if len(chunk) < TRACE_BLOCK_LEN:
+                return data
+            block += 1
+
+    #
+    # Commands
+    #
+
+    async def read(self, length: int, proto: int = PROTO_DEFAULT) -> bytes:
+        """READ length bytes."""
+        return await (await self.submit(read_request(length, proto)))
+
+    async def write(self, data: bytes, proto: int = PROTO_DEFAULT) -> Status:
+        """WRITE data, returning its status."""
+        return await (await self.submit(write_request(data, proto)))
+
+    async def submit_read(self, length: int, proto: int = PROTO_DEFAULT) -> Command:
+        return await self.submit(read_request(length, proto))
+
+    async def submit_write(self, data: bytes, proto: int = PROTO_DEFAULT) -> Command:
+        return await self.submit(write_request(data, proto))
+
+    async def submit(self, request: Request) -> Command:
+        """
+        Queue a command's transfers, first waiting for a free slot if depth
+        commands are already in flight.  Returns once the command is queued.
+        """
+        header = encode_command(request.type, request.proto, request.length, request.count, request.ack,
+                                request.transfer_id, request.store)
+        out_data = header + request.data if request.type == CMD_WRITE else header
+        response_len = request.length if request.type == CMD_READ else status_len(request.proto, request.count)
+
+        await self._slots.acquire()
+        cmd = Command(request, self._loop.create_future())
+        cmd.acked = self._ack_due(request)
+
+        # Submit the OUT before the INs it's answered on, and, as the slot
+        # wait was the last await, without yielding - so another task's
+        # command can't get its IN transfers in between these
+        try:
+            self._submit(cmd, 'out', self.bulk_out, out_data)
+            if cmd.echoes:
+                self._submit(cmd, 'echo', self.bulk_in, self._in_len(request.length))
+            # The device doesn't answer a READ of nothing, or most
+            # PROTO_NOACK WRITEs
+            if ((request.type != CMD_READ) or (request.length > 0)) and cmd.acked:
+                self._submit(cmd, 'in', self.bulk_in, self._in_len(response_len))
+        except usb1.USBError as e:
+            # Anything already submitted will complete (or time out), and
+            # see the command already failed
+            self._fail(cmd, TransferError(f"Submit failed: {e}"))
+        return cmd
+
+    async def pipeline(self, requests):
+        """
+        Submit requests, keeping up to depth in flight, and yield their
+        Commands in order as each completes.  A failed command is yielded
+        like any other - its result() raises.
+        """
+        window = collections.deque()
+        for request in requests:
+            window.append(await self.submit(request))
+            while window and window[0].done():
+                yield window.popleft()
+        while window:
+            cmd = window.popleft()
+            await asyncio.wait([cmd._future])
+            yield cmd
+
+    def _ack_due(self, request: Request) -> bool:
+        # Whether the device will send a status for this command - always,
+        # except for a PROTO_NOACK WRITE before the end of its ack interval
+        if (request.type != CMD_WRITE) or (request.proto != PROTO_NOACK):
+            return True
+        commands, kb = request.ack or (0, 0)
+        interval_commands = self._ack_interval[0] + 1
+        interval_bytes = self._ack_interval[1] + request.length
+        if (commands and interval_commands >= commands) or (kb and interval_bytes >= kb * 1024):
+            self._ack_interval = (0, 0)
+            return True
+        self._ack_interval = (interval_commands, interval_bytes)
+        return False
+
+    @staticmethod
+    def _in_len(length: int) -> int:
+        # Room for a packet more than expected, so a response which is too
+        # long is seen as such, rather than as a babble error, and so a
+        # multiple of the packet size collects its zero length packet
+        return ((length // BULK_PACKET_SIZE) + 1) * BULK_PACKET_SIZE
+
+    def _submit(self, cmd: Command, kind: str, endpoint: int, data):
+        # Transfers aren't reused - the handle closes them when it's closed
+        transfer = self._handle.getTransfer()
+        length = len(data) if kind == 'out' else data
+        transfer.setBulk(endpoint, bytearray(data) if kind == 'out' else data,
+                         callback=self._transfer_callback, user_data=(cmd, kind, length), timeout=self.timeout)
+        if kind == 'out':
+            transfer.setZeroPacket(True)
+        transfer.submit()
+        self._transfers.add(transfer)
+        self._idle.clear()
+        cmd._pending += 1
+
+    def _transfer_callback(self, transfer):
+        # Runs on the event thread - collect what we need, and hand over to
+        # the event loop
+        status = transfer.getStatus()
+        data = bytes(transfer.getBuffer()[:transfer.getActualLength()])
+        self._loop.call_soon_threadsafe(self._transfer_done, transfer, transfer.getUserData(), status, data)
+
+    def _transfer_done(self, transfer, user_data, status: int, data: bytes):
+        cmd, kind, length = user_data
+        self._transfers.discard(transfer)
+        if not self._transfers:
+            self._idle.set()
+
+        cmd._pending -= 1
+        if status != usb1.TRANSFER_COMPLETED:
+            self._fail(cmd, TransferError(f"Bulk {kind} transfer failed: status {status}"))
+            return
+        if kind == 'out':
+            if len(data) != length:
+                self._fail(cmd, TransferError(f"Short bulk out transfer: {len(data)} of {length} bytes"))
+                return
+        elif kind == 'echo':
+            cmd.echo = data
+        else:
+            cmd._response = data
+
+        if cmd._pending == 0:
+            self._complete(cmd)
+
+    def _fail(self, cmd: Command, error: Exception):
+        if cmd._error is None:
+            cmd._error = error
+        if cmd._pending == 0:
+            self._complete(cmd)
+
+    def _complete(self, cmd: Command):
+        if cmd.done():
+            return
+        cmd.completed = time.perf_counter()
+        self._slots.release()
+
+        if cmd._error is None:
+            try:
+                cmd._future.set_result(self._decode(cmd))
+                return
+            except ProtocolError as e:
+                cmd._error = e
+        cmd._future.set_exception(cmd._error)
+
+        # Nobody may ever look at a pipelined command's result, so don't
+        # have asyncio complain about it
+        cmd._future.exception()
+
+    @staticmethod
+    def _decode(cmd: Command):
+        if cmd.echoes and len(cmd.echo) != cmd.length:
+            raise ProtocolError(f"Expected {cmd.length} bytes echoed, got {len(cmd.echo)} bytes")
+        if cmd.type == CMD_WRITE:
+            if not cmd.acked:
+                return None
+            return decode_status(cmd.proto, cmd._response, cmd.request.count)
+
+        # Loopback and store READs return as much data as there is
+        if len(cmd._response) > cmd.length or \
+           (cmd.proto not in (PROTO_LOOPBACK, PROTO_STORE) and len(cmd._response) != cmd.length):
+            raise ProtocolError(f"Expected {cmd.length} bytes, got {len(cmd._response)} bytes")
+        return cmd._response
+
+#
+# A simple throughput test, and example.  host/usb-bench is the more
+# thorough (and faster) tool.
+#
+
+async def bench(args):
+    async with await Device.open(args.vendor_id, args.product_id, args.channel, args.depth) as dev:
+        await dev.init()
+
+        data = bytes(ii & 0xff for ii in range(args.size))
+        crc = zlib.crc32(data)
+        if args.workload == 'read':
+            requests = (read_request(args.size, args.proto) for _ in range(args.count))
+        else:
+            requests = (write_request(data, args.proto) for _ in range(args.count))
+
+        errors = 0
+        latencies = []
+        start = time.perf_counter()
+        async for cmd in dev.pipeline(requests):
+            try:
+                result = cmd.result()
+                if isinstance(result, Status) and \
+                   (not result.ok or result.length != args.size or result.crc not in (None, crc)):
+                    raise ProtocolError(f"Bad status {result}")
+            except (TransferError, ProtocolError) as e:
+                errors += 1
+                print(f"{cmd}: {e}", file=sys.stderr)
+            latencies.append(cmd.latency)
+        elapsed = time.perf_counter() - start
+
+        latencies.sort()
+        rate = args.count * args.size / elapsed / 1000
+        median = latencies[len(latencies) // 2] * 1e6
+        print(f"{args.workload} {args.size} bytes x {args.count}, depth {args.depth}: "
+              f"{rate:.1f} KB/s, {args.count / elapsed:.0f} commands/s, median latency {median:.0f} us, "
+              f"{errors} errors")
+        return 1 if errors else 0
+
+def main():
+    parser = argparse.ArgumentParser(description='Pipelined READ or WRITE throughput test')
+    parser.add_argument('-v', '--vendor-id', type=parse_int, default=VENDOR_ID, help='USB vendor ID')
+    parser.add_argument('-p', '--product-id', type=parse_int, default=PRODUCT_ID, help='USB product ID')
+    parser.add_argument('-i', '--channel', type=int, default=0, help='Channel (vendor interface) to use')
+    parser.add_argument('-d', '--depth', type=int, default=4, help='Commands in flight (default: 4)')
+    parser.add_argument('-n', '--count', type=int, default=1000, help='Commands to send (default: 1000)')
+    parser.add_argument('-s', '--size', type=parse_int, default=4096, help='Bytes per command (default: 4096)')
+    parser.add_argument('-P', '--proto', type=parse_int, default=PROTO_DEFAULT,
+                        help=f'Command protocol (default: {PROTO_DEFAULT})')
+    parser.add_argument('workload', choices=['read', 'write'])
+    args = parser.parse_args()
+
+    try:
+        sys.exit(asyncio.run(bench(args)))
+    except (OSError, usb1.USBError, ValueError) as e:
+        print(f"Error: {e}", file=sys.stderr)
+        sys.exit(1)
+
+if __name__ == '__main__':
+    main()
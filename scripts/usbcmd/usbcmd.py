@@ -7,10 +7,49 @@
 #
 
 import argparse
+import shlex
+import struct
 import sys
+import time
 import usb.core
 import usb.util
 
+# Full speed bulk endpoints' maximum packet size
+BULK_PACKET_SIZE = 64
+
+# CTRL_STATS request (see src/include.h), sent as a class request to the
+# vendor interface
+CTRL_STATS = 0x09
+CTRL_STATS_TYPE = 0xa1
+CTRL_STATS_INTERFACE = 0
+
+# Counters returned by CTRL_STATS, in order - must match stat_id_t in
+# src/stats.h.  Counters shown as rates when polling are marked True.
+STATS_COUNTERS = [
+    ('bytes_out', True),
+    ('bytes_in', True),
+    ('packets_out', True),
+    ('packets_in', True),
+    ('cmd_read', True),
+    ('cmd_write', True),
+    ('cmd_other', True),
+    ('status_ready', True),
+    ('status_busy', True),
+    ('status_error', True),
+    ('tx_fifo_full', True),
+    ('rx_flush', True),
+    ('main_loops', True),
+    ('aux_loops', True),
+    ('tud_task_calls', True),
+    ('tud_task_us', False),
+]
+STATS_DERIVED = ['main_loops_per_sec', 'aux_loops_per_sec', 'tud_task_max_us', 'tud_task_avg_us']
+
+# CTRL_TRACE request (see src/trace.h), which returns the flight recorder's
+# dump a block at a time
+CTRL_TRACE = 0x0f
+TRACE_BLOCK_LEN = 1024
+
 def decode_and_print_data(data):
     """Print received data in both hex and ASCII format."""
     # Print hex representation
@@ -90,6 +129,10 @@ def cleanup_device(device, interface, reattach_kernel_driver):
 def do_control(args):
     """Execute control transfer."""
     device = find_device(args.vendor_id, args.product_id)
+    control_transfer(device, args)
+
+def control_transfer(device, args):
+    """Execute control transfer on a device which has been found."""
     data = parse_data(args.data) if args.data else b''
     
     #print(f"DEBUG: Sending control transfer:")
@@ -117,33 +160,265 @@ def do_bulk(args):
     interface, was_kernel_driver_active = setup_device(device)
     
     try:
-        if args.direction == 'out':
-            data = parse_data(args.data) if args.data else b''
-            #print(f"DEBUG: Sending bulk OUT transfer:")
-            #print(f"  Endpoint: 0x{args.endpoint:02x}")
-            #print(f"  Data (hex): {data.hex()}")
-            #print(f"  Data length: {len(data)} bytes")
-            written = device.write(args.endpoint, data)
-            #print(f"  Bytes written: {written}")
-        else:  # in
-            # Need a bit of a timeout to give the device time to send the
-            # response
-            data = device.read(args.endpoint, args.length, timeout=500)
-            decode_and_print_data(data)
+        bulk_transfer(device, args)
     finally:
         # Always cleanup
         cleanup_device(device, interface, was_kernel_driver_active)
 
-def main():
-    parser = argparse.ArgumentParser(description='USB Control Tool')
-    parser.add_argument('-v', '--vendor-id', type=parse_int, help='Vendor ID (hex with 0x or decimal)')
-    parser.add_argument('-p', '--product-id', type=parse_int, help='Product ID (hex with 0x or decimal)')
+def bulk_transfer(device, args):
+    """Execute bulk transfer on a device which has been set up."""
+    if args.direction == 'out':
+        data = parse_data(args.data) if args.data else b''
+        #print(f"DEBUG: Sending bulk OUT transfer:")
+        #print(f"  Endpoint: 0x{args.endpoint:02x}")
+        #print(f"  Data (hex): {data.hex()}")
+        #print(f"  Data length: {len(data)} bytes")
+        written = device.write(args.endpoint, data)
+        #print(f"  Bytes written: {written}")
+        # The device only sees the end of a transfer which is a
+        # multiple of the packet size when it's followed by a zero
+        # length packet
+        if data and (len(data) % BULK_PACKET_SIZE) == 0:
+            device.write(args.endpoint, b'')
+    else:  # in
+        # Need a bit of a timeout to give the device time to send the
+        # response
+        data = device.read(args.endpoint, args.length, timeout=500)
+        decode_and_print_data(data)
 
-    subparsers = parser.add_subparsers(dest='command', help='Command')
+def read_stats(device, reset: bool) -> dict:
+    """Read (and optionally reset) the device's performance counters."""
+    data = bytes(device.ctrl_transfer(CTRL_STATS_TYPE, CTRL_STATS, 1 if reset else 0, CTRL_STATS_INTERFACE, stats_length()))
+    return parse_stats(data)
 
-    # List command
-    list_parser = subparsers.add_parser('list', help='List USB devices')
+def stats_length() -> int:
+    """Length of the CTRL_STATS response, with all the counters we know about."""
+    return 12 + (len(STATS_COUNTERS) + len(STATS_DERIVED)) * 4
+
+def parse_stats(data: bytes) -> dict:
+    """Parse a CTRL_STATS response."""
+    if len(data) < 8:
+        raise ValueError(f"Stats response too short: {len(data)} bytes")
+
+    version, count = data[0], data[1]
+    if version not in (1, 2):
+        raise ValueError(f"Unsupported stats version {version}")
+
+    # Version 1 firmware sent a 32 bit elapsed time, which wrapped after
+    # 71.6 minutes.  Newer firmware may have more counters than we know about.
+    elapsed_len = 8 if version >= 2 else 4
+    if len(data) < 4 + elapsed_len:
+        raise ValueError(f"Stats response too short: {len(data)} bytes")
+    stats = {'elapsed_us': int.from_bytes(data[4:4 + elapsed_len], 'little')}
+    values = struct.unpack_from(f'<{(len(data) - 4 - elapsed_len) // 4}I', data, 4 + elapsed_len)
+    for ii, (name, _) in enumerate(STATS_COUNTERS[:count]):
+        stats[name] = values[ii]
+    for ii, name in enumerate(STATS_DERIVED):
+        if count + ii < len(values):
+            stats[name] = values[count + ii]
+    return stats
+
+def print_stats(stats: dict, rates: bool):
+    """Print counters, as per-second rates (over elapsed_us) if rates is set."""
+    elapsed = stats['elapsed_us'] / 1000000
+    print(f"{'elapsed_s':<20} {elapsed:>14.3f}")
+    for name, is_rate in STATS_COUNTERS:
+        if name not in stats:
+            continue
+        if rates and is_rate and elapsed > 0:
+            print(f"{name:<20} {stats[name]:>14} {stats[name] / elapsed:>14.1f}/s")
+        else:
+            print(f"{name:<20} {stats[name]:>14}")
+    for name in STATS_DERIVED:
+        if name in stats:
+            print(f"{name:<20} {stats[name]:>14}")
+
+def do_stats(args):
+    """Read the device's performance counters, once or repeatedly."""
+    device = find_device(args.vendor_id, args.product_id)
+
+    if args.interval is None:
+        print_stats(read_stats(device, args.reset), rates=False)
+        return
+
+    # Reset the counters so each poll shows the rates over the interval
+    read_stats(device, True)
+    polls = 0
+    try:
+        while (args.count is None) or (polls < args.count):
+            time.sleep(args.interval)
+            print(f"--- {time.strftime('%H:%M:%S')}")
+            print_stats(read_stats(device, True), rates=True)
+            polls += 1
+    except KeyboardInterrupt:
+        pass
+
+def read_trace(device) -> bytes:
+    """Read the device's flight recorder dump.  Recording stops while it's
+    read, and starts again once the last (short) block has been read."""
+    data = b''
+    block = 0
+    while True:
+        chunk = bytes(device.ctrl_transfer(CTRL_STATS_TYPE, CTRL_TRACE, block, CTRL_STATS_INTERFACE, TRACE_BLOCK_LEN))
+        data += chunk
+        if len(chunk) < TRACE_BLOCK_LEN:
+            return data
+        block += 1
+
+def save_trace(device, filename: str):
+    """Save the device's flight recorder dump to a file, for
+    trace/trace2chrome.py."""
+    data = read_trace(device)
+    with open(filename, 'wb') as f:
+        f.write(data)
+    print(f"Saved {len(data)} byte trace dump to {filename}")
+
+def do_trace(args):
+    """Save the device's flight recorder dump."""
+    device = find_device(args.vendor_id, args.product_id)
+    save_trace(device, args.output)
+
+# Batch and REPL modes
+#
+# Each step is one of the transfer commands above, with the same arguments,
+# or "sleep SECONDS", one per line.  The device is found, set up and claimed
+# once, and every step runs over the same handle, so a step takes as long as
+# its transfers, rather than the tens of milliseconds it takes to set the
+# device up for each invocation of this script.
+
+class StepError(Exception):
+    """A step couldn't be parsed."""
+
+class StepHelp(Exception):
+    """A step asked for help (-h), which has been printed."""
+
+class StepParser(argparse.ArgumentParser):
+    """Parses steps, raising exceptions rather than exiting."""
+    def error(self, message):
+        raise StepError(message)
+
+    def exit(self, status=0, message=None):
+        if status != 0:
+            raise StepError(message.strip() if message else 'invalid step')
+        raise StepHelp()
 
+def make_step_parser():
+    parser = StepParser(prog='step', description='Batch/REPL step', add_help=False)
+    subparsers = parser.add_subparsers(dest='command', metavar='STEP')
+    add_transfer_parsers(subparsers)
+    sleep_parser = subparsers.add_parser('sleep', help='Wait before the next step')
+    sleep_parser.add_argument('seconds', type=float, help='Time to wait, in seconds')
+    return parser
+
+class Session:
+    """A device, set up once, which runs steps and times them."""
+    def __init__(self, vendor_id: int, product_id: int):
+        self.device = find_device(vendor_id, product_id)
+        self.interface, self.reattach = setup_device(self.device)
+        self.parser = make_step_parser()
+        self.steps = 0
+        self.failures = 0
+        self.total_s = 0.0
+
+    def close(self):
+        cleanup_device(self.device, self.interface, self.reattach)
+
+    def run(self, line: str) -> bool:
+        """Run a step, reporting how long it took.  Returns False if it
+        failed.  Blank lines and comments are ignored."""
+        words = shlex.split(line, comments=True)
+        if not words:
+            return True
+
+        try:
+            args = self.parser.parse_args(words)
+        except StepHelp:
+            return True
+        except StepError as e:
+            args = None
+            error = e
+
+        self.steps += 1
+        start = time.perf_counter()
+        try:
+            if args is None:
+                raise error
+            elif args.command == 'control':
+                control_transfer(self.device, args)
+            elif args.command == 'bulk':
+                bulk_transfer(self.device, args)
+            elif args.command == 'stats':
+                if args.interval is not None:
+                    raise StepError('stats -i is not supported in a batch')
+                print_stats(read_stats(self.device, args.reset), rates=False)
+            elif args.command == 'trace':
+                save_trace(self.device, args.output)
+            elif args.command == 'sleep':
+                time.sleep(args.seconds)
+            else:
+                raise StepError("expected one of: control, bulk, stats, trace, sleep")
+        except (StepError, ValueError, OSError, usb.core.USBError) as e:
+            elapsed_ms = (time.perf_counter() - start) * 1000
+            self.total_s += elapsed_ms / 1000
+            self.failures += 1
+            print(f"[{self.steps}] {' '.join(words)}: FAILED in {elapsed_ms:.2f} ms: {e}", file=sys.stderr)
+            return False
+
+        elapsed_ms = (time.perf_counter() - start) * 1000
+        self.total_s += elapsed_ms / 1000
+        print(f"[{self.steps}] {' '.join(words)}: {elapsed_ms:.2f} ms")
+        return True
+
+    def summary(self):
+        print(f"{self.steps} steps, {self.failures} failed, {self.total_s * 1000:.2f} ms")
+
+def do_batch(args):
+    """Run steps from a file, or stdin, over one claimed handle."""
+    f = sys.stdin if args.file == '-' else open(args.file)
+    session = Session(args.vendor_id, args.product_id)
+    try:
+        for line in f:
+            if not session.run(line) and not args.keep_going:
+                break
+    finally:
+        session.close()
+        if f is not sys.stdin:
+            f.close()
+    session.summary()
+    if session.failures > 0:
+        sys.exit(1)
+
+def do_repl(args):
+    """Run steps typed interactively, over one claimed handle."""
+    try:
+        import readline  # Line editing and history, where available
+    except ImportError:
+        pass
+
+    session = Session(args.vendor_id, args.product_id)
+    print("Enter steps (control, bulk, stats, sleep), help, or quit")
+    try:
+        while True:
+            try:
+                line = input('usbcmd> ')
+            except EOFError:
+                print()
+                break
+            except KeyboardInterrupt:
+                print()
+                continue
+            if line.strip() in ('quit', 'exit'):
+                break
+            if line.strip() in ('help', '?'):
+                session.parser.print_help()
+                continue
+            session.run(line)
+    finally:
+        session.close()
+    session.summary()
+
+def add_transfer_parsers(subparsers):
+    """Add the transfer commands, which are also the batch/REPL steps."""
     # Control transfer command
     control_parser = subparsers.add_parser('control', help='Control transfer')
     control_parser.add_argument('direction', choices=['in', 'out'], help='Transfer direction')
@@ -161,6 +436,37 @@ def main():
     bulk_parser.add_argument('-d', '--data', help='Data to send (hex with 0x)')
     bulk_parser.add_argument('-l', '--length', type=parse_int, default=64,  help='Length for IN transfer (hex with 0x or decimal)')
 
+    # Stats command
+    stats_parser = subparsers.add_parser('stats', help='Read device performance counters')
+    stats_parser.add_argument('-r', '--reset', action='store_true', help='Reset the counters after reading them')
+    stats_parser.add_argument('-i', '--interval', type=float, help='Poll every INTERVAL seconds, printing rates')
+    stats_parser.add_argument('-c', '--count', type=int, help='Number of polls (default: until interrupted)')
+
+    # Trace command
+    trace_parser = subparsers.add_parser('trace', help='Save the device\'s flight recorder dump')
+    trace_parser.add_argument('-o', '--output', default='trace.bin', help='File to save the dump to (default: trace.bin)')
+
+def main():
+    parser = argparse.ArgumentParser(description='USB Control Tool')
+    parser.add_argument('-v', '--vendor-id', type=parse_int, help='Vendor ID (hex with 0x or decimal)')
+    parser.add_argument('-p', '--product-id', type=parse_int, help='Product ID (hex with 0x or decimal)')
+
+    subparsers = parser.add_subparsers(dest='command', help='Command')
+
+    # List command
+    list_parser = subparsers.add_parser('list', help='List USB devices')
+
+    # Transfer commands
+    add_transfer_parsers(subparsers)
+
+    # Batch command
+    batch_parser = subparsers.add_parser('batch', help='Run a file of steps over one claimed handle')
+    batch_parser.add_argument('file', nargs='?', default='-', help='Steps, one per line (default: stdin)')
+    batch_parser.add_argument('-k', '--keep-going', action='store_true', help='Carry on after a step fails')
+
+    # REPL command
+    repl_parser = subparsers.add_parser('repl', help='Run steps interactively over one claimed handle')
+
     args = parser.parse_args()
 
     try:
@@ -170,6 +476,14 @@ def main():
             do_control(args)
         elif args.command == 'bulk':
             do_bulk(args)
+        elif args.command == 'stats':
+            do_stats(args)
+        elif args.command == 'trace':
+            do_trace(args)
+        elif args.command == 'batch':
+            do_batch(args)
+        elif args.command == 'repl':
+            do_repl(args)
         else:
             parser.print_help()
             sys.exit(1)
@@ -179,6 +493,10 @@ def main():
     except usb.core.USBError as e:
         print(f"USB Error: {e}", file=sys.stderr)
         sys.exit(1)
+    except OSError as e:
+        # USBError is an OSError, so this must come after it
+        print(f"Error: {e}", file=sys.stderr)
+        sys.exit(1)
 
 if __name__ == '__main__':
     main()
@@ -0,0 +1,728 @@
+#!/usr/bin/env python3
+
+#
+# Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+#
+# Licensed under MIT license - see https://opensource.org/licenses/MIT
+#
+
+#
+# usbmon capture analyzer for tinyusb-vendor-example.
+#
+# Linux's usbmon sees every transfer (URB) the host submits to a device, and
+# its completion, with a microsecond timestamp.  This script reads a capture
+# of a tinyusb-vendor-example device's traffic - in usbmon's text format
+# (cat /sys/kernel/debug/usb/usbmon/1u), or as a pcap or pcapng file (from
+# Wireshark, or tcpdump -i usbmon1), either optionally gzipped - and
+# reassembles the protocol from it (see PROTOCOL.md): the commands in each
+# channel's bulk OUT stream, the WRITE data following them, and the READ
+# data and statuses on the bulk IN endpoint, which answer the channel's
+# commands in order.  It then reports, for each channel:
+# - each kind of command's latency distribution - from the host submitting
+#   the transfer holding the command to the completion of the transfer which
+#   ends its response,
+# - the bytes per second moved in each direction, on average and over the
+#   busiest second,
+# - the statuses, and the proportion which were BUSY or ERROR,
+# and, for each device, the gaps between bulk transfers completing, split
+# into those when the host had nothing outstanding, and those when commands
+# were outstanding and the device was slow to answer.
+#
+# The capture is read a record at a time, and only running totals and
+# histograms are kept, so captures of many GB can be analyzed in constant
+# memory.  Latency percentiles come from histograms with 16 buckets per
+# doubling, so are within 5%.
+#
+# usbmon's text format only captures the first 32 bytes of each transfer,
+# so a command is only seen if it starts within them - as it does if the
+# host sends each command, with or without its data, as its own transfer.
+# A command which isn't seen is counted as a loss of sync, and the next
+# transfer's first bytes are taken as a command.
+#
+
+import argparse
+import binascii
+import collections
+import gzip
+import heapq
+import math
+import struct
+import sys
+
+# Protocol definitions - see src/include.h
+CMD_READ = 8
+CMD_WRITE = 9
+
+PROTO_DEFAULT = 16
+PROTO_LARGE = 17
+PROTO_LOOPBACK = 18
+PROTO_LOOPBACK_STREAM = 19
+PROTO_CRC = 20
+PROTO_CREDIT = 21
+PROTO_BATCH = 22
+PROTO_NOACK = 23
+PROTO_RESUME = 24
+PROTO_STORE = 25
+
+PROTO_NAMES = {
+    PROTO_DEFAULT: 'DEFAULT', PROTO_LARGE: 'LARGE', PROTO_LOOPBACK: 'LOOPBACK',
+    PROTO_LOOPBACK_STREAM: 'LOOPBACK_STREAM', PROTO_CRC: 'CRC', PROTO_CREDIT: 'CREDIT',
+    PROTO_BATCH: 'BATCH', PROTO_NOACK: 'NOACK', PROTO_RESUME: 'RESUME', PROTO_STORE: 'STORE',
+}
+
+# Protocols whose commands have the 8 byte header, with a 32-bit length
+LARGE_LEN_PROTOS = (PROTO_LARGE, PROTO_CRC, PROTO_CREDIT, PROTO_BATCH, PROTO_NOACK, PROTO_RESUME, PROTO_STORE)
+
+STATUS_BUSY = 1
+STATUS_READY = 2
+STATUS_ERROR = 3
+STATUS_NAMES = {STATUS_BUSY: 'BUSY', STATUS_READY: 'READY', STATUS_ERROR: 'ERROR'}
+
+# CTRL_INIT, which resets the channel whose interface is in wIndex
+CTRL_TYPE = 0xa1
+CTRL_INIT = 0x01
+
+# Channel n's endpoints are 0x83 + 2n (IN) and 0x04 + 2n (OUT)
+BULK_IN_EP_BASE = 3
+BULK_OUT_EP_BASE = 4
+BULK_PACKET_SIZE = 64
+
+# URB statuses of transfers the host cancelled (-ENOENT, -ECONNRESET)
+CANCELLED = (-2, -104)
+
+# usbmon's text timestamps wrap every 4096 seconds
+TEXT_TS_WRAP = 4096 * 1000000
+
+def status_len(proto: int) -> int:
+    """Length of a status for proto's commands (a batch's vector is longer)."""
+    if proto == PROTO_CRC:
+        return 9
+    if proto in (PROTO_CREDIT, PROTO_NOACK):
+        return 13
+    if proto in LARGE_LEN_PROTOS:
+        return 5
+    return 3
+
+#
+# Statistics
+#
+
+class Histogram:
+    """Counts, and percentiles within 5%, of positive values - 16 buckets per
+    doubling - with their exact total, minimum and maximum."""
+    BUCKETS_PER_DOUBLING = 16
+
+    def __init__(self):
+        self.buckets = collections.Counter()
+        self.count = 0
+        self.total = 0.0
+        self.min = None
+        self.max = 0.0
+
+    def add(self, value: float):
+        self.buckets[int(math.log2(value) * self.BUCKETS_PER_DOUBLING) if value > 1 else 0] += 1
+        self.count += 1
+        self.total += value
+        if (self.min is None) or (value < self.min):
+            self.min = value
+        if value > self.max:
+            self.max = value
+
+    def percentile(self, percent: float) -> float:
+        """The value percent of values are no larger than - the top of its
+        bucket, or the maximum if that's smaller."""
+        target = self.count * percent / 100
+        running = 0
+        for bucket in sorted(self.buckets):
+            running += self.buckets[bucket]
+            if running >= target:
+                return min(2 ** ((bucket + 1) / self.BUCKETS_PER_DOUBLING), self.max)
+        return self.max
+
+class Rate:
+    """Bytes moved in one direction - in total, in each whole second, for the
+    peak rate, and how many were WRITE data, or READ or echoed data."""
+    def __init__(self):
+        self.total = 0
+        self.payload = 0
+        self.seconds = collections.Counter()
+
+    def add(self, ts_us: float, length: int):
+        self.total += length
+        self.seconds[int(ts_us // 1000000)] += length
+
+    def peak(self) -> int:
+        return max(self.seconds.values(), default=0)
+
+#
+# Protocol reassembly
+#
+
+class Command:
+    __slots__ = ('type', 'proto', 'length', 'start_us', 'echo')
+
+    def __init__(self, type: int, proto: int, length: int, start_us: float):
+        self.type = type
+        self.proto = proto
+        self.length = length
+        self.start_us = start_us
+        # A PROTO_LOOPBACK_STREAM WRITE's data comes back before its status
+        self.echo = (type == CMD_WRITE) and (proto == PROTO_LOOPBACK_STREAM) and (length > 0)
+
+    def gets_data(self) -> bool:
+        return (self.type == CMD_READ) or self.echo
+
+class Channel:
+    """One channel's protocol state, and statistics."""
+    def __init__(self, num: int):
+        self.num = num
+
+        # Bulk OUT stream - a partial command header, or WRITE data still due
+        self.header = bytearray()
+        self.header_us = 0.0
+        self.data_left = 0
+
+        # Commands awaiting responses, oldest first
+        self.pending = collections.deque()
+
+        # The bulk IN response being received
+        self.resp_len = 0
+        self.resp_head = b''
+        self.expect_zlp = False
+
+        # PROTO_NOACK WRITEs acknowledged so far, if known
+        self.noack_acked = None
+
+        self.latency = collections.defaultdict(Histogram)
+        self.statuses = collections.Counter()
+        self.out = Rate()
+        self.inp = Rate()
+        self.zero_reads = 0
+        self.lost_sync = 0
+        self.unmatched = 0
+        self.abandoned = 0
+
+    def busy(self) -> bool:
+        return bool(self.pending) or (self.data_left > 0) or (self.resp_len > 0)
+
+    def reset(self):
+        """CTRL_INIT - the device abandons everything in progress."""
+        self.abandoned += len(self.pending)
+        self.pending.clear()
+        self.header.clear()
+        self.data_left = 0
+        self.resp_len = 0
+        self.expect_zlp = False
+        self.noack_acked = 0
+
+    def out_transfer(self, ts_us: float, length: int, data: bytes):
+        """A bulk OUT transfer of length bytes, the first of which are data,
+        submitted at ts_us."""
+        self.out.add(ts_us, length)
+        pos = 0
+        while pos < length:
+            if self.data_left > 0:
+                count = min(self.data_left, length - pos)
+                self.data_left -= count
+                self.out.payload += count
+                pos += count
+                continue
+
+            if pos >= len(data):
+                # A command starts in the part of the transfer which wasn't
+                # captured - we'll take the next transfer's first bytes as
+                # the next command
+                self.lost_sync += 1
+                self.header.clear()
+                return
+
+            if not self.header:
+                self.header_us = ts_us
+            # Twice if the protocol byte shows it's an 8 byte header
+            while (pos < len(data)) and (len(self.header) < self.header_len()):
+                count = self.header_len() - len(self.header)
+                self.header += data[pos:pos + count]
+                pos += count
+            pos = min(pos, len(data))
+            if len(self.header) < self.header_len():
+                # The rest of the header is in a later transfer
+                continue
+
+            self.command()
+
+    def header_len(self) -> int:
+        if (len(self.header) >= 2) and (self.header[1] in LARGE_LEN_PROTOS):
+            return 8
+        return 4
+
+    def command(self):
+        """The command in self.header has been sent."""
+        header = self.header
+        type, proto = header[0], header[1]
+        if proto in LARGE_LEN_PROTOS:
+            length = int.from_bytes(header[4:8], 'little')
+        else:
+            length = header[2] | (header[3] << 8)
+        header.clear()
+
+        if (type == CMD_READ) and (length == 0):
+            # Gets no response
+            self.zero_reads += 1
+            return
+
+        self.pending.append(Command(type, proto, length, self.header_us))
+        if type != CMD_READ:
+            # A WRITE's data follows it - as, the device assumes, does an
+            # unsupported command's, which it throws away
+            self.data_left = length
+
+    def in_transfer(self, ts_us: float, length: int, requested: int, data: bytes):
+        """A bulk IN transfer, which asked for requested bytes (or None if
+        unknown), completed at ts_us with length bytes, the first of which
+        are data."""
+        self.inp.add(ts_us, length)
+        if (length == 0) and (self.resp_len == 0) and self.expect_zlp:
+            # Ends the previous response, which exactly filled its transfer
+            self.expect_zlp = False
+            return
+        self.expect_zlp = False
+
+        if self.resp_len == 0:
+            self.resp_head = data[:16]
+        self.resp_len += length
+
+        # A response ends with a short packet or ZLP, which ends the transfer
+        if requested is None:
+            end = (length % BULK_PACKET_SIZE) != 0 or (length == 0)
+        else:
+            end = (length < requested) or ((length % BULK_PACKET_SIZE) != 0)
+        if not end and self.pending and self.pending[0].gets_data() and (self.resp_len >= self.pending[0].length):
+            # All the data, with the ZLP which follows it still to come
+            end = True
+            self.expect_zlp = True
+
+        if end:
+            self.response(ts_us)
+            self.resp_len = 0
+
+    def response(self, ts_us: float):
+        """A complete response has been received at ts_us."""
+        if not self.pending:
+            self.unmatched += 1
+            return
+        cmd = self.pending[0]
+        head = self.resp_head
+
+        if cmd.gets_data():
+            # Unless it's a BUSY or ERROR status sent in place of the data
+            if not ((self.resp_len != cmd.length) and (self.resp_len == status_len(cmd.proto)) and
+                    head and (head[0] in (STATUS_BUSY, STATUS_ERROR))):
+                self.inp.payload += self.resp_len
+                if cmd.echo:
+                    cmd.echo = False
+                    return
+                self.pending.popleft()
+                self.complete(cmd, ts_us, None)
+                return
+
+        code = head[0] if head else None
+        if (cmd.type == CMD_WRITE) and (cmd.proto == PROTO_NOACK) and (code == STATUS_READY) and (len(head) >= 9):
+            # Acknowledges every PROTO_NOACK WRITE since the last one
+            acked = int.from_bytes(head[5:9], 'little')
+            count = 1 if self.noack_acked is None else max(1, (acked - self.noack_acked) & 0xffffffff)
+            self.noack_acked = acked
+            while (count > 0) and self.pending and (self.pending[0].type == CMD_WRITE) and \
+                  (self.pending[0].proto == PROTO_NOACK):
+                self.complete(self.pending.popleft(), ts_us, code)
+                count -= 1
+            return
+
+        self.pending.popleft()
+        self.complete(cmd, ts_us, code)
+
+    def complete(self, cmd: Command, ts_us: float, code: int):
+        self.latency[(cmd.type, cmd.proto)].add(ts_us - cmd.start_us)
+        if code is not None:
+            self.statuses[code] += 1
+
+class Device:
+    """One device's channels, and the gaps between its bulk transfers."""
+    def __init__(self, bus: int, dev: int, gap_us: float, longest: int):
+        self.bus = bus
+        self.dev = dev
+        self.channels = {}
+        self.first_us = None
+        self.last_us = None
+        self.outstanding = False
+        self.gaps = Histogram()
+        self.gap_us = gap_us
+        self.idle = [0, 0.0]        # Gaps over gap_us with nothing outstanding - count, total
+        self.stalled = [0, 0.0]     # And with commands outstanding
+        self.longest = []           # Heap of the longest gaps - (gap, ts, outstanding)
+        self.longest_count = longest
+
+    def channel(self, num: int) -> Channel:
+        if num not in self.channels:
+            self.channels[num] = Channel(num)
+        return self.channels[num]
+
+    def activity(self, ts_us: float):
+        """A bulk transfer completed at ts_us."""
+        if self.last_us is not None:
+            gap = ts_us - self.last_us
+            self.gaps.add(gap)
+            if gap >= self.gap_us:
+                outstanding = self.outstanding
+                totals = self.stalled if outstanding else self.idle
+                totals[0] += 1
+                totals[1] += gap
+                entry = (gap, self.last_us, outstanding)
+                if len(self.longest) < self.longest_count:
+                    heapq.heappush(self.longest, entry)
+                elif self.longest and (gap > self.longest[0][0]):
+                    heapq.heapreplace(self.longest, entry)
+        else:
+            self.first_us = ts_us
+        self.last_us = ts_us
+        # Whether the gap to the next transfer is the device's doing - the
+        # host may submit more commands during it
+        self.outstanding = any(ch.busy() for ch in self.channels.values())
+
+class Analyzer:
+    """Takes usbmon events, from any of the capture formats."""
+    def __init__(self, device_filter, gap_us: float, longest: int):
+        self.device_filter = device_filter
+        self.gap_us = gap_us
+        self.longest = longest
+        self.devices = {}
+        self.in_urbs = {}           # Bulk IN URBs in flight - their requested lengths
+        self.first_us = None
+        self.errors = 0
+        self.cancelled = 0
+
+    def device(self, bus: int, dev: int) -> Device:
+        key = (bus, dev)
+        if key not in self.devices:
+            self.devices[key] = Device(bus, dev, self.gap_us, self.longest)
+        return self.devices[key]
+
+    def urb(self, event: str, bulk: bool, is_in: bool, bus: int, dev: int, ep: int, tag,
+            ts_us: float, status: int, length: int, data: bytes, setup: bytes):
+        """A usbmon event - event is 'S' (submitted), 'C' (completed) or 'E'
+        (submission failed).  data is what was captured of the transfer's
+        data, and setup a control transfer's setup packet, if any."""
+        if (self.device_filter is not None) and (self.device_filter != (bus, dev)):
+            return
+        if self.first_us is None:
+            self.first_us = ts_us
+
+        if not bulk:
+            if (event == 'S') and (setup is not None) and (setup[0] == CTRL_TYPE) and (setup[1] == CTRL_INIT):
+                self.device(bus, dev).channel(setup[4] | (setup[5] << 8)).reset()
+            return
+
+        if is_in:
+            if (ep < BULK_IN_EP_BASE) or ((ep - BULK_IN_EP_BASE) % 2):
+                return
+            chan = (ep - BULK_IN_EP_BASE) // 2
+        else:
+            if (ep < BULK_OUT_EP_BASE) or ((ep - BULK_OUT_EP_BASE) % 2):
+                return
+            chan = (ep - BULK_OUT_EP_BASE) // 2
+
+        if event == 'S':
+            if is_in:
+                self.in_urbs[tag] = length
+            else:
+                self.device(bus, dev).channel(chan).out_transfer(ts_us, length, data)
+            return
+
+        requested = self.in_urbs.pop(tag, None) if is_in else None
+        if status != 0:
+            if status in CANCELLED:
+                self.cancelled += 1
+            else:
+                self.errors += 1
+            return
+        if event != 'C':
+            return
+
+        device = self.device(bus, dev)
+        if is_in:
+            device.channel(chan).in_transfer(ts_us, length, requested, data)
+        device.activity(ts_us)
+
+#
+# Capture formats
+#
+
+def read_text(f, analyzer: Analyzer):
+    """usbmon's text format, as in Documentation/usb/usbmon.rst."""
+    wrap = 0
+    last_ts = None
+    urb = analyzer.urb
+    for line in f:
+        parts = line.split()
+        if len(parts) < 6:
+            continue
+        address = parts[3]
+        xfer = address[0:1]
+        if xfer not in (b'B', b'C'):
+            continue
+        fields = address.split(b':')
+        try:
+            if len(fields) == 4:
+                bus, dev, ep = int(fields[1]), int(fields[2]), int(fields[3])
+            elif len(fields) == 3:
+                # The older format, without the bus number
+                bus, dev, ep = 0, int(fields[1]), int(fields[2])
+            else:
+                continue
+            ts = int(parts[1])
+        except ValueError:
+            continue
+        if (last_ts is not None) and (ts < last_ts - (TEXT_TS_WRAP // 2)):
+            wrap += TEXT_TS_WRAP
+        last_ts = ts
+
+        event = parts[2].decode('ascii', 'replace')
+        is_in = address[1:2] == b'i'
+        setup = None
+        try:
+            if parts[4] == b's':
+                # A control setup packet - bmRequestType bRequest wValue wIndex wLength
+                setup = struct.pack('<BBHHH', *(int(field, 16) for field in parts[5:10]))
+                status = 0
+                rest = parts[10:]
+            else:
+                status = int(parts[4].split(b':')[0])
+                rest = parts[5:]
+            length = int(rest[0])
+        except (ValueError, IndexError, struct.error):
+            continue
+
+        data = b''
+        if (xfer == b'B') and (len(rest) > 2) and (rest[1] == b'=') and ((event == 'S') != is_in):
+            try:
+                data = binascii.a2b_hex(b''.join(rest[2:]))
+            except binascii.Error:
+                pass
+        urb(event, xfer == b'B', is_in, bus, dev, ep, parts[0], ts + wrap, status, length, data, setup)
+
+# Linux usbmon packet header (struct usbmon_packet), at the start of each
+# LINKTYPE_USB_LINUX (48 bytes) or LINKTYPE_USB_LINUX_MMAPPED (64 bytes)
+# record
+LINKTYPE_USB_LINUX = 189
+LINKTYPE_USB_LINUX_MMAPPED = 220
+USBMON_HEADER_LEN = {LINKTYPE_USB_LINUX: 48, LINKTYPE_USB_LINUX_MMAPPED: 64}
+USBMON_XFER_CONTROL = 2
+USBMON_XFER_BULK = 3
+
+def usbmon_packet(analyzer: Analyzer, header: struct.Struct, header_len: int, record: bytes, ts_us: float):
+    if len(record) < header_len:
+        return
+    (id, event, xfer, epnum, dev, bus, flag_setup, _, _, _,
+     status, length, len_cap, setup) = header.unpack_from(record)
+    if xfer not in (USBMON_XFER_BULK, USBMON_XFER_CONTROL):
+        return
+    analyzer.urb(chr(event), xfer == USBMON_XFER_BULK, bool(epnum & 0x80), bus, dev, epnum & 0x7f, id,
+                 ts_us, status, length, record[header_len:header_len + len_cap],
+                 setup if flag_setup == 0 else None)
+
+def usbmon_header(endian: str) -> struct.Struct:
+    return struct.Struct(endian + 'QBBBBHbbqiiII8s')
+
+def read_pcap(f, analyzer: Analyzer):
+    magic = f.read(4)
+    if magic in (b'\xd4\xc3\xb2\xa1', b'\x4d\x3c\xb2\xa1'):
+        endian = '<'
+    else:
+        endian = '>'
+    nanoseconds = magic in (b'\x4d\x3c\xb2\xa1', b'\xa1\xb2\x3c\x4d')
+    _, _, _, _, _, linktype = struct.unpack(endian + 'HHiIII', f.read(20))
+    if linktype not in USBMON_HEADER_LEN:
+        raise ValueError(f"Not a usbmon capture (link type {linktype})")
+    header_len = USBMON_HEADER_LEN[linktype]
+    header = usbmon_header(endian)
+    record_header = struct.Struct(endian + 'IIII')
+
+    while True:
+        raw = f.read(record_header.size)
+        if len(raw) < record_header.size:
+            break
+        sec, frac, incl_len, _ = record_header.unpack(raw)
+        record = f.read(incl_len)
+        if len(record) < incl_len:
+            break
+        ts_us = sec * 1000000 + (frac / 1000 if nanoseconds else frac)
+        usbmon_packet(analyzer, header, header_len, record, ts_us)
+
+PCAPNG_SHB = 0x0a0d0d0a
+PCAPNG_IDB = 0x00000001
+PCAPNG_EPB = 0x00000006
+PCAPNG_IF_TSRESOL = 9
+
+def read_pcapng(f, analyzer: Analyzer):
+    endian = '<'
+    interfaces = []
+    while True:
+        raw = f.read(8)
+        if len(raw) < 8:
+            break
+        if raw[:4] == b'\x0a\x0d\x0d\x0a':
+            # Section header - sets the byte order of what follows
+            bom = f.read(4)
+            endian = '<' if bom == b'\x4d\x3c\x2b\x1a' else '>'
+            block_len = struct.unpack(endian + 'I', raw[4:])[0]
+            f.read(block_len - 12)
+            interfaces = []
+            continue
+        block_type, block_len = struct.unpack(endian + 'II', raw)
+        body = f.read(block_len - 8)
+        if len(body) < block_len - 8:
+            break
+
+        if block_type == PCAPNG_IDB:
+            linktype = struct.unpack_from(endian + 'H', body)[0]
+            scale_us = 1.0
+            pos = 8
+            while pos + 4 <= len(body) - 4:
+                code, opt_len = struct.unpack_from(endian + 'HH', body, pos)
+                if code == 0:
+                    break
+                if (code == PCAPNG_IF_TSRESOL) and (opt_len >= 1):
+                    resolution = body[pos + 4]
+                    if resolution & 0x80:
+                        scale_us = 1e6 / (2 ** (resolution & 0x7f))
+                    else:
+                        scale_us = 1e6 / (10 ** resolution)
+                pos += 4 + ((opt_len + 3) & ~3)
+            interfaces.append((linktype, scale_us))
+        elif block_type == PCAPNG_EPB:
+            interface, ts_high, ts_low, cap_len, _ = struct.unpack_from(endian + 'IIIII', body)
+            if interface >= len(interfaces):
+                continue
+            linktype, scale_us = interfaces[interface]
+            if linktype not in USBMON_HEADER_LEN:
+                continue
+            usbmon_packet(analyzer, usbmon_header(endian), USBMON_HEADER_LEN[linktype],
+                          body[20:20 + cap_len], ((ts_high << 32) | ts_low) * scale_us)
+
+def read_capture(f, analyzer: Analyzer):
+    """Read a capture in any of the formats, working out which from its
+    first bytes."""
+    magic = f.peek(4)[:4]
+    if magic[:2] == b'\x1f\x8b':
+        with gzip.GzipFile(fileobj=f) as unzipped:
+            return read_capture(unzipped, analyzer)
+    if magic in (b'\xd4\xc3\xb2\xa1', b'\xa1\xb2\xc3\xd4', b'\x4d\x3c\xb2\xa1', b'\xa1\xb2\x3c\x4d'):
+        read_pcap(f, analyzer)
+    elif magic == b'\x0a\x0d\x0d\x0a':
+        read_pcapng(f, analyzer)
+    else:
+        read_text(f, analyzer)
+
+#
+# Report
+#
+
+PERCENTILES = (50, 90, 99, 99.9)
+
+def command_name(type: int, proto: int) -> str:
+    name = {CMD_READ: 'READ', CMD_WRITE: 'WRITE'}.get(type, f'0x{type:02x}')
+    return f"{name} {PROTO_NAMES.get(proto, f'0x{proto:02x}')}"
+
+def print_rate(name: str, rate: Rate, span_s: float):
+    line = f"  {name:<4} {rate.total:>14} bytes ({rate.payload} payload)"
+    if span_s > 0:
+        line += f", average {rate.total / span_s / 1000:.1f} KB/s"
+    if span_s >= 1:
+        line += f", busiest second {rate.peak() / 1000:.1f} KB/s"
+    print(line)
+
+def print_channel(ch: Channel, span_s: float):
+    print(f"  channel {ch.num}")
+    print_rate('OUT', ch.out, span_s)
+    print_rate('IN', ch.inp, span_s)
+
+    print(f"    {'command':<22} {'count':>9} " + ' '.join(f"{'p' + str(p) + ' us':>10}" for p in PERCENTILES) +
+          f" {'max us':>10}")
+    for key in sorted(ch.latency):
+        hist = ch.latency[key]
+        print(f"    {command_name(*key):<22} {hist.count:>9} " +
+              ' '.join(f"{hist.percentile(p):>10.0f}" for p in PERCENTILES) + f" {hist.max:>10.0f}")
+    if ch.zero_reads:
+        print(f"    {'(0 byte READs)':<22} {ch.zero_reads:>9}")
+
+    total = sum(ch.statuses.values())
+    if total:
+        print("    statuses: " + ', '.join(
+            f"{STATUS_NAMES.get(code, f'0x{code:02x}')} {count} ({count * 100 / total:.2f}%)"
+            for code, count in sorted(ch.statuses.items())))
+
+    problems = [(len(ch.pending), 'still outstanding'), (ch.abandoned, 'abandoned by CTRL_INIT'),
+                (ch.unmatched, 'responses without a command'), (ch.lost_sync, 'commands not captured')]
+    problems = [f"{count} {what}" for count, what in problems if count]
+    if problems:
+        print("    " + ', '.join(problems))
+
+def report(analyzer: Analyzer):
+    if not analyzer.devices:
+        print("No tinyusb-vendor-example bulk traffic found")
+        return
+    for key in sorted(analyzer.devices):
+        device = analyzer.devices[key]
+        if device.first_us is None:
+            continue
+        span_s = (device.last_us - device.first_us) / 1e6
+        print(f"Device {device.bus}:{device.dev:03d} - {span_s:.3f} s from "
+              f"{(device.first_us - analyzer.first_us) / 1e6:.6f} s")
+        for num in sorted(device.channels):
+            print_channel(device.channels[num], span_s)
+
+        gaps = device.gaps
+        if gaps.count:
+            print(f"  gaps between transfers: p50 {gaps.percentile(50):.0f} us, p99 {gaps.percentile(99):.0f} us, "
+                  f"max {gaps.max:.0f} us")
+            threshold_ms = device.gap_us / 1000
+            print(f"  gaps of {threshold_ms:g} ms or more: {device.idle[0]} idle, totalling {device.idle[1] / 1000:.1f} ms, "
+                  f"{device.stalled[0]} with commands outstanding, totalling {device.stalled[1] / 1000:.1f} ms")
+            for gap, ts_us, outstanding in sorted(device.longest, reverse=True):
+                print(f"    {gap / 1000:10.3f} ms at {(ts_us - analyzer.first_us) / 1e6:.6f} s"
+                      f"{' (commands outstanding)' if outstanding else ''}")
+
+    if analyzer.errors or analyzer.cancelled:
+        print(f"{analyzer.errors} bulk transfers failed, {analyzer.cancelled} cancelled")
+
+def parse_device(arg: str) -> tuple:
+    """BUS:DEV, as in lsusb's output."""
+    bus, _, dev = arg.partition(':')
+    return (int(bus), int(dev))
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Analyze a usbmon capture of tinyusb-vendor-example traffic (text, pcap or pcapng, optionally gzipped)')
+    parser.add_argument('capture', help='Capture file (- for stdin)')
+    parser.add_argument('-d', '--device', type=parse_device, help='Only analyze this device, as BUS:DEV')
+    parser.add_argument('-g', '--gap', type=float, default=1.0,
+                        help='Report gaps between transfers of at least this many ms (default: 1)')
+    parser.add_argument('-n', '--longest', type=int, default=5, help='Number of the longest gaps to list (default: 5)')
+    args = parser.parse_args()
+
+    analyzer = Analyzer(args.device, args.gap * 1000, args.longest)
+    try:
+        if args.capture == '-':
+            read_capture(sys.stdin.buffer, analyzer)
+        else:
+            with open(args.capture, 'rb', buffering=1 << 20) as f:
+                read_capture(f, analyzer)
+    except (OSError, ValueError, EOFError, struct.error) as e:
+        print(f"Error: {e}", file=sys.stderr)
+        sys.exit(1)
+    except KeyboardInterrupt:
+        # Report what's been read so far
+        pass
+    report(analyzer)
+
+if __name__ == '__main__':
+    main()
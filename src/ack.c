@@ -0,0 +1,80 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Acknowledgement coalescing - see ack.h.
+//
+// Core 1 counts PROTO_NOACK WRITEs as it completes them, and core 0 reads
+// the counts for CTRL_ACKS, so they're atomics.  Core 1 adds a WRITE's bytes
+// before counting the WRITE, and core 0 reads the WRITE count first, so the
+// byte count it gets is never behind the WRITE count - at worst it includes
+// the next WRITE's bytes.  The counts since the last status are only used
+// by core 1.
+//
+
+#include <stdatomic.h>
+#include "pico/stdlib.h"
+#include "tusb.h"
+#include "include.h"
+#include "ack.h"
+
+typedef struct {
+    _Atomic uint32_t commands;
+    _Atomic uint32_t bytes;
+
+    // Since the last PROTO_NOACK status
+    uint32_t interval_commands;
+    uint64_t interval_bytes;
+} ack_chan_t;
+
+static ack_chan_t chans[CFG_TUD_VENDOR];
+
+void ack_init(void) {
+    for (int ii = 0; ii < CFG_TUD_VENDOR; ii++) {
+        ack_reset(ii);
+    }
+}
+
+void ack_reset(uint8_t chan) {
+    atomic_store_explicit(&chans[chan].commands, 0, memory_order_release);
+    atomic_store_explicit(&chans[chan].bytes, 0, memory_order_release);
+    ack_restart(chan);
+}
+
+bool ack_due(uint8_t chan, uint32_t len, uint8_t commands, uint8_t kb) {
+    ack_chan_t *ac = &chans[chan];
+
+    if ((commands > 0) && ((ac->interval_commands + 1) >= commands)) {
+        return true;
+    }
+    if ((kb > 0) && ((ac->interval_bytes + len) >= ((uint64_t)kb * 1024))) {
+        return true;
+    }
+    return false;
+}
+
+// Only core 1 writes the counts, so a load and store is enough
+void ack_complete(uint8_t chan, uint32_t len) {
+    ack_chan_t *ac = &chans[chan];
+    uint32_t bytes = atomic_load_explicit(&ac->bytes, memory_order_relaxed);
+    uint32_t commands = atomic_load_explicit(&ac->commands, memory_order_relaxed);
+
+    atomic_store_explicit(&ac->bytes, bytes + len, memory_order_release);
+    atomic_store_explicit(&ac->commands, commands + 1, memory_order_release);
+
+    ac->interval_commands++;
+    ac->interval_bytes += len;
+}
+
+void ack_restart(uint8_t chan) {
+    chans[chan].interval_commands = 0;
+    chans[chan].interval_bytes = 0;
+}
+
+void ack_get(uint8_t chan, uint32_t *commands, uint32_t *bytes) {
+    *commands = atomic_load_explicit(&chans[chan].commands, memory_order_acquire);
+    *bytes = atomic_load_explicit(&chans[chan].bytes, memory_order_acquire);
+}
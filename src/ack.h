@@ -0,0 +1,75 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Acknowledgement coalescing for the tinyusb vendor example.
+//
+// Every WRITE normally gets its own status response, which the host has to
+// receive - a bulk IN transfer per WRITE, however little data it carried.
+// A host streaming data to us, in many small WRITEs, mostly wants to know
+// how far we've got, so PROTO_NOACK WRITEs are instead acknowledged a group
+// at a time.  A PROTO_NOACK WRITE which completes successfully gets no status
+// of its own, unless it is the last of an ack interval, set by its command
+// header:
+//
+// - byte 2 - send a status once this many PROTO_NOACK WRITEs have completed
+//   since the last, and
+//
+// - byte 3 - send a status once this many KB of their data have been
+//   consumed since the last.
+//
+// A status is sent after the WRITE which reaches either, and 0 turns that
+// limit off.  The status carries the channel's ack counts - the number of
+// PROTO_NOACK WRITEs completed, and their bytes, counted from when the
+// channel was last initialised - so it acknowledges every PROTO_NOACK WRITE
+// before it too.  Each WRITE's header carries its own limits, so a host can
+// ask for a status after any WRITE (byte 2 of 1), say the last of a stream,
+// and the intervals are predictable, so the host always knows which WRITEs
+// to expect a status after.
+//
+// Errors aren't coalesced: a PROTO_NOACK WRITE turned away with BUSY or
+// ERROR gets a status straight away, as any other WRITE would, with the ack
+// counts as they were.  Any PROTO_NOACK status starts a new ack interval.
+// CTRL_ACKS returns the ack counts at any time.  As with credits, the counts
+// wrap at 2^32.
+//
+// chan is the channel's number, from 0.
+//
+
+#ifndef ACK_H
+#define ACK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Called once, before core 1 is launched
+void ack_init(void);
+
+//
+// Called on core 1
+//
+
+// Start counting again, when the channel is reset
+void ack_reset(uint8_t chan);
+
+// Returns true if a PROTO_NOACK WRITE of len bytes, with the ack interval
+// limits in its header, should get a status once it completes
+bool ack_due(uint8_t chan, uint32_t len, uint8_t commands, uint8_t kb);
+
+// Count a PROTO_NOACK WRITE of len bytes as completed
+void ack_complete(uint8_t chan, uint32_t len);
+
+// A PROTO_NOACK status has been sent, so start a new ack interval
+void ack_restart(uint8_t chan);
+
+//
+// Called on either core
+//
+
+// Get the channel's ack counts
+void ack_get(uint8_t chan, uint32_t *commands, uint32_t *bytes);
+
+#endif // ACK_H
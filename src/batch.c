@@ -0,0 +1,218 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Command batches - see batch.h.
+//
+// The batch's data is taken from the WRITE sink a piece at a time: each
+// command's header is copied out, a byte or more at a time as it arrives,
+// and then its data is either passed to the channel's consumer with
+// write_sink_service(), or thrown away.  Each command's status code goes
+// straight into the status vector, which a bulk IN READ source copies into
+// the engine's segment buffers once the batch is done - so the vector is
+// free for the next batch as soon as the READ has been queued.
+//
+
+#include "pico/stdlib.h"
+#include "tusb.h"
+#include "include.h"
+#include "bulk-in.h"
+#include "write-sink.h"
+#include "batch.h"
+
+// A channel's batch state
+typedef struct {
+    uint8_t count;          // Commands in the batch
+    uint8_t done;           // Commands whose headers have been received
+    bool lost;              // An unknown command - the rest is thrown away
+    bool surplus;           // Data after the last command
+
+    // The current command's header, how much of it we have, and how much of
+    // its data is left to consume
+    uint8_t header[COMMAND_LEN_LARGE];
+    uint8_t header_len;
+    uint32_t data_remaining;
+    bool discarding;        // The current command's data is thrown away
+
+    uint8_t status[STATUS_LEN_LARGE + BATCH_MAX_COMMANDS];
+    read_source_t status_src;
+} batch_chan_t;
+
+static batch_chan_t chans[CFG_TUD_VENDOR];
+
+// WRITE sink consumer for data which isn't going anywhere
+static uint32_t discard_consumer(void *ctx, const uint8_t *data, uint32_t len) {
+    (void)ctx;
+    (void)data;
+    return len;
+}
+
+// WRITE sink consumer which gathers the current command's header
+static uint32_t header_consumer(void *ctx, const uint8_t *data, uint32_t len) {
+    batch_chan_t *bc = ctx;
+
+    memcpy(&bc->header[bc->header_len], data, len);
+    bc->header_len += len;
+    return len;
+}
+
+// READ source which sends the status vector
+static uint32_t fill_status(void *ctx, uint8_t *buf, uint32_t offset, uint32_t len) {
+    batch_chan_t *bc = ctx;
+
+    memcpy(buf, &bc->status[offset], len);
+    return len;
+}
+
+// Length of the current command's header - we only know once we've got its
+// protocol byte
+static uint32_t header_len(const batch_chan_t *bc) {
+    if ((bc->header_len >= 2) && PROTO_HAS_LARGE_LEN(bc->header[1])) {
+        return COMMAND_LEN_LARGE;
+    }
+    return COMMAND_LEN;
+}
+
+// We have the whole of the next command's header - record its status, and
+// get ready for its data, if any
+static void start_command(batch_chan_t *bc) {
+    const uint8_t *header = bc->header;
+    uint8_t status = STATUS_READY;
+    uint32_t len;
+
+    if (PROTO_HAS_LARGE_LEN(header[1])) {
+        len = header[4] | (header[5] << 8) | (header[6] << 16) | ((uint32_t)header[7] << 24);
+    } else {
+        len = header[2] | (header[3] << 8);
+    }
+
+    switch (header[0]) {
+        case CMD_WRITE:
+            if ((header[1] == PROTO_LOOPBACK) || (header[1] == PROTO_LOOPBACK_STREAM) || (header[1] == PROTO_BATCH) ||
+                (header[1] == PROTO_STORE)) {
+                INFO("Unsupported WRITE in batch: protocol %d", header[1]);
+                status = STATUS_ERROR;
+            }
+            bc->data_remaining = len;
+            break;
+
+        case CMD_READ:
+            INFO("READ in batch - not supported");
+            status = STATUS_ERROR;
+            bc->data_remaining = 0;
+            break;
+
+        default:
+            INFO("Unsupported command in batch: 0x%02x 0x%02x 0x%02x 0x%02x", header[0], header[1], header[2], header[3]);
+            status = STATUS_ERROR;
+            bc->data_remaining = 0;
+            bc->lost = true;
+            break;
+    }
+
+    bc->status[STATUS_LEN_LARGE + bc->done] = status;
+    bc->done++;
+    bc->header_len = 0;
+    bc->discarding = (status != STATUS_READY);
+}
+
+void batch_init(void) {
+    for (int ii = 0; ii < CFG_TUD_VENDOR; ii++) {
+        chans[ii].status_src = (read_source_t){
+            .map = NULL,
+            .fill = fill_status,
+            .ctx = &chans[ii],
+        };
+    }
+}
+
+void batch_start(uint8_t chan, uint8_t count) {
+    batch_chan_t *bc = &chans[chan];
+
+    bc->count = count;
+    bc->done = 0;
+    bc->lost = false;
+    bc->surplus = false;
+    bc->header_len = 0;
+    bc->data_remaining = 0;
+    bc->discarding = false;
+}
+
+uint32_t batch_service(uint8_t chan, uint32_t max_len) {
+    batch_chan_t *bc = &chans[chan];
+    uint32_t total = 0;
+    uint32_t consumed;
+    uint32_t len;
+
+    while (total < max_len) {
+        len = max_len - total;
+
+        if (bc->data_remaining > 0) {
+            // The current command's data
+            if (len > bc->data_remaining) {
+                len = bc->data_remaining;
+            }
+            if (bc->discarding) {
+                consumed = write_sink_deliver(chan, len, discard_consumer, NULL);
+            } else {
+                consumed = write_sink_service(chan, len);
+            }
+            bc->data_remaining -= consumed;
+        } else if (bc->lost || (bc->done == bc->count)) {
+            // Nothing more we can make sense of
+            consumed = write_sink_deliver(chan, len, discard_consumer, NULL);
+            if ((consumed > 0) && !bc->lost) {
+                bc->surplus = true;
+            }
+        } else {
+            // The next command's header
+            if (len > (header_len(bc) - bc->header_len)) {
+                len = header_len(bc) - bc->header_len;
+            }
+            consumed = write_sink_deliver(chan, len, header_consumer, bc);
+            if (bc->header_len == header_len(bc)) {
+                start_command(bc);
+            }
+        }
+
+        if (consumed == 0) {
+            // No more data yet, or the consumer is full
+            break;
+        }
+        total += consumed;
+    }
+
+    return total;
+}
+
+uint8_t batch_send_status(uint8_t chan, uint32_t len) {
+    batch_chan_t *bc = &chans[chan];
+    uint8_t status = bc->surplus ? STATUS_ERROR : STATUS_READY;
+
+    // A command cut short by the end of the data failed, as did any the
+    // data didn't reach
+    if (bc->data_remaining > 0) {
+        bc->status[STATUS_LEN_LARGE + bc->done - 1] = STATUS_ERROR;
+    }
+    for (uint32_t ii = bc->done; ii < bc->count; ii++) {
+        bc->status[STATUS_LEN_LARGE + ii] = STATUS_ERROR;
+    }
+    for (uint32_t ii = 0; ii < bc->count; ii++) {
+        if (bc->status[STATUS_LEN_LARGE + ii] != STATUS_READY) {
+            status = STATUS_ERROR;
+        }
+    }
+
+    bc->status[0] = status;
+    bc->status[1] = (uint8_t)(len & 0xff);
+    bc->status[2] = (uint8_t)(len >> 8);
+    bc->status[3] = (uint8_t)(len >> 16);
+    bc->status[4] = (uint8_t)(len >> 24);
+    INFO("Send batch status vector on channel %d: 0x%02x 0x%08lx, %d commands", chan, status, (unsigned long)len, bc->count);
+
+    bulk_in_start_read(chan, STATUS_LEN_LARGE + bc->count, &bc->status_src);
+    return status;
+}
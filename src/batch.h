@@ -0,0 +1,67 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Command batches for the tinyusb vendor example.
+//
+// Every command costs the host a round trip's worth of work - its own OUT
+// transfer, and its own status to receive - however little data it carries.
+// A host with many small WRITEs to send (register writes, say) can instead
+// pack them into a batch: a single PROTO_BATCH WRITE, whose data is the
+// commands themselves, each a normal command header followed by its data,
+// back to back.  Byte 2 of the PROTO_BATCH command says how many commands
+// there are, up to BATCH_MAX_COMMANDS.
+//
+// The batch is answered with a single status vector - a PROTO_LARGE status
+// for the batch as a whole, followed by a status code for each command in
+// it, in order.  Each WRITE in the batch has its data passed to the
+// channel's consumer, as any other WRITE's would be, and is READY.  Anything
+// else is an ERROR: READs (which have no data), and loopback, batch and
+// store WRITEs (whose data is thrown away).  An unknown command gets an ERROR, as
+// does every command after it - we've no idea how long it is.  The batch
+// as a whole is READY only if every command in it is, and the data held
+// exactly as many commands as the batch said.  Commands missing from the
+// end of the data get ERROR.
+//
+// A command's protocol ID only sets the length of its header (see
+// command_header_len() in main.c) - a PROTO_CRC WRITE in a batch, say, gets
+// just its status code, like any other.
+//
+// The batch is one command as far as core 0, and the work queue, are
+// concerned - core 1 parses the commands as it consumes the batch's data
+// from the WRITE sink, in a single pass, with no copy of the WRITEs' data.
+// The status vector is sent like READ data, so a vector which is a
+// multiple of the packet size is followed by a zero length packet.
+//
+// Everything here runs on core 1, as part of the worker (see worker.c).
+// chan is the channel's number, from 0.
+//
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// The most commands a batch may hold - its count is a single byte
+#define BATCH_MAX_COMMANDS  255
+
+// Called once, before core 1 is launched
+void batch_init(void);
+
+// Start a PROTO_BATCH WRITE of count commands
+void batch_start(uint8_t chan, uint8_t count);
+
+// Execute as much of the batch as up to max_len bytes of its data in the
+// WRITE sink allows.  Returns the number of bytes consumed.
+uint32_t batch_service(uint8_t chan, uint32_t max_len);
+
+// Once all the batch's data has been consumed, start sending its status
+// vector, as a bulk IN READ.  len is the batch's data length.  Returns the
+// status of the batch as a whole.
+uint8_t batch_send_status(uint8_t chan, uint32_t len);
+
+#endif // BATCH_H
@@ -0,0 +1,493 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Bulk IN streaming engine.
+//
+// Data to be sent to the host is held as a queue of segments.  Each segment
+// is a pointer and length, plus counts of how many of its bytes tinyusb has
+// accepted (tud_vendor_write()) and confirmed as sent (tud_vendor_tx_cb()).
+// Segments point either at a READ source's own memory (zero-copy), at the
+// segment's READ buffer (which the source has filled), or at a small amount
+// of data copied into the segment itself (status responses).
+//
+// The segment queue is an spsc_queue_t (see spsc-queue.h).  Core 1 produces
+// segments, and core 0 consumes them:
+// - Core 1 turns as much of the current READ as there are free segments
+//   for into segments.
+// - Each pass of core 0's main loop hands as many queued bytes to tinyusb
+//   as its TX FIFO will take, and flushes only when it reaches the end of a
+//   transfer (the end of a READ, or a status response).  tinyusb starts
+//   sending by itself whenever it has a full packet, so flushing after every
+//   write only serves to send short packets.
+// - The host may have several commands in flight, so the end of one transfer
+//   can be queued right behind the start of the next.  The host reads each
+//   transfer separately, so the two must not share a packet - once we've
+//   flushed the end of a transfer we don't hand tinyusb any more data until
+//   its TX FIFO is empty, meaning the final short packet has been handed to
+//   the endpoint.
+// - A READ whose length is a multiple of the packet size doesn't end with a
+//   short packet, so we follow it with a zero length packet (ZLP).  A host
+//   which reads with a buffer larger than the READ then doesn't wait for data
+//   which will never come.  tinyusb doesn't give the vendor class a way to
+//   send one, so we do it with tinyusb's endpoint API, once the READ's last
+//   packet has gone and the endpoint is free again - and don't hand tinyusb
+//   anything more until we have.
+// - When tinyusb tells us it has sent data we walk the segments from the
+//   oldest, marking bytes as sent, and release a segment (and so its buffer)
+//   back to core 1 only once all of its bytes have been sent.  If a
+//   segment's READ is tagged, we also count how many of the READ's bytes
+//   have been sent, so a resumable transfer (see resume.h) knows how far it
+//   got.
+//
+// Each channel (vendor interface) has its own segment queue and READ, and so
+// its own bulk IN endpoint, so one channel's READ never holds up another
+// channel's responses.
+//
+// If BULK_IN_LEGACY is defined (see CMakeLists.txt) READs of the default
+// data instead use the original path - one 64 byte buffer, refilled every
+// pass whether or not its previous contents have been sent, with a flush
+// after every chunk.  This is kept so the two can be benchmarked against
+// each other: the time taken by, and the throughput of, each READ is logged
+// when the last of its data has been sent.
+//
+
+#include "pico/stdlib.h"
+#include "tusb.h"
+#include "device/usbd_pvt.h"
+#include "include.h"
+#include "spsc-queue.h"
+#include "bulk-in.h"
+#include "stats.h"
+#include "trace.h"
+#include "event.h"
+
+static_assert((BULK_IN_SEG_COUNT & (BULK_IN_SEG_COUNT - 1)) == 0, "BULK_IN_SEG_COUNT must be a power of 2");
+
+// One chunk of data to be sent to the host
+typedef struct {
+    const uint8_t *data;
+    uint8_t *buf;        // This segment's READ buffer - fixed at init
+    uint16_t len;
+    uint16_t queued;     // Bytes accepted by tud_vendor_write()
+    uint16_t acked;      // Bytes reported sent by tud_vendor_tx_cb()
+    bool flush;          // Last segment of a transfer - flush once queued
+    bool end_of_read;    // Last segment of a READ
+    bool zlp;            // Follow this segment with a zero length packet
+    uint32_t read_len;   // For the last segment of a READ, its length and
+    uint64_t start_us;   // when it started, for benchmarking
+    uint32_t tag;        // The READ's tag, if any - see bulk_in_tag_read()
+    uint8_t inline_data[BULK_IN_INLINE_LEN];
+} bulk_in_seg_t;
+
+// A channel's engine
+typedef struct {
+    // The segment queue, and the segments' READ buffers
+    bulk_in_seg_t seg_storage[BULK_IN_SEG_COUNT];
+    spsc_queue_t segs;
+    uint8_t read_bufs[BULK_IN_SEG_COUNT][READ_BUF_SIZE] __attribute__((aligned(4)));
+
+    // Core 0 state - the number of segments (from the oldest) which have
+    // been handed to tinyusb in their entirety, whether we need to flush,
+    // whether we're waiting for the end of a transfer to leave tinyusb's TX
+    // FIFO, and whether we need to send a zero length packet
+    uint32_t handed;
+    bool flush_pending;
+    bool boundary_pending;
+    bool zlp_pending;
+
+    // Core 0 state - the most recent tagged READ to have had bytes
+    // confirmed as sent, and how many
+    uint32_t sent_tag;
+    uint32_t sent_bytes;
+
+    // Core 1 state - the READ currently being turned into segments
+    const read_source_t *read_src;
+    uint32_t read_len;
+    uint32_t read_offset;
+    uint64_t read_start_us;
+    uint32_t read_tag;
+} bulk_in_chan_t;
+
+static bulk_in_chan_t chans[CFG_TUD_VENDOR];
+
+#ifdef BULK_IN_LEGACY
+static uint8_t legacy_buf[64];
+#endif // BULK_IN_LEGACY
+
+// The default READ source.  As the data never changes we can just hand
+// tinyusb the same block of 'x's over and over, without any copying.
+static const uint8_t x_block[READ_BUF_SIZE] = { [0 ... READ_BUF_SIZE - 1] = 'x' };
+
+static const uint8_t *map_x(void *ctx, uint32_t offset, uint32_t *len) {
+    (void)ctx;
+    (void)offset;
+    if (*len > sizeof(x_block)) {
+        *len = sizeof(x_block);
+    }
+    return x_block;
+}
+
+const read_source_t read_source_x = {
+    .map = map_x,
+    .fill = NULL,
+    .ctx = NULL,
+};
+
+void bulk_in_init(void) {
+    for (int ii = 0; ii < CFG_TUD_VENDOR; ii++) {
+        bulk_in_chan_t *bc = &chans[ii];
+
+        spsc_init(&bc->segs, bc->seg_storage, sizeof(bulk_in_seg_t), BULK_IN_SEG_COUNT);
+        for (int jj = 0; jj < BULK_IN_SEG_COUNT; jj++) {
+            bc->seg_storage[jj].buf = bc->read_bufs[jj];
+        }
+        bc->handed = 0;
+        bc->flush_pending = false;
+        bc->boundary_pending = false;
+        bc->zlp_pending = false;
+        bc->sent_tag = 0;
+        bc->sent_bytes = 0;
+        bc->read_src = NULL;
+    }
+}
+
+//
+// Producer side (core 1)
+//
+
+bool bulk_in_start_read(uint8_t chan, uint32_t len, const read_source_t *src) {
+    bulk_in_chan_t *bc = &chans[chan];
+
+    if (bc->read_src != NULL) {
+        return false;
+    }
+
+    bc->read_src = src;
+    bc->read_len = len;
+    bc->read_offset = 0;
+    bc->read_start_us = time_us_64();
+    bc->read_tag = 0;
+
+    return true;
+}
+
+bool bulk_in_read_active(uint8_t chan) {
+    return chans[chan].read_src != NULL;
+}
+
+void bulk_in_abort_read(uint8_t chan) {
+    chans[chan].read_src = NULL;
+}
+
+// Segments are only released once sent, so none queued means nothing is
+// left to send
+bool bulk_in_idle(uint8_t chan) {
+    bulk_in_chan_t *bc = &chans[chan];
+
+    return (bc->read_src == NULL) && (spsc_count(&bc->segs) == 0);
+}
+
+void bulk_in_tag_read(uint8_t chan, uint32_t tag) {
+    chans[chan].read_tag = tag;
+}
+
+// Get the next free segment, or return NULL if they're all in use.  It
+// isn't queued until spsc_produce_commit() is called.
+static bulk_in_seg_t *alloc_seg(bulk_in_chan_t *bc) {
+    bulk_in_seg_t *seg;
+    uint32_t count;
+
+    seg = spsc_produce_span(&bc->segs, &count);
+    if (count == 0) {
+        return NULL;
+    }
+
+    seg->queued = 0;
+    seg->acked = 0;
+    seg->flush = false;
+    seg->end_of_read = false;
+    seg->zlp = false;
+    seg->tag = 0;
+
+    return seg;
+}
+
+bool bulk_in_can_send(uint8_t chan) {
+    return spsc_space(&chans[chan].segs) > 0;
+}
+
+bool bulk_in_send(uint8_t chan, const uint8_t *data, uint16_t len) {
+    bulk_in_chan_t *bc = &chans[chan];
+    bulk_in_seg_t *seg;
+
+    if (len > BULK_IN_INLINE_LEN) {
+        return false;
+    }
+
+    seg = alloc_seg(bc);
+    if (seg == NULL) {
+        INFO("No room to queue %d byte response on channel %d", len, chan);
+        return false;
+    }
+
+    if (len > 0) {
+        memcpy(seg->inline_data, data, len);
+    }
+    seg->data = seg->inline_data;
+    seg->len = len;
+    seg->flush = true;
+    seg->zlp = (len == 0);
+    spsc_produce_commit(&bc->segs, 1);
+
+    return true;
+}
+
+// Turn the next chunk of the current READ into a segment.  Returns false if
+// there were no free segments to do so, or the source has no data yet.
+static bool queue_read_segment(bulk_in_chan_t *bc) {
+    bulk_in_seg_t *seg;
+    uint32_t len;
+
+    seg = alloc_seg(bc);
+    if (seg == NULL) {
+        return false;
+    }
+
+    len = bc->read_len - bc->read_offset;
+
+    if (len == 0) {
+        // A READ of nothing - the segment is empty, and just carries the
+        // zero length packet
+        seg->data = seg->buf;
+#ifdef BULK_IN_LEGACY
+    } else if (bc->read_src == &read_source_x) {
+        // The original path - always the same 64 byte buffer, refilled
+        // whether or not tinyusb has sent its previous contents
+        if (len > sizeof(legacy_buf)) {
+            len = sizeof(legacy_buf);
+        }
+        memset(legacy_buf, 'x', len);
+        seg->data = legacy_buf;
+        seg->flush = true;
+#endif // BULK_IN_LEGACY
+    } else if (bc->read_src->map != NULL) {
+        seg->data = bc->read_src->map(bc->read_src->ctx, bc->read_offset, &len);
+    } else {
+        if (len > READ_BUF_SIZE) {
+            len = READ_BUF_SIZE;
+        }
+        len = bc->read_src->fill(bc->read_src->ctx, seg->buf, bc->read_offset, len);
+        if (len == 0) {
+            // Nothing available yet - leave the segment free
+            return false;
+        }
+        seg->data = seg->buf;
+    }
+
+    if (len > UINT16_MAX) {
+        len = UINT16_MAX;
+    }
+    seg->len = (uint16_t)len;
+    seg->tag = bc->read_tag;
+    bc->read_offset += len;
+
+    if (bc->read_offset >= bc->read_len) {
+        // That's all the data for this READ
+        seg->flush = true;
+        seg->end_of_read = true;
+        seg->zlp = ((bc->read_len % ENDPOINT_BULK_SIZE) == 0);
+        seg->read_len = bc->read_len;
+        seg->start_us = bc->read_start_us;
+        bc->read_src = NULL;
+    }
+
+    spsc_produce_commit(&bc->segs, 1);
+    return true;
+}
+
+bool bulk_in_produce(uint8_t chan) {
+    bulk_in_chan_t *bc = &chans[chan];
+    bool queued = false;
+
+    while (bc->read_src != NULL) {
+        if (!queue_read_segment(bc)) {
+            break;
+        }
+        queued = true;
+#ifdef BULK_IN_LEGACY
+        // The original path only sent one chunk per main loop pass
+        break;
+#endif // BULK_IN_LEGACY
+    }
+    return queued;
+}
+
+//
+// Consumer side (core 0)
+//
+
+// Send a zero length packet, once the data before it has all been sent.
+// Returns false if it can't be sent yet.
+static bool send_zlp(uint8_t chan) {
+    uint8_t ep = BULK_IN_ENDPOINT_N(chan);
+
+    if (tud_vendor_n_write_available(chan) < CFG_TUD_VENDOR_TX_BUFSIZE) {
+        return false;
+    }
+    if (!usbd_edpt_claim(BOARD_TUD_RHPORT, ep)) {
+        // Still sending the last packet
+        return false;
+    }
+    if (!usbd_edpt_xfer(BOARD_TUD_RHPORT, ep, NULL, 0)) {
+        usbd_edpt_release(BOARD_TUD_RHPORT, ep);
+        return false;
+    }
+    chans[chan].zlp_pending = false;
+    return true;
+}
+
+void bulk_in_service(uint8_t chan) {
+    bulk_in_chan_t *bc = &chans[chan];
+    bulk_in_seg_t *seg;
+    uint32_t available;
+    uint32_t to_write;
+
+    while ((seg = spsc_peek(&bc->segs, bc->handed)) != NULL) {
+        if (bc->zlp_pending && !send_zlp(chan)) {
+            break;
+        }
+        available = tud_vendor_n_write_available(chan);
+        if (bc->boundary_pending) {
+            if (available < CFG_TUD_VENDOR_TX_BUFSIZE) {
+                // The end of the previous transfer is still in the FIFO
+                break;
+            }
+            bc->boundary_pending = false;
+        }
+        if (available == 0) {
+            stats_inc(STAT_TX_FIFO_FULL);
+            break;
+        }
+
+        to_write = seg->len - seg->queued;
+        if (to_write > available) {
+            to_write = available;
+        }
+        to_write = tud_vendor_n_write(chan, seg->data + seg->queued, to_write);
+        trace_event(TRACE_VENDOR_WRITE, chan, 0, to_write);
+        seg->queued += to_write;
+        DEBUG("Queued %d bytes, %d/%d of segment", to_write, seg->queued, seg->len);
+
+        if (seg->queued < seg->len) {
+            // tinyusb's FIFO is full - we'll carry on when it has room
+            break;
+        }
+
+        if (seg->flush) {
+            bc->flush_pending = true;
+            bc->boundary_pending = true;
+        }
+        if (seg->zlp) {
+            bc->zlp_pending = true;
+        }
+        bc->handed++;
+    }
+
+    // If we've got to the end of a transfer, make sure tinyusb sends any
+    // final short packet.  If it's busy sending already it will pick the
+    // remaining data up when that completes.
+    if (bc->flush_pending) {
+        tud_vendor_n_write_flush(chan);
+        bc->flush_pending = false;
+    }
+    if (bc->zlp_pending) {
+        send_zlp(chan);
+    }
+}
+
+// Log how long a READ took, so the engine can be benchmarked
+static void log_read_complete(uint8_t chan, const bulk_in_seg_t *seg) {
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+    uint32_t elapsed_us = (uint32_t)(time_us_64() - seg->start_us);
+    uint32_t kbps;
+
+    if (elapsed_us == 0) {
+        elapsed_us = 1;
+    }
+    kbps = (uint32_t)(((uint64_t)seg->read_len * 1000) / elapsed_us);
+    INFO("READ of %lu bytes on channel %d sent in %lu us (%lu KB/s)",
+        (unsigned long)seg->read_len, chan, (unsigned long)elapsed_us, (unsigned long)kbps);
+#else
+    (void)chan;
+    (void)seg;
+#endif
+}
+
+void bulk_in_tx_cb(uint8_t chan, uint32_t sent_bytes) {
+    bulk_in_chan_t *bc = &chans[chan];
+    bulk_in_seg_t *seg;
+    uint32_t acked;
+
+    while ((seg = spsc_peek(&bc->segs, 0)) != NULL) {
+        // We can only have had confirmation for bytes we've queued
+        acked = seg->queued - seg->acked;
+        if (acked > sent_bytes) {
+            acked = sent_bytes;
+        }
+        seg->acked += acked;
+        sent_bytes -= acked;
+
+        // Count a tagged READ's progress
+        if ((seg->tag != 0) && (acked > 0)) {
+            if (seg->tag != bc->sent_tag) {
+                bc->sent_tag = seg->tag;
+                bc->sent_bytes = 0;
+            }
+            bc->sent_bytes += acked;
+        }
+
+        // An empty segment (a READ of nothing) is released as soon as it
+        // has been handed to tinyusb - by the confirmation of its zero length
+        // packet, if not of the data before it
+        if ((seg->acked < seg->len) || (bc->handed == 0)) {
+            break;
+        }
+
+        // This segment has been sent in its entirety - release it, and its
+        // buffer, back to core 1
+        if (seg->end_of_read) {
+            log_read_complete(chan, seg);
+        }
+        spsc_consume_release(&bc->segs, 1);
+        bc->handed--;
+
+        // Core 1 may be waiting for a free segment
+        event_signal();
+    }
+
+    if (sent_bytes > 0) {
+        // We don't have any way to take data back from tinyusb, so after
+        // bulk_in_discard() any bytes already handed to it are still sent.
+        DEBUG("%d sent bytes not in any segment", sent_bytes);
+    }
+}
+
+uint32_t bulk_in_tagged_sent(uint8_t chan, uint32_t tag) {
+    bulk_in_chan_t *bc = &chans[chan];
+
+    return (bc->sent_tag == tag) ? bc->sent_bytes : 0;
+}
+
+void bulk_in_discard(uint8_t chan) {
+    bulk_in_chan_t *bc = &chans[chan];
+
+    spsc_consume_all(&bc->segs);
+    bc->handed = 0;
+    bc->flush_pending = false;
+    bc->boundary_pending = false;
+    bc->zlp_pending = false;
+}
@@ -0,0 +1,134 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Bulk IN (device to host) streaming engine for the tinyusb vendor example.
+//
+// Everything we send on the bulk IN endpoint - READ data and status
+// responses - goes through this engine, so it can track which bytes tinyusb
+// has been given and which it has confirmed as sent (via
+// tud_vendor_tx_cb()).  Buffers are only reused once tinyusb has confirmed
+// the data in them has been sent.
+//
+// Data is produced on core 1 (see worker.c) and handed to tinyusb on core
+// 0, via a lock-free queue of segments.
+//
+// Each channel (vendor interface - see CFG_TUD_VENDOR in tusb_config.h) has
+// its own engine, sending on its own endpoint.  chan is the channel's
+// number, from 0.
+//
+
+#ifndef BULK_IN_H
+#define BULK_IN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Number of segments (chunks of data) each channel's engine can have waiting to be
+// handed to tinyusb, or handed to tinyusb but not yet confirmed as sent.
+// Must be a power of 2.
+#define BULK_IN_SEG_COUNT    8
+
+// Size of the buffer each segment has for READ data which a source
+// generates on the fly - as much as tinyusb sends in one transfer (see
+// USB_PROFILE in tusb_config.h)
+#define READ_BUF_SIZE        CFG_TUD_VENDOR_EP_BUFSIZE
+
+// Largest response which can be queued with bulk_in_send() - it is copied
+// into the segment itself, so the caller's buffer can be reused immediately.
+#define BULK_IN_INLINE_LEN   16
+
+// A READ source supplies the data streamed to the host for a READ command.
+// It does so in one of two ways:
+// - map - return a pointer to up to *len bytes of data at offset, updating
+//   *len to the number of bytes actually available there.  This data is
+//   handed to tinyusb in place, with no copy, so must remain valid and
+//   unchanged until the engine has finished with it.
+// - fill - fill an engine owned buffer with up to len bytes of data from
+//   offset, returning how many it filled.  Used for data which is generated
+//   on the fly, or copied from elsewhere.  The buffer is word aligned, and
+//   READ_BUF_SIZE bytes long, whatever len is.  A source which doesn't have any
+//   more data yet returns 0, and is called again later.  If it fills fewer
+//   than len bytes, other than at the end of the READ, it should fill a
+//   multiple of ENDPOINT_BULK_SIZE: tinyusb sends whatever is in its TX FIFO
+//   once the previous transfer completes, and a short packet would end the
+//   READ early, as far as the host is concerned.
+//
+// Exactly one of map and fill should be non-NULL.  Sources are called on
+// core 1.
+typedef struct {
+    const uint8_t *(*map)(void *ctx, uint32_t offset, uint32_t *len);
+    uint32_t (*fill)(void *ctx, uint8_t *buf, uint32_t offset, uint32_t len);
+    void *ctx;
+} read_source_t;
+
+// The default READ source - returns ASCII 'x' characters.  See pattern.h
+// for the others.
+extern const read_source_t read_source_x;
+
+// Called once, before either core uses the engine
+void bulk_in_init(void);
+
+//
+// Producer side (core 1)
+//
+
+// Start streaming len bytes of READ data from src.  Returns false if a READ
+// is already in progress.  A len of 0 sends a zero length packet - as for a
+// READ of an empty object.  (A READ command of 0 bytes gets no response, so
+// never gets here - see handle_command().)
+bool bulk_in_start_read(uint8_t chan, uint32_t len, const read_source_t *src);
+
+// Returns true until all the data for the current READ has been queued
+bool bulk_in_read_active(uint8_t chan);
+
+// Turn as much of the current READ into queued segments as there is room for.
+// Returns true if any were queued.
+bool bulk_in_produce(uint8_t chan);
+
+// Abandon the current READ
+void bulk_in_abort_read(uint8_t chan);
+
+// Tag the current READ, so that core 0 counts how many of its bytes have
+// been sent - see bulk_in_tagged_sent().  tag must be non-zero, and differ
+// from the last READ tagged.
+void bulk_in_tag_read(uint8_t chan, uint32_t tag);
+
+// Returns true once everything queued on the channel has been sent, and no
+// READ is in progress - so the engine has finished with any memory a map
+// READ source handed it
+bool bulk_in_idle(uint8_t chan);
+
+// Returns true if there is room to queue a response with bulk_in_send()
+bool bulk_in_can_send(uint8_t chan);
+
+// Queue a short response (such as a status) to be sent after any data
+// already queued.  A 0 byte response is sent as a zero length packet.
+// Returns false if there is no room for it.
+bool bulk_in_send(uint8_t chan, const uint8_t *data, uint16_t len);
+
+//
+// Consumer side (core 0)
+//
+
+// Called from the main loop to hand as much of a channel's queued data to
+// tinyusb as it will accept
+void bulk_in_service(uint8_t chan);
+
+// Called from tud_vendor_tx_cb() with the number of bytes tinyusb has sent
+void bulk_in_tx_cb(uint8_t chan, uint32_t sent_bytes);
+
+// Returns how many bytes of the READ tagged with tag (see bulk_in_tag_read())
+// tinyusb has confirmed as sent - 0 if it isn't the READ most recently
+// tagged to have had any sent.  Unaffected by bulk_in_discard(), so it says
+// how far a READ got before it was thrown away.
+uint32_t bulk_in_tagged_sent(uint8_t chan, uint32_t tag);
+
+// Throw away all queued segments.  Core 1 must have stopped producing (see
+// worker_request_reset()).
+void bulk_in_discard(uint8_t chan);
+
+#endif // BULK_IN_H
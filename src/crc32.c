@@ -0,0 +1,89 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// CRC-32 - see crc32.h.
+//
+// The DMA sniffer's CRC32R mode bit reverses each byte before feeding it to
+// a non-reflected CRC-32, which leaves the reflected CRC's register bit
+// reversed in its accumulator.  We keep the running CRC in the usual form
+// between calls, so convert to and from the accumulator's form around each
+// transfer.  The transfer reads from the WRITE sink's ring, and writes every
+// byte to the same dummy location - it's only there to feed the sniffer.
+//
+// Each call waits for its transfer to finish.  The WRITE sink hands over at
+// most a packet or two's worth of data at a time, which the DMA reads at a
+// byte per cycle, so this takes about as long as setting the transfer up.
+//
+
+#include "pico/stdlib.h"
+#include "include.h"
+#include "crc32.h"
+
+#ifndef CRC32_TABLE
+#include "hardware/dma.h"
+
+static uint dma_chan;
+static uint8_t dma_sink;
+
+// The M0+ has no bit reverse instruction
+static inline uint32_t reverse_bits(uint32_t value) {
+    value = ((value >> 1) & 0x55555555) | ((value & 0x55555555) << 1);
+    value = ((value >> 2) & 0x33333333) | ((value & 0x33333333) << 2);
+    value = ((value >> 4) & 0x0f0f0f0f) | ((value & 0x0f0f0f0f) << 4);
+    return __builtin_bswap32(value);
+}
+
+void crc32_init(void) {
+    dma_chan = dma_claim_unused_channel(true);
+}
+
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, uint32_t len) {
+    dma_channel_config config;
+
+    if (len == 0) {
+        return crc;
+    }
+
+    config = dma_channel_get_default_config(dma_chan);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_8);
+    channel_config_set_read_increment(&config, true);
+    channel_config_set_write_increment(&config, false);
+    channel_config_set_sniff_enable(&config, true);
+
+    dma_sniffer_set_data_accumulator(reverse_bits(~crc));
+    dma_sniffer_enable(dma_chan, DMA_SNIFF_CTRL_CALC_VALUE_CRC32R, true);
+    dma_channel_configure(dma_chan, &config, &dma_sink, data, len, true);
+    dma_channel_wait_for_finish_blocking(dma_chan);
+
+    return ~reverse_bits(dma_sniffer_get_data_accumulator());
+}
+
+#else // CRC32_TABLE
+
+static uint32_t table[256];
+
+void crc32_init(void) {
+    uint32_t value;
+
+    for (uint32_t ii = 0; ii < 256; ii++) {
+        value = ii;
+        for (int bit = 0; bit < 8; bit++) {
+            value = (value & 1) ? ((value >> 1) ^ 0xedb88320) : (value >> 1);
+        }
+        table[ii] = value;
+    }
+}
+
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, uint32_t len) {
+    crc = ~crc;
+    for (uint32_t ii = 0; ii < len; ii++) {
+        crc = table[(crc ^ data[ii]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+#endif // CRC32_TABLE
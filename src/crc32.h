@@ -0,0 +1,34 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// CRC-32 of WRITE data, for PROTO_CRC WRITEs (see include.h).
+//
+// This is the common CRC-32 used by Ethernet, zlib and others (polynomial
+// 0x04c11db7, reflected, with an initial value and final XOR of
+// 0xffffffff), so the host can check it with whatever library it has to
+// hand.  Like zlib's crc32(), a running CRC starts at 0, and each call
+// returns the CRC of all the data so far.
+//
+// On the device the CRC is calculated by the DMA sniffer, while a DMA
+// channel reads the data, rather than by core 1.  If CRC32_TABLE is defined
+// (always the case in the simulator, which has no DMA) it is calculated in
+// software instead, a byte at a time, from a table.
+//
+
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stdint.h>
+
+// Called once, before core 1 is launched
+void crc32_init(void);
+
+// Returns the CRC of the data crc is the CRC of, followed by len bytes of
+// data.  Only called on core 1.
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, uint32_t len);
+
+#endif // CRC32_H
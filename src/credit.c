@@ -0,0 +1,72 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Flow control credits - see credit.h.
+//
+// Core 0 counts what it has received, and core 1 reads the counts when it
+// builds a PROTO_CREDIT status, so they're atomics.  Core 0 only counts a
+// command or data once it has added it to the work queue or WRITE sink, and
+// we read the counts before the free space, so if either changes in between
+// the room we see is smaller, never larger, than it should be.  The worst
+// that can happen is the host is told it has a little less credit than it
+// has.
+//
+
+#include <stdatomic.h>
+#include "pico/stdlib.h"
+#include "tusb.h"
+#include "include.h"
+#include "worker.h"
+#include "write-sink.h"
+#include "credit.h"
+
+// Work queue slots kept back from the command credit - see credit.h
+#if CFG_TUD_VENDOR_RX_BUFSIZE == 0
+#define RESERVED_SLOTS  1
+#else
+#define RESERVED_SLOTS  0
+#endif
+
+typedef struct {
+    _Atomic uint32_t commands;
+    _Atomic uint32_t bytes;
+} credit_chan_t;
+
+static credit_chan_t chans[CFG_TUD_VENDOR];
+
+void credit_init(void) {
+    for (int ii = 0; ii < CFG_TUD_VENDOR; ii++) {
+        credit_reset(ii);
+    }
+}
+
+void credit_reset(uint8_t chan) {
+    atomic_store_explicit(&chans[chan].commands, 0, memory_order_release);
+    atomic_store_explicit(&chans[chan].bytes, 0, memory_order_release);
+}
+
+// Only core 0 writes the counts, so a load and store is enough
+void credit_command(uint8_t chan) {
+    uint32_t commands = atomic_load_explicit(&chans[chan].commands, memory_order_relaxed);
+    atomic_store_explicit(&chans[chan].commands, commands + 1, memory_order_release);
+}
+
+void credit_bytes(uint8_t chan, uint32_t len) {
+    uint32_t bytes = atomic_load_explicit(&chans[chan].bytes, memory_order_relaxed);
+    atomic_store_explicit(&chans[chan].bytes, bytes + len, memory_order_release);
+}
+
+void credit_get(uint8_t chan, uint32_t *commands, uint32_t *bytes) {
+    uint32_t free_slots;
+
+    *commands = atomic_load_explicit(&chans[chan].commands, memory_order_acquire);
+    *bytes = atomic_load_explicit(&chans[chan].bytes, memory_order_acquire);
+
+    free_slots = worker_free(chan);
+    *commands += (free_slots > RESERVED_SLOTS) ? (free_slots - RESERVED_SLOTS) : 0;
+    *bytes += write_sink_free(chan);
+}
@@ -0,0 +1,78 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Flow control credits for the tinyusb vendor example.
+//
+// A channel has room for as many commands as core 1's work queue has free
+// slots, and as much WRITE data as its WRITE sink has free space.  A host
+// which sends more than that is held up: with tinyusb's RX FIFO the data
+// waits there, and the host sees NAKs, but without it (VENDOR_RX_UNBUFFERED)
+// we have to answer STATUS_BUSY and throw the command, and any data
+// following it, away, leaving the host to guess when to try again.
+//
+// Instead the host can pace itself by the channel's credits, which say
+// exactly how much it may send.  They are two limits, counted from when the
+// channel was last initialised (CTRL_INIT, or the device being mounted,
+// suspended and so on):
+//
+// - the command limit - the number of commands the host may have sent, and
+//
+// - the byte limit - the number of bytes of WRITE data the host may have
+//   sent.
+//
+// The host keeps its own counts, and sends the next command (or byte of
+// WRITE data) only while its count stays within the limit, waiting for new
+// credits if it doesn't.  As the limits are cumulative, they're still
+// correct however long they take to reach the host, and however many
+// commands and bytes were on their way to us at the time.  The counts and
+// limits wrap at 2^32, so compare them with (int32_t)(limit - count) >= 0.
+//
+// Each limit is what we've received so far, plus the room we have for more:
+// the free work queue slots, less one without tinyusb's RX FIFO (kept back,
+// so there's always room for an ERROR status), and the free space in the
+// WRITE sink.  So a host which keeps within its credits is never sent
+// STATUS_BUSY, and is never NAKed for want of room in the sink.
+//
+// The host reads the credits with CTRL_CREDITS, which also tells us it's
+// pacing itself by them, and they're included in every PROTO_CREDIT status
+// (see include.h).  A command rejected with a BUSY or ERROR status still
+// counts, as does the data following it, which we read and throw away (see
+// process_rx() in main.c) - so the host's counts stay in step with ours
+// whatever the status.
+//
+// chan is the channel's number, from 0.
+//
+
+#ifndef CREDIT_H
+#define CREDIT_H
+
+#include <stdint.h>
+
+// Called once, before core 1 is launched
+void credit_init(void);
+
+//
+// Called on core 0
+//
+
+// Start counting again, when the channel is initialised
+void credit_reset(uint8_t chan);
+
+// Count a command received, once it has been submitted to core 1 (or
+// rejected with a status), and WRITE data, once it has been committed to
+// the WRITE sink (or thrown away, after a rejected command)
+void credit_command(uint8_t chan);
+void credit_bytes(uint8_t chan, uint32_t len);
+
+//
+// Called on either core
+//
+
+// Get the channel's current command and byte limits
+void credit_get(uint8_t chan, uint32_t *commands, uint32_t *bytes);
+
+#endif // CREDIT_H
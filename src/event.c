@@ -0,0 +1,78 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Event driven scheduling - see event.h.
+//
+
+#include <stdatomic.h>
+#include "pico/stdlib.h"
+#include "hardware/watchdog.h"
+#include "hardware/structs/scb.h"
+#include "include.h"
+#include "event.h"
+
+// Passes of each core's loop.  Each is only written by its own core, and
+// read by the watchdog timer.
+static _Atomic uint32_t passes[2];
+
+// Only used by the watchdog timer
+static uint32_t fed_passes[2];
+static repeating_timer_t watchdog_timer;
+
+// Runs on core 0, from the timer interrupt
+static bool feed_watchdog(repeating_timer_t *rt) {
+    bool alive = true;
+
+    (void)rt;
+
+    for (int core = 0; core < 2; core++) {
+        uint32_t now = atomic_load_explicit(&passes[core], memory_order_relaxed);
+        if (now == fed_passes[core]) {
+            alive = false;
+        }
+        fed_passes[core] = now;
+    }
+
+    if (alive) {
+        watchdog_update();
+    }
+
+    // Wake both cores, so that each goes round its loop before we next check
+    __sev();
+
+    return true;
+}
+
+void event_init(void) {
+    // Have an interrupt becoming pending wake core 0 from WFE, even if it
+    // arrived just before it - so core 0 can't sleep through a USB event
+    scb_hw->scr |= M0PLUS_SCR_SEVONPEND_BITS;
+
+    if (!add_repeating_timer_ms(WATCHDOG_FEED_MS, feed_watchdog, NULL, &watchdog_timer)) {
+        INFO("Failed to start watchdog timer");
+    }
+}
+
+void event_wait(bool busy) {
+    _Atomic uint32_t *count = &passes[get_core_num()];
+
+    atomic_store_explicit(count, atomic_load_explicit(count, memory_order_relaxed) + 1, memory_order_relaxed);
+
+#ifndef BUSY_POLL
+    if (!busy) {
+        // Returns straight away if there has been an event since the last
+        // WFE, so nothing which happened during this pass is missed
+        __wfe();
+        return;
+    }
+#else // BUSY_POLL
+    (void)busy;
+#endif // BUSY_POLL
+
+    // There's more to do - go straight round again
+    tight_loop_contents();
+}
@@ -0,0 +1,61 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Event driven scheduling for the tinyusb vendor example.
+//
+// Rather than spin round their loops continuously, each core goes to sleep
+// (WFE) as soon as a pass of its loop finds nothing more to do, until there
+// is an event:
+// - Any interrupt wakes core 0 - SEVONPEND is set, so this includes one
+//   which arrives between the loop deciding to sleep and the WFE.  In
+//   particular tinyusb's USB interrupt, which queues work for tud_task(),
+//   such as a completed transfer.
+// - Either core is woken by the other calling event_signal(), which each
+//   does whenever it hands the other work, or frees up something the other
+//   may be waiting for - see the calls in worker.c, write-sink.c, bulk-in.c
+//   and core1().
+// - Both are woken every WATCHDOG_FEED_MS by the watchdog timer.
+//
+// As a core may sleep for a long time, it can't feed the watchdog itself.
+// Instead a repeating timer, on core 0, feeds it - but only if both cores
+// have been round their loops since it last did, so that if either hangs
+// the device still reboots.
+//
+// Build with -DBUSY_POLL=ON to have both cores spin instead, as they used
+// to, for comparison.
+//
+
+#ifndef EVENT_H
+#define EVENT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "hardware/sync.h"
+
+// How often the watchdog timer fires, in ms.  Must be well within the
+// watchdog's timeout (see main()).
+#define WATCHDOG_FEED_MS   100
+
+// Called once on core 0, after core 1 has been launched
+void event_init(void);
+
+// Wake the other core, if it's asleep.  This also sets the calling core's
+// own event flag, so its next event_wait() returns straight away - at worst
+// costing one extra pass of its loop.
+static inline void event_signal(void) {
+#ifndef BUSY_POLL
+    __sev();
+#endif // BUSY_POLL
+}
+
+// Called by each core at the end of every pass of its loop.  If busy is
+// false - the pass left nothing for the core to do until another event -
+// the core sleeps until there is one.  Also records that the core is still
+// running, for the watchdog timer.
+void event_wait(bool busy);
+
+#endif // EVENT_H
@@ -0,0 +1,380 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Flash backed store objects - see flash-store.h.
+//
+// Only one WRITE programs flash at a time, so there's a single sector buffer,
+// and a single record of the WRITE's progress.  Positions in it are offsets
+// into the object's slot - its data starts at FLASH_PAGE_SIZE, after the
+// header page.  Each sector the data covers is erased, filled in the buffer,
+// and programmed, in turn, and once the last has been, the header.  The
+// first sector is erased as soon as the WRITE starts, taking the old header
+// with it.
+//
+// As in store.c, everything but the occupancy counts is only used by core 1,
+// which updates the counts, as atomics, for core 0 to read for CTRL_STORE.
+//
+
+#include <stdatomic.h>
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "tusb.h"
+#include "include.h"
+#include "bulk-in.h"
+#include "write-sink.h"
+#include "store.h"
+#include "flash-store.h"
+
+static_assert((FLASH_STORE_SLOT_SIZE > 0) && ((FLASH_STORE_SLOT_SIZE % FLASH_SECTOR_SIZE) == 0),
+              "FLASH_STORE_SIZE must be a multiple of FLASH_STORE_OBJECTS sectors");
+static_assert(FLASH_STORE_SIZE <= PICO_FLASH_SIZE_BYTES, "FLASH_STORE_SIZE is larger than the flash");
+static_assert(CFG_TUD_VENDOR <= 8, "Each channel needs a bit in flash_object_t's readers");
+
+// Offset of the region from the start of the flash
+#define REGION_OFFSET   (PICO_FLASH_SIZE_BYTES - FLASH_STORE_SIZE)
+
+// Offset of the end of the firmware, from the Pico SDK's linker script.  The
+// simulator's firmware isn't in its flash, so ends at the start.
+#if defined(PICO_ON_DEVICE) && PICO_ON_DEVICE
+extern char __flash_binary_end;
+#define FIRMWARE_END    ((uintptr_t)&__flash_binary_end - XIP_BASE)
+#else
+#define FIRMWARE_END    0
+#endif
+
+// Largest object - the slot, less its header page
+#define MAX_LEN         (FLASH_STORE_SLOT_SIZE - FLASH_PAGE_SIZE)
+
+// Marks a slot's header as programmed
+#define HEADER_MAGIC    0x53484c46
+
+// The current WRITE's channel, when there isn't one
+#define NO_CHAN         0xff
+
+// The start of each slot's header page
+typedef struct {
+    uint32_t magic;
+    uint32_t len;
+    uint32_t len_check;     // ~len
+} flash_header_t;
+
+typedef struct {
+    uint32_t len;
+    uint8_t readers;        // As for store_object_t
+} flash_object_t;
+
+// The WRITE programming flash
+typedef struct {
+    uint8_t chan;           // NO_CHAN if there isn't one
+    uint8_t object;
+    uint32_t old_len;       // The object's length before it started
+    uint32_t remaining;     // Data still to be consumed
+    uint32_t sector;        // The sector the buffer is for
+    uint32_t fill;          // Where the next byte goes
+    uint32_t programmed;    // Where the data programmed so far ends
+    bool erased;            // Whether the buffer's sector has been erased
+    uint64_t next_op_us;    // When the next operation may start
+} flash_write_t;
+
+// A channel's current READ
+typedef struct {
+    const uint8_t *read_data;
+    read_source_t src;
+} flash_chan_t;
+
+static uint8_t sector_buf[FLASH_SECTOR_SIZE] __attribute__((aligned(4)));
+static flash_write_t active;
+static flash_object_t objects[FLASH_STORE_OBJECTS];
+static flash_chan_t chans[CFG_TUD_VENDOR];
+
+// For CTRL_STORE
+static _Atomic uint32_t sectors_used;
+static _Atomic uint32_t objects_used;
+
+static uint32_t slot_offset(uint8_t object) {
+    return REGION_OFFSET + ((uint32_t)object * FLASH_STORE_SLOT_SIZE);
+}
+
+// Where the slot can be read, through the XIP window
+static const uint8_t *slot_data(uint8_t object) {
+    return (const uint8_t *)(XIP_BASE + slot_offset(object));
+}
+
+static void update_counts(void) {
+    uint32_t sectors = 0;
+    uint32_t used = 0;
+
+    for (int ii = 0; ii < FLASH_STORE_OBJECTS; ii++) {
+        if (objects[ii].len > 0) {
+            sectors += (FLASH_PAGE_SIZE + objects[ii].len + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE;
+            used++;
+        }
+    }
+    atomic_store_explicit(&sectors_used, sectors, memory_order_release);
+    atomic_store_explicit(&objects_used, used, memory_order_release);
+}
+
+// Erase (data NULL) or program len bytes of flash at offset.  Nothing can be
+// read from flash until it's done, so this runs from RAM, with core 0 paused
+// and interrupts off.
+static void __not_in_flash_func(flash_op)(uint32_t offset, const uint8_t *data, uint32_t len) {
+    uint32_t ints;
+
+    multicore_lockout_start_blocking();
+    ints = save_and_disable_interrupts();
+    if (data == NULL) {
+        flash_range_erase(offset, len);
+    } else {
+        flash_range_program(offset, data, len);
+    }
+    restore_interrupts(ints);
+    multicore_lockout_end_blocking();
+}
+
+static void finish_write(void) {
+    active.chan = NO_CHAN;
+    update_counts();
+}
+
+// Carry out the current WRITE's next flash operation, if it needs one, and
+// it's due
+static void service_ops(void) {
+    flash_object_t *obj = &objects[active.object];
+    uint32_t base = slot_offset(active.object);
+    flash_header_t header;
+    uint32_t start;
+    uint32_t end;
+
+    if ((active.chan == NO_CHAN) || (time_us_64() < active.next_op_us)) {
+        return;
+    }
+
+    if (!active.erased) {
+        flash_op(base + active.sector, NULL, FLASH_SECTOR_SIZE);
+        active.erased = true;
+    } else if ((active.fill > active.programmed) &&
+               ((active.fill == (active.sector + FLASH_SECTOR_SIZE)) || (active.remaining == 0))) {
+        // Program the buffer, from the first page not yet programmed (the
+        // first sector's header page is left for now), to the end of the
+        // last page with data in
+        start = active.programmed - active.sector;
+        end = (active.fill - active.sector + FLASH_PAGE_SIZE - 1) & ~(FLASH_PAGE_SIZE - 1);
+        flash_op(base + active.sector + start, &sector_buf[start], end - start);
+        active.programmed = active.fill;
+
+        // READs on other channels can have the data now
+        obj->len = active.fill - FLASH_PAGE_SIZE;
+        update_counts();
+
+        if (active.remaining > 0) {
+            active.sector += FLASH_SECTOR_SIZE;
+            active.erased = false;
+            memset(sector_buf, 0xff, sizeof(sector_buf));
+        }
+    } else if ((active.remaining == 0) && (active.fill == active.programmed)) {
+        // The data is all in, so the header can go in too.  An empty object
+        // doesn't have one.
+        if (obj->len > 0) {
+            header.magic = HEADER_MAGIC;
+            header.len = obj->len;
+            header.len_check = ~obj->len;
+            memset(sector_buf, 0xff, FLASH_PAGE_SIZE);
+            memcpy(sector_buf, &header, sizeof(header));
+            flash_op(base, sector_buf, FLASH_PAGE_SIZE);
+        }
+        DEBUG("Flash object %d written, %lu bytes", active.object, (unsigned long)obj->len);
+        finish_write();
+    } else {
+        // Waiting for data
+        return;
+    }
+
+    active.next_op_us = time_us_64() + FLASH_STORE_OP_GAP_US;
+}
+
+// WRITE sink consumer which gathers the data into the sector buffer, up to
+// the end of its sector
+static uint32_t flash_consumer(void *ctx, const uint8_t *data, uint32_t len) {
+    uint32_t space = active.sector + FLASH_SECTOR_SIZE - active.fill;
+
+    (void)ctx;
+
+    if (len > space) {
+        len = space;
+    }
+    memcpy(&sector_buf[active.fill - active.sector], data, len);
+    active.fill += len;
+    active.remaining -= len;
+    return len;
+}
+
+// READ source which hands the object's data to the bulk IN engine straight
+// from the XIP window - it's contiguous, so it's all available at once
+static const uint8_t *map_flash(void *ctx, uint32_t offset, uint32_t *len) {
+    flash_chan_t *fc = ctx;
+
+    (void)len;
+    return fc->read_data + offset;
+}
+
+void flash_store_init(void) {
+    const flash_header_t *header;
+
+    // If the firmware reaches the region, the first WRITE would erase part
+    // of it, so stop here, before one can, rather than leave a device which
+    // won't boot next time.  Reduce FLASH_STORE_SIZE.
+    hard_assert(FIRMWARE_END <= REGION_OFFSET);
+
+    // Core 0 must be able to be paused while flash is erased or programmed
+    multicore_lockout_victim_init();
+
+    for (uint8_t ii = 0; ii < FLASH_STORE_OBJECTS; ii++) {
+        header = (const flash_header_t *)slot_data(ii);
+        objects[ii].readers = 0;
+        if ((header->magic == HEADER_MAGIC) && (header->len_check == ~header->len) &&
+            (header->len <= MAX_LEN)) {
+            objects[ii].len = header->len;
+            INFO("Flash object %d holds %lu bytes", ii, (unsigned long)header->len);
+        } else {
+            objects[ii].len = 0;
+        }
+    }
+    for (int ii = 0; ii < CFG_TUD_VENDOR; ii++) {
+        chans[ii].read_data = NULL;
+        chans[ii].src = (read_source_t){
+            .map = map_flash,
+            .fill = NULL,
+            .ctx = &chans[ii],
+        };
+    }
+    active.chan = NO_CHAN;
+    active.next_op_us = 0;
+    update_counts();
+}
+
+bool flash_store_write_ready(uint8_t chan, uint8_t object) {
+    flash_object_t *obj;
+
+    (void)chan;
+
+    if (active.chan != NO_CHAN) {
+        // Only one WRITE programs flash at a time
+        return false;
+    }
+    if (object >= FLASH_STORE_OBJECTS) {
+        // flash_store_start_write() turns it away
+        return true;
+    }
+
+    // Wait for READs of the data we're replacing to have been sent
+    obj = &objects[object];
+    for (uint8_t ii = 0; ii < CFG_TUD_VENDOR; ii++) {
+        if ((obj->readers & (1 << ii)) && bulk_in_idle(ii)) {
+            obj->readers &= (uint8_t)~(1 << ii);
+        }
+    }
+    return obj->readers == 0;
+}
+
+bool flash_store_start_write(uint8_t chan, uint8_t object, uint32_t len) {
+    if (object >= FLASH_STORE_OBJECTS) {
+        INFO("No flash object %d, for WRITE on channel %d", object, chan);
+        return false;
+    }
+    if (len > MAX_LEN) {
+        INFO("No room for %lu byte WRITE to flash object %d on channel %d", (unsigned long)len, object, chan);
+        return false;
+    }
+
+    active.chan = chan;
+    active.object = object;
+    active.old_len = objects[object].len;
+    active.remaining = len;
+    active.sector = 0;
+    active.fill = FLASH_PAGE_SIZE;
+    active.programmed = FLASH_PAGE_SIZE;
+    active.erased = false;
+    memset(sector_buf, 0xff, sizeof(sector_buf));
+
+    objects[object].len = 0;
+    update_counts();
+    return true;
+}
+
+uint32_t flash_store_service_write(uint8_t chan, uint32_t max_len) {
+    uint32_t consumed = 0;
+
+    if (active.chan != chan) {
+        return 0;
+    }
+    if (active.remaining > 0) {
+        if (max_len > active.remaining) {
+            max_len = active.remaining;
+        }
+        consumed = write_sink_deliver(chan, max_len, flash_consumer, NULL);
+    }
+    service_ops();
+    return consumed;
+}
+
+bool flash_store_write_done(uint8_t chan) {
+    return active.chan != chan;
+}
+
+uint32_t flash_store_start_read(uint8_t chan, uint8_t object, uint32_t len) {
+    flash_chan_t *fc = &chans[chan];
+    flash_object_t *obj;
+
+    if (object >= FLASH_STORE_OBJECTS) {
+        INFO("No flash object %d, for READ on channel %d", object, chan);
+        len = 0;
+    } else {
+        obj = &objects[object];
+        if (len > obj->len) {
+            INFO("Flash READ of %lu bytes on channel %d, object %d only holds %lu", (unsigned long)len, chan, object, (unsigned long)obj->len);
+            len = obj->len;
+        }
+        if (len > 0) {
+            obj->readers |= (uint8_t)(1 << chan);
+            fc->read_data = slot_data(object) + FLASH_PAGE_SIZE;
+        }
+    }
+
+    bulk_in_start_read(chan, len, &fc->src);
+    return len;
+}
+
+void flash_store_abort(uint8_t chan) {
+    if (active.chan != chan) {
+        return;
+    }
+
+    // If nothing has been erased yet, the object is still intact
+    if ((active.sector == 0) && !active.erased) {
+        objects[active.object].len = active.old_len;
+    } else {
+        objects[active.object].len = 0;
+    }
+    finish_write();
+}
+
+void flash_store_get_info(uint8_t *info) {
+    uint32_t used = atomic_load_explicit(&sectors_used, memory_order_acquire);
+    uint32_t objs = atomic_load_explicit(&objects_used, memory_order_acquire);
+    uint32_t sectors = FLASH_STORE_SIZE / FLASH_SECTOR_SIZE;
+
+    info[0] = (uint8_t)(used & 0xff);
+    info[1] = (uint8_t)(used >> 8);
+    info[2] = (uint8_t)(sectors & 0xff);
+    info[3] = (uint8_t)(sectors >> 8);
+    info[4] = (uint8_t)(FLASH_SECTOR_SIZE & 0xff);
+    info[5] = (uint8_t)(FLASH_SECTOR_SIZE >> 8);
+    info[6] = (uint8_t)objs;
+    info[7] = FLASH_STORE_OBJECTS;
+}
@@ -0,0 +1,120 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Flash backed objects for the tinyusb vendor example's object store.
+//
+// A PROTO_STORE command with STORE_FLASH in its flags (see store.h) READs or
+// WRITEs one of FLASH_STORE_OBJECTS objects kept in a region of flash
+// reserved for them, at the end of the flash, rather than in RAM - so they
+// survive the device being reset, or powered off.  Each object has a fixed
+// slot of FLASH_STORE_SLOT_SIZE bytes in the region: a header page, holding
+// the object's length, followed by its data.
+//
+// A READ streams the object's data straight from the flash, through the XIP
+// (execute in place) window the flash is mapped at, so - as for a RAM
+// object - it is never copied on the device, other than by tinyusb into its
+// FIFO.
+//
+// A WRITE replaces the object's data.  Flash can only be erased a sector
+// (FLASH_SECTOR_SIZE bytes) at a time, and programmed a page at a time, so
+// the WRITE's data is gathered into a sector sized RAM buffer, and each
+// sector is erased, and then programmed from the buffer, in one operation
+// each.  Its first operation erases the object's header, and its last
+// programs it, with the object's new length, once all its data is in flash
+// - so a WRITE which is interrupted, whether by a channel reset or by power
+// being lost, leaves the object empty, rather than holding some of its data.
+// As with a RAM object, a READ on another channel can have the data the
+// WRITE has programmed so far.  A WRITE gets its status once its data is
+// all in flash.  A WRITE which doesn't fit in the object's slot - or with
+// STORE_APPEND, which flash objects don't support - gets an ERROR status,
+// and leaves the object as it was.
+//
+// Nothing can be read from flash while it is being erased or programmed -
+// including the code either core is running - so for each operation core 1,
+// running from RAM, pauses core 0 (also in RAM - see the Pico SDK's
+// multicore_lockout_start_blocking()), and disables its own interrupts.  An
+// operation takes at most a few tens of ms (a sector erase), well within
+// the watchdog's timeout, and the USB hardware NAKs the host meanwhile.
+// Core 1 then leaves at least FLASH_STORE_OP_GAP_US before its next
+// operation, so core 0 keeps running tud_task() - answering control
+// requests, moving data, and having the watchdog fed - throughout a long
+// WRITE.  Only one WRITE can be programming flash at a time, so a flash
+// WRITE on another channel waits until the current one has finished.
+//
+// The region must be beyond the end of the firmware - FLASH_STORE_SIZE must
+// be no more than the flash left over.  flash_store_init() checks, and stops
+// the device before anything is erased if it isn't.
+//
+// Everything here runs on core 1, as part of the store (see store.c),
+// apart from flash_store_init() and flash_store_get_info().  chan is the
+// channel's number, from 0.
+//
+
+#ifndef FLASH_STORE_H
+#define FLASH_STORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Size of the region of flash reserved for the objects, at the end of the
+// flash.  Must be a multiple of FLASH_STORE_OBJECTS sectors.  Can be
+// overridden from CMakeLists.txt.
+#ifndef FLASH_STORE_SIZE
+#define FLASH_STORE_SIZE       (256 * 1024)
+#endif
+
+// Number of objects, each of which gets an equal slot of the region
+#define FLASH_STORE_OBJECTS    4
+#define FLASH_STORE_SLOT_SIZE  (FLASH_STORE_SIZE / FLASH_STORE_OBJECTS)
+
+// Minimum time core 1 leaves core 0 running between flash operations
+#define FLASH_STORE_OP_GAP_US  1000
+
+// Called once, on core 0, before core 1 is launched.  Reads the objects'
+// headers, to find what the region holds.
+void flash_store_init(void);
+
+//
+// Called on core 1
+//
+
+// Returns false if a WRITE to object must wait before starting - see above
+bool flash_store_write_ready(uint8_t chan, uint8_t object);
+
+// Start a WRITE of len bytes to object, once flash_store_write_ready()
+// returns true.  Returns false, without starting it, if the object doesn't
+// exist, or the data won't fit in its slot.
+bool flash_store_start_write(uint8_t chan, uint8_t object, uint32_t len);
+
+// Move up to max_len bytes of the current WRITE's data from the WRITE sink
+// into the sector buffer, and carry out the next flash operation, if one is
+// due.  Returns the number of bytes consumed.
+uint32_t flash_store_service_write(uint8_t chan, uint32_t max_len);
+
+// Returns true once the current WRITE's data, and header, have all been
+// programmed
+bool flash_store_write_done(uint8_t chan);
+
+// Start a READ of up to len bytes of object, by starting a bulk IN READ from
+// its slot in the XIP window.  Returns the number of bytes which will be
+// sent.
+uint32_t flash_store_start_read(uint8_t chan, uint8_t object, uint32_t len);
+
+// Abandon the channel's current WRITE, when the channel is reset.  The
+// object is left empty - unless the WRITE hadn't yet erased anything, in
+// which case it's left as it was.
+void flash_store_abort(uint8_t chan);
+
+//
+// Called on either core
+//
+
+// Fill info (STORE_INFO_LEN bytes, laid out as for the RAM pool - see
+// store.h) with the region's occupancy, counting sectors as blocks
+void flash_store_get_info(uint8_t *info);
+
+#endif // FLASH_STORE_H
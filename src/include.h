@@ -41,27 +41,34 @@ enum {
     STRID_SERIAL,
 };
 
-// Interfaces for the USB device descriptor
+// Interfaces for the USB device descriptor.  There is one vendor interface
+// per channel (CFG_TUD_VENDOR of them - see tusb_config.h), numbered from
+// ITF_NUM_VENDOR.  tinyusb numbers its vendor class instances in the same
+// order, so a channel's number is both its tinyusb itf and its interface
+// number less ITF_NUM_VENDOR.
 enum {
     ITF_NUM_VENDOR = 0,
-    ITF_NUM_TOTAL
 };
+#define ITF_NUM_TOTAL          (ITF_NUM_VENDOR + CFG_TUD_VENDOR)
 
 // These could be 0x01 and 0x02 (with the IN ORed with 0x80).  I'm setting
 // them to 0x83 and 0x04 to replicate another device.
 #define BULK_IN_ENDPOINT_DIR   0x83
 #define BULK_OUT_ENDPOINT_DIR  0x04
 
+// Further channels use the next pairs of endpoint numbers up - channel 1 has
+// 0x85 and 0x06, and so on.  The RP2040 has 15 endpoint numbers besides
+// endpoint 0, which limits us to MAX_VENDOR_CHANNELS.
+#define BULK_IN_ENDPOINT_N(n)  (BULK_IN_ENDPOINT_DIR + (2 * (n)))
+#define BULK_OUT_ENDPOINT_N(n) (BULK_OUT_ENDPOINT_DIR + (2 * (n)))
+#define MAX_VENDOR_CHANNELS    6
+
 //
 // Logging macros
 //
 
-#define INFO(fmt, ...) printf("core%d: " fmt "\n", get_core_num(), ##__VA_ARGS__)
-#ifdef DEBUG
-#define DEBUG(...)  INFO(__VA_ARGS__)
-#else
-#define DEBUG(...)
-#endif
+// INFO() and DEBUG() - see log.h
+#include "log.h"
 
 // How often to log in the loops - this is the number of interations to use as
 // a period
@@ -80,20 +87,80 @@ enum {
 #define CTRL_GITREV            0x06
 #define CTRL_GCCVER            0x07
 #define CTRL_SDKVER            0x08
+#define CTRL_STATS             0x09
+#define CTRL_PATTERN           0x0a
+#define CTRL_CREDITS           0x0b
+#define CTRL_ACKS              0x0c
+#define CTRL_RESUME            0x0d
+#define CTRL_STORE             0x0e
+#define CTRL_TRACE             0x0f
 
 // Supported write_bulk protocol commands
 #define CMD_NONE                   0
 #define CMD_READ                   8
 #define CMD_WRITE                  9
 
-// Supported command protocols
+// Supported command protocols.  PROTO_LARGE commands have an extended header
+// carrying a 32-bit data length, and get status responses with a 32-bit
+// length.  PROTO_LOOPBACK and PROTO_LOOPBACK_STREAM commands are otherwise
+// as PROTO_DEFAULT, but send WRITE data back to the host - see loopback.h.
+// PROTO_CRC commands are as PROTO_LARGE, but WRITE statuses also carry a
+// CRC-32 of the data the device received - see crc32.h.  PROTO_CREDIT
+// commands are also as PROTO_LARGE, but all their statuses carry the
+// channel's flow control credits - see credit.h.  A PROTO_BATCH WRITE's data
+// is a batch of commands, which are answered with a single status vector -
+// see batch.h.  PROTO_NOACK commands are as PROTO_LARGE, but WRITEs only get
+// a status every so often, acknowledging all those before - see ack.h.
+// PROTO_RESUME commands are also as PROTO_LARGE, but carry a transfer ID, so
+// a transfer which is interrupted can be resumed from where it got to - see
+// resume.h.  PROTO_STORE commands are also as PROTO_LARGE, but READ and
+// WRITE objects held in device RAM, or flash - see store.h.  Any other
+// protocol value is treated as PROTO_DEFAULT.
 #define PROTO_DEFAULT              16
+#define PROTO_LARGE                17
+#define PROTO_LOOPBACK             18
+#define PROTO_LOOPBACK_STREAM      19
+#define PROTO_CRC                  20
+#define PROTO_CREDIT               21
+#define PROTO_BATCH                22
+#define PROTO_NOACK                23
+#define PROTO_RESUME               24
+#define PROTO_STORE                25
+
+// Protocols whose commands and statuses have 32-bit lengths
+#define PROTO_HAS_LARGE_LEN(proto) (((proto) == PROTO_LARGE) || ((proto) == PROTO_CRC) || \
+                                    ((proto) == PROTO_CREDIT) || ((proto) == PROTO_BATCH) || \
+                                    ((proto) == PROTO_NOACK) || ((proto) == PROTO_RESUME) || \
+                                    ((proto) == PROTO_STORE))
 
 // Nmber of bytes in a write_bulk command
 #define COMMAND_LEN                4
 
-// Number of bytes in a status response
+// Number of bytes in a PROTO_LARGE (or PROTO_CRC, PROTO_CREDIT, PROTO_BATCH,
+// PROTO_NOACK, PROTO_RESUME or PROTO_STORE) command - the usual command,
+// followed by a 4 byte data length.  A PROTO_BATCH command's byte 2 is the
+// number of commands in the batch, a PROTO_NOACK command's bytes 2 and 3 are
+// its ack interval, a PROTO_RESUME command's bytes 2 and 3 its transfer ID,
+// and a PROTO_STORE command's bytes 2 and 3 its object number and flags.
+#define COMMAND_LEN_LARGE          8
+
+// Number of bytes in a status response, in a PROTO_LARGE status response,
+// and in a PROTO_CRC status response - the PROTO_LARGE status followed by a
+// 4 byte CRC, low order byte first.  The CRC is 0 in statuses which don't
+// follow a WRITE's data (BUSY and ERROR).  A PROTO_CREDIT status is the
+// PROTO_LARGE status followed by the command and byte limits (see credit.h),
+// 4 bytes each, low order byte first.  A PROTO_BATCH WRITE's status vector
+// is the PROTO_LARGE status followed by a status code per command in the
+// batch (see batch.h) - but a batch turned away before its data is received
+// (BUSY or ERROR) gets just the PROTO_LARGE status.  A PROTO_NOACK status,
+// when one is sent, is the PROTO_LARGE status followed by the ack counts (see
+// ack.h) - WRITEs, then bytes - 4 bytes each, low order byte first.
+// PROTO_RESUME and PROTO_STORE statuses are as PROTO_LARGE.
 #define STATUS_LEN                 3
+#define STATUS_LEN_LARGE           5
+#define STATUS_LEN_CRC             9
+#define STATUS_LEN_CREDIT          13
+#define STATUS_LEN_NOACK           13
 
 // Status codes for the first byte of the status response
 #define STATUS_BUSY                1
@@ -0,0 +1,154 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Generated by scripts/logtok/logtok.py header - do not edit.
+//
+// LOG_TOKEN(s) calculates the token for string literal s at compile time.
+// It must match token_hash() in logtok.py.
+//
+
+#ifndef LOG_TOKEN_HASH_H
+#define LOG_TOKEN_HASH_H
+
+#include <stdint.h>
+
+#define LOG_TOKEN_HASH_LEN  128
+
+#define LOG_HASH_TERM(s, i, k) \
+    (((i) < sizeof(s) - 1) ? (uint32_t)(k) * (uint8_t)(s)[((i) < sizeof(s) - 1) ? (i) : 0] : 0)
+
+#define LOG_TOKEN(s) ((uint32_t)(sizeof(s) - 1) \
+    + LOG_HASH_TERM(s, 0, 0x0001003fu) \
+    + LOG_HASH_TERM(s, 1, 0x007e0f81u) \
+    + LOG_HASH_TERM(s, 2, 0x2e86d0bfu) \
+    + LOG_HASH_TERM(s, 3, 0x43ec5f01u) \
+    + LOG_HASH_TERM(s, 4, 0x162c613fu) \
+    + LOG_HASH_TERM(s, 5, 0xd62aee81u) \
+    + LOG_HASH_TERM(s, 6, 0xa311b1bfu) \
+    + LOG_HASH_TERM(s, 7, 0xd319be01u) \
+    + LOG_HASH_TERM(s, 8, 0xb156c23fu) \
+    + LOG_HASH_TERM(s, 9, 0x6698cd81u) \
+    + LOG_HASH_TERM(s, 10, 0x0d1b92bfu) \
+    + LOG_HASH_TERM(s, 11, 0xcc881d01u) \
+    + LOG_HASH_TERM(s, 12, 0x7280233fu) \
+    + LOG_HASH_TERM(s, 13, 0x50c7ac81u) \
+    + LOG_HASH_TERM(s, 14, 0x8da473bfu) \
+    + LOG_HASH_TERM(s, 15, 0x4f377c01u) \
+    + LOG_HASH_TERM(s, 16, 0xfaa8843fu) \
+    + LOG_HASH_TERM(s, 17, 0x33b78b81u) \
+    + LOG_HASH_TERM(s, 18, 0x45ac54bfu) \
+    + LOG_HASH_TERM(s, 19, 0x7a27db01u) \
+    + LOG_HASH_TERM(s, 20, 0xeacfe53fu) \
+    + LOG_HASH_TERM(s, 21, 0xae686a81u) \
+    + LOG_HASH_TERM(s, 22, 0x563335bfu) \
+    + LOG_HASH_TERM(s, 23, 0x6c593a01u) \
+    + LOG_HASH_TERM(s, 24, 0xe3f6463fu) \
+    + LOG_HASH_TERM(s, 25, 0x5fda4981u) \
+    + LOG_HASH_TERM(s, 26, 0xe03916bfu) \
+    + LOG_HASH_TERM(s, 27, 0x44cb9901u) \
+    + LOG_HASH_TERM(s, 28, 0x871ba73fu) \
+    + LOG_HASH_TERM(s, 29, 0xe70d2881u) \
+    + LOG_HASH_TERM(s, 30, 0x04bdf7bfu) \
+    + LOG_HASH_TERM(s, 31, 0x227ef801u) \
+    + LOG_HASH_TERM(s, 32, 0x7540083fu) \
+    + LOG_HASH_TERM(s, 33, 0xe3010781u) \
+    + LOG_HASH_TERM(s, 34, 0xe4c1d8bfu) \
+    + LOG_HASH_TERM(s, 35, 0x24735701u) \
+    + LOG_HASH_TERM(s, 36, 0x4f63693fu) \
+    + LOG_HASH_TERM(s, 37, 0xf2b5e681u) \
+    + LOG_HASH_TERM(s, 38, 0xa144b9bfu) \
+    + LOG_HASH_TERM(s, 39, 0x69a8b601u) \
+    + LOG_HASH_TERM(s, 40, 0xb685ca3fu) \
+    + LOG_HASH_TERM(s, 41, 0xb52bc581u) \
+    + LOG_HASH_TERM(s, 42, 0x5b469abfu) \
+    + LOG_HASH_TERM(s, 43, 0x111f1501u) \
+    + LOG_HASH_TERM(s, 44, 0x4ba72b3fu) \
+    + LOG_HASH_TERM(s, 45, 0xc962a481u) \
+    + LOG_HASH_TERM(s, 46, 0x33c77bbfu) \
+    + LOG_HASH_TERM(s, 47, 0x39d67401u) \
+    + LOG_HASH_TERM(s, 48, 0xafc78c3fu) \
+    + LOG_HASH_TERM(s, 49, 0xce5a8381u) \
+    + LOG_HASH_TERM(s, 50, 0x4bc75cbfu) \
+    + LOG_HASH_TERM(s, 51, 0x02ced301u) \
+    + LOG_HASH_TERM(s, 52, 0x83e6ed3fu) \
+    + LOG_HASH_TERM(s, 53, 0x63136281u) \
+    + LOG_HASH_TERM(s, 54, 0xc4463dbfu) \
+    + LOG_HASH_TERM(s, 55, 0x8b083201u) \
+    + LOG_HASH_TERM(s, 56, 0x69054e3fu) \
+    + LOG_HASH_TERM(s, 57, 0x268d4181u) \
+    + LOG_HASH_TERM(s, 58, 0xbe441ebfu) \
+    + LOG_HASH_TERM(s, 59, 0xf1829101u) \
+    + LOG_HASH_TERM(s, 60, 0x0022af3fu) \
+    + LOG_HASH_TERM(s, 61, 0xb7c82081u) \
+    + LOG_HASH_TERM(s, 62, 0x5ac0ffbfu) \
+    + LOG_HASH_TERM(s, 63, 0x553df001u) \
+    + LOG_HASH_TERM(s, 64, 0xea3f103fu) \
+    + LOG_HASH_TERM(s, 65, 0xb5c3ff81u) \
+    + LOG_HASH_TERM(s, 66, 0xbabce0bfu) \
+    + LOG_HASH_TERM(s, 67, 0xd53a4f01u) \
+    + LOG_HASH_TERM(s, 68, 0xc85a713fu) \
+    + LOG_HASH_TERM(s, 69, 0xbf80de81u) \
+    + LOG_HASH_TERM(s, 70, 0xff37c1bfu) \
+    + LOG_HASH_TERM(s, 71, 0x9077ae01u) \
+    + LOG_HASH_TERM(s, 72, 0x3b74d23fu) \
+    + LOG_HASH_TERM(s, 73, 0x73febd81u) \
+    + LOG_HASH_TERM(s, 74, 0x4931a2bfu) \
+    + LOG_HASH_TERM(s, 75, 0xa5f60d01u) \
+    + LOG_HASH_TERM(s, 76, 0xe48e333fu) \
+    + LOG_HASH_TERM(s, 77, 0x723d9c81u) \
+    + LOG_HASH_TERM(s, 78, 0xb9aa83bfu) \
+    + LOG_HASH_TERM(s, 79, 0x34b56c01u) \
+    + LOG_HASH_TERM(s, 80, 0x64a6943fu) \
+    + LOG_HASH_TERM(s, 81, 0x593d7b81u) \
+    + LOG_HASH_TERM(s, 82, 0x71a264bfu) \
+    + LOG_HASH_TERM(s, 83, 0x5bb5cb01u) \
+    + LOG_HASH_TERM(s, 84, 0x5cbdf53fu) \
+    + LOG_HASH_TERM(s, 85, 0xc7fe5a81u) \
+    + LOG_HASH_TERM(s, 86, 0x921945bfu) \
+    + LOG_HASH_TERM(s, 87, 0x39f72a01u) \
+    + LOG_HASH_TERM(s, 88, 0x6dd4563fu) \
+    + LOG_HASH_TERM(s, 89, 0x5d803981u) \
+    + LOG_HASH_TERM(s, 90, 0x3c0f26bfu) \
+    + LOG_HASH_TERM(s, 91, 0xee798901u) \
+    + LOG_HASH_TERM(s, 92, 0x38e9b73fu) \
+    + LOG_HASH_TERM(s, 93, 0xb8c31881u) \
+    + LOG_HASH_TERM(s, 94, 0x908407bfu) \
+    + LOG_HASH_TERM(s, 95, 0x983ce801u) \
+    + LOG_HASH_TERM(s, 96, 0x5efe183fu) \
+    + LOG_HASH_TERM(s, 97, 0x78c6f781u) \
+    + LOG_HASH_TERM(s, 98, 0xb077e8bfu) \
+    + LOG_HASH_TERM(s, 99, 0x56414701u) \
+    + LOG_HASH_TERM(s, 100, 0x8111793fu) \
+    + LOG_HASH_TERM(s, 101, 0x3c8bd681u) \
+    + LOG_HASH_TERM(s, 102, 0xbceac9bfu) \
+    + LOG_HASH_TERM(s, 103, 0x4786a601u) \
+    + LOG_HASH_TERM(s, 104, 0x4023da3fu) \
+    + LOG_HASH_TERM(s, 105, 0xa311b581u) \
+    + LOG_HASH_TERM(s, 106, 0xd6dcaabfu) \
+    + LOG_HASH_TERM(s, 107, 0x8b0d0501u) \
+    + LOG_HASH_TERM(s, 108, 0x3d353b3fu) \
+    + LOG_HASH_TERM(s, 109, 0x4b589481u) \
+    + LOG_HASH_TERM(s, 110, 0x1f4d8bbfu) \
+    + LOG_HASH_TERM(s, 111, 0x3fd46401u) \
+    + LOG_HASH_TERM(s, 112, 0x19459c3fu) \
+    + LOG_HASH_TERM(s, 113, 0xd4607381u) \
+    + LOG_HASH_TERM(s, 114, 0xb73d6cbfu) \
+    + LOG_HASH_TERM(s, 115, 0x84dcc301u) \
+    + LOG_HASH_TERM(s, 116, 0x7554fd3fu) \
+    + LOG_HASH_TERM(s, 117, 0xdd295281u) \
+    + LOG_HASH_TERM(s, 118, 0xbfac4dbfu) \
+    + LOG_HASH_TERM(s, 119, 0x79262201u) \
+    + LOG_HASH_TERM(s, 120, 0xf2635e3fu) \
+    + LOG_HASH_TERM(s, 121, 0x04b33181u) \
+    + LOG_HASH_TERM(s, 122, 0x599a2ebfu) \
+    + LOG_HASH_TERM(s, 123, 0x3bb08101u) \
+    + LOG_HASH_TERM(s, 124, 0x3170bf3fu) \
+    + LOG_HASH_TERM(s, 125, 0xe9fe1081u) \
+    + LOG_HASH_TERM(s, 126, 0xa6070fbfu) \
+    + LOG_HASH_TERM(s, 127, 0xeb7be001u))
+
+#endif // LOG_TOKEN_HASH_H
@@ -0,0 +1,291 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Deferred logging backend.
+//
+// Each core has its own ring of log records, an spsc_queue_t (see
+// spsc-queue.h).  The core logging is the only producer, and core 1 (via
+// log_drain()) the only consumer, so no locks are needed, and a log call
+// never waits on the UART - or on the other core.
+//
+// The rings are merged by timestamp when drained, so records come out in
+// the order they were logged, whichever core logged them.
+//
+// With LOG_TOKENIZED, records hold a token rather than a format string, and
+// are output as a base64 encoded binary record on a line starting with '$'
+// (see scripts/logtok/logtok.py for the record format).
+//
+
+#include <stdarg.h>
+#include "pico/stdlib.h"
+#include "include.h"
+#include "spsc-queue.h"
+#include "log.h"
+
+#ifdef LOG_DEFERRED
+
+static_assert((LOG_RING_LEN & (LOG_RING_LEN - 1)) == 0, "LOG_RING_LEN must be a power of 2");
+
+#define LOG_CORES  2
+
+// A single log record
+typedef struct {
+    uint32_t time_us;
+#ifdef LOG_TOKENIZED
+    uint32_t token;
+    uint8_t str_mask;    // Which of args are strings
+#else
+    const char *fmt;
+#endif
+    uint8_t nargs;
+    uintptr_t args[LOG_MAX_ARGS];
+} log_record_t;
+
+static log_record_t ring_storage[LOG_CORES][LOG_RING_LEN];
+static spsc_queue_t rings[LOG_CORES];
+
+// Number of records dropped because a ring was full (only written by the
+// ring's producer), and the number we've reported (only used by core 1)
+static _Atomic uint32_t dropped[LOG_CORES];
+static uint32_t dropped_reported[LOG_CORES];
+
+void log_init(void) {
+    for (int ii = 0; ii < LOG_CORES; ii++) {
+        spsc_init(&rings[ii], ring_storage[ii], sizeof(log_record_t), LOG_RING_LEN);
+        atomic_store(&dropped[ii], 0);
+        dropped_reported[ii] = 0;
+    }
+}
+
+// Get the next free record on the calling core's ring, or return NULL,
+// counting the record as dropped, if it's full
+static log_record_t *alloc_record(uint32_t core) {
+    log_record_t *rec;
+    uint32_t count;
+    uint32_t drops;
+
+    rec = spsc_produce_span(&rings[core], &count);
+    if (count == 0) {
+        drops = atomic_load_explicit(&dropped[core], memory_order_relaxed);
+        atomic_store_explicit(&dropped[core], drops + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    rec->time_us = time_us_32();
+    return rec;
+}
+
+// Copy the arguments into a record, and queue it
+static void commit_record(uint32_t core, log_record_t *rec, uint32_t nargs, va_list args) {
+    if (nargs > LOG_MAX_ARGS) {
+        nargs = LOG_MAX_ARGS;
+    }
+    rec->nargs = nargs;
+    for (uint32_t ii = 0; ii < nargs; ii++) {
+        rec->args[ii] = va_arg(args, uintptr_t);
+    }
+
+    spsc_produce_commit(&rings[core], 1);
+}
+
+#ifdef LOG_TOKENIZED
+void log_write_token(uint32_t token, uint32_t str_mask, uint32_t nargs, ...) {
+    uint32_t core = get_core_num();
+    log_record_t *rec;
+    va_list args;
+
+    rec = alloc_record(core);
+    if (rec == NULL) {
+        return;
+    }
+
+    rec->token = token;
+    rec->str_mask = str_mask;
+    va_start(args, nargs);
+    commit_record(core, rec, nargs, args);
+    va_end(args);
+}
+#else // !LOG_TOKENIZED
+void log_write(const char *fmt, uint32_t nargs, ...) {
+    uint32_t core = get_core_num();
+    log_record_t *rec;
+    va_list args;
+
+    rec = alloc_record(core);
+    if (rec == NULL) {
+        return;
+    }
+
+    rec->fmt = fmt;
+    va_start(args, nargs);
+    commit_record(core, rec, nargs, args);
+    va_end(args);
+}
+#endif // LOG_TOKENIZED
+
+// Report any records dropped from a core's ring since we last did so
+static void report_dropped(uint32_t core) {
+    uint32_t drops = atomic_load_explicit(&dropped[core], memory_order_relaxed);
+
+    if (drops != dropped_reported[core]) {
+        printf("core%lu: log: %lu records dropped\n",
+            (unsigned long)core, (unsigned long)(drops - dropped_reported[core]));
+        dropped_reported[core] = drops;
+    }
+}
+
+#ifdef LOG_TOKENIZED
+// Largest encoded record - header, token, timestamp delta, and arguments
+// (strings being the longest)
+#define LOG_FRAME_MAX   (1 + 4 + 5 + (LOG_MAX_ARGS * (1 + LOG_MAX_STR_LEN)))
+
+// Timestamp of the last record output, as records hold the time since it
+static uint32_t last_time_us;
+
+static uint32_t put_varint(uint8_t *buf, uint32_t value) {
+    uint32_t len = 0;
+
+    while (value >= 0x80) {
+        buf[len++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    buf[len++] = (uint8_t)value;
+
+    return len;
+}
+
+// base64 encode len bytes of data into out, which must have room for
+// ((len + 2) / 3) * 4 + 1 characters
+static void base64_encode(const uint8_t *data, uint32_t len, char *out) {
+    static const char chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    uint32_t val;
+
+    for (uint32_t ii = 0; ii < len; ii += 3) {
+        val = data[ii] << 16;
+        if ((ii + 1) < len) {
+            val |= data[ii + 1] << 8;
+        }
+        if ((ii + 2) < len) {
+            val |= data[ii + 2];
+        }
+        *out++ = chars[(val >> 18) & 0x3f];
+        *out++ = chars[(val >> 12) & 0x3f];
+        *out++ = ((ii + 1) < len) ? chars[(val >> 6) & 0x3f] : '=';
+        *out++ = ((ii + 2) < len) ? chars[val & 0x3f] : '=';
+    }
+    *out = 0;
+}
+
+static void output_record(uint32_t core, const log_record_t *rec) {
+    static uint8_t frame[LOG_FRAME_MAX];
+    static char line[((LOG_FRAME_MAX + 2) / 3) * 4 + 1];
+    const char *str;
+    uint32_t str_len;
+    uint32_t len = 0;
+
+    frame[len++] = (uint8_t)((core << 4) | rec->nargs);
+    frame[len++] = (uint8_t)(rec->token);
+    frame[len++] = (uint8_t)(rec->token >> 8);
+    frame[len++] = (uint8_t)(rec->token >> 16);
+    frame[len++] = (uint8_t)(rec->token >> 24);
+    len += put_varint(&frame[len], rec->time_us - last_time_us);
+    last_time_us = rec->time_us;
+
+    for (uint32_t ii = 0; ii < rec->nargs; ii++) {
+        if (rec->str_mask & (1 << ii)) {
+            str = (const char *)rec->args[ii];
+            str_len = (str != NULL) ? strnlen(str, LOG_MAX_STR_LEN) : 0;
+            len += put_varint(&frame[len], str_len);
+            memcpy(&frame[len], str, str_len);
+            len += str_len;
+        } else {
+            len += put_varint(&frame[len], (uint32_t)rec->args[ii]);
+        }
+    }
+
+    base64_encode(frame, len, line);
+    printf("$%s\n", line);
+}
+#else // !LOG_TOKENIZED
+static void output_record(uint32_t core, const log_record_t *rec) {
+    const uintptr_t *a = rec->args;
+
+    // Unused arguments are ignored by printf(), so we can always pass them
+    // all
+    printf("%10lu core%lu: ", (unsigned long)rec->time_us, (unsigned long)core);
+    printf(rec->fmt, a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7]);
+    printf("\n");
+}
+#endif // LOG_TOKENIZED
+
+bool log_drain(void) {
+    log_record_t *rec = NULL;
+    log_record_t *oldest = NULL;
+    uint32_t core = 0;
+
+    // Find the oldest record at the head of either ring.  Timestamps wrap
+    // after about 71 minutes, hence the signed comparison.
+    for (uint32_t ii = 0; ii < LOG_CORES; ii++) {
+        rec = spsc_peek(&rings[ii], 0);
+        if ((rec != NULL) &&
+            ((oldest == NULL) || ((int32_t)(rec->time_us - oldest->time_us) < 0))) {
+            oldest = rec;
+            core = ii;
+        }
+    }
+
+    if (oldest == NULL) {
+        for (uint32_t ii = 0; ii < LOG_CORES; ii++) {
+            report_dropped(ii);
+        }
+        return false;
+    }
+
+    output_record(core, oldest);
+    spsc_consume_release(&rings[core], 1);
+
+    // Records are dropped when the ring is full, so report them once the
+    // records before them have been output
+    if (spsc_peek(&rings[core], 0) == NULL) {
+        report_dropped(core);
+    }
+
+    return true;
+}
+
+void log_flush(void) {
+    while (log_drain()) {
+        ;
+    }
+    fflush(stdout);
+}
+
+#else // !LOG_DEFERRED
+
+void log_init(void) {
+}
+
+void log_write(const char *fmt, uint32_t nargs, ...) {
+    (void)fmt;
+    (void)nargs;
+}
+
+void log_write_token(uint32_t token, uint32_t str_mask, uint32_t nargs, ...) {
+    (void)token;
+    (void)str_mask;
+    (void)nargs;
+}
+
+bool log_drain(void) {
+    return false;
+}
+
+void log_flush(void) {
+    fflush(stdout);
+}
+
+#endif // LOG_DEFERRED
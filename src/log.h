@@ -0,0 +1,151 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Logging for the tinyusb vendor example.
+//
+// Log calls are made at one of the levels below.  LOG_LEVEL (set from
+// CMakeLists.txt) selects the most verbose level compiled in - calls at
+// levels above it compile to nothing, so cost nothing at runtime.
+//
+// If LOG_DEFERRED is defined (the default - see CMakeLists.txt) a log call
+// doesn't format anything or touch the UART.  It just copies a record - a
+// timestamp, the format string's address and the arguments - into a
+// lock-free ring for the calling core.  Core 1 formats the records and
+// writes them to the UART (log_drain()), oldest first, as it goes round its
+// loop.  If a ring fills, records are dropped and counted, and the count is
+// logged once there is room again.
+//
+// As records are formatted later, arguments are stored as uintptr_t, so:
+// - at most LOG_MAX_ARGS arguments are supported,
+// - 64-bit arguments (%llu etc) are not supported,
+// - %s arguments must point at strings which never change, such as string
+//   literals.
+//
+// Without LOG_DEFERRED, log calls printf() directly, as they always used to.
+// This is useful if you need to see logs right up to a crash.
+//
+// If LOG_TOKENIZED is also defined, format strings aren't even compiled
+// into the firmware.  Each log call is instead identified by a token - a
+// hash of its format string, calculated at compile time - and core 1 outputs
+// the token and the raw arguments, base64 encoded, on a line starting with
+// '$'.  The build generates a dictionary of tokens (log-tokens.csv), which
+// scripts/logtok/logtok.py uses to turn the output back into text.  String
+// arguments are output in full (up to LOG_MAX_STR_LEN bytes), as the
+// dictionary can't know what they point at.
+//
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Log levels
+#define LOG_LEVEL_NONE    0
+#define LOG_LEVEL_INFO    1
+#define LOG_LEVEL_DEBUG   2
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL         LOG_LEVEL_INFO
+#endif
+
+// Number of records each core's ring can hold.  Must be a power of 2.  Can
+// be overridden from CMakeLists.txt.
+#ifndef LOG_RING_LEN
+#define LOG_RING_LEN      64
+#endif
+
+// Most arguments a single log call can take
+#define LOG_MAX_ARGS      8
+
+// Longest string argument output in full by tokenized logging
+#define LOG_MAX_STR_LEN   32
+
+#ifdef LOG_DEFERRED
+
+// Count the arguments (up to LOG_MAX_ARGS) and cast each to uintptr_t, so
+// they can be passed to log_write()
+#define LOG_NARGS(...) LOG_NARGS_(_, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define LOG_NARGS_(_, _1, _2, _3, _4, _5, _6, _7, _8, N, ...) N
+#define LOG_CAST_0()
+#define LOG_CAST_1(a)                      , (uintptr_t)(a)
+#define LOG_CAST_2(a, b)                   LOG_CAST_1(a) LOG_CAST_1(b)
+#define LOG_CAST_3(a, b, c)                LOG_CAST_2(a, b) LOG_CAST_1(c)
+#define LOG_CAST_4(a, b, c, d)             LOG_CAST_3(a, b, c) LOG_CAST_1(d)
+#define LOG_CAST_5(a, b, c, d, e)          LOG_CAST_4(a, b, c, d) LOG_CAST_1(e)
+#define LOG_CAST_6(a, b, c, d, e, f)       LOG_CAST_5(a, b, c, d, e) LOG_CAST_1(f)
+#define LOG_CAST_7(a, b, c, d, e, f, g)    LOG_CAST_6(a, b, c, d, e, f) LOG_CAST_1(g)
+#define LOG_CAST_8(a, b, c, d, e, f, g, h) LOG_CAST_7(a, b, c, d, e, f, g) LOG_CAST_1(h)
+#define LOG_CAST_N_(n)                     LOG_CAST_##n
+#define LOG_CAST_N(n)                      LOG_CAST_N_(n)
+#define LOG_CAST(...)                      LOG_CAST_N(LOG_NARGS(__VA_ARGS__))(__VA_ARGS__)
+
+#ifdef LOG_TOKENIZED
+#include "log-token-hash.h"
+
+// Build a mask of which arguments are strings, so they can be output in full
+#define LOG_IS_STR(a)                     _Generic((a), char *: 1u, const char *: 1u, default: 0u)
+#define LOG_STR_0()                       0u
+#define LOG_STR_1(a)                      LOG_IS_STR(a)
+#define LOG_STR_2(a, b)                   (LOG_STR_1(a) | (LOG_IS_STR(b) << 1))
+#define LOG_STR_3(a, b, c)                (LOG_STR_2(a, b) | (LOG_IS_STR(c) << 2))
+#define LOG_STR_4(a, b, c, d)             (LOG_STR_3(a, b, c) | (LOG_IS_STR(d) << 3))
+#define LOG_STR_5(a, b, c, d, e)          (LOG_STR_4(a, b, c, d) | (LOG_IS_STR(e) << 4))
+#define LOG_STR_6(a, b, c, d, e, f)       (LOG_STR_5(a, b, c, d, e) | (LOG_IS_STR(f) << 5))
+#define LOG_STR_7(a, b, c, d, e, f, g)    (LOG_STR_6(a, b, c, d, e, f) | (LOG_IS_STR(g) << 6))
+#define LOG_STR_8(a, b, c, d, e, f, g, h) (LOG_STR_7(a, b, c, d, e, f, g) | (LOG_IS_STR(h) << 7))
+#define LOG_STR_N_(n)                     LOG_STR_##n
+#define LOG_STR_N(n)                      LOG_STR_N_(n)
+#define LOG_STR_MASK(...)                 LOG_STR_N(LOG_NARGS(__VA_ARGS__))(__VA_ARGS__)
+
+#define LOG(fmt, ...) log_write_token(LOG_TOKEN(fmt), LOG_STR_MASK(__VA_ARGS__), LOG_NARGS(__VA_ARGS__) LOG_CAST(__VA_ARGS__))
+
+#else // !LOG_TOKENIZED
+
+#define LOG(fmt, ...) log_write(fmt, LOG_NARGS(__VA_ARGS__) LOG_CAST(__VA_ARGS__))
+
+#endif // LOG_TOKENIZED
+
+#else // !LOG_DEFERRED
+
+#define LOG(fmt, ...) printf("core%d: " fmt "\n", get_core_num(), ##__VA_ARGS__)
+
+#endif // LOG_DEFERRED
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define INFO(...)   LOG(__VA_ARGS__)
+#else
+#define INFO(...)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define DEBUG(...)  LOG(__VA_ARGS__)
+#else
+#define DEBUG(...)
+#endif
+
+// Called once on core 0, before anything is logged
+void log_init(void);
+
+// Queue a log record on the calling core's ring.  nargs arguments, each a
+// uintptr_t, follow.  Use INFO() or DEBUG() rather than calling this
+// directly.
+void log_write(const char *fmt, uint32_t nargs, ...);
+
+// As log_write(), but for tokenized logging.  Bit n of str_mask is set if
+// argument n is a string.
+void log_write_token(uint32_t token, uint32_t str_mask, uint32_t nargs, ...);
+
+// Called from core 1's loop to format and output the oldest queued record.
+// Returns false if there were none.
+bool log_drain(void);
+
+// Output all queued records.  Only call this once core 1 has been stopped,
+// as it does the job of core 1's log_drain().
+void log_flush(void);
+
+#endif // LOG_H
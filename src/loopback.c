@@ -0,0 +1,190 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Loopback modes - see loopback.h.
+//
+// Each channel's loopback buffer is a byte-wide spsc_queue_t, like the
+// WRITE sink, although here both ends are on core 1: the WRITE sink's data
+// is delivered into it, and a bulk IN READ source copies it out again.  The
+// READ source copies into the engine's segment buffers, rather than handing
+// tinyusb the data in place, so that the space is free for the next WRITE
+// as soon as the READ has been queued.
+//
+// Streaming echo doesn't use the buffer - its READ source copies data
+// straight from the WRITE sink into the segment buffers.
+//
+
+#include "pico/stdlib.h"
+#include "tusb.h"
+#include "include.h"
+#include "spsc-queue.h"
+#include "bulk-in.h"
+#include "write-sink.h"
+#include "loopback.h"
+
+static_assert((LOOPBACK_SIZE & (LOOPBACK_SIZE - 1)) == 0, "LOOPBACK_SIZE must be a power of 2");
+
+// A channel's loopback buffer, and the READ sources which send from it
+typedef struct {
+    uint8_t storage[LOOPBACK_SIZE];
+    spsc_queue_t ring;
+    uint8_t chan;
+    bool discarding;       // The current WRITE didn't fit
+    read_source_t buffer_src;
+    read_source_t echo_src;
+} loopback_chan_t;
+
+static loopback_chan_t chans[CFG_TUD_VENDOR];
+
+// Where an echo READ's data is being copied to
+typedef struct {
+    uint8_t *buf;
+    uint32_t filled;
+} echo_fill_t;
+
+// WRITE sink consumer for a WRITE which didn't fit in the loopback buffer
+static uint32_t discard_consumer(void *ctx, const uint8_t *data, uint32_t len) {
+    (void)ctx;
+    (void)data;
+    return len;
+}
+
+// WRITE sink consumer which stores the data in the loopback buffer
+static uint32_t store_consumer(void *ctx, const uint8_t *data, uint32_t len) {
+    loopback_chan_t *lc = ctx;
+    uint8_t *dst;
+    uint32_t span;
+    uint32_t total = 0;
+
+    // At most two passes, if the free space wraps
+    while (total < len) {
+        dst = spsc_produce_span(&lc->ring, &span);
+        if (span == 0) {
+            break;
+        }
+        if (span > (len - total)) {
+            span = len - total;
+        }
+        memcpy(dst, data + total, span);
+        spsc_produce_commit(&lc->ring, span);
+        total += span;
+    }
+
+    return total;
+}
+
+// READ source which sends the oldest data in the loopback buffer
+static uint32_t fill_from_buffer(void *ctx, uint8_t *buf, uint32_t offset, uint32_t len) {
+    loopback_chan_t *lc = ctx;
+    const uint8_t *src;
+    uint32_t span;
+    uint32_t total = 0;
+
+    (void)offset;
+
+    while (total < len) {
+        src = spsc_consume_span(&lc->ring, &span);
+        if (span == 0) {
+            break;
+        }
+        if (span > (len - total)) {
+            span = len - total;
+        }
+        memcpy(buf + total, src, span);
+        spsc_consume_release(&lc->ring, span);
+        total += span;
+    }
+
+    return total;
+}
+
+// WRITE sink consumer which copies the data into an echo READ's segment
+// buffer
+static uint32_t echo_consumer(void *ctx, const uint8_t *data, uint32_t len) {
+    echo_fill_t *fill = ctx;
+
+    memcpy(fill->buf + fill->filled, data, len);
+    fill->filled += len;
+    return len;
+}
+
+// READ source which sends whatever WRITE data has arrived.  Apart from the
+// end of the echo, it only sends whole packets - see read_source_t.
+static uint32_t fill_from_sink(void *ctx, uint8_t *buf, uint32_t offset, uint32_t len) {
+    loopback_chan_t *lc = ctx;
+    uint32_t available = write_sink_level(lc->chan);
+    echo_fill_t fill = {
+        .buf = buf,
+        .filled = 0,
+    };
+
+    (void)offset;
+
+    if (available < len) {
+        len = available - (available % ENDPOINT_BULK_SIZE);
+        if (len == 0) {
+            return 0;
+        }
+    }
+    return write_sink_deliver(lc->chan, len, echo_consumer, &fill);
+}
+
+void loopback_init(void) {
+    for (int ii = 0; ii < CFG_TUD_VENDOR; ii++) {
+        loopback_chan_t *lc = &chans[ii];
+
+        spsc_init(&lc->ring, lc->storage, 1, LOOPBACK_SIZE);
+        lc->chan = (uint8_t)ii;
+        lc->discarding = false;
+        lc->buffer_src = (read_source_t){
+            .map = NULL,
+            .fill = fill_from_buffer,
+            .ctx = lc,
+        };
+        lc->echo_src = (read_source_t){
+            .map = NULL,
+            .fill = fill_from_sink,
+            .ctx = lc,
+        };
+    }
+}
+
+bool loopback_start_write(uint8_t chan, uint32_t len) {
+    loopback_chan_t *lc = &chans[chan];
+
+    lc->discarding = (len > spsc_space_fresh(&lc->ring));
+    if (lc->discarding) {
+        INFO("No room for %lu byte loopback WRITE on channel %d", (unsigned long)len, chan);
+    }
+    return !lc->discarding;
+}
+
+uint32_t loopback_service_write(uint8_t chan, uint32_t max_len) {
+    loopback_chan_t *lc = &chans[chan];
+
+    return write_sink_deliver(chan, max_len, lc->discarding ? discard_consumer : store_consumer, lc);
+}
+
+uint32_t loopback_start_read(uint8_t chan, uint32_t len) {
+    loopback_chan_t *lc = &chans[chan];
+    uint32_t held = spsc_available_fresh(&lc->ring);
+
+    if (len > held) {
+        INFO("Loopback READ of %lu bytes on channel %d, only %lu held", (unsigned long)len, chan, (unsigned long)held);
+        len = held;
+    }
+    bulk_in_start_read(chan, len, &lc->buffer_src);
+    return len;
+}
+
+void loopback_start_echo(uint8_t chan, uint32_t len) {
+    bulk_in_start_read(chan, len, &chans[chan].echo_src);
+}
+
+void loopback_discard(uint8_t chan) {
+    spsc_consume_all(&chans[chan].ring);
+}
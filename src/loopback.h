@@ -0,0 +1,67 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Loopback modes for the tinyusb vendor example, used to test the device's
+// data path, and measure its round trip latency, with data the host can
+// check.  They are selected by the command's protocol ID:
+//
+// - PROTO_LOOPBACK - store and forward.  A WRITE's data is kept in the
+//   channel's loopback buffer, rather than thrown away, and subsequent
+//   READs return it, oldest first.  A READ returns at most as much data as
+//   the buffer holds, so may be short (or, if the buffer is empty, just a
+//   zero length packet).  A WRITE with more data than there is room for in
+//   the buffer is consumed, but its data thrown away, and it gets an ERROR
+//   status.
+//
+// - PROTO_LOOPBACK_STREAM - streaming echo.  A WRITE's data is sent straight
+//   back, as it arrives, as if it were the data of a READ of the same
+//   length, followed by the WRITE's status.  Nothing is stored, so the
+//   WRITE can be of any length, and the loop is continuous - the host must
+//   read the echoed data while it sends, or the device stops accepting it.
+//
+// Everything here runs on core 1, as part of the worker (see worker.c).
+// Each channel has its own loopback buffer.  chan is the channel's number,
+// from 0.
+//
+
+#ifndef LOOPBACK_H
+#define LOOPBACK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Size of each channel's loopback buffer - the most WRITE data which can be
+// held for READs.  Must be a power of 2.  Can be overridden from
+// CMakeLists.txt.
+#ifndef LOOPBACK_SIZE
+#define LOOPBACK_SIZE    4096
+#endif
+
+// Called once, before core 1 is launched
+void loopback_init(void);
+
+// Start a PROTO_LOOPBACK WRITE of len bytes.  Returns false if there isn't
+// room for them in the buffer, in which case loopback_service_write()
+// throws the data away.
+bool loopback_start_write(uint8_t chan, uint32_t len);
+
+// Move up to max_len bytes of the current WRITE's data from the WRITE sink
+// into the buffer.  Returns the number of bytes consumed.
+uint32_t loopback_service_write(uint8_t chan, uint32_t max_len);
+
+// Start a PROTO_LOOPBACK READ of up to len bytes, by starting a bulk IN
+// READ from the buffer.  Returns the number of bytes which will be sent.
+uint32_t loopback_start_read(uint8_t chan, uint32_t len);
+
+// Start a PROTO_LOOPBACK_STREAM WRITE of len bytes, by starting a bulk IN
+// READ of len bytes, which is fed from the WRITE sink as the data arrives
+void loopback_start_echo(uint8_t chan, uint32_t len);
+
+// Throw away everything in the buffer, when the channel is reset
+void loopback_discard(uint8_t chan);
+
+#endif // LOOPBACK_H
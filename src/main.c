@@ -6,8 +6,9 @@
 
 //
 // This example demonstrates a simple USB device that uses the tinyusb stack
-// to implement a vendor class device.  The device has a single interface, and
-// supports both control and bulk transfers.
+// to implement a vendor class device.  The device has a vendor interface per
+// channel (one, unless configured with more - see CFG_TUD_VENDOR in
+// tusb_config.h), and supports both control and bulk transfers.
 //
 // While the protocol this example implements can be considered arbitrary, it
 // actually is a subset of the protocol used by the xum1541 project, which
@@ -26,23 +27,43 @@
 
 // Our own header files
 #include "include.h"
+#include "bulk-in.h"
+#include "write-sink.h"
+#include "loopback.h"
+#include "batch.h"
+#include "pattern.h"
+#include "crc32.h"
+#include "credit.h"
+#include "ack.h"
+#include "resume.h"
+#include "store.h"
+#include "worker.h"
+#include "stats.h"
+#include "trace.h"
+#include "event.h"
 
 // Forward declaration of functions later in main.c that we need to call from
 // main()
 void core1(void);
 void example_tight_loop_contents(char *loop_name);
 void maybe_send_data(void);
+void maybe_receive_data(void);
+void init_channels(void);
 void enter_bootloader(void);
 
 // Our main function, which
 // - Sets up the pico, a watchdog and the tinyusb stack
-// - Runs a loop scheduling tinyusb, feeding the watchdog and implementing our
-//   sample protocol
+// - Runs a loop scheduling tinyusb and implementing our sample protocol,
+//   sleeping whenever there's nothing to do (see event.h)
 void main(void) {
     // Initialize the Pico
     stdio_init_all();
     stdio_set_driver_enabled(&stdio_uart, true);
 
+    // Set up logging before we log anything.  Logs are output by core 1, so
+    // won't appear until it has started.
+    log_init();
+
     INFO("-----");
     INFO("tinyusb vendor example started");
 
@@ -53,19 +74,39 @@ void main(void) {
         INFO("Watchdog caused last reboot");
     }
 
+    // Set up the queues core 0 and core 1 use to communicate, and the
+    // counters they both update, before core 1 starts using them
+    stats_init();
+    trace_init();
+    worker_init();
+    bulk_in_init();
+    write_sink_init();
+    loopback_init();
+    batch_init();
+    pattern_init();
+    crc32_init();
+    credit_init();
+    ack_init();
+    resume_init();
+    store_init();
+    init_channels();
+
     // Create a new task on core 1.
     //
-    // This is a no-op in this example, but you could in theory run your
-    // business logic on one core, and schedule tinyusb on the other core (so
-    // long as you have some thread safe mechanism to communicate between
-    // them).
+    // In this example we schedule tinyusb on core 0, and run our business
+    // logic - executing READ and WRITE commands - on core 1.  The two
+    // communicate using lock-free queues (see worker.c), so neither ever has
+    // to wait for the other, and a slow command never stops us servicing
+    // USB.
     //
-    // Or run usb and business logic on one task, and other tasks, such as
-    // WiFi handling, on the other core.
+    // Alternatively you could run usb and business logic on one core, and
+    // other tasks, such as WiFi handling, on the other core.
     //
-    // Just remember, if you use a watchdog, to feed it with with
-    // watchdog_update from both cores.
+    // Just remember, if you use a watchdog, to make sure it can tell if
+    // either core stops running.  Here a timer feeds it, as long as both
+    // cores are still going round their loops (see event.c).
     multicore_launch_core1(core1);
+    event_init();
 
     // Initialize tinyusb
     board_init();  // This is a Pico specific tinyusb board init function
@@ -73,64 +114,173 @@ void main(void) {
 
     // Now enter our main loop, running forever
     while (true) {
+        uint32_t task_start_us;
+
         // Makes this tight loop searchable (even though it's not strictly a
         // tight loop because it does some work)
         example_tight_loop_contents("main loop");
+        stats_inc(STAT_MAIN_LOOPS);
 
         // Schedule tinyusb device stack to allow it to do some work.
         // While incoming USB packets are received by tinyusb via interrupts,
         // it doesn't call our callbacks via interrupts.  Instead it queues
         // them up and schedules them from within tud_task().  Hence if you
         // don't call tud_task(), USB won't work!
+        //
+        // We time it, as it's where our callbacks run, to see how long
+        // they hold up USB servicing.
+        task_start_us = time_us_32();
         tud_task();
+        stats_tud_task(time_us_32() - task_start_us);
 
-        // See if we were requested to send data, and if so, send it
+        // Send any data core 1 has queued for the host
         maybe_send_data();
 
-        // Feed the watchdog
-        watchdog_update();
+        // Take any data from tinyusb which we didn't previously have room
+        // for
+        maybe_receive_data();
+
+        // Sleep until there's something more to do - a USB interrupt, core 1
+        // having sent or consumed data, or the watchdog timer.  Anything
+        // which is waiting now is waiting on one of these, unless tinyusb
+        // queued more work for tud_task() during this pass.
+        event_wait(tud_task_event_ready());
     }
 }
 
 //
 // Our sample protocol handling code
 //
+// This runs on core 0.  It parses commands, and moves WRITE data from
+// tinyusb into the WRITE sink, but the commands themselves are executed on
+// core 1 (see worker.c) - which produces READ data, consumes WRITE data and
+// sends status responses.
+//
 
-// Some statics to support reading/writing arbitrary amounts of data from/to
-// the host in response to a WRITE or READ command (coming in from
-// write_bulk).
+// A run of identical statuses sent from core 0 (see send_status_response())
+// waiting for room in core 1's work queue
+typedef struct {
+    uint8_t proto;
+    uint8_t status;
+    bool empty_echo;
+    uint32_t count;
+} held_status_t;
+
+// How many runs of statuses a channel can hold - each a different protocol,
+// status, or kind of WRITE from the one before
+#define HELD_STATUS_RUNS  8
+
+// Each channel - a vendor interface, with its own pair of bulk endpoints -
+// has its own protocol state, so commands on one channel are received, and
+// executed, independently of those on any other.  In particular a long READ
+// or WRITE on one channel doesn't hold up commands on another.
+//
+// The state supports reading/writing arbitrary amounts of data from/to the
+// host in response to a WRITE or READ command (coming in from write_bulk).
 //
-// See tud_vendor_rx_cb() for more details
+// See process_rx() for more details
 //
 // expected_data_len of 0 means we expect a command as the next transfer.
 //
-// If expected_data_len is non-zero, we are expecting to receive or send
-// data.  We expect a remainder of (expected_data_len - handled_data_len)
-// bytes.
+// If expected_data_len is non-zero, we are expecting to receive data.  We
+// expect a remainder of (expected_data_len - handled_data_len) bytes.  (For
+// a READ we have nothing to do ourselves, so go straight back to expecting a
+// command.)
 //
-// If handled_data_len == expected_data_len we're done on this command 
+// After a command we've rejected (with BUSY, or ERROR), we throw away the
+// WRITE data which follows it in the same way - current_command is then
+// CMD_DISCARD - so that we take the next command from where the host put
+// it, rather than from the middle of that data.
 //
-// These are
-// statics, so they retain their values across callbacks (but are not
-// thread-safe, if running this example on multiple cores).
-static uint16_t expected_data_len = 0;
-static uint16_t handled_data_len = 0;
+// If handled_data_len == expected_data_len, we're done on this command, and
+// ready for the next one.  We don't wait for core 1 to finish executing it
+// - the host may have several commands in flight at once, up to the length
+// of core 1's work queue (see process_rx()).
+//
+// This state is only used on core 0.
+
+typedef struct {
+    // The channel's number - its tinyusb vendor itf
+    uint8_t num;
+
+    uint32_t expected_data_len;
+    uint32_t handled_data_len;
+
+    // The command being received, and how many bytes of it we have so far.
+    // A command may arrive split across packets, and PROTO_LARGE commands
+    // are longer than others - see command_header_len().
+    uint8_t rx_command[COMMAND_LEN_LARGE];
+    uint8_t rx_command_len;
+
+    // The current command (received from write_bulk) whose data we're
+    // receiving.  This is only ever CMD_WRITE, CMD_DISCARD or CMD_NONE, as
+    // core 0 has nothing to do for any other command once it's been passed
+    // to core 1.
+    uint8_t current_command;
+
+    // Set when we've asked core 1 to reset, and it hasn't yet done so
+    bool reset_pending;
+
+    // Set once the host has read the channel's credits (see credit.h) since
+    // it was initialised, so is pacing itself by them - see
+    // can_accept_command()
+    bool paced;
+
+    // Statuses waiting for room in core 1's work queue, oldest first - see
+    // send_status_response()
+    held_status_t held[HELD_STATUS_RUNS];
+    uint8_t held_runs;
+
+#if CFG_TUD_VENDOR_RX_BUFSIZE == 0
+    // The data passed to tud_vendor_rx_cb(), and how much of it is left -
+    // see rx_available()
+    uint8_t const *rx_packet;
+    uint32_t rx_packet_len;
+#endif
+} channel_t;
 
-// Static holding the current command (received from write_bulk) being
-// executed
-static uint8_t current_command = CMD_NONE;
+// current_command while we throw away a rejected command's data.  Not a
+// command the host can send.
+#define CMD_DISCARD  0xff
 
-// Buffer used to return a status. As this is a static, and we could receive
-// and handle another command before the usb stack manages to send the status
-// we shouldn't reuse this buffer between commands, without providing some
-// sort of checking (for example in tud_vendor_rx_cb()), but we will anyway.
-static uint8_t status[STATUS_LEN];
+static channel_t channels[CFG_TUD_VENDOR];
 
 // Used by our protocol handling to reset data read once we've read/written
 // the data associated with a WRITE command
-void reset_data(void) {
-    expected_data_len = 0;
-    handled_data_len = 0;
+void reset_data(channel_t *ch) {
+    ch->expected_data_len = 0;
+    ch->handled_data_len = 0;
+}
+
+// Pass a work item to core 1.  There's always room - we only take a
+// command once there's a free slot in core 1's work queue for it (see
+// process_rx()), and statuses without one are held (see
+// send_status_response()).
+void submit_work(channel_t *ch, const work_item_t *item) {
+    bool submitted = worker_submit(ch->num, item);
+    hard_assert(submitted);
+}
+
+// Pass as many of the channel's held statuses to core 1 as its work queue
+// has room for.  Once this has been called, if there's any room, none are
+// left held.
+void release_held_statuses(channel_t *ch) {
+    held_status_t *run = &ch->held[0];
+
+    while ((ch->held_runs > 0) && (worker_space(ch->num) > 0)) {
+        work_item_t item = {
+            .type = WORK_SEND_STATUS,
+            .proto = run->proto,
+            .status = run->status,
+            .empty_echo = run->empty_echo,
+        };
+
+        submit_work(ch, &item);
+        if (--run->count == 0) {
+            ch->held_runs--;
+            memmove(&ch->held[0], &ch->held[1], ch->held_runs * sizeof(ch->held[0]));
+        }
+    }
 }
 
 // Send a status back in response to a bulk command.  The format of the status
@@ -138,96 +288,575 @@ void reset_data(void) {
 // byte 0 - a 1 byte status value (STATUS_BUSY, STATUS_READY or STATUS_ERROR)
 // byte 1 - low order byte of data length
 // byte 2 - high order byte of data length
-void send_status_response(uint8_t status_val, uint16_t data_len) {
-    static_assert(STATUS_LEN == 3);
-    
-    // Fill in the status 
-    status[0] = status_val;
-    status[1] = (uint8_t)(data_len & 0xff);
-    status[2] = (uint8_t)(data_len >> 8);
-    INFO("All data received - send status response: 0x%02x 0x%02x 0x%02x", status[0], status[1], status[2]);
-
-    // Send it - and flush the write buffer to ensure it gets sent immediately
-    tud_vendor_write(status, STATUS_LEN);
-    tud_vendor_write_flush();
-}
-
-// Used to send data from within our main loop, if we received a command
-// asking us to send data.  We'll send up to the amount tinyusb will let us
-// (and that we need to send), every time we're called.
+//
+// For PROTO_LARGE commands the data length is 4 bytes (bytes 1-4), low order
+// byte first.  PROTO_CRC statuses are as PROTO_LARGE, followed by the
+// 4 byte CRC of the WRITE's data (bytes 5-8), added by core 1.  PROTO_CREDIT
+// statuses are also as PROTO_LARGE, followed by the channel's credits (bytes
+// 5-12 - see credit.h), also added by core 1.  A PROTO_BATCH WRITE is
+// answered with a status vector (see batch.h) once core 1 has executed it,
+// but the statuses sent from here, turning a batch away, are as PROTO_LARGE.
+// PROTO_NOACK statuses are as PROTO_LARGE, followed by the channel's ack
+// counts (bytes 5-12 - see ack.h), added by core 1 - those sent from here
+// are always sent, but core 1 only sends one for some successful WRITEs.
+// PROTO_RESUME and PROTO_STORE statuses are as PROTO_LARGE.
+//
+// We ask core 1 to send it, so that it is sent after any data core 1 has
+// already queued for earlier commands.  The statuses we send from here all
+// have a data length of 0.  empty_echo is set for a PROTO_LOOPBACK_STREAM
+// WRITE with data, which gets an empty echo first (see reject_command()).
+//
+// If core 1's work queue is full, the status is held on the channel until
+// there's room (see release_held_statuses()), rather than lost - so every
+// command the host sends gets its response, whenever it sends it.  Until
+// they've all gone, anything else for core 1 waits behind them (see
+// process_rx()), so they're still sent in order.
+void send_status_response(channel_t *ch, uint8_t proto, uint8_t status_val, bool empty_echo) {
+    held_status_t *run;
+    work_item_t item = {
+        .type = WORK_SEND_STATUS,
+        .proto = proto,
+        .status = status_val,
+        .empty_echo = empty_echo,
+    };
+
+    release_held_statuses(ch);
+    if (worker_space(ch->num) > 0) {
+        submit_work(ch, &item);
+        return;
+    }
+
+    INFO("Work queue full - holding status 0x%02x on channel %d", status_val, ch->num);
+    if (ch->held_runs > 0) {
+        run = &ch->held[ch->held_runs - 1];
+        if ((run->proto == proto) && (run->status == status_val) && (run->empty_echo == empty_echo)) {
+            run->count++;
+            return;
+        }
+    }
+
+    // A host would have to pipeline many more commands than we can queue,
+    // of many different kinds, to get here
+    hard_assert(ch->held_runs < HELD_STATUS_RUNS);
+    run = &ch->held[ch->held_runs++];
+    run->proto = proto;
+    run->status = status_val;
+    run->empty_echo = empty_echo;
+    run->count = 1;
+}
+
+// Returns false if we're still waiting for core 1 to finish resetting (see
+// init_protocol_handling()).  Once it has, we can throw away anything it
+// queued to send before it did so.
+bool check_reset_complete(channel_t *ch) {
+    if (ch->reset_pending) {
+        if (!worker_reset_done(ch->num)) {
+            return false;
+        }
+        bulk_in_discard(ch->num);
+        ch->reset_pending = false;
+    }
+    return true;
+}
+
+// Called from within our main loop to send any data core 1 has queued for
+// the host.  If we received a READ command, core 1 generates the data for it
+// and the bulk IN engine (see bulk-in.c) hands as much as tinyusb will
+// accept to it each time we're called.
+//
+// Until a channel's reset is complete, anything queued on it is about to be
+// thrown away, so there's no point handing it to tinyusb.  Once it is, we
+// also pass core 1 any statuses held for want of room in its work queue.
 void maybe_send_data(void) {
-    // We're going to use this static to send data.  This is a bit naughty
-    // as it might get overwritten by a subsequent send if tinyusb doesn't
-    // send it quickly.  In reality this is unlikely to be a problem for
-    // small amounts of data at low speeds. 
-    static uint8_t send_buffer[64];
-
-    // Local variables used to figure out how many bytes to send this time
-    uint32_t max_bytes_to_send;
-    uint16_t want_to_send;
-    uint16_t try_to_send;
-
-    // Number of bytes sent
-    uint32_t sent;
-    
-    if (current_command == CMD_READ) {
-        // We are expecting to send data
-
-        // We can only send as many bytes as tinyusb will let us (based on its
-        // internal buffer).
-        max_bytes_to_send = tud_vendor_write_available();
-
-        // We have this many bytes to actually send
-        want_to_send = expected_data_len - handled_data_len;
-        
-        // Get the minimum of the two values
-        if (want_to_send > max_bytes_to_send) {
-            try_to_send = max_bytes_to_send;
-        } else {
-            try_to_send = want_to_send;
+    for (int ii = 0; ii < CFG_TUD_VENDOR; ii++) {
+        if (check_reset_complete(&channels[ii])) {
+            release_held_statuses(&channels[ii]);
+            bulk_in_service(channels[ii].num);
         }
+    }
+}
 
-        // Now we're going to use a stack buffer to send the data.  We will
-        // cap this at 64 bytes to avoid blowing the stack.  In reality, the
-        // max endpoint buf size is likely to be 64 bytes, so all should be
-        // good.
-        //
-        // Note that using a stack buffer is a bit naughty.  The USB stack
-        // may 
-        if (try_to_send > 64) {
-            INFO("We wanted to send more than 64 bytes (%d), capping at 64", try_to_send);
-            try_to_send = 64;
+// Used by tud_vendor_control_xfer_cb() to initialize a channel's protocol
+// handling on a CTRL_INIT command.
+//
+// Core 1 may be part way through a command, so we ask it to abandon it, and
+// anything else we've given it on this channel.  Until it has done so we
+// don't send any data, or take any more from tinyusb.  The channel's
+// resumable transfer record (see resume.h) is kept, so that an interrupted
+// PROTO_RESUME transfer can carry on from where it got to, as are the
+// objects in the store (see store.h).
+void init_channel(channel_t *ch) {
+    ch->current_command = CMD_NONE;
+    ch->rx_command_len = 0;
+    reset_data(ch);
+    ch->reset_pending = true;
+    ch->paced = false;
+    ch->held_runs = 0;
+    worker_request_reset(ch->num);
+    credit_reset(ch->num);
+
+#if CFG_TUD_VENDOR_RX_BUFSIZE > 0
+    // Throw away anything left in tinyusb's RX FIFO from a previous command
+    if (tud_mounted()) {
+        stats_inc(STAT_RX_FLUSH);
+        tud_vendor_n_read_flush(ch->num);
+    }
+#endif
+}
+
+// Initialize every channel's protocol handling, when the device is mounted,
+// unmounted, suspended or resumed
+void init_protocol_handling(void) {
+    for (int ii = 0; ii < CFG_TUD_VENDOR; ii++) {
+        init_channel(&channels[ii]);
+    }
+}
+
+// Called once at startup, before tinyusb can call us
+void init_channels(void) {
+    for (int ii = 0; ii < CFG_TUD_VENDOR; ii++) {
+        memset(&channels[ii], 0, sizeof(channels[ii]));
+        channels[ii].num = ii;
+        channels[ii].current_command = CMD_NONE;
+    }
+}
+
+// Receiving data from the host
+//
+// Commands and WRITE data arrive from the host via tinyusb, which tells us
+// about each transfer (one or more packets, up to CFG_TUD_VENDOR_EP_BUFSIZE
+// bytes) with tud_vendor_rx_cb().  How we get at the data depends on how
+// tinyusb is configured (in tusb_config.h):
+//
+// - If CFG_TUD_VENDOR_RX_BUFSIZE > 0 (the default), tinyusb places received
+//   packets in its own RX FIFO, and we take data out of it with
+//   tud_vendor_read() as and when we're ready to.  Data we don't take stays
+//   there, and once the FIFO is full tinyusb stops accepting more from the
+//   host (the host sees NAKs and retries).  This is how we apply
+//   back-pressure when the WRITE sink's consumer falls behind.
+//
+// - If CFG_TUD_VENDOR_RX_BUFSIZE == 0, there's no FIFO.  The data is only
+//   available, in the endpoint buffer passed to tud_vendor_rx_cb(), until
+//   the callback returns - so we must deal with all of it there and then.
+//   WRITE data is copied straight from the endpoint buffer into the WRITE
+//   sink's ring, saving a copy, but if the ring is full we have to wait for
+//   core 1's consumer to make room before returning from the callback.
+//
+// These rx_ functions hide the difference from process_rx().  rx_skip()
+// throws away up to len bytes, returning how many it did, and rx_discard()
+// everything received so far.
+#if CFG_TUD_VENDOR_RX_BUFSIZE > 0
+uint32_t rx_available(channel_t *ch) {
+    return tud_vendor_n_available(ch->num);
+}
+
+uint32_t rx_read(channel_t *ch, uint8_t *buf, uint32_t len) {
+    return tud_vendor_n_read(ch->num, buf, len);
+}
+
+uint32_t rx_skip(channel_t *ch, uint32_t len) {
+    uint8_t scratch[64];
+    uint32_t total = 0;
+    uint32_t chunk;
+    uint32_t read;
+
+    while (total < len) {
+        chunk = len - total;
+        if (chunk > sizeof(scratch)) {
+            chunk = sizeof(scratch);
         }
+        read = tud_vendor_n_read(ch->num, scratch, chunk);
+        if (read == 0) {
+            break;
+        }
+        total += read;
+    }
+    return total;
+}
+
+void rx_discard(channel_t *ch) {
+    stats_inc(STAT_RX_FLUSH);
+    tud_vendor_n_read_flush(ch->num);
+}
+#else // CFG_TUD_VENDOR_RX_BUFSIZE == 0
+uint32_t rx_available(channel_t *ch) {
+    return ch->rx_packet_len;
+}
+
+uint32_t rx_read(channel_t *ch, uint8_t *buf, uint32_t len) {
+    if (len > ch->rx_packet_len) {
+        len = ch->rx_packet_len;
+    }
+    memcpy(buf, ch->rx_packet, len);
+    ch->rx_packet += len;
+    ch->rx_packet_len -= len;
+    return len;
+}
+
+uint32_t rx_skip(channel_t *ch, uint32_t len) {
+    if (len > ch->rx_packet_len) {
+        len = ch->rx_packet_len;
+    }
+    ch->rx_packet += len;
+    ch->rx_packet_len -= len;
+    return len;
+}
+
+void rx_discard(channel_t *ch) {
+    stats_inc(STAT_RX_FLUSH);
+    ch->rx_packet_len = 0;
+}
+#endif // CFG_TUD_VENDOR_RX_BUFSIZE
+
+// Handle a newly received command.
+//
+// In our protocol, we expect a 4 byte command followed by an optional
+// number of bytes, as indicated in the 4 byte command.
+//
+// Bear in mind this protocol in entirely arbitary - you can implement
+// whatever protocol you would lile.
+//
+// The format of the command is:
+// byte 0 - command
+// byte 1 - indicates protocol to use
+// byte 2 - length of data which follows (low order byte)
+// byte 3 - length of data which follows (high order byte)
+//
+// The protocols with 32-bit lengths (PROTO_LARGE, PROTO_CRC, PROTO_CREDIT,
+// PROTO_BATCH, PROTO_NOACK, PROTO_RESUME and PROTO_STORE) follow the command
+// with a 4 byte length, low order byte first, allowing more than 64KB to be
+// transferred by a single command.  Bytes 2 and 3 then aren't the length.
+// Most of these protocols ignore them, but some use them:
+// - PROTO_BATCH - byte 2 is the number of commands in the batch
+// - PROTO_NOACK - the ack interval
+// - PROTO_RESUME - the transfer ID
+// - PROTO_STORE - the object number and flags
+//
+// After a WRITE command, plus its data, has been received (and consumed by
+// core 1), we respond with a status.  It's 3 bytes long, or 5 for the
+// protocols with 32-bit lengths.  PROTO_CRC statuses are 9 bytes, and
+// PROTO_CREDIT and PROTO_NOACK ones 13.  A PROTO_BATCH status has an extra
+// byte per command in the batch.  PROTO_NOACK WRITEs only get a status at
+// the end of an ack interval, or on an error.
+
+// Returns the length of the command being received, which we only know once
+// we've got its protocol byte
+uint32_t command_header_len(channel_t *ch) {
+    if ((ch->rx_command_len >= COMMAND_LEN) && PROTO_HAS_LARGE_LEN(ch->rx_command[1])) {
+        return COMMAND_LEN_LARGE;
+    }
+    return COMMAND_LEN;
+}
 
-        INFO("Trying to send %d bytes", try_to_send);
+// Returns the length of data the command says follows it (READ) or is to be
+// sent (WRITE)
+uint32_t command_data_len(const uint8_t *command) {
+    if (PROTO_HAS_LARGE_LEN(command[1])) {
+        return command[4] | (command[5] << 8) | (command[6] << 16) | ((uint32_t)command[7] << 24);
+    }
+    return command[2] | (command[3] << 8);
+}
 
-        // Send the data - we'll just send ascii 'x' characters
-        memset(send_buffer, 'x', try_to_send);
-        sent = tud_vendor_write(send_buffer, try_to_send);
-        tud_vendor_write_flush();
-        INFO("Actually sent %d bytes", sent);
-        
-        // Now update the data statics
-        handled_data_len += sent;
+// Throw away the len bytes of data following a command we've rejected (see
+// process_rx())
+void discard_data(channel_t *ch, uint32_t len) {
+    reset_data(ch);
+    if (len > 0) {
+        stats_inc(STAT_RX_FLUSH);
+        ch->expected_data_len = len;
+        ch->current_command = CMD_DISCARD;
+    }
+}
+
+void handle_command(channel_t *ch, const uint8_t *command) {
+    work_item_t item = {
+        .type = command[0],
+        .proto = command[1],
+        .count = (command[1] == PROTO_BATCH) ? command[2] : 0,
+        .ack_commands = (command[1] == PROTO_NOACK) ? command[2] : 0,
+        .ack_kb = (command[1] == PROTO_NOACK) ? command[3] : 0,
+        .id = (command[1] == PROTO_RESUME) ? (uint16_t)(command[2] | (command[3] << 8)) : 0,
+        .object = (command[1] == PROTO_STORE) ? command[2] : 0,
+        .store_flags = (command[1] == PROTO_STORE) ? command[3] : 0,
+        .len = command_data_len(command),
+    };
+
+    trace_event(TRACE_COMMAND, ch->num, (uint16_t)((command[0] << 8) | command[1]), item.len);
+
+    // Handle the specific command
+    switch (command[0]) {
+        case CMD_WRITE:
+            stats_inc(STAT_CMD_WRITE);
+
+            // Get the expected data length
+            ch->expected_data_len = item.len;
+            ch->handled_data_len = 0;
+
+            INFO("Got WRITE command on channel %d, expecting to receive %lu bytes of data", ch->num, (unsigned long)ch->expected_data_len);
+
+            // Pass it to core 1, which will consume the data as we receive
+            // it, and send the status once it has consumed it all (straight
+            // away if there's no data).  Core 1 may still be working on
+            // earlier commands, in which case the data waits in the WRITE
+            // sink.
+            submit_work(ch, &item);
+            if (ch->expected_data_len > 0) {
+                ch->current_command = command[0];
+            } else {
+                reset_data(ch);
+            }
+            break;
 
-        if (handled_data_len >= expected_data_len) {
-            // No status after READ completes
+        case CMD_READ:
+            stats_inc(STAT_CMD_READ);
+
+            // Get the expected data length
+            ch->expected_data_len = item.len;
+
+            INFO("Got READ command on channel %d, expecting to send %lu bytes of data", ch->num, (unsigned long)ch->expected_data_len);
+
+            if (ch->expected_data_len > 0) {
+                // Pass it to core 1, which will produce the data once it has
+                // finished any earlier commands.  We don't have any data to
+                // handle ourselves, so are immediately ready for the next
+                // command.
+                submit_work(ch, &item);
+            } else {
+                // No bytes requested, so nothing to do
 
-            // Now we've sent all the data, reset back to waiting for a
-            // command
-            reset_data();
-            current_command = CMD_NONE;
+                // Don't send back a status for a READ
+            }
+
+            // Reset back to waiting for a command
+            reset_data(ch);
+            break;
+
+        default:
+            stats_inc(STAT_CMD_OTHER);
+            INFO("Unsupported command: 0x%02x 0x%02x 0x%02x 0x%02x", command[0], command[1], command[2], command[3]);
+            send_status_response(ch, command[1], STATUS_ERROR, false);
+
+            // We've no idea what this is, so take its length as that of the
+            // data following it, as for a WRITE, and throw that away
+            discard_data(ch, item.len);
+            break;
+    }
+}
+
+// Move as much WRITE data as we can from tinyusb into the WRITE sink.
+// Returns the number of bytes handled - 0 means the sink is full, and we
+// need to wait for its consumer to catch up.
+uint32_t receive_write_data(channel_t *ch) {
+    uint8_t *ptr;
+    uint32_t space;
+    uint32_t len;
+    uint32_t total = 0;
+
+    while ((ch->handled_data_len < ch->expected_data_len) && (rx_available(ch) > 0)) {
+        // Get the next contiguous free space in the ring - we read the
+        // data directly into it
+        ptr = write_sink_write_ptr(ch->num, &space);
+
+        if (space == 0) {
+#if CFG_TUD_VENDOR_RX_BUFSIZE > 0
+            // Leave the rest with tinyusb until the consumer makes room
+            break;
+#else
+            // We can't leave this data with tinyusb, so we have to wait for
+            // the consumer on core 1 to make room
+            tight_loop_contents();
+            continue;
+#endif
         }
+
+        len = ch->expected_data_len - ch->handled_data_len;
+        if (len > space) {
+            len = space;
+        }
+        len = rx_read(ch, ptr, len);
+        write_sink_commit(ch->num, len);
+        credit_bytes(ch->num, len);
+
+        ch->handled_data_len += len;
+        total += len;
     }
 
-    return;
+    if (total > 0) {
+        INFO("Received %lu bytes of data on channel %d, %lu received total, %lu expected total",
+            (unsigned long)total, ch->num, (unsigned long)ch->handled_data_len, (unsigned long)ch->expected_data_len);
+    }
+
+    if (ch->handled_data_len == ch->expected_data_len) {
+        // That's all this command's data - we're ready for the next command
+        reset_data(ch);
+        ch->current_command = CMD_NONE;
+    }
+
+    return total;
 }
 
-// Used by tud_vendor_control_xfer_cb() to initialize protocol handling on
-// a CTRL_INIT command
-void init_protocol_handling(void) {
-    current_command = CMD_NONE;
-    reset_data();
+// Without tinyusb's RX FIFO, returns true if we can accept this command
+// now.  (With it, we just leave commands with tinyusb until core 1's work
+// queue has room - see process_rx().)
+//
+// Each command takes one slot in core 1's work queue - either to execute it,
+// or to send an ERROR status if it's invalid - so the host can have as many
+// commands in flight as the queue is long.  We can't wait for a slot to free
+// up, so tell the host we're BUSY instead - that status is held until there
+// is one (see send_status_response()), as is any later command's, so that
+// they're sent in order.  We also only
+// take a WRITE if all its data will fit in the WRITE sink, or core 1 is idle
+// and so will consume it straight away.  Otherwise we could end up waiting in
+// tud_vendor_rx_cb() for room in the sink while core 1 waits for us to send
+// the data for an earlier READ.  That can't happen if the host is pacing
+// itself by our credits (see credit.h), as it then never sends more data than
+// the sink has room for, so we take any WRITE.
+#if CFG_TUD_VENDOR_RX_BUFSIZE == 0
+bool can_accept_command(channel_t *ch, const uint8_t *command) {
+    uint32_t len = command_data_len(command);
+
+    if ((ch->held_runs > 0) || (worker_space(ch->num) == 0)) {
+        return false;
+    }
+    if ((command[0] == CMD_WRITE) &&
+        !ch->paced &&
+        (len > write_sink_space(ch->num)) &&
+        !worker_idle(ch->num)) {
+        return false;
+    }
+    return true;
+}
+
+// Answer a command we can't accept with BUSY, and throw away any WRITE data
+// following it.  A PROTO_LOOPBACK_STREAM WRITE still gets the two responses
+// the host is expecting - its echo is just empty.
+void reject_command(channel_t *ch, const uint8_t *command) {
+    uint32_t len = command_data_len(command);
+    bool empty_echo = (command[0] == CMD_WRITE) && (command[1] == PROTO_LOOPBACK_STREAM) && (len > 0);
+
+    INFO("Too many commands in flight - rejecting 0x%02x", command[0]);
+
+    send_status_response(ch, command[1], STATUS_BUSY, empty_echo);
+    if (command[0] == CMD_WRITE) {
+        discard_data(ch, len);
+    }
+}
+#endif // CFG_TUD_VENDOR_RX_BUFSIZE
+
+// Process data received from the host - commands, and any data which
+// follows them.
+//
+// Note that the command and any data are expected to come in multiple
+// callbacks, and the data may well come in several itself (as our maximum
+// endpoint bulk size is 64).  Commands are framed by their length, rather
+// than by packet - we take COMMAND_LEN bytes (COMMAND_LEN_LARGE for the
+// protocols with 32-bit lengths) as a command, and then as many bytes as it
+// says follow as its data.
+//
+// The host doesn't have to wait for one command's response before sending
+// the next - we move straight on to the next command once we've received
+// the previous one's data, and core 1 executes them, and sends their data
+// and statuses, in order.
+//
+// A command we reject - with BUSY, without tinyusb's RX FIFO, or with ERROR,
+// as it isn't one we support - is framed in the same way: we throw away the
+// data it says follows it, and take the bytes after that as the next
+// command.  So the host can carry on sending commands, and send the rejected
+// one again once it has its status.
+void process_rx(channel_t *ch) {
+    uint32_t len;
+
+    if (!check_reset_complete(ch)) {
+#if CFG_TUD_VENDOR_RX_BUFSIZE > 0
+        // We'll pick the data up from tinyusb once core 1 has reset
+        return;
+#else
+        // Core 1 resets very quickly, so just wait for it
+        while (!check_reset_complete(ch)) {
+            tight_loop_contents();
+        }
+#endif
+    }
+
+    while (rx_available(ch) > 0) {
+        switch (ch->current_command) {
+            case CMD_NONE:
+                // We are expecting a new command.  Any statuses held for
+                // earlier ones go to core 1 first.
+                release_held_statuses(ch);
+#if CFG_TUD_VENDOR_RX_BUFSIZE > 0
+                // Each command takes a slot in core 1's work queue.  If
+                // they're all in use, leave the command with tinyusb until
+                // one is free.
+                if ((ch->rx_command_len == 0) && (worker_space(ch->num) == 0)) {
+                    return;
+                }
+#endif
+                ch->rx_command_len += rx_read(ch, &ch->rx_command[ch->rx_command_len], command_header_len(ch) - ch->rx_command_len);
+                if (ch->rx_command_len < command_header_len(ch)) {
+#if CFG_TUD_VENDOR_RX_BUFSIZE > 0
+                    // Wait for the rest of it - once we have the protocol
+                    // byte we may find there's more to come
+#else
+                    if (rx_available(ch) == 0) {
+                        // The rest of it won't be coming - a command must be
+                        // sent in a single packet
+                        INFO("Unexpected command length: %d", ch->rx_command_len);
+                        send_status_response(ch, PROTO_DEFAULT, STATUS_ERROR, false);
+                        ch->rx_command_len = 0;
+                    }
+#endif
+                    break;
+                }
+                ch->rx_command_len = 0;
+
+#if CFG_TUD_VENDOR_RX_BUFSIZE == 0
+                if (!can_accept_command(ch, ch->rx_command)) {
+                    reject_command(ch, ch->rx_command);
+                    credit_command(ch->num);
+                    break;
+                }
+#endif
+                handle_command(ch, ch->rx_command);
+                credit_command(ch->num);
+                break;
+
+            case CMD_WRITE:
+                // We are expecting to receive data
+                if (receive_write_data(ch) == 0) {
+                    // No room in the WRITE sink
+                    return;
+                }
+                break;
+
+            case CMD_DISCARD:
+                // We are throwing away a rejected command's data
+                len = rx_skip(ch, ch->expected_data_len - ch->handled_data_len);
+                credit_bytes(ch->num, len);
+                ch->handled_data_len += len;
+                if (ch->handled_data_len == ch->expected_data_len) {
+                    reset_data(ch);
+                    ch->current_command = CMD_NONE;
+                }
+                break;
+
+            default:
+                INFO("Received data while in invalid current command: 0x%02x", ch->current_command);
+                rx_discard(ch);
+                send_status_response(ch, PROTO_DEFAULT, STATUS_ERROR, false);
+                break;
+        }
+    }
+}
+
+// Called from within our main loop to take any data from tinyusb which we
+// previously didn't have room for in the WRITE sink (or weren't ready for).
+void maybe_receive_data(void) {
+#if CFG_TUD_VENDOR_RX_BUFSIZE > 0
+    for (int ii = 0; ii < CFG_TUD_VENDOR; ii++) {
+        process_rx(&channels[ii]);
+    }
+#endif
 }
 
 //
@@ -242,6 +871,7 @@ void init_protocol_handling(void) {
 // - Set a configuration (we only have 1 configuration)
 void tud_mount_cb(void) {
     INFO("Device mounted");
+    trace_event(TRACE_MOUNT, TRACE_NO_CHAN, 0, 0);
 
     // We will reset our protocol handling support
     init_protocol_handling();
@@ -254,6 +884,7 @@ void tud_mount_cb(void) {
 // - Device-initiated detachment
 void tud_umount_cb(void) {
     INFO("Device unmounted");
+    trace_event(TRACE_UNMOUNT, TRACE_NO_CHAN, 0, 0);
 
     // We will reset our protocol handling support
     init_protocol_handling();
@@ -272,6 +903,7 @@ void tud_umount_cb(void) {
 //   wakeup feature
 void tud_suspend_cb(bool remote_wakeup_en) {
     INFO("Device suspended, remote wakeup %s", remote_wakeup_en ? "enabled" : "disabled");
+    trace_event(TRACE_SUSPEND, TRACE_NO_CHAN, remote_wakeup_en ? 1 : 0, 0);
 
     // We will reset our protocol handling support
     init_protocol_handling();
@@ -283,166 +915,84 @@ void tud_suspend_cb(bool remote_wakeup_en) {
 // - The device successfully triggered a remote wakeup
 void tud_resume_cb(void) {
     INFO("Device resumed");
+    trace_event(TRACE_RESUME, TRACE_NO_CHAN, 0, 0);
 
     // We will reset our protocol handling support
     init_protocol_handling();
 }
 
-// This callback handles write_bulk transfers.
+// The number of bulk packets a transfer of len bytes took - a zero length
+// packet counts too
+static uint32_t bulk_packets(uint32_t len) {
+    if (len == 0) {
+        return 1;
+    }
+    return (len + ENDPOINT_BULK_SIZE - 1) / ENDPOINT_BULK_SIZE;
+}
+
+// This callback handles write_bulk transfers.  It is called each time
+// tinyusb's OUT transfer completes - on a short packet, including a zero
+// length packet, or once CFG_TUD_VENDOR_EP_BUFSIZE bytes (which may be
+// several packets) have been received.
 //
-// You can send back using tud_vendor_write().
+// The actual protocol handling is done by process_rx() - see there, and the
+// notes above rx_available(), for more details.
 void tud_vendor_rx_cb(uint8_t itf, uint8_t const* buffer, uint16_t bufsize) {
-    // In our protocol, we expect a 4 byte command followed by an optional
-    // number of bytes, as indicated in the 4 byte command.
-    //
-    // Bear in mind this protocol in entirely arbitary - you can implement
-    // whatever protocol you would lile.
-    //
-    // The format of the command is:
-    // byte 0 - command
-    // byte 1 - indicates protocol to use
-    // byte 2 - length of data which follows (low order byte)
-    // byte 3 - length of data which follows (high order byte)
-    //
-    // After the command, plus any data, has been received, we respond with
-    // a 3 byte status.
-    //
-    // Note that the command and any data are expected to come in multiple
-    // callbacks, and the data may well come in several itself (as our maximum
-    // endpoint bulk size is 64).
-    
-    // Local variables used to handle the command protocol
-    uint8_t cmd;
-    uint8_t proto;
+    channel_t *ch;
 
     // Check the interface
-    if (itf == ITF_NUM_VENDOR) {
-        if (current_command == CMD_NONE) {
-            // We are expecting a new command
-
-            if (bufsize == COMMAND_LEN) {
-                // Get the command and protocol
-                cmd = buffer[0];
-                proto = buffer[1];
-
-                // Handle the specific command
-                switch (buffer[0]) {
-                    case CMD_WRITE:
-                        // Get the expected data length
-                        expected_data_len = buffer[2] | (buffer[3] << 8);
-                        handled_data_len = 0;
-
-                        INFO("Got WRITE command, expecting to receive %d bytes of data", expected_data_len);
-    
-                        if (expected_data_len == 0) {
-                            // No data expected - return status now (all zeros)
-                            memset(status, 0, STATUS_LEN);
-                            status[0] = STATUS_READY;
-
-                            INFO("Send status response: 0x%02x 0x%02x 0x%02x", status[0], status[1], status[2]);
-
-                            tud_vendor_write(status, STATUS_LEN);
-                            tud_vendor_write_flush();
-                        } else {
-                            // Set the current command, so we know to expect
-                            // data subsequqently
-                            current_command = buffer[0];
-                        }
-                        break;
-
-                    case CMD_READ:
-                        // Get the expected data length
-                        expected_data_len = buffer[2] | (buffer[3] << 8);
-                        handled_data_len = 0;
-
-                        INFO("Got READ command, expecting to send %d bytes of data", expected_data_len);
-
-                        if (expected_data_len > 0) {
-                            // Set the current command, so we know to send
-                            // data from within our main loop
-                            current_command = buffer[0];
-                        } else {
-                            // No bytes requested, so nothing to do
-
-                            // Don't send back a status for a READ
-
-                            // Reset back to waiting for a command
-                            reset_data();
-                            current_command = CMD_NONE;
-                        }
-                        break;
-    
-                    default:
-                        INFO("Unsupported command: 0x%02x 0x%02x 0x%02x 0x%02x", buffer[0], buffer[1], buffer[2], buffer[3]);
-                        send_status_response(STATUS_ERROR, 0);
-                        break;
-                }
-            } else {
-                INFO("Unexpected command length: %d", bufsize);
-                send_status_response(STATUS_ERROR, 0);
-                return;
-            }
-        } else {
-            // We are expecting to send or receive data
-            switch (current_command) {
-                case CMD_WRITE:
-                    // We are expecting to write data
-                    //
-                    // Record the amount received, but
-                    // ignore the data itself (in buffer).
-                    handled_data_len += bufsize;
-                    INFO("Received %d bytes of data, %d received total, %d expected total", bufsize, handled_data_len, expected_data_len);
-            
-                    if (expected_data_len == handled_data_len) {
-                        // Have received all data
-
-                        // Send status response
-                        send_status_response(STATUS_READY, handled_data_len);
-
-                        // Reset back to waiting for a command
-                        reset_data();
-                        current_command = CMD_NONE;
-                    }
-                break;
-
-                case CMD_READ:
-                    // We are not expecting to receive data, instead we're
-                    // expecting to provide it
-                    INFO("Unexpectedly received data when executing READ command: %d bytes", bufsize);
-                    send_status_response(STATUS_BUSY, 0);
-                    break;
-
-                default:
-                    INFO("Received data while in invalid current command: 0x%02x", current_command);
-                    send_status_response(STATUS_ERROR, 0);
-                    break;
-            }
-        }
-    } else {
+    if (itf >= CFG_TUD_VENDOR) {
         INFO("Received data on unexpected interface 0x%02x - ignoring", itf);
+#if CFG_TUD_VENDOR_RX_BUFSIZE > 0
+        tud_vendor_n_read_flush(itf);
+#endif
+        return;
     }
+    ch = &channels[itf];
+    trace_event(TRACE_RX_CB_ENTER, itf, 0, bufsize);
 
-    // The following code is copied from the tinyusb webusb_serial example.  
-    // I think that when RX_BUFSIZE is > 0 tinyusb uses a ring buffer
-    // internally to capture and supply data to us.  I suspect if we don't
-    // flush the buffer, it fills up and we stop receiving data.
-    //
-    // Additionally, I think if RX_BUFSIZE > 0 we can either call
-    // tud_vendor_read() to get the data, or get it from buffer/bufsize
-    // passed into this callback.
+    stats_add(STAT_PACKETS_OUT, bulk_packets(bufsize));
+    stats_add(STAT_BYTES_OUT, bufsize);
 
-    // if using RX buffered is enabled, we need to flush the buffer to make room for new data
 #if CFG_TUD_VENDOR_RX_BUFSIZE > 0
-    tud_vendor_read_flush();
+    // tinyusb has also placed this data in its RX FIFO, and that's where
+    // we'll take it from - possibly not all of it now, if the WRITE sink is
+    // full.
+    (void)buffer;
+    (void)bufsize;
+    process_rx(ch);
+#else
+    // This is the only chance we get at this data, so process_rx() must
+    // handle all of it
+    ch->rx_packet = buffer;
+    ch->rx_packet_len = bufsize;
+    process_rx(ch);
+    ch->rx_packet_len = 0;
 #endif
 
+    trace_event(TRACE_RX_CB_EXIT, itf, 0, 0);
     return;
 }
 
 // This callback is called once data we have sent (using tud_vendor_write())
 // has actually been sent.
+//
+// This is the only place the bulk IN engine releases buffers, so that it
+// never reuses one before tinyusb has finished with its contents.
 void tud_vendor_tx_cb(uint8_t itf, uint32_t sent_bytes) {
-    INFO("Sent 0x%02x bytes", sent_bytes);
+    DEBUG("Sent 0x%02x bytes on channel %d", sent_bytes, itf);
+    trace_event(TRACE_TX_CB, itf, 0, sent_bytes);
+    stats_add(STAT_PACKETS_IN, bulk_packets(sent_bytes));
+    stats_add(STAT_BYTES_IN, sent_bytes);
+    if (itf < CFG_TUD_VENDOR) {
+        bulk_in_tx_cb(itf, sent_bytes);
+
+        // There's now room in the TX FIFO, so refill it straight away,
+        // rather than once tud_task() has handled any other events
+        if (check_reset_complete(&channels[itf])) {
+            bulk_in_service(itf);
+        }
+    }
 }
 
 // This callback handles control transfers.
@@ -462,13 +1012,21 @@ void tud_vendor_tx_cb(uint8_t itf, uint32_t sent_bytes) {
 // this stage).
 //
 // In our implementation we are only implementing CLASS requests, those
-// directed at our vendor interface, and those IN (i.e. where the host wants
-// us to send it data).
+// directed at our vendor interfaces, and those IN (i.e. where the host wants
+// us to send it data).  Requests which affect the protocol state (CTRL_INIT,
+// CTRL_PATTERN, CTRL_CREDITS, CTRL_ACKS and CTRL_RESUME) apply to the
+// channel whose interface they're directed at - the others apply to the
+// whole device.
 bool tud_vendor_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_request_t const* request) {
     // In our control protocol, responses can be up to 8 bytes.  This is in
     // effect, and arbitrary value. 
     static uint8_t ctrl_rsp[8];
     static uint8_t rsp_len;
+    static uint8_t stats_rsp[STATS_BLOCK_LEN];
+    static uint8_t resume_rsp[RESUME_INFO_LEN];
+#ifdef TRACE
+    static uint8_t trace_rsp[TRACE_BLOCK_LEN];
+#endif
 
     // Used to test the direction
     bool dir_in = (request->bmRequestType_bit.direction == TUSB_DIR_IN) ? true : false; 
@@ -488,7 +1046,9 @@ bool tud_vendor_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_requ
         return false;
     }
 
-    if (request->wIndex != ITF_NUM_VENDOR) {
+    // The vendor interfaces start at 0, so wIndex can't be below them
+    static_assert(ITF_NUM_VENDOR == 0);
+    if (request->wIndex >= ITF_NUM_TOTAL) {
         INFO("Control transfer - Ignoring unexpected interface 0x%02x", request->wIndex);
         return false;
     }
@@ -532,8 +1092,8 @@ bool tud_vendor_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_requ
                         return false;
                     }
 
-                    // Initialized our protocol handling
-                    init_protocol_handling(); 
+                    // Initialize this channel's protocol handling
+                    init_channel(&channels[request->wIndex - ITF_NUM_VENDOR]);
 
                     // Return a control response
                     memset(ctrl_rsp, 0, sizeof(ctrl_rsp));
@@ -580,7 +1140,6 @@ bool tud_vendor_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_requ
                         return false;
                     }
 
-                    fflush(stdout);
                     enter_bootloader();
                     break;
 
@@ -632,6 +1191,183 @@ bool tud_vendor_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_requ
                     rsp_len = sizeof(ctrl_rsp);
                     break;
 
+                case CTRL_STATS:
+                    // Return the performance counters (see stats.h).  If
+                    // wValue is 1 the counters are also reset, so the next
+                    // CTRL_STATS returns the counts since this one.
+                    //
+                    // The counters don't fit in ctrl_rsp, so have their own
+                    // buffer.  tinyusb only sends as much of it as the host
+                    // asked for (wLength).
+
+                    // This returns data so must be an IN request (i.e. the
+                    // host will accept data from the device)
+                    if (!dir_in) {
+                        INFO("Unexpected direction");
+                        return false;
+                    }
+
+                    DEBUG("Control transfer - Stats");
+                    stats_snapshot(stats_rsp, request->wValue == 1);
+                    return tud_control_xfer(rhport, request, stats_rsp, sizeof(stats_rsp));
+
+                case CTRL_PATTERN:
+                    // Select the data subsequent READs on this channel
+                    // return (see pattern.h) - the pattern in wValue's low
+                    // byte, and its seed in the high byte.  Returns the
+                    // pattern selected, or stalls if it isn't supported.
+
+                    // This returns data so must be an IN request (i.e. the
+                    // host will accept data from the device)
+                    if (!dir_in) {
+                        INFO("Unexpected direction");
+                        return false;
+                    }
+
+                    INFO("Control transfer - Pattern");
+                    if (!pattern_select(request->wIndex - ITF_NUM_VENDOR, request->wValue)) {
+                        INFO("Unsupported pattern: 0x%02x", request->wValue & 0xff);
+                        return false;
+                    }
+                    ctrl_rsp[0] = (uint8_t)request->wValue;
+                    rsp_len = 1;
+                    break;
+
+                case CTRL_CREDITS:
+                    // Return this channel's flow control credits (see
+                    // credit.h) - the command limit, then the byte limit,
+                    // 4 bytes each, low order byte first.  From now until
+                    // the channel is next initialised we take the host to be
+                    // pacing itself by them.
+
+                    // This returns data so must be an IN request (i.e. the
+                    // host will accept data from the device)
+                    if (!dir_in) {
+                        INFO("Unexpected direction");
+                        return false;
+                    }
+
+                    DEBUG("Control transfer - Credits");
+                    {
+                        channel_t *ch = &channels[request->wIndex - ITF_NUM_VENDOR];
+                        uint32_t commands;
+                        uint32_t bytes;
+
+                        credit_get(ch->num, &commands, &bytes);
+                        for (int ii = 0; ii < 4; ii++) {
+                            ctrl_rsp[ii] = (uint8_t)(commands >> (8 * ii));
+                            ctrl_rsp[4 + ii] = (uint8_t)(bytes >> (8 * ii));
+                        }
+                        ch->paced = true;
+                    }
+                    rsp_len = sizeof(ctrl_rsp);
+                    break;
+
+                case CTRL_ACKS:
+                    // Return this channel's ack counts (see ack.h) - the
+                    // number of PROTO_NOACK WRITEs completed, then their
+                    // bytes, 4 bytes each, low order byte first.  Until
+                    // core 1 has finished resetting the channel they're 0.
+
+                    // This returns data so must be an IN request (i.e. the
+                    // host will accept data from the device)
+                    if (!dir_in) {
+                        INFO("Unexpected direction");
+                        return false;
+                    }
+
+                    DEBUG("Control transfer - Acks");
+                    {
+                        channel_t *ch = &channels[request->wIndex - ITF_NUM_VENDOR];
+                        uint32_t commands = 0;
+                        uint32_t bytes = 0;
+
+                        if (check_reset_complete(ch)) {
+                            ack_get(ch->num, &commands, &bytes);
+                        }
+                        for (int ii = 0; ii < 4; ii++) {
+                            ctrl_rsp[ii] = (uint8_t)(commands >> (8 * ii));
+                            ctrl_rsp[4 + ii] = (uint8_t)(bytes >> (8 * ii));
+                        }
+                    }
+                    rsp_len = sizeof(ctrl_rsp);
+                    break;
+
+                case CTRL_RESUME:
+                    // Return this channel's resumable transfer record (see
+                    // resume.h) - how far the last PROTO_RESUME command got.
+                    // The record survives the channel being reset, but
+                    // until core 1 has finished resetting it, it may still
+                    // be changing, so we say we're BUSY.
+                    //
+                    // The record doesn't fit in ctrl_rsp, so has its own
+                    // buffer.
+
+                    // This returns data so must be an IN request (i.e. the
+                    // host will accept data from the device)
+                    if (!dir_in) {
+                        INFO("Unexpected direction");
+                        return false;
+                    }
+
+                    DEBUG("Control transfer - Resume");
+                    {
+                        channel_t *ch = &channels[request->wIndex - ITF_NUM_VENDOR];
+
+                        if (check_reset_complete(ch)) {
+                            resume_get(ch->num, resume_rsp);
+                        } else {
+                            memset(resume_rsp, 0, sizeof(resume_rsp));
+                            resume_rsp[3] = STATUS_BUSY;
+                        }
+                    }
+                    return tud_control_xfer(rhport, request, resume_rsp, sizeof(resume_rsp));
+
+                case CTRL_STORE:
+                    // Return the object store's occupancy (see store.h) -
+                    // the blocks in use, out of how many, and their size,
+                    // 2 bytes each, low order byte first, then the objects
+                    // holding data, out of how many.  The store is shared
+                    // by all the channels.  With STORE_FLASH in wValue, it's
+                    // the flash objects' occupancy instead, in sectors.
+
+                    // This returns data so must be an IN request (i.e. the
+                    // host will accept data from the device)
+                    if (!dir_in) {
+                        INFO("Unexpected direction");
+                        return false;
+                    }
+
+                    DEBUG("Control transfer - Store");
+                    static_assert(STORE_INFO_LEN == sizeof(ctrl_rsp));
+                    store_get_info((uint8_t)request->wValue, ctrl_rsp);
+                    rsp_len = STORE_INFO_LEN;
+                    break;
+
+#ifdef TRACE
+                case CTRL_TRACE:
+                    // Return block number wValue of the flight recorder's
+                    // dump (see trace.h).  Block 0 stops recording, and
+                    // takes the dump - the host then reads blocks until it
+                    // gets a short one, which starts recording again.  The
+                    // recorder is shared by all the channels.
+                    //
+                    // The blocks don't fit in ctrl_rsp, so have their own
+                    // buffer.  tinyusb only sends as much of a block as the
+                    // host asked for (wLength), so the host should always
+                    // ask for TRACE_BLOCK_LEN bytes.
+
+                    // This returns data so must be an IN request (i.e. the
+                    // host will accept data from the device)
+                    if (!dir_in) {
+                        INFO("Unexpected direction");
+                        return false;
+                    }
+
+                    DEBUG("Control transfer - Trace");
+                    return tud_control_xfer(rhport, request, trace_rsp, trace_dump(request->wValue, trace_rsp));
+#endif // TRACE
+
                 default:
                     INFO("Control transfer - Unsupported type: 0x%02x, dir: %s",
                         request->bRequest, dir_in ? "IN" : "OUT");
@@ -656,11 +1392,29 @@ bool tud_vendor_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_requ
 // Our core1 function
 void core1(void) {
     while (true) {
+        bool progress;
+        bool logged;
+
         // Call our tight loop function, to demonstrate that core 1 is running
         example_tight_loop_contents("aux  loop");
+        stats_inc(STAT_AUX_LOOPS);
+
+        // Execute any commands core 0 has passed us.  If that produced
+        // data, consumed data or completed a command, core 0 may be waiting
+        // for it.
+        progress = worker_service();
+        if (progress) {
+            event_signal();
+        }
+
+        // Output a log record, if either core has logged anything.  Just one
+        // per pass, so a burst of logs doesn't hold up commands.
+        logged = log_drain();
 
-        // Feed the watchdog
-        watchdog_update();
+        // Sleep until core 0 signals us, unless there's more to do.  Core 0
+        // doesn't signal when it logs, so its logs may wait for the next
+        // event, at most WATCHDOG_FEED_MS.
+        event_wait(progress || logged);
     }
 
 }
@@ -684,6 +1438,7 @@ void enter_bootloader(void) {
     // in order to exit our program.  This, combined with the #define,
     // will cause the Pico to reboot and enter the bootloader.
     multicore_reset_core1();
+    log_flush();
     reset_usb_boot(0, 0);
 #else
     INFO("Bootloader support not compiled in");
@@ -0,0 +1,108 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// READ test patterns - see pattern.h.
+//
+// The selection is made on core 0, in the control request handler, but the
+// generator runs on core 1, so core 0 just publishes the selection, tagged
+// with a generation count, and core 1 (re)starts the generator when it
+// starts a READ and sees a selection it hasn't applied yet.  Selecting the
+// same pattern again therefore restarts its sequence.
+//
+// Patterns are generated straight into the bulk IN engine's segment
+// buffers, a word at a time.  At full speed the bus carries a 64 byte packet
+// every 50us or so at most, and generating one takes well under a
+// microsecond, so generation never holds up the bus - and as it happens on
+// core 1 it doesn't hold up core 0's main loop either.
+//
+
+#include <stdatomic.h>
+#include "pico/stdlib.h"
+#include "tusb.h"
+#include "include.h"
+#include "bulk-in.h"
+#include "pattern.h"
+
+static_assert((READ_BUF_SIZE % 4) == 0, "Patterns are generated a word at a time");
+
+// Marks a channel's generator as needing to be restarted from the current
+// selection - never a valid selection, as the pattern byte is too large
+#define SELECTION_RESTART  0xffffffff
+
+// A channel's selected pattern, and its generator
+typedef struct {
+    // Written by core 0 - the generation count in the top 16 bits, and the
+    // CTRL_PATTERN wValue in the bottom 16
+    _Atomic uint32_t selection;
+
+    // Core 1 state - the selection the generator was last started from
+    uint32_t applied;
+    pattern_gen_t gen;
+    read_source_t src;
+} pattern_chan_t;
+
+static pattern_chan_t chans[CFG_TUD_VENDOR];
+
+// READ source which generates the pattern.  The segment buffers are word
+// aligned, and READ_BUF_SIZE bytes long, so a partial last word can be
+// generated in full.
+static uint32_t fill_pattern(void *ctx, uint8_t *buf, uint32_t offset, uint32_t len) {
+    pattern_chan_t *pc = ctx;
+
+    (void)offset;
+
+    pattern_gen_fill(&pc->gen, (uint32_t *)buf, (len + 3) / 4);
+    return len;
+}
+
+void pattern_init(void) {
+    for (int ii = 0; ii < CFG_TUD_VENDOR; ii++) {
+        pattern_chan_t *pc = &chans[ii];
+
+        atomic_store(&pc->selection, PATTERN_X);
+        pc->applied = SELECTION_RESTART;
+        pc->src = (read_source_t){
+            .map = NULL,
+            .fill = fill_pattern,
+            .ctx = pc,
+        };
+    }
+}
+
+bool pattern_select(uint8_t chan, uint16_t selection) {
+    pattern_chan_t *pc = &chans[chan];
+    uint32_t generation;
+
+    if ((selection & 0xff) >= PATTERN_COUNT) {
+        return false;
+    }
+
+    generation = (atomic_load_explicit(&pc->selection, memory_order_relaxed) >> 16) + 1;
+    atomic_store_explicit(&pc->selection, (generation << 16) | selection, memory_order_release);
+    return true;
+}
+
+void pattern_start_read(uint8_t chan, uint32_t len) {
+    pattern_chan_t *pc = &chans[chan];
+    uint32_t selection = atomic_load_explicit(&pc->selection, memory_order_acquire);
+
+    if (selection != pc->applied) {
+        DEBUG("Start pattern %d seed %d on channel %d", (int)(selection & 0xff), (int)((selection >> 8) & 0xff), chan);
+        pattern_gen_init(&pc->gen, (uint8_t)selection, (uint8_t)(selection >> 8));
+        pc->applied = selection;
+    }
+
+    if (pc->gen.pattern == PATTERN_X) {
+        bulk_in_start_read(chan, len, &read_source_x);
+    } else {
+        bulk_in_start_read(chan, len, &pc->src);
+    }
+}
+
+void pattern_restart(uint8_t chan) {
+    chans[chan].applied = SELECTION_RESTART;
+}
@@ -0,0 +1,170 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// READ test patterns for the tinyusb vendor example.
+//
+// By default READs return ASCII 'x' characters, which only shows the host
+// got the right amount of data.  The host can instead select (with
+// CTRL_PATTERN - see include.h) one of these patterns, which change from
+// byte to byte and READ to READ, so data which is corrupted, lost,
+// duplicated or reordered is detected:
+//
+// - PATTERN_COUNTER - incrementing 32-bit words, starting at 0.
+//
+// - PATTERN_PRBS31 - the PRBS-31 sequence (x^31 + x^28 + 1, as ITU-T
+//   O.150), starting from all ones.  Each word holds the next 32 bits of the
+//   sequence, the first bit in the word's most significant bit.
+//
+// - PATTERN_LFSR - a 32-bit xorshift sequence, seeded by the host.
+//
+// Patterns are generated a 32-bit word at a time, and words are sent low
+// order byte first.  The sequence carries on from one READ to the next, but
+// each READ starts with a new word: if a READ's length isn't a multiple of 4
+// the rest of its last word is not sent.  The sequence restarts when the
+// pattern is selected, or the channel is reset.
+//
+// The generators are all here, and have no Pico SDK dependencies, so that
+// the hosts (see host/) can generate the same data to check READs against.
+// The device side, which turns a channel's selected pattern into a READ
+// source, is in pattern.c.
+//
+
+#ifndef PATTERN_H
+#define PATTERN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PATTERN_X           0   // ASCII 'x' characters - the default
+#define PATTERN_COUNTER     1
+#define PATTERN_PRBS31      2
+#define PATTERN_LFSR        3
+#define PATTERN_COUNT       4
+
+// A pattern generator's state
+typedef struct {
+    uint8_t pattern;
+    uint32_t state;
+} pattern_gen_t;
+
+// Start pattern's sequence from the beginning.  seed is only used by
+// PATTERN_LFSR.
+static inline void pattern_gen_init(pattern_gen_t *gen, uint8_t pattern, uint8_t seed) {
+    gen->pattern = pattern;
+    switch (pattern) {
+        case PATTERN_PRBS31:
+            gen->state = 0x7fffffff;
+            break;
+
+        case PATTERN_LFSR:
+            // Spread the seed out, and never start at 0, which xorshift
+            // would never leave
+            gen->state = 0x9e3779b9u * ((uint32_t)seed + 1);
+            break;
+
+        default:
+            gen->state = 0;
+            break;
+    }
+}
+
+// PRBS-31 generates its next 16 bits from the current state in one go, as
+// the taps are more than 16 bits apart
+static inline uint32_t pattern_prbs31_16(uint32_t *state) {
+    uint32_t bits = ((*state >> 15) ^ (*state >> 12)) & 0xffff;
+    *state = ((*state << 16) | bits) & 0x7fffffff;
+    return bits;
+}
+
+// Returns the next word of the sequence
+static inline uint32_t pattern_gen_next(pattern_gen_t *gen) {
+    uint32_t word;
+
+    switch (gen->pattern) {
+        case PATTERN_COUNTER:
+            return gen->state++;
+
+        case PATTERN_PRBS31:
+            word = pattern_prbs31_16(&gen->state) << 16;
+            return word | pattern_prbs31_16(&gen->state);
+
+        case PATTERN_LFSR:
+            word = gen->state;
+            word ^= word << 13;
+            word ^= word >> 17;
+            word ^= word << 5;
+            gen->state = word;
+            return word;
+
+        default:
+            return 0x78787878;  // "xxxx"
+    }
+}
+
+// Fill buf with the next count words of the sequence.  This is on the
+// device's READ path, so the pattern is chosen once, rather than per word,
+// and each loop is simple enough for the compiler to keep the state in a
+// register.
+static inline void pattern_gen_fill(pattern_gen_t *gen, uint32_t *buf, uint32_t count) {
+    uint32_t state = gen->state;
+    uint32_t word;
+
+    switch (gen->pattern) {
+        case PATTERN_COUNTER:
+            for (uint32_t ii = 0; ii < count; ii++) {
+                buf[ii] = state++;
+            }
+            break;
+
+        case PATTERN_PRBS31:
+            for (uint32_t ii = 0; ii < count; ii++) {
+                word = pattern_prbs31_16(&state) << 16;
+                buf[ii] = word | pattern_prbs31_16(&state);
+            }
+            break;
+
+        case PATTERN_LFSR:
+            for (uint32_t ii = 0; ii < count; ii++) {
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                buf[ii] = state;
+            }
+            break;
+
+        default:
+            for (uint32_t ii = 0; ii < count; ii++) {
+                buf[ii] = 0x78787878;
+            }
+            break;
+    }
+
+    gen->state = state;
+}
+
+//
+// Device side (see pattern.c).  chan is the channel's number, from 0.
+//
+
+// Called once, before core 1 is launched
+void pattern_init(void);
+
+// Select the pattern subsequent READs on a channel return, from a
+// CTRL_PATTERN request's wValue - the pattern in the low byte and the seed
+// in the high byte.  Returns false if the pattern isn't supported.  Called
+// on core 0 - core 1 picks the change up at the start of the next READ.
+bool pattern_select(uint8_t chan, uint16_t selection);
+
+// Start a READ of len bytes of the channel's selected pattern, by starting a
+// bulk IN READ.  Called on core 1.
+void pattern_start_read(uint8_t chan, uint32_t len);
+
+// Restart the channel's sequence, when the channel is reset.  Called on
+// core 1.
+void pattern_restart(uint8_t chan);
+
+#endif // PATTERN_H
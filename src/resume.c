@@ -0,0 +1,144 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Resumable transfers - see resume.h.
+//
+// Core 1 writes each channel's record, as it starts PROTO_RESUME commands
+// and consumes their WRITE data, and core 0 reads it for CTRL_RESUME.  The
+// record is several fields, which core 0 must see consistently, so it's
+// protected by a sequence count: core 1 makes the count odd while it
+// updates the record, and core 0 reads the record again if the count was
+// odd, or changed, while it did.  Core 1 never waits for core 0.
+//
+// A READ's progress is counted on core 0, as tinyusb confirms its data sent
+// - core 1 tags the READ's segments (see bulk_in_tag_read()), and the
+// record holds the tag, so core 0 can look the count up.
+//
+
+#include <stdatomic.h>
+#include "pico/stdlib.h"
+#include "tusb.h"
+#include "include.h"
+#include "bulk-in.h"
+#include "resume.h"
+
+typedef struct {
+    uint16_t id;
+    uint8_t type;
+    uint32_t len;         // The transfer's total length
+    uint32_t offset;      // Where the current command started
+    uint32_t consumed;    // A WRITE's data consumed since then
+    uint32_t tag;         // A READ's bulk IN tag
+} resume_record_t;
+
+typedef struct {
+    _Atomic uint32_t seq;
+    resume_record_t record;
+
+    // Only used by core 1
+    uint32_t next_tag;
+} resume_chan_t;
+
+static resume_chan_t chans[CFG_TUD_VENDOR];
+
+// Core 1's side of the sequence count
+static void update_begin(resume_chan_t *rc) {
+    uint32_t seq = atomic_load_explicit(&rc->seq, memory_order_relaxed);
+
+    atomic_store_explicit(&rc->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void update_end(resume_chan_t *rc) {
+    uint32_t seq = atomic_load_explicit(&rc->seq, memory_order_relaxed);
+
+    atomic_store_explicit(&rc->seq, seq + 1, memory_order_release);
+}
+
+void resume_init(void) {
+    for (int ii = 0; ii < CFG_TUD_VENDOR; ii++) {
+        atomic_store(&chans[ii].seq, 0);
+        memset(&chans[ii].record, 0, sizeof(chans[ii].record));
+        chans[ii].next_tag = 1;
+    }
+}
+
+void resume_start(uint8_t chan, uint8_t type, uint16_t id, uint32_t len) {
+    resume_chan_t *rc = &chans[chan];
+    const resume_record_t *last = &rc->record;
+    uint16_t transfer = id & ~RESUME_CONTINUE;
+    uint32_t total = len;
+    uint32_t offset = 0;
+    uint32_t tag = 0;
+
+    if ((id & RESUME_CONTINUE) &&
+        (last->type == type) && (last->id == transfer) && (len <= last->len)) {
+        total = last->len;
+        offset = total - len;
+        INFO("Resume transfer 0x%04x on channel %d at %lu of %lu bytes", transfer, chan, (unsigned long)offset, (unsigned long)total);
+    } else if (id & RESUME_CONTINUE) {
+        INFO("Can't resume transfer 0x%04x on channel %d - starting it again", transfer, chan);
+    }
+
+    if (type == CMD_READ) {
+        tag = rc->next_tag++;
+        if (rc->next_tag == 0) {
+            rc->next_tag = 1;
+        }
+        bulk_in_tag_read(chan, tag);
+    }
+
+    update_begin(rc);
+    rc->record.id = transfer;
+    rc->record.type = type;
+    rc->record.len = total;
+    rc->record.offset = offset;
+    rc->record.consumed = 0;
+    rc->record.tag = tag;
+    update_end(rc);
+}
+
+void resume_progress(uint8_t chan, uint32_t len) {
+    resume_chan_t *rc = &chans[chan];
+
+    update_begin(rc);
+    rc->record.consumed += len;
+    update_end(rc);
+}
+
+void resume_get(uint8_t chan, uint8_t *info) {
+    resume_chan_t *rc = &chans[chan];
+    resume_record_t record;
+    uint32_t seq;
+    uint32_t done;
+
+    do {
+        seq = atomic_load_explicit(&rc->seq, memory_order_acquire);
+        record = rc->record;
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1) || (seq != atomic_load_explicit(&rc->seq, memory_order_relaxed)));
+
+    if (record.type == CMD_READ) {
+        done = bulk_in_tagged_sent(chan, record.tag);
+    } else {
+        done = record.consumed;
+    }
+    if (done > (record.len - record.offset)) {
+        done = record.len - record.offset;
+    }
+    done += record.offset;
+
+    memset(info, 0, RESUME_INFO_LEN);
+    info[0] = (uint8_t)(record.id & 0xff);
+    info[1] = (uint8_t)(record.id >> 8);
+    info[2] = record.type;
+    info[3] = STATUS_READY;
+    for (int ii = 0; ii < 4; ii++) {
+        info[4 + ii] = (uint8_t)(record.len >> (8 * ii));
+        info[8 + ii] = (uint8_t)(done >> (8 * ii));
+    }
+}
@@ -0,0 +1,89 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Resumable transfers for the tinyusb vendor example.
+//
+// A channel reset - CTRL_INIT, or the device being suspended, resumed,
+// unmounted or mounted - abandons whatever the channel was doing, so a long
+// READ or WRITE which is interrupted would have to be started again from
+// the beginning.  PROTO_RESUME commands can instead be resumed from where
+// they got to.  They are as PROTO_LARGE commands, but bytes 2 and 3 of the
+// header are a transfer ID, chosen by the host, low order byte first.
+//
+// Each channel keeps a record of the PROTO_RESUME command it most recently
+// started - its transfer ID, whether it was a READ or a WRITE, the
+// transfer's total length, and how much of it is done:
+//
+// - for a WRITE, the bytes of its data consumed - passed to the channel's
+//   consumer, so never needed again, and
+//
+// - for a READ, the bytes of its data tinyusb has confirmed as sent.  A host
+//   may have received more than this (the last transfer's confirmation may
+//   have been lost to the interruption), but never less.
+//
+// The record survives channel resets, and CTRL_RESUME returns it (see
+// resume_get()).  To resume, the host sends a PROTO_RESUME command with the
+// same transfer ID, plus RESUME_CONTINUE, of the same type, whose length is
+// what's left of the transfer - the total less the bytes it's done.  A WRITE
+// sends just the rest of its data, and a READ gets just the rest of its
+// data.  The record carries on, at the new offset, so a transfer can be
+// resumed as many times as it's interrupted.  A PROTO_RESUME command which
+// doesn't match the record (or without RESUME_CONTINUE) starts a new
+// transfer, and record.
+//
+// Only the most recently started PROTO_RESUME command is recorded, so a
+// host which wants to be able to resume its transfers should only have one
+// in flight at a time.  The READ sources in this example don't use the
+// offset - a resumed READ's data carries on from where the source had got
+// to, as it would for any READ (see pattern.h).
+//
+// chan is the channel's number, from 0.
+//
+
+#ifndef RESUME_H
+#define RESUME_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Added to a PROTO_RESUME command's transfer ID to resume the transfer,
+// rather than start a new one - transfer IDs are 15 bits
+#define RESUME_CONTINUE   0x8000
+
+// Length of the CTRL_RESUME response:
+// bytes 0-1 - transfer ID, low order byte first
+// byte 2 - CMD_READ or CMD_WRITE, or 0 if no PROTO_RESUME command has been
+//          started on the channel
+// byte 3 - STATUS_READY, or STATUS_BUSY if the channel is still being reset
+//          (in which case the rest is 0 - ask again)
+// bytes 4-7 - the transfer's total length, low order byte first
+// bytes 8-11 - the bytes of it done, low order byte first
+#define RESUME_INFO_LEN   12
+
+// Called once, before core 1 is launched
+void resume_init(void);
+
+//
+// Called on core 1
+//
+
+// A PROTO_RESUME command of type, with transfer ID id and data length len,
+// is starting.  A READ must already have been started with
+// bulk_in_start_read().
+void resume_start(uint8_t chan, uint8_t type, uint16_t id, uint32_t len);
+
+// len more bytes of the current PROTO_RESUME WRITE's data have been consumed
+void resume_progress(uint8_t chan, uint32_t len);
+
+//
+// Called on core 0
+//
+
+// Fill info (RESUME_INFO_LEN bytes) with the channel's record
+void resume_get(uint8_t chan, uint8_t *info);
+
+#endif // RESUME_H
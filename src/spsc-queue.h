@@ -0,0 +1,234 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Lock-free single-producer/single-consumer queue.
+//
+// Used to pass commands, data and buffers between core 0 (which runs
+// tinyusb) and core 1 (which runs the command handlers), without either
+// core ever having to wait for the other.
+//
+// This header has no Pico SDK dependencies, so it can also be built on a
+// host - see host/spsc-bench.c.
+//
+// How it works:
+// - The queue holds a power of 2 number of fixed size elements.
+// - head and tail are free running counters.  Only the producer writes head
+//   and only the consumer writes tail, so no locks or atomic
+//   read-modify-write operations are needed (which is just as well, as the
+//   RP2040's Cortex-M0+ cores don't have any).
+// - The producer fills in an element and then publishes it by storing head
+//   with release semantics.  The consumer loads head with acquire semantics,
+//   so it is guaranteed to see the element's contents.  The reverse applies
+//   when the consumer releases elements back to the producer via tail.
+// - Each side also keeps a cached copy of the other side's counter, and
+//   only reloads it when the cached copy says the queue is full (producer)
+//   or empty (consumer).  head and tail, with their caches, are placed on
+//   separate cache lines so the two sides don't continually steal a line
+//   from each other.  The RP2040 doesn't have a data cache, so we don't pad
+//   there, to save RAM.
+//
+// Elements may either be copied in and out (spsc_push()/spsc_pop()) or
+// accessed in place (spsc_produce_span()/spsc_produce_commit() and
+// spsc_consume_span()/spsc_consume_release()), the latter allowing runs of
+// contiguous elements to be handled at once - for example reading USB data
+// directly into a byte queue.
+//
+
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#ifndef SPSC_CACHE_LINE
+#if defined(PICO_ON_DEVICE) && PICO_ON_DEVICE
+#define SPSC_CACHE_LINE  4
+#else
+#define SPSC_CACHE_LINE  64
+#endif
+#endif // SPSC_CACHE_LINE
+
+typedef struct {
+    // Written by the producer
+    _Alignas(SPSC_CACHE_LINE) _Atomic uint32_t head;
+    uint32_t tail_cache;
+
+    // Written by the consumer
+    _Alignas(SPSC_CACHE_LINE) _Atomic uint32_t tail;
+    uint32_t head_cache;
+
+    // Fixed at initialization
+    _Alignas(SPSC_CACHE_LINE) uint8_t *storage;
+    uint32_t elem_size;
+    uint32_t mask;
+} spsc_queue_t;
+
+// Initialize a queue, using storage of capacity * elem_size bytes.  capacity
+// must be a power of 2.  Must not be called while either side is using the
+// queue.
+static inline void spsc_init(spsc_queue_t *q, void *storage, uint32_t elem_size, uint32_t capacity) {
+    q->storage = (uint8_t *)storage;
+    q->elem_size = elem_size;
+    q->mask = capacity - 1;
+    q->tail_cache = 0;
+    q->head_cache = 0;
+    atomic_store_explicit(&q->head, 0, memory_order_relaxed);
+    atomic_store_explicit(&q->tail, 0, memory_order_relaxed);
+}
+
+static inline uint32_t spsc_capacity(const spsc_queue_t *q) {
+    return q->mask + 1;
+}
+
+static inline void *spsc_elem(const spsc_queue_t *q, uint32_t counter) {
+    return q->storage + ((counter & q->mask) * q->elem_size);
+}
+
+// Number of elements queued.  Only a snapshot if called from the side which
+// doesn't own the counter which is changing.
+static inline uint32_t spsc_count(spsc_queue_t *q) {
+    return atomic_load_explicit(&q->head, memory_order_acquire) -
+           atomic_load_explicit(&q->tail, memory_order_acquire);
+}
+
+//
+// Producer side
+//
+
+// Number of free elements
+static inline uint32_t spsc_space(spsc_queue_t *q) {
+    uint32_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    uint32_t space = spsc_capacity(q) - (head - q->tail_cache);
+
+    if (space == 0) {
+        q->tail_cache = atomic_load_explicit(&q->tail, memory_order_acquire);
+        space = spsc_capacity(q) - (head - q->tail_cache);
+    }
+    return space;
+}
+
+// Number of free elements, always reloading the consumer's counter.
+// spsc_space() only reloads it once the cached copy says the queue is full,
+// so may under-report - use this if you need to know whether there's room
+// for more than one element.
+static inline uint32_t spsc_space_fresh(spsc_queue_t *q) {
+    uint32_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+
+    q->tail_cache = atomic_load_explicit(&q->tail, memory_order_acquire);
+    return spsc_capacity(q) - (head - q->tail_cache);
+}
+
+// Returns a pointer to the next free element, setting *count to the number
+// of contiguous free elements from it (0 if the queue is full).
+static inline void *spsc_produce_span(spsc_queue_t *q, uint32_t *count) {
+    uint32_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    uint32_t space = spsc_space(q);
+    uint32_t contiguous = spsc_capacity(q) - (head & q->mask);
+
+    *count = (space < contiguous) ? space : contiguous;
+    return spsc_elem(q, head);
+}
+
+// Publish count elements, previously filled in via spsc_produce_span()
+static inline void spsc_produce_commit(spsc_queue_t *q, uint32_t count) {
+    uint32_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    atomic_store_explicit(&q->head, head + count, memory_order_release);
+}
+
+// Copy one element in.  Returns false if the queue is full.
+static inline bool spsc_push(spsc_queue_t *q, const void *elem) {
+    uint32_t count;
+    void *slot = spsc_produce_span(q, &count);
+
+    if (count == 0) {
+        return false;
+    }
+    memcpy(slot, elem, q->elem_size);
+    spsc_produce_commit(q, 1);
+    return true;
+}
+
+//
+// Consumer side
+//
+
+// Number of elements available to consume
+static inline uint32_t spsc_available(spsc_queue_t *q) {
+    uint32_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    uint32_t available = q->head_cache - tail;
+
+    if (available == 0) {
+        q->head_cache = atomic_load_explicit(&q->head, memory_order_acquire);
+        available = q->head_cache - tail;
+    }
+    return available;
+}
+
+// Number of elements available to consume, always reloading the producer's
+// counter.  spsc_available() only reloads it once the cached copy says the
+// queue is empty, so may under-report - use this if you need to know
+// whether more than one element is available.
+static inline uint32_t spsc_available_fresh(spsc_queue_t *q) {
+    uint32_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+
+    q->head_cache = atomic_load_explicit(&q->head, memory_order_acquire);
+    return q->head_cache - tail;
+}
+
+// Returns a pointer to the nth available element (0 being the oldest), or
+// NULL if there aren't that many.  The element stays queued.
+static inline void *spsc_peek(spsc_queue_t *q, uint32_t n) {
+    uint32_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+
+    if ((q->head_cache - tail) <= n) {
+        q->head_cache = atomic_load_explicit(&q->head, memory_order_acquire);
+        if ((q->head_cache - tail) <= n) {
+            return NULL;
+        }
+    }
+    return spsc_elem(q, tail + n);
+}
+
+// Returns a pointer to the oldest element, setting *count to the number of
+// contiguous available elements from it (0 if the queue is empty).
+static inline void *spsc_consume_span(spsc_queue_t *q, uint32_t *count) {
+    uint32_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    uint32_t available = spsc_available(q);
+    uint32_t contiguous = spsc_capacity(q) - (tail & q->mask);
+
+    *count = (available < contiguous) ? available : contiguous;
+    return spsc_elem(q, tail);
+}
+
+// Hand count elements back to the producer
+static inline void spsc_consume_release(spsc_queue_t *q, uint32_t count) {
+    uint32_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    atomic_store_explicit(&q->tail, tail + count, memory_order_release);
+}
+
+// Copy one element out.  Returns false if the queue is empty.
+static inline bool spsc_pop(spsc_queue_t *q, void *elem) {
+    uint32_t count;
+    void *slot = spsc_consume_span(q, &count);
+
+    if (count == 0) {
+        return false;
+    }
+    memcpy(elem, slot, q->elem_size);
+    spsc_consume_release(q, 1);
+    return true;
+}
+
+// Discard everything currently queued
+static inline void spsc_consume_all(spsc_queue_t *q) {
+    q->head_cache = atomic_load_explicit(&q->head, memory_order_acquire);
+    atomic_store_explicit(&q->tail, q->head_cache, memory_order_release);
+}
+
+#endif // SPSC_QUEUE_H
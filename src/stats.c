@@ -0,0 +1,96 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Performance counters - see stats.h.
+//
+// Counters only ever increase (wrapping at 32 bits).  Rather than zeroing
+// them on a reset, which would race with the other core updating them, we
+// remember the totals at the time of the reset, and report the difference.
+//
+
+#include "pico/stdlib.h"
+#include "include.h"
+#include "stats.h"
+
+_Atomic uint32_t stats_counters[2][STAT_COUNT];
+
+// Only used by core 0 - the totals when the counters were last reset, when
+// that was, and the longest tud_task() call since
+static uint32_t baseline[STAT_COUNT];
+static uint64_t reset_us;
+static uint32_t tud_task_max_us;
+
+void stats_init(void) {
+    for (int core = 0; core < 2; core++) {
+        for (int ii = 0; ii < STAT_COUNT; ii++) {
+            atomic_store(&stats_counters[core][ii], 0);
+        }
+    }
+    memset(baseline, 0, sizeof(baseline));
+    reset_us = time_us_64();
+    tud_task_max_us = 0;
+}
+
+void stats_tud_task(uint32_t us) {
+    stats_inc(STAT_TUD_TASK_CALLS);
+    stats_add(STAT_TUD_TASK_US, us);
+    if (us > tud_task_max_us) {
+        tud_task_max_us = us;
+    }
+}
+
+static uint8_t *put_u32(uint8_t *buf, uint32_t val) {
+    buf[0] = (uint8_t)val;
+    buf[1] = (uint8_t)(val >> 8);
+    buf[2] = (uint8_t)(val >> 16);
+    buf[3] = (uint8_t)(val >> 24);
+    return buf + 4;
+}
+
+// Work out a rate per second, from a count over elapsed_us
+static uint32_t per_second(uint32_t count, uint64_t elapsed_us) {
+    if (elapsed_us == 0) {
+        return 0;
+    }
+    return (uint32_t)(((uint64_t)count * 1000000) / elapsed_us);
+}
+
+void stats_snapshot(uint8_t *buf, bool reset) {
+    uint32_t values[STAT_COUNT];
+    uint32_t total;
+    uint64_t now_us = time_us_64();
+    uint64_t elapsed_us = now_us - reset_us;
+
+    for (int ii = 0; ii < STAT_COUNT; ii++) {
+        total = atomic_load_explicit(&stats_counters[0][ii], memory_order_relaxed) +
+                atomic_load_explicit(&stats_counters[1][ii], memory_order_relaxed);
+        values[ii] = total - baseline[ii];
+        if (reset) {
+            baseline[ii] = total;
+        }
+    }
+
+    buf[0] = STATS_VERSION;
+    buf[1] = STAT_COUNT;
+    buf[2] = 0;
+    buf[3] = 0;
+    buf = put_u32(buf + 4, (uint32_t)elapsed_us);
+    buf = put_u32(buf, (uint32_t)(elapsed_us >> 32));
+    for (int ii = 0; ii < STAT_COUNT; ii++) {
+        buf = put_u32(buf, values[ii]);
+    }
+    buf = put_u32(buf, per_second(values[STAT_MAIN_LOOPS], elapsed_us));
+    buf = put_u32(buf, per_second(values[STAT_AUX_LOOPS], elapsed_us));
+    buf = put_u32(buf, tud_task_max_us);
+    put_u32(buf, (values[STAT_TUD_TASK_CALLS] > 0) ?
+        (values[STAT_TUD_TASK_US] / values[STAT_TUD_TASK_CALLS]) : 0);
+
+    if (reset) {
+        reset_us = now_us;
+        tud_task_max_us = 0;
+    }
+}
@@ -0,0 +1,87 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Performance counters for the tinyusb vendor example.
+//
+// Each core has its own set of counters, which only it writes, so updating
+// a counter is just a load, add and store - no locks, and no atomic
+// read-modify-write instructions (which the RP2040 doesn't have).  The two
+// sets are added together when the host reads them, with the CTRL_STATS
+// control request (see stats_snapshot()).
+//
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "pico/stdlib.h"
+
+// The counters.  The order is the order they are returned to the host in,
+// so only add to the end (before STAT_COUNT), and update usbcmd.py to
+// match.
+typedef enum {
+    STAT_BYTES_OUT,          // Bulk bytes received from the host
+    STAT_BYTES_IN,           // Bulk bytes sent to the host
+    STAT_PACKETS_OUT,        // Bulk packets received from the host
+    STAT_PACKETS_IN,         // Bulk packets sent to the host
+    STAT_CMD_READ,           // READ commands received
+    STAT_CMD_WRITE,          // WRITE commands received
+    STAT_CMD_OTHER,          // Unsupported commands received
+    STAT_STATUS_READY,       // READY statuses sent
+    STAT_STATUS_BUSY,        // BUSY statuses sent
+    STAT_STATUS_ERROR,       // ERROR statuses sent
+    STAT_TX_FIFO_FULL,       // Times we had data to send but tinyusb's TX FIFO was full
+    STAT_RX_FLUSH,           // Times received data was thrown away
+    STAT_MAIN_LOOPS,         // Core 0 main loop iterations
+    STAT_AUX_LOOPS,          // Core 1 loop iterations
+    STAT_TUD_TASK_CALLS,     // tud_task() calls timed
+    STAT_TUD_TASK_US,        // Total time spent in tud_task()
+    STAT_COUNT
+} stat_id_t;
+
+// Size of the block returned by stats_snapshot():
+// - byte 0     - version (STATS_VERSION)
+// - byte 1     - number of counters (STAT_COUNT)
+// - bytes 2-3  - reserved
+// - 8 bytes    - microseconds since the counters were last reset (64 bits,
+//                as 32 bits would wrap after 71.6 minutes)
+// - 4 bytes    - each counter, in stat_id_t order
+// - 4 bytes    - core 0 main loop iterations per second
+// - 4 bytes    - core 1 loop iterations per second
+// - 4 bytes    - maximum tud_task() duration, in microseconds
+// - 4 bytes    - average tud_task() duration, in microseconds
+// All values are little-endian.
+#define STATS_VERSION     2
+#define STATS_BLOCK_LEN   (4 + 8 + (STAT_COUNT * 4) + 16)
+
+// Per-core counters - use the functions below rather than accessing these
+extern _Atomic uint32_t stats_counters[2][STAT_COUNT];
+
+// Called once on core 0, before core 1 is launched
+void stats_init(void);
+
+// Add to a counter belonging to the calling core
+static inline void stats_add(stat_id_t id, uint32_t val) {
+    _Atomic uint32_t *counter = &stats_counters[get_core_num()][id];
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + val, memory_order_relaxed);
+}
+
+static inline void stats_inc(stat_id_t id) {
+    stats_add(id, 1);
+}
+
+// Called on core 0 with the time a tud_task() call took
+void stats_tud_task(uint32_t us);
+
+// Called on core 0 to fill buf (of STATS_BLOCK_LEN bytes) with the current
+// counters.  If reset is true the counters are then reset - this is done by
+// remembering their current values, so neither core has to stop counting.
+void stats_snapshot(uint8_t *buf, bool reset);
+
+#endif // STATS_H
@@ -0,0 +1,411 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// RAM object store - see store.h.
+//
+// The pool's blocks are chained by next_block[] - an object's blocks in
+// order, and the free blocks as a stack - so allocating or freeing a block
+// is a couple of array accesses, and an object can use any blocks, in any
+// order.  Between WRITEs an object has just enough blocks for its data.
+//
+// Everything but the occupancy counts is only used by core 1, so needs no
+// locking, even though several channels may use an object at once.  Core 1
+// updates the counts, as atomics, whenever blocks are allocated or freed,
+// or a WRITE finishes, for core 0 to read for CTRL_STORE.
+//
+// A READ's source maps the object's blocks a block at a time, following the
+// chain from the block it last mapped, as the bulk IN engine asks for the
+// READ's data in order.
+//
+// Commands for flash objects are passed on to flash-store.c.
+//
+
+#include <stdatomic.h>
+#include "pico/stdlib.h"
+#include "tusb.h"
+#include "include.h"
+#include "bulk-in.h"
+#include "write-sink.h"
+#include "store.h"
+#include "flash-store.h"
+
+static_assert((STORE_BLOCK_SIZE & (STORE_BLOCK_SIZE - 1)) == 0, "STORE_BLOCK_SIZE must be a power of 2");
+static_assert(STORE_BLOCK_SIZE <= 32768, "STORE_BLOCK_SIZE must be at most 32768");
+static_assert((STORE_BLOCKS > 0) && (STORE_BLOCKS < 0xffff), "STORE_BLOCKS must be 1-65534");
+static_assert(CFG_TUD_VENDOR <= 8, "Each channel needs a bit in store_object_t's readers");
+
+// End of a chain
+#define NO_BLOCK   0xffff
+
+// An object's writer, when it hasn't got one
+#define NO_CHAN    0xff
+
+typedef struct {
+    uint32_t len;
+    uint16_t first;        // The chain of blocks holding the data, or
+    uint16_t last;         // NO_BLOCK
+    uint16_t blocks;
+    uint8_t writer;        // The channel with a WRITE to it in progress
+    uint8_t readers;       // Channels which have READ it, one bit each -
+                           // cleared once they have sent everything
+} store_object_t;
+
+// A channel's current WRITE and READ
+typedef struct {
+    bool flash;                  // The WRITE is to a flash object
+    store_object_t *write_obj;   // NULL if the WRITE's data is thrown away
+    uint32_t write_remaining;
+    uint16_t write_block;        // Where the next byte goes
+    uint32_t write_off;
+
+    uint16_t read_block;         // The block last mapped, and the offset of
+    uint32_t read_start;         // its first byte in the object
+    read_source_t src;
+} store_chan_t;
+
+static uint8_t pool[STORE_BLOCKS][STORE_BLOCK_SIZE] __attribute__((aligned(4)));
+static uint16_t next_block[STORE_BLOCKS];
+static uint16_t free_head;
+static uint32_t free_count;
+
+static store_object_t objects[STORE_OBJECTS];
+static store_chan_t chans[CFG_TUD_VENDOR];
+
+// For CTRL_STORE
+static _Atomic uint32_t blocks_used;
+static _Atomic uint32_t objects_used;
+
+static void update_counts(void) {
+    uint32_t used = 0;
+
+    for (int ii = 0; ii < STORE_OBJECTS; ii++) {
+        if (objects[ii].len > 0) {
+            used++;
+        }
+    }
+    atomic_store_explicit(&blocks_used, STORE_BLOCKS - free_count, memory_order_release);
+    atomic_store_explicit(&objects_used, used, memory_order_release);
+}
+
+// Take count blocks from the free stack, chained in order, and add them to
+// the end of obj's chain.  There must be enough free.
+static void alloc_blocks(store_object_t *obj, uint32_t count) {
+    uint16_t block;
+
+    for (uint32_t ii = 0; ii < count; ii++) {
+        block = free_head;
+        free_head = next_block[block];
+        next_block[block] = NO_BLOCK;
+
+        if (obj->first == NO_BLOCK) {
+            obj->first = block;
+        } else {
+            next_block[obj->last] = block;
+        }
+        obj->last = block;
+        obj->blocks++;
+    }
+    free_count -= count;
+}
+
+// Return every block of obj's chain after the first keep to the free stack
+static void free_blocks(store_object_t *obj, uint32_t keep) {
+    uint16_t block = obj->first;
+    uint16_t next;
+
+    for (uint32_t ii = 0; (ii < keep) && (block != NO_BLOCK); ii++) {
+        obj->last = block;
+        block = next_block[block];
+    }
+    if (keep == 0) {
+        obj->first = NO_BLOCK;
+        obj->last = NO_BLOCK;
+    } else {
+        next_block[obj->last] = NO_BLOCK;
+    }
+
+    while (block != NO_BLOCK) {
+        next = next_block[block];
+        next_block[block] = free_head;
+        free_head = block;
+        free_count++;
+        obj->blocks--;
+        block = next;
+    }
+}
+
+static uint32_t blocks_for(uint32_t len) {
+    return (uint32_t)(((uint64_t)len + STORE_BLOCK_SIZE - 1) / STORE_BLOCK_SIZE);
+}
+
+// The current WRITE has had all its data
+static void finish_write(store_chan_t *sc) {
+    if (sc->write_obj != NULL) {
+        sc->write_obj->writer = NO_CHAN;
+        sc->write_obj = NULL;
+    }
+    update_counts();
+}
+
+// WRITE sink consumer for a WRITE which is being thrown away
+static uint32_t discard_consumer(void *ctx, const uint8_t *data, uint32_t len) {
+    (void)ctx;
+    (void)data;
+    return len;
+}
+
+// WRITE sink consumer which copies the data into the object's blocks, which
+// were allocated when the WRITE started
+static uint32_t store_consumer(void *ctx, const uint8_t *data, uint32_t len) {
+    store_chan_t *sc = ctx;
+    uint32_t span;
+    uint32_t total = 0;
+
+    while (total < len) {
+        if (sc->write_off == STORE_BLOCK_SIZE) {
+            sc->write_block = next_block[sc->write_block];
+            sc->write_off = 0;
+        }
+        span = STORE_BLOCK_SIZE - sc->write_off;
+        if (span > (len - total)) {
+            span = len - total;
+        }
+        memcpy(&pool[sc->write_block][sc->write_off], data + total, span);
+        sc->write_off += span;
+        total += span;
+    }
+
+    // READs on other channels can have the data now
+    sc->write_obj->len += total;
+    return total;
+}
+
+// READ source which hands the object's blocks to the bulk IN engine in place
+static const uint8_t *map_object(void *ctx, uint32_t offset, uint32_t *len) {
+    store_chan_t *sc = ctx;
+    uint32_t within;
+
+    while ((offset - sc->read_start) >= STORE_BLOCK_SIZE) {
+        sc->read_block = next_block[sc->read_block];
+        sc->read_start += STORE_BLOCK_SIZE;
+    }
+    within = offset - sc->read_start;
+    if (*len > (STORE_BLOCK_SIZE - within)) {
+        *len = STORE_BLOCK_SIZE - within;
+    }
+    return &pool[sc->read_block][within];
+}
+
+void store_init(void) {
+    flash_store_init();
+
+    for (uint32_t ii = 0; ii < STORE_BLOCKS; ii++) {
+        next_block[ii] = (ii + 1 < STORE_BLOCKS) ? (uint16_t)(ii + 1) : NO_BLOCK;
+    }
+    free_head = 0;
+    free_count = STORE_BLOCKS;
+
+    for (int ii = 0; ii < STORE_OBJECTS; ii++) {
+        objects[ii] = (store_object_t){
+            .len = 0,
+            .first = NO_BLOCK,
+            .last = NO_BLOCK,
+            .blocks = 0,
+            .writer = NO_CHAN,
+            .readers = 0,
+        };
+    }
+    for (int ii = 0; ii < CFG_TUD_VENDOR; ii++) {
+        store_chan_t *sc = &chans[ii];
+
+        sc->flash = false;
+        sc->write_obj = NULL;
+        sc->write_remaining = 0;
+        sc->src = (read_source_t){
+            .map = map_object,
+            .fill = NULL,
+            .ctx = sc,
+        };
+    }
+    update_counts();
+}
+
+bool store_write_ready(uint8_t chan, uint8_t object, uint8_t flags) {
+    store_object_t *obj;
+
+    if (flags & STORE_FLASH) {
+        // store_start_write() turns appends away
+        return (flags & STORE_APPEND) || flash_store_write_ready(chan, object);
+    }
+    if (object >= STORE_OBJECTS) {
+        // store_start_write() turns it away
+        return true;
+    }
+    obj = &objects[object];
+    if (obj->writer != NO_CHAN) {
+        return false;
+    }
+    if (flags & STORE_APPEND) {
+        return true;
+    }
+
+    // Wait for READs of the data we're replacing to have been sent
+    for (uint8_t ii = 0; ii < CFG_TUD_VENDOR; ii++) {
+        if ((obj->readers & (1 << ii)) && bulk_in_idle(ii)) {
+            obj->readers &= (uint8_t)~(1 << ii);
+        }
+    }
+    return obj->readers == 0;
+}
+
+bool store_start_write(uint8_t chan, uint8_t object, uint8_t flags, uint32_t len) {
+    store_chan_t *sc = &chans[chan];
+    store_object_t *obj;
+    uint32_t needed;
+
+    sc->flash = false;
+    sc->write_obj = NULL;
+    sc->write_remaining = len;
+
+    if (flags & STORE_FLASH) {
+        if (flags & STORE_APPEND) {
+            INFO("Can't append to flash object %d, on channel %d", object, chan);
+            return false;
+        }
+        sc->flash = flash_store_start_write(chan, object, len);
+        return sc->flash;
+    }
+    if (object >= STORE_OBJECTS) {
+        INFO("No store object %d, for WRITE on channel %d", object, chan);
+        return false;
+    }
+    obj = &objects[object];
+
+    if (flags & STORE_APPEND) {
+        needed = (len <= (UINT32_MAX - obj->len)) ? (blocks_for(obj->len + len) - obj->blocks) : UINT32_MAX;
+        if (needed > free_count) {
+            INFO("No room to append %lu bytes to store object %d on channel %d", (unsigned long)len, object, chan);
+            return false;
+        }
+        if (obj->blocks == 0) {
+            alloc_blocks(obj, needed);
+            sc->write_block = obj->first;
+            sc->write_off = 0;
+        } else {
+            // Carry on from the end of the last block - if it's full, the
+            // consumer moves on to the first new one
+            sc->write_block = obj->last;
+            sc->write_off = obj->len - ((obj->blocks - 1) * STORE_BLOCK_SIZE);
+            alloc_blocks(obj, needed);
+        }
+    } else {
+        needed = blocks_for(len);
+        if (needed > (free_count + obj->blocks)) {
+            INFO("No room for %lu byte WRITE to store object %d on channel %d", (unsigned long)len, object, chan);
+            return false;
+        }
+        free_blocks(obj, 0);
+        obj->len = 0;
+        alloc_blocks(obj, needed);
+        sc->write_block = obj->first;
+        sc->write_off = 0;
+    }
+
+    obj->writer = chan;
+    sc->write_obj = obj;
+    if (len == 0) {
+        finish_write(sc);
+    } else {
+        update_counts();
+    }
+    return true;
+}
+
+uint32_t store_service_write(uint8_t chan, uint32_t max_len) {
+    store_chan_t *sc = &chans[chan];
+    uint32_t consumed;
+
+    if (sc->flash) {
+        return flash_store_service_write(chan, max_len);
+    }
+    consumed = write_sink_deliver(chan, max_len, (sc->write_obj != NULL) ? store_consumer : discard_consumer, sc);
+    sc->write_remaining -= consumed;
+    if ((consumed > 0) && (sc->write_remaining == 0)) {
+        finish_write(sc);
+    }
+    return consumed;
+}
+
+bool store_write_done(uint8_t chan) {
+    return !chans[chan].flash || flash_store_write_done(chan);
+}
+
+uint32_t store_start_read(uint8_t chan, uint8_t object, uint8_t flags, uint32_t len) {
+    store_chan_t *sc = &chans[chan];
+    store_object_t *obj;
+
+    if (flags & STORE_FLASH) {
+        return flash_store_start_read(chan, object, len);
+    }
+    if (object >= STORE_OBJECTS) {
+        INFO("No store object %d, for READ on channel %d", object, chan);
+        len = 0;
+    } else {
+        obj = &objects[object];
+        if (len > obj->len) {
+            INFO("Store READ of %lu bytes on channel %d, object %d only holds %lu", (unsigned long)len, chan, object, (unsigned long)obj->len);
+            len = obj->len;
+        }
+        if (len > 0) {
+            obj->readers |= (uint8_t)(1 << chan);
+            sc->read_block = obj->first;
+            sc->read_start = 0;
+        }
+    }
+
+    bulk_in_start_read(chan, len, &sc->src);
+    return len;
+}
+
+void store_abort(uint8_t chan) {
+    store_chan_t *sc = &chans[chan];
+    store_object_t *obj = sc->write_obj;
+
+    if (sc->flash) {
+        flash_store_abort(chan);
+        sc->flash = false;
+        return;
+    }
+    if (obj == NULL) {
+        return;
+    }
+
+    // Give back the blocks the rest of the data would have gone in - READs
+    // on other channels only use the data already written
+    free_blocks(obj, blocks_for(obj->len));
+    sc->write_remaining = 0;
+    finish_write(sc);
+}
+
+void store_get_info(uint8_t flags, uint8_t *info) {
+    uint32_t used = atomic_load_explicit(&blocks_used, memory_order_acquire);
+    uint32_t objs = atomic_load_explicit(&objects_used, memory_order_acquire);
+
+    if (flags & STORE_FLASH) {
+        flash_store_get_info(info);
+        return;
+    }
+
+    info[0] = (uint8_t)(used & 0xff);
+    info[1] = (uint8_t)(used >> 8);
+    info[2] = (uint8_t)(STORE_BLOCKS & 0xff);
+    info[3] = (uint8_t)(STORE_BLOCKS >> 8);
+    info[4] = (uint8_t)(STORE_BLOCK_SIZE & 0xff);
+    info[5] = (uint8_t)(STORE_BLOCK_SIZE >> 8);
+    info[6] = (uint8_t)objs;
+    info[7] = STORE_OBJECTS;
+}
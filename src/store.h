@@ -0,0 +1,132 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// RAM object store for the tinyusb vendor example.
+//
+// An ordinary WRITE's data goes to the channel's consumer, and an ordinary
+// READ returns whatever its source generates, so the device can't hold data
+// for the host.  PROTO_STORE commands instead address objects - numbered
+// from 0 to STORE_OBJECTS - 1 - held in device RAM, so a host can preload
+// data once, and READ it back as often as it likes.  They are as PROTO_LARGE
+// commands, but byte 2 of the header is the object number, and byte 3 its
+// flags:
+//
+// - A WRITE replaces the object's data with its own, or, with STORE_APPEND,
+//   adds its data to the end of the object's.  A WRITE of 0 bytes, without
+//   STORE_APPEND, empties the object.
+//
+// - A READ returns the object's data, from the start.  It returns at most as
+//   much data as the object holds, so may be short (or, if the object is
+//   empty, just a zero length packet), as a PROTO_LOOPBACK READ may be.
+//
+// Objects are held in blocks of STORE_BLOCK_SIZE bytes, from a pool of
+// STORE_BLOCKS shared by all the objects (and channels) - there's no malloc,
+// and as every block is the same size, the pool can't fragment.  An object's
+// blocks are chained, in order.  A WRITE gets all the blocks it needs when it
+// starts, so a WRITE with more data than there is room for in the pool - or
+// for an object number which doesn't exist - is consumed, but its data thrown
+// away, and it gets an ERROR status, leaving the object as it was.
+//
+// A READ hands the object's blocks to the bulk IN engine in place (see the
+// map READ source in bulk-in.h), so its data goes straight from the pool to
+// tud_vendor_write(), with no copy.  The blocks must then stay as they are
+// until it has been sent, so a WRITE replacing an object waits, before it
+// starts, until every channel which has READ the object has sent everything
+// it queued - and a WRITE to an object another channel is writing waits for
+// that WRITE to finish.  A WRITE appending to an object only adds data after
+// the end any READ has seen, so doesn't wait for READs.
+//
+// Objects survive channels being reset - only a WRITE changes them.
+// CTRL_STORE returns the pool's occupancy (see store_get_info()).
+//
+// With STORE_FLASH in its flags, a command instead addresses one of the
+// objects kept in flash, which also survive the device being reset, or
+// powered off - see flash-store.h.  CTRL_STORE, with STORE_FLASH in its
+// wValue, returns their occupancy.
+//
+// Everything here runs on core 1, as part of the worker (see worker.c),
+// apart from store_init() and store_get_info().  chan is the channel's number, from 0.
+//
+
+#ifndef STORE_H
+#define STORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Size of each block in the pool.  Must be a power of 2, at most 32768.  Can
+// be overridden from CMakeLists.txt.
+#ifndef STORE_BLOCK_SIZE
+#define STORE_BLOCK_SIZE   1024
+#endif
+
+// Number of blocks in the pool - STORE_BLOCK_SIZE * STORE_BLOCKS bytes of
+// RAM hold every object's data.  At most 65535.  Can be overridden from
+// CMakeLists.txt.
+#ifndef STORE_BLOCKS
+#define STORE_BLOCKS       64
+#endif
+
+// Number of objects
+#define STORE_OBJECTS      16
+
+// PROTO_STORE command flags (header byte 3)
+#define STORE_APPEND       0x01    // A WRITE adds to the object's data
+#define STORE_FLASH        0x02    // The object is kept in flash
+
+// Length of the CTRL_STORE response:
+// bytes 0-1 - blocks in use, low order byte first
+// bytes 2-3 - blocks in the pool (STORE_BLOCKS), low order byte first
+// bytes 4-5 - STORE_BLOCK_SIZE, low order byte first
+// byte 6 - objects holding data
+// byte 7 - STORE_OBJECTS
+#define STORE_INFO_LEN     8
+
+// Called once, before core 1 is launched
+void store_init(void);
+
+//
+// Called on core 1
+//
+
+// Returns false if a PROTO_STORE WRITE to object, with flags, must wait
+// before starting - see above
+bool store_write_ready(uint8_t chan, uint8_t object, uint8_t flags);
+
+// Start a PROTO_STORE WRITE of len bytes to object, once
+// store_write_ready() returns true.  Returns false if the object doesn't
+// exist, or there isn't room for the data, in which case
+// store_service_write() throws the data away.
+bool store_start_write(uint8_t chan, uint8_t object, uint8_t flags, uint32_t len);
+
+// Move up to max_len bytes of the current WRITE's data from the WRITE sink
+// into the object.  Returns the number of bytes consumed.
+uint32_t store_service_write(uint8_t chan, uint32_t max_len);
+
+// Returns true once the current WRITE's data is all in its object.  A flash
+// object's data is still being programmed after it has all been consumed,
+// by further calls to store_service_write().
+bool store_write_done(uint8_t chan);
+
+// Start a PROTO_STORE READ of up to len bytes of object, with flags, by
+// starting a bulk IN READ from its blocks.  Returns the number of bytes which
+// will be sent.
+uint32_t store_start_read(uint8_t chan, uint8_t object, uint8_t flags, uint32_t len);
+
+// Abandon the channel's current WRITE, when the channel is reset.  The
+// object keeps the data written so far.
+void store_abort(uint8_t chan);
+
+//
+// Called on either core
+//
+
+// Fill info (STORE_INFO_LEN bytes) with the pool's occupancy - or, with
+// STORE_FLASH in flags, the flash objects'
+void store_get_info(uint8_t flags, uint8_t *info);
+
+#endif // STORE_H
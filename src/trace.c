@@ -0,0 +1,142 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Flight recorder - see trace.h.
+//
+// Stopping recording can't stop an event the other core is part way
+// through recording: it may already have checked trace_frozen, and then go
+// on to write the entry at its ring's head, and move the head on.  So when
+// the dump is taken, the entry at each ring's head - the oldest, once the
+// ring has wrapped - may be being overwritten, and is left out.  After that
+// one, the other core sees trace_frozen, so the rest of the dump can't
+// change while the host reads it.
+//
+
+#include "pico/stdlib.h"
+#include "include.h"
+#include "trace.h"
+
+#ifdef TRACE
+
+static_assert((TRACE_LEN & (TRACE_LEN - 1)) == 0, "TRACE_LEN must be a power of 2");
+static_assert(TRACE_LEN <= 32768, "TRACE_LEN must be at most 32768");
+static_assert(sizeof(trace_entry_t) == 12);
+
+trace_ring_t trace_rings[TRACE_CORES];
+_Atomic bool trace_frozen;
+
+// Only used by core 0 - the dump being read, if any: each ring's oldest
+// entry in it, and how many of its entries there are
+static bool dumping;
+static uint32_t dump_first[TRACE_CORES];
+static uint16_t dump_count[TRACE_CORES];
+static uint8_t dump_header[TRACE_HEADER_LEN];
+
+void trace_init(void) {
+    for (int core = 0; core < TRACE_CORES; core++) {
+        atomic_store(&trace_rings[core].head, 0);
+    }
+    atomic_store(&trace_frozen, false);
+    dumping = false;
+}
+
+// Stop recording, and take the dump
+static void take_dump(void) {
+    uint64_t now_us;
+    uint32_t head;
+    uint32_t count;
+
+    atomic_store(&trace_frozen, true);
+    now_us = time_us_64();
+
+    for (int core = 0; core < TRACE_CORES; core++) {
+        head = atomic_load_explicit(&trace_rings[core].head, memory_order_acquire);
+        count = (head < TRACE_LEN) ? head : (TRACE_LEN - 1);
+        dump_first[core] = head - count;
+        dump_count[core] = (uint16_t)count;
+    }
+
+    dump_header[0] = TRACE_VERSION;
+    dump_header[1] = sizeof(trace_entry_t);
+    for (int core = 0; core < TRACE_CORES; core++) {
+        dump_header[2 + (core * 2)] = (uint8_t)(dump_count[core] & 0xff);
+        dump_header[3 + (core * 2)] = (uint8_t)(dump_count[core] >> 8);
+    }
+    dump_header[6] = 0;
+    dump_header[7] = 0;
+    for (int ii = 0; ii < 8; ii++) {
+        dump_header[8 + ii] = (uint8_t)(now_us >> (8 * ii));
+    }
+    dumping = true;
+}
+
+// Returns where the dump's byte at offset is held, and sets *len to the
+// number of bytes which follow it there
+static const uint8_t *dump_ptr(uint32_t offset, uint32_t *len) {
+    uint32_t entry;
+    uint32_t within;
+    int core = 0;
+
+    if (offset < TRACE_HEADER_LEN) {
+        *len = TRACE_HEADER_LEN - offset;
+        return &dump_header[offset];
+    }
+
+    offset -= TRACE_HEADER_LEN;
+    entry = offset / sizeof(trace_entry_t);
+    within = offset % sizeof(trace_entry_t);
+    if (entry >= dump_count[0]) {
+        entry -= dump_count[0];
+        core = 1;
+    }
+    entry = (dump_first[core] + entry) & (TRACE_LEN - 1);
+
+    *len = sizeof(trace_entry_t) - within;
+    return (const uint8_t *)&trace_rings[core].entries[entry] + within;
+}
+
+uint16_t trace_dump(uint16_t block, uint8_t *buf) {
+    uint32_t offset = (uint32_t)block * TRACE_BLOCK_LEN;
+    uint32_t total;
+    uint32_t len;
+    uint16_t filled = 0;
+    const uint8_t *src;
+
+    if (block == 0) {
+        take_dump();
+    } else if (!dumping) {
+        return 0;
+    }
+
+    total = TRACE_HEADER_LEN + ((dump_count[0] + dump_count[1]) * sizeof(trace_entry_t));
+    while ((filled < TRACE_BLOCK_LEN) && (offset < total)) {
+        src = dump_ptr(offset, &len);
+        if (len > (uint32_t)(TRACE_BLOCK_LEN - filled)) {
+            len = TRACE_BLOCK_LEN - filled;
+        }
+        if (len > (total - offset)) {
+            len = total - offset;
+        }
+        memcpy(buf + filled, src, len);
+        filled += (uint16_t)len;
+        offset += len;
+    }
+
+    if (filled < TRACE_BLOCK_LEN) {
+        // That's the last block - start recording again
+        dumping = false;
+        atomic_store(&trace_frozen, false);
+    }
+    return filled;
+}
+
+#else
+
+void trace_init(void) {
+}
+
+#endif // TRACE
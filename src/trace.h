@@ -0,0 +1,150 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Flight recorder for the tinyusb vendor example.
+//
+// When a command takes far longer than it should, the counters (stats.h)
+// show that it happened, but not when, or what else was going on - and
+// logging (log.h) is too slow to leave on, and the UART often isn't
+// connected.  Instead, with TRACE defined, each core records what it's
+// doing - tinyusb's callbacks, commands being decoded, data being handed to
+// tinyusb, statuses being sent, and the bus being suspended and resumed - as
+// small fixed size entries, each with a microsecond timestamp, in a ring in
+// RAM, overwriting the oldest entries once the ring is full.  So the ring
+// always holds the last TRACE_LEN events on each core, for the host to read
+// after the fact, with CTRL_TRACE.
+//
+// As with the counters, each core has its own ring, which only it writes,
+// so recording an event is a handful of loads and stores - no locks, and
+// nothing which waits for the other core.  Entries hold the low 32 bits of
+// time_us_64(), which is a single register read; the dump carries the full
+// 64-bit time it was taken at, which the host unwraps the entries' times
+// against.
+//
+// Reading the rings while they're being written would give the host a mix
+// of old and new entries, so the first block of a dump stops both cores
+// recording, until the host has read the last block.  Events in between
+// aren't recorded.
+//
+// Without TRACE, trace_event() compiles to nothing, and CTRL_TRACE isn't
+// supported.
+//
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "pico/stdlib.h"
+
+// Entries in each core's ring.  Must be a power of 2, at most 32768.  Can be
+// overridden from CMakeLists.txt.
+#ifndef TRACE_LEN
+#define TRACE_LEN          512
+#endif
+
+// The events.  Each entry also has a channel (TRACE_NO_CHAN if the event
+// isn't for a particular one), and two arguments, aux and arg, as below.
+// The values are part of the dump format, so only add to the end, and
+// update scripts/trace/trace2chrome.py to match.
+typedef enum {
+    TRACE_NONE,
+    TRACE_RX_CB_ENTER,       // arg - bytes received
+    TRACE_RX_CB_EXIT,
+    TRACE_COMMAND,           // aux - type << 8 | protocol, arg - data length
+    TRACE_VENDOR_WRITE,      // arg - bytes tud_vendor_write() accepted
+    TRACE_TX_CB,             // arg - bytes sent
+    TRACE_STATUS,            // aux - status, arg - data length
+    TRACE_SUSPEND,           // aux - 1 if remote wakeup is enabled
+    TRACE_RESUME,
+    TRACE_MOUNT,
+    TRACE_UNMOUNT,
+    TRACE_EVENT_COUNT
+} trace_event_t;
+
+#define TRACE_NO_CHAN      0xff
+
+// A single entry
+typedef struct {
+    uint32_t time_us;        // Low 32 bits of time_us_64()
+    uint8_t event;
+    uint8_t chan;
+    uint16_t aux;
+    uint32_t arg;
+} trace_entry_t;
+
+// CTRL_TRACE returns the dump in blocks of TRACE_BLOCK_LEN bytes - see
+// trace_dump().  The dump is:
+// - byte 0     - version (TRACE_VERSION)
+// - byte 1     - entry length (sizeof(trace_entry_t))
+// - bytes 2-3  - core 0 entries
+// - bytes 4-5  - core 1 entries
+// - bytes 6-7  - reserved
+// - 8 bytes    - time_us_64() when the dump was taken
+// - core 0's entries, oldest first, then core 1's, each laid out as
+//   trace_entry_t
+// All values are little-endian.
+#define TRACE_VERSION      1
+#define TRACE_HEADER_LEN   16
+#define TRACE_BLOCK_LEN    1024
+
+#define TRACE_CORES        2
+
+// Each core's ring - use trace_event() rather than accessing these
+typedef struct {
+    trace_entry_t entries[TRACE_LEN];
+    _Atomic uint32_t head;   // Entries ever recorded
+} trace_ring_t;
+
+extern trace_ring_t trace_rings[TRACE_CORES];
+extern _Atomic bool trace_frozen;
+
+// Called once on core 0, before core 1 is launched
+void trace_init(void);
+
+//
+// Called on either core
+//
+
+// Record an event on the calling core's ring
+static inline void trace_event(trace_event_t event, uint8_t chan, uint16_t aux, uint32_t arg) {
+#ifdef TRACE
+    trace_ring_t *ring = &trace_rings[get_core_num()];
+    trace_entry_t *entry;
+    uint32_t head;
+
+    if (atomic_load_explicit(&trace_frozen, memory_order_relaxed)) {
+        return;
+    }
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    entry = &ring->entries[head & (TRACE_LEN - 1)];
+    entry->time_us = time_us_32();
+    entry->event = (uint8_t)event;
+    entry->chan = chan;
+    entry->aux = aux;
+    entry->arg = arg;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+#else
+    (void)event;
+    (void)chan;
+    (void)aux;
+    (void)arg;
+#endif
+}
+
+//
+// Called on core 0
+//
+
+// Fill buf (of TRACE_BLOCK_LEN bytes) with block number block of the dump.
+// Block 0 stops recording, and takes the dump; the dump's last block - the
+// first with fewer than TRACE_BLOCK_LEN bytes, which may have none - starts
+// it again.  Returns the number of bytes in the block.
+uint16_t trace_dump(uint16_t block, uint8_t *buf);
+
+#endif // TRACE_H
@@ -70,11 +70,53 @@ extern "C" {
 
 //------------- CLASS -------------//
 
-// Vendor specific class configuration
+// Vendor class buffer sizing profiles, selected with USB_PROFILE in
+// CMakeLists.txt.  The endpoint buffer size is the most tinyusb moves in one
+// transfer - with more than a packet's worth (64 bytes), several packets are
+// sent or received back to back without our code getting involved.  The
+// FIFOs hold data waiting to be sent, or received data we haven't read yet.
+//
+// With an endpoint buffer larger than a packet, an OUT transfer only
+// completes on a short packet, so the host must follow an OUT transfer which
+// is a multiple of 64 bytes with a zero length packet - or its last packets
+// sit with tinyusb until the host sends more.  LOW_MEM, which completes every
+// packet, is the default, so that hosts which don't do so keep working.
+#define USB_PROFILE_LOW_MEM         0   // One packet each way, as tinyusb's examples
+#define USB_PROFILE_BALANCED        1
+#define USB_PROFILE_MAX_THROUGHPUT  2
+
+#ifndef USB_PROFILE
+#define USB_PROFILE  USB_PROFILE_LOW_MEM
+#endif
+
+#if USB_PROFILE == USB_PROFILE_LOW_MEM
+#define USB_PROFILE_EP_BUFSIZE    64
+#define USB_PROFILE_FIFO_SIZE     64
+#elif USB_PROFILE == USB_PROFILE_BALANCED
+#define USB_PROFILE_EP_BUFSIZE    256
+#define USB_PROFILE_FIFO_SIZE     512
+#elif USB_PROFILE == USB_PROFILE_MAX_THROUGHPUT
+#define USB_PROFILE_EP_BUFSIZE    1024
+#define USB_PROFILE_FIFO_SIZE     4096
+#else
+#error Unknown USB_PROFILE
+#endif
+
+// Vendor specific class configuration.  CFG_TUD_VENDOR is the number of
+// vendor interfaces, or channels, each with its own pair of bulk endpoints
+// and independent protocol handling - see VENDOR_CHANNELS in CMakeLists.txt.
+#ifndef CFG_TUD_VENDOR
 #define CFG_TUD_VENDOR           1
-#define CFG_TUD_VENDOR_EP_BUFSIZE  64
-#define CFG_TUD_VENDOR_RX_BUFSIZE  64
-#define CFG_TUD_VENDOR_TX_BUFSIZE  64
+#endif
+#define CFG_TUD_VENDOR_EP_BUFSIZE  USB_PROFILE_EP_BUFSIZE
+#define CFG_TUD_VENDOR_TX_BUFSIZE  USB_PROFILE_FIFO_SIZE
+
+// Set CFG_TUD_VENDOR_RX_BUFSIZE to 0 (see VENDOR_RX_UNBUFFERED in
+// CMakeLists.txt) to have tinyusb pass received packets directly to
+// tud_vendor_rx_cb(), without first copying them into its RX FIFO
+#ifndef CFG_TUD_VENDOR_RX_BUFSIZE
+#define CFG_TUD_VENDOR_RX_BUFSIZE  USB_PROFILE_FIFO_SIZE
+#endif
 
 // DFU RT does not required for this project
 #define CFG_TUD_DFU_RT           0
@@ -41,15 +41,36 @@ uint8_t const* tud_descriptor_device_cb(void) {
 }
 
 // Configuration descriptor
-// Just need the TUD_CONFIG_DESCRIPTOR, and a TUD_VENDOR_DESCRIPTOR
+// Just need the TUD_CONFIG_DESCRIPTOR, and a TUD_VENDOR_DESCRIPTOR per
+// channel (see CFG_TUD_VENDOR in tusb_config.h).
 // You can add other descriptors here if you mix classes (e.g. add
 // a CDC descriptor as well to add a communications device)
-#define CONFIG_TOTAL_LEN (TUD_CONFIG_DESC_LEN + TUD_VENDOR_DESC_LEN)
+static_assert((CFG_TUD_VENDOR >= 1) && (CFG_TUD_VENDOR <= MAX_VENDOR_CHANNELS), "Unsupported number of vendor channels");
+
+#define VENDOR_DESCRIPTOR(n) \
+    TUD_VENDOR_DESCRIPTOR(ITF_NUM_VENDOR + (n), 0, BULK_OUT_ENDPOINT_N(n), BULK_IN_ENDPOINT_N(n), ENDPOINT_BULK_SIZE)
+
+#define CONFIG_TOTAL_LEN (TUD_CONFIG_DESC_LEN + (CFG_TUD_VENDOR * TUD_VENDOR_DESC_LEN))
 uint8_t static desc_configuration[] = {
     // Configuration descriptor
     TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, 0x80, 100),
 
-    TUD_VENDOR_DESCRIPTOR(ITF_NUM_VENDOR, 0, BULK_OUT_ENDPOINT_DIR, BULK_IN_ENDPOINT_DIR, ENDPOINT_BULK_SIZE),
+    VENDOR_DESCRIPTOR(0),
+#if CFG_TUD_VENDOR > 1
+    VENDOR_DESCRIPTOR(1),
+#endif
+#if CFG_TUD_VENDOR > 2
+    VENDOR_DESCRIPTOR(2),
+#endif
+#if CFG_TUD_VENDOR > 3
+    VENDOR_DESCRIPTOR(3),
+#endif
+#if CFG_TUD_VENDOR > 4
+    VENDOR_DESCRIPTOR(4),
+#endif
+#if CFG_TUD_VENDOR > 5
+    VENDOR_DESCRIPTOR(5),
+#endif
 };
 
 // String descriptors
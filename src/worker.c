@@ -0,0 +1,450 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Core 1 command worker.
+//
+// Three lock-free single producer/single consumer queues connect the two
+// cores, for each channel:
+// - the work queue (here), from core 0 to core 1, carrying commands,
+// - the WRITE sink ring (write-sink.c), from core 0 to core 1, carrying
+//   WRITE data, and
+// - the bulk IN segment queue (bulk-in.c), from core 1 to core 0, carrying
+//   READ data and status responses to be sent.
+//
+// Everything core 1 sends on a channel goes through its one segment queue,
+// in the order the commands were received, so the host sees responses in
+// order.  Each status response is copied into its own segment, so any number
+// of them can be queued - one per command - without one overwriting another.
+//
+// Core 1 never blocks - if it can't make progress on a channel's current
+// work item (no WRITE data yet, or no free segments for READ data) it moves
+// on to the next channel, and tries again next time round its loop.  If it
+// can't make progress on any, it sleeps until core 0 signals it has done
+// something which might change that (see event.h).
+//
+
+#include "pico/stdlib.h"
+#include "tusb.h"
+#include "include.h"
+#include "spsc-queue.h"
+#include "bulk-in.h"
+#include "write-sink.h"
+#include "loopback.h"
+#include "batch.h"
+#include "pattern.h"
+#include "credit.h"
+#include "ack.h"
+#include "resume.h"
+#include "store.h"
+#include "worker.h"
+#include "stats.h"
+#include "trace.h"
+#include "event.h"
+
+static_assert((WORK_QUEUE_LEN & (WORK_QUEUE_LEN - 1)) == 0, "WORK_QUEUE_LEN must be a power of 2");
+
+// A channel's work queue and state
+typedef struct {
+    work_item_t storage[WORK_QUEUE_LEN];
+    spsc_queue_t queue;
+
+    // Number of work items submitted (only used by core 0) and completed
+    // (only written by core 1)
+    uint32_t submitted;
+    _Atomic uint32_t completed;
+
+    // Reset handshake.  Core 0 bumps reset_request, and core 1 sets
+    // reset_ack to match once it has thrown everything away.
+    _Atomic uint32_t reset_request;
+    _Atomic uint32_t reset_ack;
+
+    // State only used by core 1 - the work item being executed, how much
+    // WRITE data it has left to consume, the status to send once it has,
+    // (for PROTO_CRC) the CRC of the data consumed so far, and (for
+    // PROTO_BATCH) whether its status vector is being sent
+    work_item_t current;
+    bool have_current;
+    uint32_t write_remaining;
+    uint8_t write_status;
+    uint32_t write_crc;
+    bool batch_sending;
+} worker_chan_t;
+
+static worker_chan_t chans[CFG_TUD_VENDOR];
+
+void worker_init(void) {
+    for (int ii = 0; ii < CFG_TUD_VENDOR; ii++) {
+        worker_chan_t *wc = &chans[ii];
+
+        spsc_init(&wc->queue, wc->storage, sizeof(work_item_t), WORK_QUEUE_LEN);
+        wc->submitted = 0;
+        atomic_store(&wc->completed, 0);
+        atomic_store(&wc->reset_request, 0);
+        atomic_store(&wc->reset_ack, 0);
+        wc->have_current = false;
+    }
+}
+
+bool worker_submit(uint8_t chan, const work_item_t *item) {
+    worker_chan_t *wc = &chans[chan];
+
+    if (!spsc_push(&wc->queue, item)) {
+        return false;
+    }
+    wc->submitted++;
+    event_signal();
+    return true;
+}
+
+uint32_t worker_space(uint8_t chan) {
+    return spsc_space_fresh(&chans[chan].queue);
+}
+
+uint32_t worker_free(uint8_t chan) {
+    return WORK_QUEUE_LEN - spsc_count(&chans[chan].queue);
+}
+
+bool worker_idle(uint8_t chan) {
+    worker_chan_t *wc = &chans[chan];
+    return atomic_load_explicit(&wc->completed, memory_order_acquire) == wc->submitted;
+}
+
+void worker_request_reset(uint8_t chan) {
+    worker_chan_t *wc = &chans[chan];
+    uint32_t request = atomic_load_explicit(&wc->reset_request, memory_order_relaxed);
+    atomic_store_explicit(&wc->reset_request, request + 1, memory_order_release);
+    event_signal();
+}
+
+bool worker_reset_done(uint8_t chan) {
+    worker_chan_t *wc = &chans[chan];
+    uint32_t request = atomic_load_explicit(&wc->reset_request, memory_order_relaxed);
+
+    if (atomic_load_explicit(&wc->reset_ack, memory_order_acquire) != request) {
+        return false;
+    }
+
+    // Core 1 has discarded everything submitted, so nothing is outstanding
+    wc->submitted = atomic_load_explicit(&wc->completed, memory_order_acquire);
+    return true;
+}
+
+// Mark the current work item as done.  This happens before any final status
+// is queued, so that by the time the host sees the status, core 0 sees
+// core 1 as idle.
+static void complete_current(worker_chan_t *wc) {
+    uint32_t done = atomic_load_explicit(&wc->completed, memory_order_relaxed);
+    atomic_store_explicit(&wc->completed, done + 1, memory_order_release);
+    wc->have_current = false;
+}
+
+static void count_status(uint8_t status_val) {
+    switch (status_val) {
+        case STATUS_READY:
+            stats_inc(STAT_STATUS_READY);
+            break;
+        case STATUS_BUSY:
+            stats_inc(STAT_STATUS_BUSY);
+            break;
+        default:
+            stats_inc(STAT_STATUS_ERROR);
+            break;
+    }
+}
+
+// Complete the current work item by sending a status response.  Returns
+// false, leaving the item current, if there's no room to queue the status.
+//
+// The status is in the format for the work item's protocol.  The protocols
+// with 32-bit command lengths have a 32-bit length in their statuses, and
+// the rest a 16-bit one.  PROTO_CRC statuses add the CRC of the WRITE's
+// data, and PROTO_CREDIT statuses the channel's credits.  PROTO_NOACK
+// statuses add its ack counts, including this WRITE if it succeeded.  (An
+// executed batch's status vector is sent by batch_send_status() instead.)
+static bool complete_with_status(uint8_t chan, uint8_t status_val, uint32_t data_len) {
+    worker_chan_t *wc = &chans[chan];
+    uint8_t status[STATUS_LEN_CREDIT];
+    uint16_t status_len;
+    uint32_t crc;
+    uint32_t commands;
+    uint32_t bytes;
+    static_assert(STATUS_LEN == 3);
+    static_assert(STATUS_LEN_LARGE == 5);
+    static_assert(STATUS_LEN_CRC == 9);
+    static_assert(STATUS_LEN_CREDIT == 13);
+    static_assert(STATUS_LEN_NOACK == 13);
+    static_assert(STATUS_LEN_CREDIT <= BULK_IN_INLINE_LEN);
+
+    if (!bulk_in_can_send(chan)) {
+        return false;
+    }
+
+    status[0] = status_val;
+    status[1] = (uint8_t)(data_len & 0xff);
+    status[2] = (uint8_t)(data_len >> 8);
+    if (wc->current.proto == PROTO_CRC) {
+        crc = (wc->current.type == CMD_WRITE) ? wc->write_crc : 0;
+        status[3] = (uint8_t)(data_len >> 16);
+        status[4] = (uint8_t)(data_len >> 24);
+        status[5] = (uint8_t)(crc & 0xff);
+        status[6] = (uint8_t)(crc >> 8);
+        status[7] = (uint8_t)(crc >> 16);
+        status[8] = (uint8_t)(crc >> 24);
+        status_len = STATUS_LEN_CRC;
+        INFO("Send status response on channel %d: 0x%02x 0x%08lx crc 0x%08lx", chan, status[0], (unsigned long)data_len, (unsigned long)crc);
+    } else if (wc->current.proto == PROTO_CREDIT) {
+        // This item's slot is already free, so it's included
+        credit_get(chan, &commands, &bytes);
+        status[3] = (uint8_t)(data_len >> 16);
+        status[4] = (uint8_t)(data_len >> 24);
+        for (int ii = 0; ii < 4; ii++) {
+            status[5 + ii] = (uint8_t)(commands >> (8 * ii));
+            status[9 + ii] = (uint8_t)(bytes >> (8 * ii));
+        }
+        status_len = STATUS_LEN_CREDIT;
+        INFO("Send status response on channel %d: 0x%02x 0x%08lx credits %lu %lu", chan, status[0], (unsigned long)data_len, (unsigned long)commands, (unsigned long)bytes);
+    } else if (wc->current.proto == PROTO_NOACK) {
+        // This status acknowledges every PROTO_NOACK WRITE so far
+        if ((wc->current.type == CMD_WRITE) && (status_val == STATUS_READY)) {
+            ack_complete(chan, data_len);
+        }
+        ack_get(chan, &commands, &bytes);
+        ack_restart(chan);
+        status[3] = (uint8_t)(data_len >> 16);
+        status[4] = (uint8_t)(data_len >> 24);
+        for (int ii = 0; ii < 4; ii++) {
+            status[5 + ii] = (uint8_t)(commands >> (8 * ii));
+            status[9 + ii] = (uint8_t)(bytes >> (8 * ii));
+        }
+        status_len = STATUS_LEN_NOACK;
+        INFO("Send status response on channel %d: 0x%02x 0x%08lx acks %lu %lu", chan, status[0], (unsigned long)data_len, (unsigned long)commands, (unsigned long)bytes);
+    } else if ((wc->current.proto == PROTO_LARGE) || (wc->current.proto == PROTO_BATCH) ||
+               (wc->current.proto == PROTO_RESUME) || (wc->current.proto == PROTO_STORE)) {
+        status[3] = (uint8_t)(data_len >> 16);
+        status[4] = (uint8_t)(data_len >> 24);
+        status_len = STATUS_LEN_LARGE;
+        INFO("Send status response on channel %d: 0x%02x 0x%08lx", chan, status[0], (unsigned long)data_len);
+    } else {
+        status_len = STATUS_LEN;
+        INFO("Send status response on channel %d: 0x%02x 0x%02x 0x%02x", chan, status[0], status[1], status[2]);
+    }
+
+    count_status(status_val);
+    trace_event(TRACE_STATUS, chan, status_val, data_len);
+    complete_current(wc);
+    bulk_in_send(chan, status, status_len);
+    return true;
+}
+
+// Start executing a newly dequeued work item
+static void start_current(uint8_t chan) {
+    worker_chan_t *wc = &chans[chan];
+
+    switch (wc->current.type) {
+        case CMD_READ:
+            if (wc->current.proto == PROTO_LOOPBACK) {
+                loopback_start_read(chan, wc->current.len);
+            } else if (wc->current.proto == PROTO_STORE) {
+                store_start_read(chan, wc->current.object, wc->current.store_flags, wc->current.len);
+            } else {
+                pattern_start_read(chan, wc->current.len);
+            }
+            break;
+
+        case CMD_WRITE:
+            wc->write_remaining = wc->current.len;
+            wc->write_status = STATUS_READY;
+            wc->write_crc = 0;
+            wc->batch_sending = false;
+            if (wc->current.proto == PROTO_LOOPBACK) {
+                if (!loopback_start_write(chan, wc->current.len)) {
+                    wc->write_status = STATUS_ERROR;
+                }
+            } else if ((wc->current.proto == PROTO_LOOPBACK_STREAM) && (wc->current.len > 0)) {
+                // The data is consumed by sending it back
+                loopback_start_echo(chan, wc->current.len);
+                wc->write_remaining = 0;
+            } else if (wc->current.proto == PROTO_BATCH) {
+                batch_start(chan, wc->current.count);
+            } else if (wc->current.proto == PROTO_STORE) {
+                if (!store_start_write(chan, wc->current.object, wc->current.store_flags, wc->current.len)) {
+                    wc->write_status = STATUS_ERROR;
+                }
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    // Record how far a resumable transfer gets
+    if ((wc->current.proto == PROTO_RESUME) &&
+        ((wc->current.type == CMD_READ) || (wc->current.type == CMD_WRITE))) {
+        resume_start(chan, wc->current.type, wc->current.id, wc->current.len);
+    }
+}
+
+// Returns false if the next work item can't be started yet - a PROTO_STORE
+// WRITE whose object is still being read or written (see store.h).  It
+// stays queued until it can.
+static bool can_start(uint8_t chan) {
+    const work_item_t *next = spsc_peek(&chans[chan].queue, 0);
+
+    if ((next == NULL) || (next->type != CMD_WRITE) || (next->proto != PROTO_STORE)) {
+        return true;
+    }
+    return store_write_ready(chan, next->object, next->store_flags);
+}
+
+// Make as much progress on one channel's work as possible.  Returns true if
+// any was made.
+static bool service_chan(uint8_t chan) {
+    worker_chan_t *wc = &chans[chan];
+    uint32_t request;
+    uint32_t consumed;
+    bool progress = false;
+
+    request = atomic_load_explicit(&wc->reset_request, memory_order_acquire);
+    if (request != atomic_load_explicit(&wc->reset_ack, memory_order_relaxed)) {
+        // Abandon everything, and tell core 0 we've done so
+        wc->have_current = false;
+        spsc_consume_all(&wc->queue);
+        write_sink_discard(chan);
+        loopback_discard(chan);
+        pattern_restart(chan);
+        ack_reset(chan);
+        store_abort(chan);
+        bulk_in_abort_read(chan);
+        atomic_store_explicit(&wc->reset_ack, request, memory_order_release);
+        return true;
+    }
+
+    if (!wc->have_current) {
+        if (!can_start(chan) || !spsc_pop(&wc->queue, &wc->current)) {
+            // Nothing to do
+            return false;
+        }
+        wc->have_current = true;
+        start_current(chan);
+        progress = true;
+    }
+
+    switch (wc->current.type) {
+        case CMD_READ:
+            // Produce as much READ data as there are free segments for
+            if (bulk_in_produce(chan)) {
+                progress = true;
+            }
+            if (!bulk_in_read_active(chan)) {
+                // No status after READ completes
+                complete_current(wc);
+                progress = true;
+            }
+            break;
+
+        case CMD_WRITE:
+            if (bulk_in_read_active(chan)) {
+                // Echo as much of this command's data as has arrived, and
+                // there are free segments for - or queue as much of a
+                // batch's status vector as there are free segments for
+                if (bulk_in_produce(chan)) {
+                    progress = true;
+                }
+                if (bulk_in_read_active(chan)) {
+                    break;
+                }
+            }
+            if (wc->batch_sending) {
+                // The batch's status vector has all been queued, so, as
+                // with a READ, that's it done
+                complete_current(wc);
+                progress = true;
+                break;
+            }
+
+            // Deliver as much of this command's data to the application (or
+            // loopback buffer) as has arrived, and it will take
+            if (wc->current.proto == PROTO_LOOPBACK) {
+                consumed = loopback_service_write(chan, wc->write_remaining);
+            } else if (wc->current.proto == PROTO_CRC) {
+                consumed = write_sink_service_crc(chan, wc->write_remaining, &wc->write_crc);
+            } else if (wc->current.proto == PROTO_BATCH) {
+                consumed = batch_service(chan, wc->write_remaining);
+            } else if (wc->current.proto == PROTO_STORE) {
+                consumed = store_service_write(chan, wc->write_remaining);
+                if (!store_write_done(chan)) {
+                    // Programming flash - keep going round, rather than
+                    // sleep, until it's done
+                    progress = true;
+                }
+            } else {
+                consumed = write_sink_service(chan, wc->write_remaining);
+            }
+            wc->write_remaining -= consumed;
+            if (consumed > 0) {
+                if (wc->current.proto == PROTO_RESUME) {
+                    resume_progress(chan, consumed);
+                }
+                progress = true;
+            }
+            if ((wc->write_remaining > 0) ||
+                ((wc->current.proto == PROTO_STORE) && !store_write_done(chan))) {
+                break;
+            }
+            if (wc->current.proto == PROTO_BATCH) {
+                // Answered with a status vector, sent like READ data
+                uint8_t status_val = batch_send_status(chan, wc->current.len);
+                count_status(status_val);
+                trace_event(TRACE_STATUS, chan, status_val, wc->current.len);
+                wc->batch_sending = true;
+                progress = true;
+            } else if ((wc->current.proto == PROTO_NOACK) && (wc->write_status == STATUS_READY) &&
+                       !ack_due(chan, wc->current.len, wc->current.ack_commands, wc->current.ack_kb)) {
+                // A later status will acknowledge it
+                ack_complete(chan, wc->current.len);
+                complete_current(wc);
+                progress = true;
+            } else if (complete_with_status(chan, wc->write_status, wc->current.len)) {
+                progress = true;
+            }
+            break;
+
+        case WORK_SEND_STATUS:
+            if (wc->current.empty_echo) {
+                // A PROTO_LOOPBACK_STREAM WRITE turned away before its data
+                // was received still gets two responses - the echo, empty,
+                // and then the status - as the host is expecting
+                if (!bulk_in_send(chan, NULL, 0)) {
+                    break;
+                }
+                wc->current.empty_echo = false;
+            }
+            if (complete_with_status(chan, wc->current.status, wc->current.len)) {
+                progress = true;
+            }
+            break;
+
+        default:
+            INFO("Unexpected work item type: 0x%02x", wc->current.type);
+            complete_current(wc);
+            progress = true;
+            break;
+    }
+
+    return progress;
+}
+
+bool worker_service(void) {
+    bool progress = false;
+
+    for (uint8_t chan = 0; chan < CFG_TUD_VENDOR; chan++) {
+        if (service_chan(chan)) {
+            progress = true;
+        }
+    }
+    return progress;
+}
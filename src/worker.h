@@ -0,0 +1,97 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// Core 1 command worker for the tinyusb vendor example.
+//
+// Core 0 runs tinyusb, parses commands and moves WRITE data into the WRITE
+// sink.  It then hands each command to core 1, via a lock-free queue, and
+// core 1 executes it - producing READ data and consuming WRITE data, and
+// queueing any status response to be sent.  This way a slow command handler
+// never stops core 0 from servicing USB.
+//
+// Each channel (vendor interface - see CFG_TUD_VENDOR in tusb_config.h) has
+// its own work queue, and core 1 makes progress on every channel's current
+// command each pass of its loop, so a long READ on one channel doesn't hold
+// up commands on another.  chan is the channel's number, from 0.
+//
+
+#ifndef WORKER_H
+#define WORKER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Number of work items which can be queued for core 1, per channel.  This
+// bounds how many commands the host can have in flight on a channel at once
+// (see process_rx() in main.c).  Must be a power of 2.  Can be overridden
+// from CMakeLists.txt.
+#ifndef WORK_QUEUE_LEN
+#define WORK_QUEUE_LEN     8
+#endif
+
+// Work item type used to ask core 1 to send a status response, so that it
+// is sent in order with any other data core 1 is producing.  Other work
+// items use the command value (CMD_READ, CMD_WRITE).
+#define WORK_SEND_STATUS   0xff
+
+// A unit of work passed from core 0 to core 1
+typedef struct {
+    uint8_t type;      // CMD_READ, CMD_WRITE or WORK_SEND_STATUS
+    uint8_t proto;     // Protocol ID from the command
+    uint8_t status;    // Status to send, for WORK_SEND_STATUS
+    uint8_t count;     // Number of commands in a PROTO_BATCH WRITE
+    uint8_t ack_commands;  // A PROTO_NOACK WRITE's ack interval, in WRITEs
+    uint8_t ack_kb;        // and in KB
+    uint16_t id;       // A PROTO_RESUME command's transfer ID
+    uint8_t object;    // A PROTO_STORE command's object number
+    uint8_t store_flags;   // and flags
+    bool empty_echo;   // For WORK_SEND_STATUS, send an empty echo (a ZLP) first
+    uint32_t len;      // Data length
+} work_item_t;
+
+// Called once on core 0, before core 1 is launched
+void worker_init(void);
+
+//
+// Called on core 0
+//
+
+// Queue a work item for core 1.  Returns false if the queue is full.
+bool worker_submit(uint8_t chan, const work_item_t *item);
+
+// Number of further work items which can be submitted
+uint32_t worker_space(uint8_t chan);
+
+// Returns true if core 1 has finished all the work submitted to it
+bool worker_idle(uint8_t chan);
+
+// Ask core 1 to abandon all queued and in progress work on a channel, and
+// discard any WRITE data it has yet to consume.  Core 0 must not submit work
+// or add WRITE data on the channel until worker_reset_done() returns true.
+void worker_request_reset(uint8_t chan);
+bool worker_reset_done(uint8_t chan);
+
+//
+// Called on either core
+//
+
+// Number of free work queue slots.  Unlike worker_space() this doesn't
+// touch core 0's cached state, so core 1 can call it too, but on core 1 it's
+// only a snapshot.
+uint32_t worker_free(uint8_t chan);
+
+//
+// Called on core 1
+//
+
+// Make as much progress on every channel's queued work as possible, without
+// blocking.  Returns true if any was made - if not, every channel is waiting
+// for core 0 (for work, WRITE data, or free segments), and core 1 can sleep
+// until core 0 signals it.
+bool worker_service(void);
+
+#endif // WORKER_H
@@ -0,0 +1,152 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// WRITE data sink ring buffer.
+//
+// The ring is a byte-wide spsc_queue_t (see spsc-queue.h), which takes care
+// of making it safe for core 0 to add data while core 1 removes it.  We use
+// its in place access functions so that data is read from tinyusb directly
+// into the ring, and the consumer is handed data directly from the ring.
+// Each channel has its own ring and consumer.
+//
+
+#include "pico/stdlib.h"
+#include "tusb.h"
+#include "include.h"
+#include "spsc-queue.h"
+#include "write-sink.h"
+#include "crc32.h"
+#include "event.h"
+
+static_assert((WRITE_SINK_SIZE & (WRITE_SINK_SIZE - 1)) == 0, "WRITE_SINK_SIZE must be a power of 2");
+
+// The default consumer just throws the data away, as this example has
+// nothing to do with it
+static uint32_t discard_consumer(void *ctx, const uint8_t *data, uint32_t len) {
+    (void)ctx;
+    (void)data;
+    return len;
+}
+
+// A channel's ring, and its consumer
+typedef struct {
+    uint8_t storage[WRITE_SINK_SIZE];
+    spsc_queue_t ring;
+    write_sink_consumer_t consumer;
+    void *consumer_ctx;
+} sink_t;
+
+static sink_t sinks[CFG_TUD_VENDOR];
+
+void write_sink_init(void) {
+    for (int ii = 0; ii < CFG_TUD_VENDOR; ii++) {
+        spsc_init(&sinks[ii].ring, sinks[ii].storage, 1, WRITE_SINK_SIZE);
+        sinks[ii].consumer = discard_consumer;
+        sinks[ii].consumer_ctx = NULL;
+    }
+}
+
+void write_sink_set_consumer(uint8_t chan, write_sink_consumer_t new_consumer, void *ctx) {
+    sink_t *sink = &sinks[chan];
+
+    sink->consumer = (new_consumer != NULL) ? new_consumer : discard_consumer;
+    sink->consumer_ctx = ctx;
+}
+
+uint32_t write_sink_space(uint8_t chan) {
+    return spsc_space_fresh(&sinks[chan].ring);
+}
+
+uint32_t write_sink_free(uint8_t chan) {
+    return WRITE_SINK_SIZE - spsc_count(&sinks[chan].ring);
+}
+
+uint8_t *write_sink_write_ptr(uint8_t chan, uint32_t *len) {
+    return spsc_produce_span(&sinks[chan].ring, len);
+}
+
+void write_sink_commit(uint8_t chan, uint32_t len) {
+    spsc_produce_commit(&sinks[chan].ring, len);
+    event_signal();
+}
+
+uint32_t write_sink_level(uint8_t chan) {
+    return spsc_available_fresh(&sinks[chan].ring);
+}
+
+uint32_t write_sink_service(uint8_t chan, uint32_t max_len) {
+    sink_t *sink = &sinks[chan];
+
+    return write_sink_deliver(chan, max_len, sink->consumer, sink->consumer_ctx);
+}
+
+// Passes data on to the channel's consumer, and adds whatever it consumes to
+// a running CRC
+typedef struct {
+    sink_t *sink;
+    uint32_t crc;
+} crc_ctx_t;
+
+static uint32_t crc_consumer(void *ctx, const uint8_t *data, uint32_t len) {
+    crc_ctx_t *cc = ctx;
+    uint32_t consumed = cc->sink->consumer(cc->sink->consumer_ctx, data, len);
+
+    if (consumed > len) {
+        consumed = len;
+    }
+    cc->crc = crc32_update(cc->crc, data, consumed);
+    return consumed;
+}
+
+uint32_t write_sink_service_crc(uint8_t chan, uint32_t max_len, uint32_t *crc) {
+    crc_ctx_t cc = {
+        .sink = &sinks[chan],
+        .crc = *crc,
+    };
+    uint32_t consumed = write_sink_deliver(chan, max_len, crc_consumer, &cc);
+
+    *crc = cc.crc;
+    return consumed;
+}
+
+uint32_t write_sink_deliver(uint8_t chan, uint32_t max_len, write_sink_consumer_t consumer, void *ctx) {
+    sink_t *sink = &sinks[chan];
+    const uint8_t *data;
+    uint32_t len;
+    uint32_t consumed;
+    uint32_t total = 0;
+
+    // At most two passes - one up to the end of the ring, and one from the
+    // start if the data wraps
+    while (total < max_len) {
+        data = spsc_consume_span(&sink->ring, &len);
+        if (len == 0) {
+            break;
+        }
+        if (len > (max_len - total)) {
+            len = max_len - total;
+        }
+
+        consumed = consumer(ctx, data, len);
+        if (consumed > len) {
+            consumed = len;
+        }
+        spsc_consume_release(&sink->ring, consumed);
+        total += consumed;
+
+        if (consumed < len) {
+            // The consumer has had enough for now
+            break;
+        }
+    }
+
+    return total;
+}
+
+void write_sink_discard(uint8_t chan) {
+    spsc_consume_all(&sinks[chan].ring);
+}
@@ -0,0 +1,95 @@
+//
+// Copyright (c) 2025 Piers Finlayson <piers@piers.rocks>
+//
+// Licensed under MIT license - see https://opensource.org/licenses/MIT
+//
+
+//
+// WRITE data sink for the tinyusb vendor example.
+//
+// Data received from the host as part of a WRITE command is placed in a ring
+// buffer, from which it is delivered to an application supplied consumer.
+// If the consumer falls behind and the ring fills, we stop taking data from
+// tinyusb, which in turn stops accepting it from the host (it NAKs the OUT
+// endpoint), so no data is ever dropped.
+//
+// The ring is a single producer/single consumer queue - core 0 places data
+// in it and core 1 runs the consumer (see worker.c).
+//
+// Each channel (vendor interface - see CFG_TUD_VENDOR in tusb_config.h) has
+// its own ring and consumer, so a WRITE on one channel never waits for
+// another channel's consumer.  chan is the channel's number, from 0.
+//
+
+#ifndef WRITE_SINK_H
+#define WRITE_SINK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Size of each channel's WRITE sink ring buffer.  Must be a power of 2.  Can be
+// overridden from CMakeLists.txt.
+#ifndef WRITE_SINK_SIZE
+#define WRITE_SINK_SIZE  1024
+#endif
+
+// Application supplied consumer of WRITE data.  Called with the next len
+// bytes of data from the ring (which may be less than is held, if it wraps),
+// and returns how many of those bytes it consumed.  If it returns fewer
+// than len, it will be called again later with the remainder.
+typedef uint32_t (*write_sink_consumer_t)(void *ctx, const uint8_t *data, uint32_t len);
+
+// Called once, before either core uses the rings
+void write_sink_init(void);
+
+// Register a channel's consumer.  NULL restores the default consumer, which
+// discards the data.  Must be called before core 1 is launched, or from core
+// 1.
+void write_sink_set_consumer(uint8_t chan, write_sink_consumer_t consumer, void *ctx);
+
+//
+// Producer side (core 0)
+//
+
+// Bytes free in the ring
+uint32_t write_sink_space(uint8_t chan);
+
+// Return a pointer to the largest contiguous free area of the ring, setting
+// *len to its size, so data can be placed directly into it.  Call
+// write_sink_commit() once len (or fewer) bytes have been written.
+uint8_t *write_sink_write_ptr(uint8_t chan, uint32_t *len);
+void write_sink_commit(uint8_t chan, uint32_t len);
+
+//
+// Either side
+//
+
+// Bytes free in the ring.  Unlike write_sink_space() this doesn't touch the
+// producer's cached state, so core 1 can call it too, but on core 1 it's
+// only a snapshot.
+uint32_t write_sink_free(uint8_t chan);
+
+//
+// Consumer side (core 1)
+//
+
+// Bytes held in the ring
+uint32_t write_sink_level(uint8_t chan);
+
+// Deliver up to max_len bytes from the ring to the consumer, as many as it
+// will accept.  Returns the number of bytes consumed.
+uint32_t write_sink_service(uint8_t chan, uint32_t max_len);
+
+// As write_sink_service(), also updating *crc, a running CRC-32 (see
+// crc32.h), with the data consumed - for PROTO_CRC WRITEs
+uint32_t write_sink_service_crc(uint8_t chan, uint32_t max_len, uint32_t *crc);
+
+// As write_sink_service(), but to the given consumer rather than the
+// channel's registered one - for WRITEs whose data the worker handles itself
+// (see loopback.h)
+uint32_t write_sink_deliver(uint8_t chan, uint32_t max_len, write_sink_consumer_t consumer, void *ctx);
+
+// Throw away all data in the ring
+void write_sink_discard(uint8_t chan);
+
+#endif // WRITE_SINK_H